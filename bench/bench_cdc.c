@@ -0,0 +1,171 @@
+/*
+ * bench_cdc.c - CDC ACM loopback throughput, copied and lent receive
+ *
+ * A simulated high-speed ACM modem that sends back what it is sent.  A
+ * writer thread pushes a counting pattern through ttyACM0 in 4 KiB
+ * writes while the main thread takes it back, once with read() into
+ * its own buffer and once with USB_CDC_CTRL_RX_GET/_PUT, which lends it
+ * the receive urbs' buffers.  Both check every byte; reported are the
+ * loopback throughput and the CPU time the process spends per MB.
+ */
+
+#include "sim.h"
+#include "usb_cdc.h"
+
+#define BENCH_VID	0x1d6b
+#define BENCH_PID	0x0113
+#define BENCH_CHUNK	4096
+
+/* a control interface with a union to its data interface */
+static const uint8_t bench_union[] = {
+	sizeof(struct usb_cdc_union_desc), USB_DT_CS_INTERFACE,
+	USB_CDC_UNION_TYPE, 0, 1,
+};
+
+static const uint8_t bench_data[] = {
+	USB_DESC_LENGTH_INTERFACE, USB_DESC_TYPE_INTERFACE,
+	1, 0, 2, USB_CLASS_CDC_DATA, 0, 0, 0,
+	USB_DESC_LENGTH_ENDPOINT, USB_DESC_TYPE_ENDPOINT,
+	USB_DIR_IN | 1, USB_EP_ATTR_BULK, 0x00, 0x02, 0,
+	USB_DESC_LENGTH_ENDPOINT, USB_DESC_TYPE_ENDPOINT,
+	2, USB_EP_ATTR_BULK, 0x00, 0x02, 0,
+};
+
+static struct rt_semaphore bench_rx;
+static struct rt_semaphore bench_done;
+static rt_size_t bench_total;
+
+static rt_err_t bench_rx_indicate(rt_device_t dev, rt_size_t size)
+{
+	rt_sem_release(&bench_rx);
+	return RT_EOK;
+}
+
+static void bench_writer(void *parameter)
+{
+	static uint8_t buf[BENCH_CHUNK];
+	rt_device_t dev = parameter;
+	rt_size_t done, i;
+
+	for (done = 0; done < bench_total; done += sizeof(buf)) {
+		for (i = 0; i < sizeof(buf); i++)
+			buf[i] = (uint8_t)(done + i);
+		SIM_CHECK(rt_device_write(dev, 0, buf, sizeof(buf)) ==
+				sizeof(buf));
+	}
+	rt_sem_release(&bench_done);
+}
+
+static rt_uint64_t bench_cpu_usecs(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+	return (rt_uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/* checks @len received bytes at offset @done of the pattern */
+static void bench_check(const uint8_t *p, rt_size_t len, rt_size_t done)
+{
+	rt_size_t i;
+
+	for (i = 0; i < len; i++)
+		SIM_CHECK(p[i] == (uint8_t)(done + i));
+}
+
+static void bench_run(rt_device_t dev, int lend)
+{
+	static uint8_t buf[BENCH_CHUNK];
+	struct usb_cdc_rx_buf rx;
+	rt_uint64_t start, cpu, usecs;
+	const char *mode = lend ? "lent" : "read()";
+	rt_size_t done = 0;
+	rt_ssize_t ret;
+	rt_thread_t tid;
+	char name[64];
+
+	start = sim_usecs();
+	cpu = bench_cpu_usecs();
+	tid = rt_thread_create("bwrite", bench_writer, dev, 4096,
+			10, 10);
+	SIM_CHECK(tid != RT_NULL);
+	rt_thread_startup(tid);
+
+	while (done < bench_total) {
+		if (lend) {
+			if (rt_device_control(dev, USB_CDC_CTRL_RX_GET,
+					&rx) != RT_EOK) {
+				SIM_CHECK(rt_sem_take(&bench_rx, 1000) ==
+						RT_EOK);
+				continue;
+			}
+			bench_check(rx.data, rx.len, done);
+			done += rx.len;
+			rt_device_control(dev, USB_CDC_CTRL_RX_PUT, &rx);
+		} else {
+			ret = rt_device_read(dev, 0, buf, sizeof(buf));
+			SIM_CHECK(ret >= 0);
+			if (!ret) {
+				SIM_CHECK(rt_sem_take(&bench_rx, 1000) ==
+						RT_EOK);
+				continue;
+			}
+			bench_check(buf, ret, done);
+			done += ret;
+		}
+	}
+	SIM_CHECK(done == bench_total);
+	SIM_CHECK(rt_sem_take(&bench_done, 1000) == RT_EOK);
+	cpu = bench_cpu_usecs() - cpu;
+	usecs = sim_usecs() - start;
+
+	rt_snprintf(name, sizeof(name), "loopback, %s", mode);
+	sim_report(name, (double)done / usecs, "MB/s");
+	rt_snprintf(name, sizeof(name), "cpu time, %s", mode);
+	sim_report(name, cpu * 1e6 / done, "us/MB");
+}
+
+int main(int argc, char **argv)
+{
+	struct sim_device sd;
+	struct usb_hcd *hcd;
+	rt_device_t dev;
+	int i;
+
+	bench_total = sim_quick(argc, argv) ? 256 * 1024 : 16 * 1024 * 1024;
+	rt_sem_init(&bench_rx, "brx", 0, RT_IPC_FLAG_FIFO);
+	rt_sem_init(&bench_done, "bdone", 0, RT_IPC_FLAG_FIFO);
+
+	hcd = sim_start();
+	sim_device_init(&sd, USB_SPEED_HIGH, BENCH_VID, BENCH_PID,
+			USB_CLASS_CDC, RT_NULL, 0);
+	/* bInterfaceSubClass and bInterfaceProtocol, AT commands */
+	sd.config[USB_DESC_LENGTH_CONFIG + 6] = USB_CDC_SUBCLASS_ACM;
+	sd.config[USB_DESC_LENGTH_CONFIG + 7] = 1;
+	sim_device_extra(&sd, bench_union, sizeof(bench_union));
+	sim_device_extra(&sd, bench_data, sizeof(bench_data));
+	sd.config[4] = 2;		/* bNumInterfaces */
+	sd.mode = SIM_LOOPBACK;
+
+	SIM_CHECK(dummy_hcd_connect(hcd, 1, &sd.vdev) == 0);
+	for (i = 0; !(dev = rt_device_find("ttyACM0")); i++) {
+		SIM_CHECK(i < 5000);
+		rt_thread_mdelay(1);
+	}
+	SIM_CHECK(rt_device_open(dev, RT_DEVICE_OFLAG_RDWR) == RT_EOK);
+	dev->rx_indicate = bench_rx_indicate;
+
+	bench_run(dev, 0);
+	bench_run(dev, 1);
+
+	SIM_CHECK(rt_device_close(dev) == RT_EOK);
+	dummy_hcd_disconnect(hcd, 1);
+	for (i = 0; rt_device_find("ttyACM0"); i++) {
+		SIM_CHECK(i < 5000);
+		rt_thread_mdelay(1);
+	}
+	sim_device_release(&sd);
+	rt_sem_detach(&bench_rx);
+	rt_sem_detach(&bench_done);
+	return 0;
+}
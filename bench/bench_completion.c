@@ -0,0 +1,215 @@
+/*
+ * bench_completion.c - per-device endpoint state on the completion path
+ *
+ * A synthetic completion loop, no bus behind it: for each completed
+ * transfer an hcd checks that the endpoint isn't halted, finds its
+ * private endpoint data, counts the packets from maxpacket, tells a
+ * short transfer and advances the data toggle.  Done against the
+ * ep_state entries of usb_device, which keep all of that on one cache
+ * line, and, for comparison, the old way: maxpacket and the type from
+ * the endpoint descriptor, hcpriv from usb_host_endpoint, and halt and
+ * toggle bits in a per-device word among the cold enumeration data.
+ *
+ * Completions are spread at random over four endpoints of 1 to 256
+ * devices; with the larger counts the old layout no longer fits a small
+ * L1, which is where the difference shows.
+ */
+
+#include "sim.h"
+
+#define BENCH_MAX_DEVS	256
+#define BENCH_EPS	4
+#define BENCH_EVENTS	65536		/* a power of two */
+
+/* where the old layout kept halt and toggle bits: after the strings */
+struct bench_cold {
+	char		strings[192];
+	unsigned int	toggle[2];
+	unsigned int	halted[2];
+};
+
+struct bench_dev {
+	struct usb_device		*udev;
+	struct usb_host_endpoint	*eps[BENCH_EPS];
+	struct bench_cold		*cold;
+	void				*arena;	/* descriptors in between */
+};
+
+struct bench_event {
+	struct usb_device	*udev;
+	struct bench_cold	*cold;
+	unsigned int		pipe;
+	unsigned int		len;
+};
+
+static const struct {
+	uint8_t		addr;
+	uint8_t		attr;
+	uint16_t	maxp;
+} bench_eps[BENCH_EPS] = {
+	{ USB_DIR_IN | 1, USB_EP_ATTR_BULK, 512 },
+	{ 2, USB_EP_ATTR_BULK, 512 },
+	{ USB_DIR_IN | 3, USB_EP_ATTR_INT, 64 },
+	{ 4, USB_EP_ATTR_BULK, 512 },
+};
+
+static struct bench_dev bench_devs[BENCH_MAX_DEVS];
+static struct bench_event bench_events[BENCH_EVENTS];
+static volatile unsigned int bench_sink;
+
+static void bench_setup(void)
+{
+	struct usb_host_endpoint *ep;
+	struct usb_ep_state *st;
+	struct bench_dev *bd;
+	unsigned int pipe;
+	int i, j;
+
+	for (i = 0; i < BENCH_MAX_DEVS; i++) {
+		bd = &bench_devs[i];
+		bd->udev = rt_malloc_align(sizeof(*bd->udev), USB_CACHE_LINE);
+		SIM_CHECK(bd->udev != RT_NULL);
+		rt_memset(bd->udev, 0, sizeof(*bd->udev));
+		bd->udev->devnum = i % 127 + 1;
+		bd->udev->speed = USB_SPEED_HIGH;
+
+		for (j = 0; j < BENCH_EPS; j++) {
+			ep = rt_calloc(1, sizeof(*ep));
+			SIM_CHECK(ep != RT_NULL);
+			ep->desc.bLength = USB_DESC_LENGTH_ENDPOINT;
+			ep->desc.bEndpointAddress = bench_eps[j].addr;
+			ep->desc.bmAttributes = bench_eps[j].attr;
+			ep->desc.wMaxPacketSize = bench_eps[j].maxp;
+			ep->hcpriv = ep;
+			bd->eps[j] = ep;
+
+			pipe = usb_pipe_encode(usb_endpoint_pipetype(&ep->desc),
+					0, ep->desc.bEndpointAddress, 0);
+			bd->udev->ep_table[usb_pipe_epidx(pipe)] = ep;
+			st = usb_pipe_ep_state(bd->udev, pipe);
+			st->hcpriv = ep;
+			st->maxpacket = bench_eps[j].maxp;
+			st->type = usb_pipetype(pipe);
+			st->mult = 1;
+			st->flags = USB_EP_ENABLED;
+		}
+		bd->cold = rt_calloc(1, sizeof(*bd->cold));
+		bd->arena = rt_malloc(1024);
+		SIM_CHECK(bd->cold != RT_NULL && bd->arena != RT_NULL);
+	}
+}
+
+static void bench_events_fill(int ndevs)
+{
+	struct bench_event *ev;
+	unsigned int seed = 1, r;
+	int i, j;
+
+	for (i = 0; i < BENCH_EVENTS; i++) {
+		ev = &bench_events[i];
+		seed = seed * 1103515245 + 12345;
+		r = seed >> 8;
+		ev->udev = bench_devs[r % ndevs].udev;
+		ev->cold = bench_devs[r % ndevs].cold;
+		j = (r / ndevs) % BENCH_EPS;
+		ev->pipe = usb_pipe_encode(bench_eps[j].attr ==
+				USB_EP_ATTR_INT ? PIPE_INTERRUPT : PIPE_BULK,
+				ev->udev->devnum, bench_eps[j].addr,
+				USB_SPEED_HIGH);
+		/* mostly full transfers, now and then a short one */
+		ev->len = (r & 7) ? 4096 : (r >> 16) % 4096;
+	}
+}
+
+/* everything from the pipe's ep_state entry */
+static unsigned int bench_state(int n)
+{
+	struct bench_event *ev;
+	struct usb_ep_state *st;
+	unsigned int packets, sum = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		ev = &bench_events[i & (BENCH_EVENTS - 1)];
+		st = usb_pipe_ep_state(ev->udev, ev->pipe);
+		if (st->flags & USB_EP_HALTED)
+			continue;
+		sum += (rt_ubase_t)st->hcpriv & 0xff;
+		packets = (ev->len + st->maxpacket - 1) / st->maxpacket;
+		if (ev->len % st->maxpacket || !ev->len)
+			sum++;
+		if (packets & 1)
+			st->flags ^= USB_EP_TOGGLE;
+		sum += packets;
+	}
+	return sum;
+}
+
+/* the same from the endpoint, its descriptor and the cold tail */
+static unsigned int bench_scattered(int n)
+{
+	struct usb_host_endpoint *ep;
+	struct bench_event *ev;
+	unsigned int packets, maxp, epnum, out, sum = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		ev = &bench_events[i & (BENCH_EVENTS - 1)];
+		epnum = usb_pipeendpoint(ev->pipe);
+		out = usb_pipeout(ev->pipe) ? 1 : 0;
+		if ((ev->cold->halted[out] >> epnum) & 1)
+			continue;
+		ep = out ? ev->udev->ep_out[epnum] : ev->udev->ep_in[epnum];
+		if ((ep->desc.bmAttributes & USB_EP_ATTR_TYPE_MASK) ==
+				USB_EP_ATTR_ISOC)
+			continue;
+		sum += (rt_ubase_t)ep->hcpriv & 0xff;
+		maxp = ep->desc.wMaxPacketSize & 0x7ff;
+		packets = (ev->len + maxp - 1) / maxp;
+		if (ev->len % maxp || !ev->len)
+			sum++;
+		if (packets & 1)
+			ev->cold->toggle[out] ^= 1 << epnum;
+		sum += packets;
+	}
+	return sum;
+}
+
+static void bench_run(int ndevs, int n, const char *name,
+		unsigned int (*fn)(int n))
+{
+	rt_uint64_t start, usecs;
+	char label[64];
+
+	bench_sink = fn(BENCH_EVENTS);		/* warm up */
+	start = sim_usecs();
+	bench_sink = fn(n);
+	usecs = sim_usecs() - start;
+
+	rt_snprintf(label, sizeof(label), "completion, %d device%s, %s",
+			ndevs, ndevs > 1 ? "s" : "", name);
+	sim_report(label, (double)usecs * 1000 / n, "ns");
+}
+
+int main(int argc, char **argv)
+{
+	int n = sim_quick(argc, argv) ? 1000000 : 50000000;
+	int ndevs, i, j;
+
+	rt_components_init();
+	bench_setup();
+	for (ndevs = 1; ndevs <= BENCH_MAX_DEVS; ndevs *= 4) {
+		bench_events_fill(ndevs);
+		bench_run(ndevs, n, "ep_state", bench_state);
+		bench_run(ndevs, n, "descriptors", bench_scattered);
+	}
+
+	for (i = 0; i < BENCH_MAX_DEVS; i++) {
+		for (j = 0; j < BENCH_EPS; j++)
+			rt_free(bench_devs[i].eps[j]);
+		rt_free(bench_devs[i].cold);
+		rt_free(bench_devs[i].arena);
+		rt_free_align(bench_devs[i].udev);
+	}
+	return 0;
+}
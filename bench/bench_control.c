@@ -0,0 +1,142 @@
+/*
+ * bench_control.c - control transfers per second and what they allocate
+ *
+ * Back to back control requests to a device behind a virtual hub:
+ * GET_STATUS and GET_DESCRIPTOR with buffers on the stack through
+ * usb_control_msg(), GET_STATUS chained from the completion callback of
+ * usb_control_msg_async(), and the hub's GET_PORT_STATUS the hub thread
+ * polls with.  Every rt_malloc() during a run is counted through the
+ * malloc hook; with the per-device control urb and bounce buffer it
+ * should be none per transfer.
+ */
+
+#include "sim.h"
+
+#define BENCH_VID	0x1d6b
+#define BENCH_PID	0x0110
+
+static const struct sim_ep bench_eps[] = {
+	{ USB_DIR_IN | 1, USB_EP_ATTR_BULK, 512, 0 },
+};
+
+static atomic_t bench_allocs;
+
+static void bench_malloc_hook(void *ptr, rt_size_t size)
+{
+	rt_atomic_add(&bench_allocs, 1);
+}
+
+static void bench_result(const char *what, int n, rt_uint64_t usecs,
+		rt_uint32_t allocs)
+{
+	char name[64];
+
+	sim_report(what, n * 1e6 / usecs, "/s");
+	rt_snprintf(name, sizeof(name), "%s, allocations", what);
+	sim_report(name, (double)allocs / n, "/transfer");
+}
+
+static void bench_sync(struct usb_device *udev, const char *what,
+		uint8_t request, uint8_t requesttype, uint16_t value,
+		uint16_t index, uint16_t size, int n)
+{
+	rt_uint64_t start, usecs;
+	rt_uint32_t allocs;
+	uint8_t buf[USB_DESC_LENGTH_DEVICE];
+	int i;
+
+	rt_atomic_store(&bench_allocs, 0);
+	start = sim_usecs();
+	for (i = 0; i < n; i++)
+		SIM_CHECK(usb_control_msg(udev, usb_rcvctrlpipe(udev, 0),
+				request, requesttype, value, index, buf, size,
+				1000) == size);
+	usecs = sim_usecs() - start;
+	allocs = rt_atomic_load(&bench_allocs);
+	bench_result(what, n, usecs, allocs);
+}
+
+struct bench_async {
+	struct rt_semaphore	done;
+	uint8_t			status[2];
+	int			left;
+	int			error;
+};
+
+static void bench_async_complete(struct usb_device *udev, void *context,
+		int status, int length)
+{
+	struct bench_async *ba = context;
+
+	if (status || length != 2)
+		ba->error = 1;
+	if (ba->error || --ba->left == 0 ||
+			usb_control_msg_async(udev, usb_rcvctrlpipe(udev, 0),
+				USB_REQ_GET_STATUS, USB_DIR_IN, 0, 0,
+				ba->status, 2, bench_async_complete, ba))
+		rt_sem_release(&ba->done);
+}
+
+static void bench_async(struct usb_device *udev, int n)
+{
+	struct bench_async ba = { 0 };
+	rt_uint64_t start, usecs;
+	rt_uint32_t allocs;
+
+	rt_sem_init(&ba.done, "bench", 0, RT_IPC_FLAG_FIFO);
+	ba.left = n;
+	rt_atomic_store(&bench_allocs, 0);
+	start = sim_usecs();
+	SIM_CHECK(usb_control_msg_async(udev, usb_rcvctrlpipe(udev, 0),
+			USB_REQ_GET_STATUS, USB_DIR_IN, 0, 0, ba.status, 2,
+			bench_async_complete, &ba) == 0);
+	SIM_CHECK(rt_sem_take(&ba.done, n * 10 + 1000) == RT_EOK);
+	usecs = sim_usecs() - start;
+	allocs = rt_atomic_load(&bench_allocs);
+	SIM_CHECK(!ba.error && ba.left == 0);
+	rt_sem_detach(&ba.done);
+	bench_result("GET_STATUS, async", n, usecs, allocs);
+}
+
+int main(int argc, char **argv)
+{
+	int n = sim_quick(argc, argv) ? 50 : 2000;
+	struct dummy_device *hub;
+	struct usb_interface *intf;
+	struct sim_driver sdrv;
+	struct usb_device *udev;
+	struct sim_device sd;
+	struct usb_hcd *hcd;
+
+	hcd = sim_start();
+	sim_driver_register(&sdrv, BENCH_VID, BENCH_PID);
+	sim_device_init(&sd, USB_SPEED_HIGH, BENCH_VID, BENCH_PID, 0xff,
+			bench_eps, 1);
+	hub = dummy_hub_create(4);
+	SIM_CHECK(hub != RT_NULL);
+	SIM_CHECK(dummy_hub_connect(hub, 1, &sd.vdev) == 0);
+	SIM_CHECK(dummy_hcd_connect(hcd, 1, hub) == 0);
+	intf = sim_wait_probe(&sdrv, 5000);
+	SIM_CHECK(intf != RT_NULL);
+	udev = intf->udev;
+
+	rt_malloc_sethook(bench_malloc_hook);
+	rt_free(rt_malloc(1));
+	SIM_CHECK(rt_atomic_load(&bench_allocs) >= 1);
+	bench_sync(udev, "GET_STATUS", USB_REQ_GET_STATUS, USB_DIR_IN, 0, 0,
+			2, n);
+	bench_sync(udev, "GET_DESCRIPTOR", USB_REQ_GET_DESCRIPTOR, USB_DIR_IN,
+			USB_DESC_TYPE_DEVICE << 8, 0, USB_DESC_LENGTH_DEVICE, n);
+	bench_async(udev, n);
+	bench_sync(udev->parent, "hub GET_PORT_STATUS", USB_REQ_GET_STATUS,
+			USB_DIR_IN | USB_RT_PORT, 0, 1, 4, n);
+	rt_malloc_sethook(RT_NULL);
+
+	dummy_hcd_disconnect(hcd, 1);
+	SIM_CHECK(sim_wait_disconnect(&sdrv, 2000) == 0);
+	rt_thread_mdelay(200);
+	dummy_hub_destroy(hub);
+	sim_driver_unregister(&sdrv);
+	sim_device_release(&sd);
+	return 0;
+}
@@ -0,0 +1,202 @@
+/*
+ * bench_desc.c - memory per device and interface lookups
+ *
+ * A composite device of four interfaces, each with two altsettings, a
+ * class descriptor and string descriptors, is enumerated while every
+ * rt_malloc() is counted through the malloc hook.  Reported are those
+ * allocations, the size of the one descriptor block the device keeps,
+ * and, for comparison, the allocations the per-object layout it
+ * replaced would need for the same descriptors: one per interface,
+ * altsetting array, endpoint array, raw descriptor and string.
+ *
+ * Then interface and altsetting lookups at random: through the index
+ * of usb_ifnum_to_if() and usb_altnum_to_altsetting(), by a linear scan
+ * of the interfaces, and by walking the raw configuration descriptor.
+ */
+
+#include "sim.h"
+
+#define BENCH_VID	0x1d6b
+#define BENCH_PID	0x0117
+#define BENCH_INTFS	4
+#define BENCH_ALTS	2
+
+static const char * const bench_strings[] = {
+	"Composite", "Test Vendor", "0123456789",
+};
+
+static atomic_t bench_allocs;
+
+static void bench_malloc_hook(void *ptr, rt_size_t size)
+{
+	rt_atomic_add(&bench_allocs, 1);
+}
+
+/* a class descriptor after every interface descriptor, CS_INTERFACE */
+static const uint8_t bench_cs[] = { 5, 0x24, 0x00, 0x10, 0x01 };
+
+/* interface @ifnum, alternate setting @alt, with @alt + 1 endpoints */
+static void bench_add_intf(struct sim_device *sd, int ifnum, int alt)
+{
+	uint8_t intf[USB_DESC_LENGTH_INTERFACE] = {
+		USB_DESC_LENGTH_INTERFACE, USB_DESC_TYPE_INTERFACE,
+		ifnum, alt, alt + 1, 0xff, 0, 0, 0,
+	};
+	uint8_t ep[USB_DESC_LENGTH_ENDPOINT] = {
+		USB_DESC_LENGTH_ENDPOINT, USB_DESC_TYPE_ENDPOINT,
+		0, USB_EP_ATTR_BULK, 0x00, 0x02, 0,
+	};
+	int i;
+
+	/* the first one is sim_device_init()'s */
+	if (ifnum || alt)
+		sim_device_extra(sd, intf, sizeof(intf));
+	sim_device_extra(sd, bench_cs, sizeof(bench_cs));
+	for (i = 0; i <= alt; i++) {
+		ep[2] = (i ? 0 : USB_DIR_IN) | (ifnum + 1);
+		sim_device_extra(sd, ep, sizeof(ep));
+	}
+}
+
+static void bench_device_init(struct sim_device *sd)
+{
+	int i, alt;
+
+	sim_device_init(sd, USB_SPEED_HIGH, BENCH_VID, BENCH_PID, 0xff,
+			RT_NULL, 0);
+	sd->config[USB_DESC_LENGTH_CONFIG + 4] = 1;	/* bNumEndpoints */
+	for (i = 0; i < BENCH_INTFS; i++)
+		for (alt = 0; alt < BENCH_ALTS; alt++)
+			bench_add_intf(sd, i, alt);
+	sd->config[4] = BENCH_INTFS;
+	sd->desc.iProduct = 1;
+	sd->desc.iManufacturer = 2;
+	sd->desc.iSerialNumber = 3;
+	sd->vdev.strings = bench_strings;
+	sd->vdev.nstrings = 3;
+}
+
+/* what the per-object layout allocated for @udev's descriptors */
+static int bench_object_allocs(struct usb_device *udev)
+{
+	struct usb_host_config *c;
+	struct usb_interface *intf;
+	int n, i, j, k;
+
+	/* the config array, the rawdescriptors array, the strings */
+	n = 2 + (udev->product != RT_NULL) +
+			(udev->manufacturer != RT_NULL) +
+			(udev->serial != RT_NULL);
+	for (i = 0; i < udev->descriptor.bNumConfigurations; i++) {
+		c = &udev->config[i];
+		n++;		/* the raw descriptors */
+		for (j = 0; j < c->desc.bNumInterfaces; j++) {
+			intf = c->interface[j];
+			n += 2;	/* the interface, its altsetting array */
+			for (k = 0; k < intf->num_altsetting; k++)
+				n += intf->altsetting[k].desc.bNumEndpoints
+						!= 0;
+		}
+	}
+	return n;
+}
+
+/* the interface descriptor @ifnum/@alt, found the long way */
+static const void *bench_walk(struct usb_device *udev, int ifnum, int alt)
+{
+	const uint8_t *p = (const uint8_t *)udev->rawdescriptors[0];
+	const uint8_t *end = p + udev->config[0].desc.wTotalLength;
+
+	for (; p + 2 <= end && p[0] >= 2; p += p[0])
+		if (p[1] == USB_DESC_TYPE_INTERFACE && p[2] == ifnum &&
+				p[3] == alt)
+			return p;
+	return RT_NULL;
+}
+
+/* the interface by a scan of the config, then its altsetting by a scan */
+static const void *bench_scan(struct usb_device *udev, int ifnum, int alt)
+{
+	struct usb_host_config *c = udev->actconfig;
+	struct usb_interface *intf;
+	int i, j;
+
+	for (i = 0; i < c->desc.bNumInterfaces; i++) {
+		intf = c->interface[i];
+		if (intf->altsetting[0].desc.bInterfaceNumber != ifnum)
+			continue;
+		for (j = 0; j < intf->num_altsetting; j++)
+			if (intf->altsetting[j].desc.bAlternateSetting == alt)
+				return &intf->altsetting[j];
+	}
+	return RT_NULL;
+}
+
+/* the same through the index */
+static const void *bench_index(struct usb_device *udev, int ifnum, int alt)
+{
+	return usb_altnum_to_altsetting(usb_ifnum_to_if(udev, ifnum), alt);
+}
+
+static volatile rt_ubase_t bench_sink;
+
+static void bench_lookups(struct usb_device *udev, int n, const char *name,
+		const void *(*fn)(struct usb_device *udev, int ifnum, int alt))
+{
+	rt_uint64_t start, usecs;
+	unsigned int seed = 1;
+	rt_ubase_t sum = 0;
+	int i;
+
+	start = sim_usecs();
+	for (i = 0; i < n; i++) {
+		seed = seed * 1103515245 + 12345;
+		sum += (rt_ubase_t)fn(udev, (seed >> 8) % BENCH_INTFS,
+				(seed >> 16) % BENCH_ALTS);
+	}
+	usecs = sim_usecs() - start;
+	bench_sink = sum;
+	sim_report(name, usecs * 1000.0 / n, "ns");
+}
+
+int main(int argc, char **argv)
+{
+	int n = sim_quick(argc, argv) ? 100000 : 10000000;
+	struct sim_driver sdrv;
+	struct usb_device *udev;
+	struct sim_device sd;
+	struct usb_hcd *hcd;
+	rt_uint32_t allocs;
+	int i;
+
+	hcd = sim_start();
+	sim_driver_register(&sdrv, BENCH_VID, BENCH_PID);
+	bench_device_init(&sd);
+
+	rt_malloc_sethook(bench_malloc_hook);
+	SIM_CHECK(dummy_hcd_connect(hcd, 1, &sd.vdev) == 0);
+	for (i = 0; i < BENCH_INTFS; i++)
+		SIM_CHECK(sim_wait_probe(&sdrv, 2000) != RT_NULL);
+	allocs = rt_atomic_load(&bench_allocs);
+	rt_malloc_sethook(RT_NULL);
+	udev = sdrv.intf[0]->udev;
+	SIM_CHECK(udev->actconfig->desc.bNumInterfaces == BENCH_INTFS);
+	SIM_CHECK(usb_ifnum_to_if(udev, BENCH_INTFS - 1)->num_altsetting ==
+			BENCH_ALTS);
+
+	sim_report("enumeration", allocs, "allocations");
+	sim_report("descriptor block", sizeof(*udev->descs) +
+			udev->descs->size, "bytes");
+	sim_report("per-object layout", bench_object_allocs(udev),
+			"allocations");
+	bench_lookups(udev, n, "lookup, index", bench_index);
+	bench_lookups(udev, n, "lookup, interface scan", bench_scan);
+	bench_lookups(udev, n, "lookup, descriptor walk", bench_walk);
+
+	dummy_hcd_disconnect(hcd, 1);
+	for (i = 0; i < BENCH_INTFS; i++)
+		SIM_CHECK(sim_wait_disconnect(&sdrv, 2000) == 0);
+	sim_driver_unregister(&sdrv);
+	sim_device_release(&sd);
+	return 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * bench_devnum.c - device address allocation under contention
+ *
+ * Threads allocate and free addresses on one bus as fast as they can,
+ * with 100 of the 127 held by devices that stay, like a production line
+ * replugging a few devices among many.  Reported is the cost of an
+ * allocate and free pair, lock free and, for comparison, with every
+ * call serialized on a mutex the way devnum_next_mutex used to do it.
+ */
+
+#include "sim.h"
+
+#define BENCH_MAX_THREADS	8
+#define BENCH_HELD		100
+
+static struct usb_bus bench_bus;
+static struct rt_mutex bench_mutex;
+static struct rt_semaphore bench_finished;
+static int bench_locked;
+static int bench_rounds;
+
+static void bench_thread_entry(void *parameter)
+{
+	int i, devnum;
+
+	for (i = 0; i < bench_rounds; i++) {
+		if (bench_locked)
+			rt_mutex_take(&bench_mutex, RT_WAITING_FOREVER);
+		devnum = usb_alloc_devnum(&bench_bus);
+		if (bench_locked)
+			rt_mutex_release(&bench_mutex);
+		SIM_CHECK(devnum > 0);
+
+		if (bench_locked)
+			rt_mutex_take(&bench_mutex, RT_WAITING_FOREVER);
+		usb_free_devnum(&bench_bus, devnum);
+		if (bench_locked)
+			rt_mutex_release(&bench_mutex);
+	}
+	rt_sem_release(&bench_finished);
+}
+
+static void bench_run(int nthreads, int locked)
+{
+	rt_uint64_t start, usecs;
+	rt_thread_t tid;
+	char name[64];
+	int i;
+
+	bench_locked = locked;
+	start = sim_usecs();
+	for (i = 0; i < nthreads; i++) {
+		tid = rt_thread_create("devnum", bench_thread_entry, RT_NULL,
+				4096, 10, 10);
+		SIM_CHECK(tid != RT_NULL);
+		rt_thread_startup(tid);
+	}
+	for (i = 0; i < nthreads; i++)
+		SIM_CHECK(rt_sem_take(&bench_finished, 60000) == RT_EOK);
+	usecs = sim_usecs() - start;
+
+	rt_snprintf(name, sizeof(name), "alloc+free, %d thread%s%s", nthreads,
+			nthreads > 1 ? "s" : "", locked ? ", mutex" : "");
+	sim_report(name, (double)usecs * 1000 / bench_rounds / nthreads,
+			"ns");
+}
+
+int main(int argc, char **argv)
+{
+	int n;
+
+	rt_components_init();
+	bench_rounds = sim_quick(argc, argv) ? 10000 : 1000000;
+	rt_mutex_init(&bench_mutex, "bench", RT_IPC_FLAG_PRIO);
+	rt_sem_init(&bench_finished, "bench", 0, RT_IPC_FLAG_FIFO);
+	for (n = 0; n < BENCH_HELD; n++)
+		SIM_CHECK(usb_alloc_devnum(&bench_bus) == n + 1);
+
+	for (n = 1; n <= BENCH_MAX_THREADS; n *= 2) {
+		bench_run(n, 0);
+		bench_run(n, 1);
+	}
+
+	rt_sem_detach(&bench_finished);
+	rt_mutex_detach(&bench_mutex);
+	return 0;
+}
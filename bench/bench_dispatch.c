@@ -0,0 +1,184 @@
+/*
+ * bench_dispatch.c - from a pipe to its endpoint's state
+ *
+ * What an hcd does with every urb before it touches the bus: find the
+ * endpoint, check the pipe's type against it, and fetch maxpacket, the
+ * period and the data toggle.  Done the way the stack does it, one
+ * indexed load into ep_table and ep_state, and for comparison the way
+ * it used to be done, picking ep_in[] or ep_out[] by direction and
+ * decoding the endpoint descriptor.  The pipes come from every endpoint
+ * of a device in random order, so the branches of the decode can't be
+ * learned.  Reported per urb in nanoseconds and, where the cpu has a
+ * time stamp counter, in its cycles.
+ */
+
+#include "sim.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define bench_cycles()		__rdtsc()
+#endif
+
+#define BENCH_VID	0x1d6b
+#define BENCH_PID	0x010e
+#define BENCH_PIPES	4096		/* a power of two */
+
+static const struct sim_ep bench_eps[] = {
+	{ USB_DIR_IN | 1, USB_EP_ATTR_BULK, 512, 0 },
+	{ 2, USB_EP_ATTR_BULK, 512, 0 },
+	{ USB_DIR_IN | 3, USB_EP_ATTR_INT, 64, 4 },
+	{ 4, USB_EP_ATTR_INT, 64, 4 },
+	{ USB_DIR_IN | 5, USB_EP_ATTR_ISOC, 1024, 1 },
+	{ 6, USB_EP_ATTR_ISOC, 1024, 1 },
+	{ USB_DIR_IN | 7, USB_EP_ATTR_BULK, 512, 0 },
+	{ 8, USB_EP_ATTR_BULK, 512, 0 },
+};
+
+static unsigned int bench_pipes[BENCH_PIPES];
+static volatile unsigned int bench_sink;
+
+/* ep_state, one load for the slot and one line of state */
+static unsigned int bench_table(struct usb_device *udev, int n)
+{
+	struct usb_ep_state *st;
+	unsigned int pipe, sum = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		pipe = bench_pipes[i & (BENCH_PIPES - 1)];
+		if (!usb_pipe_endpoint(udev, pipe))
+			return 0;
+		st = usb_pipe_ep_state(udev, pipe);
+		if (st->type != usb_pipetype(pipe) ||
+				!(st->flags & USB_EP_ENABLED))
+			return 0;
+		sum += st->maxpacket * st->mult + st->interval;
+		sum += usb_gettoggle(udev, pipe);
+		usb_dotoggle(udev, pipe);
+	}
+	return sum;
+}
+
+/* the same answers from the descriptors, toggles in two bitmasks */
+static unsigned int bench_toggle[2];
+
+static unsigned int bench_decode(struct usb_device *udev, int n)
+{
+	struct usb_host_endpoint *ep;
+	unsigned int pipe, sum = 0, epnum, out, type, maxp, mult, period;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		pipe = bench_pipes[i & (BENCH_PIPES - 1)];
+		epnum = usb_pipeendpoint(pipe);
+		out = usb_pipeout(pipe) ? 1 : 0;
+		ep = out ? udev->ep_out[epnum] : udev->ep_in[epnum];
+		if (!ep)
+			return 0;
+
+		switch (ep->desc.bmAttributes & USB_EP_ATTR_TYPE_MASK) {
+		case USB_EP_ATTR_CONTROL:
+			type = PIPE_CONTROL;
+			break;
+		case USB_EP_ATTR_ISOC:
+			type = PIPE_ISOCHRONOUS;
+			break;
+		case USB_EP_ATTR_BULK:
+			type = PIPE_BULK;
+			break;
+		default:
+			type = PIPE_INTERRUPT;
+			break;
+		}
+		if (type != usb_pipetype(pipe))
+			return 0;
+
+		maxp = ep->desc.wMaxPacketSize & 0x7ff;
+		mult = 1;
+		period = 0;
+		if (type == PIPE_ISOCHRONOUS || type == PIPE_INTERRUPT) {
+			if (udev->speed == USB_SPEED_HIGH) {
+				mult += (ep->desc.wMaxPacketSize >> 11) & 3;
+				period = 1 << (ep->desc.bInterval - 1);
+				period = period < 8 ? 1 : period / 8;
+			} else if (type == PIPE_ISOCHRONOUS) {
+				period = 1 << (ep->desc.bInterval - 1);
+			} else {
+				period = ep->desc.bInterval;
+			}
+		}
+		sum += maxp * mult + period;
+		sum += (bench_toggle[out] >> epnum) & 1;
+		bench_toggle[out] ^= 1 << epnum;
+	}
+	return sum;
+}
+
+static void bench_run(struct usb_device *udev, const char *name, int n,
+		unsigned int (*fn)(struct usb_device *udev, int n))
+{
+	rt_uint64_t start, usecs;
+	char label[64];
+#ifdef bench_cycles
+	rt_uint64_t cycles;
+#endif
+
+	bench_sink = fn(udev, BENCH_PIPES);	/* warm up */
+	SIM_CHECK(bench_sink != 0);
+#ifdef bench_cycles
+	cycles = bench_cycles();
+#endif
+	start = sim_usecs();
+	bench_sink = fn(udev, n);
+	usecs = sim_usecs() - start;
+#ifdef bench_cycles
+	cycles = bench_cycles() - cycles;
+#endif
+	SIM_CHECK(bench_sink != 0);
+
+	rt_snprintf(label, sizeof(label), "dispatch, %s", name);
+	sim_report(label, (double)usecs * 1000 / n, "ns");
+#ifdef bench_cycles
+	sim_report(label, (double)cycles / n, "cycles");
+#endif
+}
+
+int main(int argc, char **argv)
+{
+	int n = sim_quick(argc, argv) ? 1000000 : 100000000;
+	struct usb_interface *intf;
+	struct sim_driver sdrv;
+	struct usb_device *udev;
+	struct sim_device sd;
+	struct usb_hcd *hcd;
+	struct usb_host_interface *alt;
+	struct usb_host_endpoint *ep;
+	unsigned int seed = 1;
+	int i;
+
+	hcd = sim_start();
+	sim_driver_register(&sdrv, BENCH_VID, BENCH_PID);
+	sim_device_init(&sd, USB_SPEED_HIGH, BENCH_VID, BENCH_PID, 0xff,
+			bench_eps, sizeof(bench_eps) / sizeof(bench_eps[0]));
+	SIM_CHECK(dummy_hcd_connect(hcd, 1, &sd.vdev) == 0);
+	intf = sim_wait_probe(&sdrv, 2000);
+	SIM_CHECK(intf != RT_NULL);
+	udev = intf->udev;
+
+	alt = intf->cur_altsetting;
+	for (i = 0; i < BENCH_PIPES; i++) {
+		seed = seed * 1103515245 + 12345;
+		ep = &alt->endpoint[(seed >> 16) % alt->desc.bNumEndpoints];
+		bench_pipes[i] = usb_pipe_encode(usb_endpoint_pipetype(
+				&ep->desc), udev->devnum,
+				ep->desc.bEndpointAddress, udev->speed);
+	}
+
+	bench_run(udev, "ep_state table", n, bench_table);
+	bench_run(udev, "descriptor decode", n, bench_decode);
+	dummy_hcd_disconnect(hcd, 1);
+	SIM_CHECK(sim_wait_disconnect(&sdrv, 2000) == 0);
+	sim_driver_unregister(&sdrv);
+	sim_device_release(&sd);
+	return 0;
+}
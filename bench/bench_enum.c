@@ -0,0 +1,99 @@
+/*
+ * bench_enum.c - time until a bench full of devices is configured
+ *
+ * N devices with string descriptors behind four virtual hubs, one per
+ * root port, are plugged in at once, like a test jig coming up at boot.
+ * Reported is the time from the connect until the last of them has been
+ * probed, and what that is per device; with USB_HUB_ENUM_THREADS
+ * enumerating side by side the total should grow much slower than N
+ * times the time of one.  The hub debounce and the 1 ms frames set the
+ * floor.
+ */
+
+#include "sim.h"
+
+#define BENCH_VID	0x1d6b
+#define BENCH_PID	0x0108
+#define BENCH_HUBS	4
+#define BENCH_MAX_DEVS	(BENCH_HUBS * DUMMY_HUB_PORTS)
+
+static const struct sim_ep bench_eps[] = {
+	{ USB_DIR_IN | 1, USB_EP_ATTR_BULK, 512, 0 },
+	{ 2, USB_EP_ATTR_BULK, 512, 0 },
+};
+
+static const char *const bench_strings[] = {
+	"RT-Thread", "Simulated jig device", "0123456789AB",
+};
+
+static struct sim_device bench_devs[BENCH_MAX_DEVS];
+static struct dummy_device *bench_hubs[BENCH_HUBS];
+
+static void bench_enum(struct usb_hcd *hcd, struct sim_driver *sdrv, int n)
+{
+	rt_uint64_t start, usecs;
+	char name[64];
+	int i;
+
+	for (i = 0; i < BENCH_HUBS; i++) {
+		bench_hubs[i] = dummy_hub_create(DUMMY_HUB_PORTS);
+		SIM_CHECK(bench_hubs[i] != RT_NULL);
+	}
+	/* spread over the hubs, the way a jig is wired */
+	for (i = 0; i < n; i++)
+		SIM_CHECK(dummy_hub_connect(bench_hubs[i % BENCH_HUBS],
+				i / BENCH_HUBS + 1, &bench_devs[i].vdev) == 0);
+
+	start = sim_usecs();
+	for (i = 0; i < BENCH_HUBS; i++)
+		SIM_CHECK(dummy_hcd_connect(hcd, i + 1, bench_hubs[i]) == 0);
+	for (i = 0; i < n; i++)
+		SIM_CHECK(sim_wait_probe(sdrv, 10000) != RT_NULL);
+	usecs = sim_usecs() - start;
+
+	rt_snprintf(name, sizeof(name), "all configured, N=%d", n);
+	sim_report(name, usecs / 1000.0, "ms");
+	rt_snprintf(name, sizeof(name), "per device, N=%d", n);
+	sim_report(name, (double)usecs / 1000 / n, "ms");
+
+	for (i = 0; i < BENCH_HUBS; i++)
+		dummy_hcd_disconnect(hcd, i + 1);
+	for (i = 0; i < n; i++)
+		SIM_CHECK(sim_wait_disconnect(sdrv, 5000) == 0);
+	/* the hubs go after the devices behind them */
+	rt_thread_mdelay(200);
+	for (i = 0; i < BENCH_HUBS; i++)
+		dummy_hub_destroy(bench_hubs[i]);
+}
+
+int main(int argc, char **argv)
+{
+	static const int counts[] = { 1, 4, 12, 28 };
+	int quick = sim_quick(argc, argv);
+	struct sim_driver sdrv;
+	struct usb_hcd *hcd;
+	unsigned int i;
+
+	hcd = sim_start();
+	sim_driver_register(&sdrv, BENCH_VID, BENCH_PID);
+	for (i = 0; i < BENCH_MAX_DEVS; i++) {
+		sim_device_init(&bench_devs[i], USB_SPEED_HIGH, BENCH_VID,
+				BENCH_PID, 0xff, bench_eps, 2);
+		bench_devs[i].desc.iManufacturer = 1;
+		bench_devs[i].desc.iProduct = 2;
+		bench_devs[i].desc.iSerialNumber = 3;
+		bench_devs[i].vdev.strings = bench_strings;
+		bench_devs[i].vdev.nstrings = 3;
+	}
+
+	for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		if (quick && counts[i] > 4)
+			break;
+		bench_enum(hcd, &sdrv, counts[i]);
+	}
+
+	sim_driver_unregister(&sdrv);
+	for (i = 0; i < BENCH_MAX_DEVS; i++)
+		sim_device_release(&bench_devs[i]);
+	return 0;
+}
@@ -0,0 +1,93 @@
+/*
+ * bench_fifo.c - bulk fifo throughput by urbs in flight and urb size
+ *
+ * usb_bulk_fifo_read() and usb_bulk_fifo_write() of a high-speed
+ * source/sink device, with K = 1, 2, 4 and 8 urbs kept in flight and
+ * 512 byte to 16 KiB per urb.  The application side reads and writes
+ * in 4 KiB calls, like a CDC link would.  With one urb the endpoint
+ * idles while it is resubmitted; the dummy's frame budget is the
+ * ceiling the larger K should reach.
+ */
+
+#include "sim.h"
+
+#define BENCH_VID	0x1d6b
+#define BENCH_PID	0x0111
+#define BENCH_CHUNK	4096
+
+static const struct sim_ep bench_eps[] = {
+	{ USB_DIR_IN | 1, USB_EP_ATTR_BULK, 512, 0 },
+	{ 2, USB_EP_ATTR_BULK, 512, 0 },
+};
+
+static void bench_run(struct usb_device *udev, int in, int nurbs,
+		int buf_size, rt_size_t total)
+{
+	static uint8_t buf[BENCH_CHUNK];
+	struct usb_bulk_fifo fifo;
+	rt_uint64_t start, usecs;
+	rt_size_t done;
+	rt_ssize_t ret;
+	char name[64];
+
+	SIM_CHECK(usb_bulk_fifo_init(&fifo, udev, in ?
+			usb_rcvbulkpipe(udev, 1) : usb_sndbulkpipe(udev, 2),
+			nurbs, buf_size, in ? 0 : URB_ZERO_PACKET) == 0);
+	SIM_CHECK(usb_bulk_fifo_start(&fifo) == 0);
+
+	start = sim_usecs();
+	for (done = 0; done < total; done += ret) {
+		if (in)
+			ret = usb_bulk_fifo_read(&fifo, buf, sizeof(buf),
+					1000);
+		else
+			ret = usb_bulk_fifo_write(&fifo, buf, sizeof(buf),
+					1000);
+		SIM_CHECK(ret > 0);
+	}
+	if (!in)
+		SIM_CHECK(usb_bulk_fifo_flush(&fifo, 1000) == 0);
+	usecs = sim_usecs() - start;
+
+	usb_bulk_fifo_stop(&fifo);
+	usb_bulk_fifo_release(&fifo);
+
+	rt_snprintf(name, sizeof(name), "bulk %s, K=%d, %d B urbs",
+			in ? "IN" : "OUT", nurbs, buf_size);
+	sim_report(name, (double)done / usecs, "MB/s");
+}
+
+int main(int argc, char **argv)
+{
+	static const int sizes[] = { 512, 4096, 16384 };
+	rt_size_t total = sim_quick(argc, argv) ? 256 * 1024 :
+			8 * 1024 * 1024;
+	struct usb_interface *intf;
+	struct sim_driver sdrv;
+	struct usb_device *udev;
+	struct sim_device sd;
+	struct usb_hcd *hcd;
+	unsigned int i;
+	int nurbs, in;
+
+	hcd = sim_start();
+	sim_driver_register(&sdrv, BENCH_VID, BENCH_PID);
+	sim_device_init(&sd, USB_SPEED_HIGH, BENCH_VID, BENCH_PID, 0xff,
+			bench_eps, 2);
+	SIM_CHECK(dummy_hcd_connect(hcd, 1, &sd.vdev) == 0);
+	intf = sim_wait_probe(&sdrv, 2000);
+	SIM_CHECK(intf != RT_NULL);
+	udev = intf->udev;
+
+	for (in = 1; in >= 0; in--)
+		for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+			for (nurbs = 1; nurbs <= USB_BULK_FIFO_URBS;
+					nurbs *= 2)
+				bench_run(udev, in, nurbs, sizes[i], total);
+
+	dummy_hcd_disconnect(hcd, 1);
+	SIM_CHECK(sim_wait_disconnect(&sdrv, 2000) == 0);
+	sim_driver_unregister(&sdrv);
+	sim_device_release(&sd);
+	return 0;
+}
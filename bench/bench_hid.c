@@ -0,0 +1,155 @@
+/*
+ * bench_hid.c - CPU time of polling many HID devices
+ *
+ * 32 devices with an 8 byte interrupt IN endpoint polled every 1 ms,
+ * behind two tiers of virtual hubs, each with one urb resubmitted from
+ * its completion handler like a keyboard driver does.  Measured is the
+ * CPU time the whole process spends per second of polling, and the
+ * context switches per report, with the urbs plain and with
+ * URB_NO_INTERRUPT, which lets the dummy_hcd hand a frame's reports to
+ * the giveback worker as one batch.
+ */
+
+#include "sim.h"
+
+#include <sys/resource.h>
+
+#define BENCH_VID	0x1d6b
+#define BENCH_PID	0x010f
+#define BENCH_DEVS	32
+#define BENCH_HUBS	8		/* four on the root, four below them */
+#define BENCH_REPORT	8
+
+static const struct sim_ep bench_eps[] = {
+	{ USB_DIR_IN | 1, USB_EP_ATTR_INT, BENCH_REPORT, 4 },	/* 1 ms */
+};
+
+static struct sim_device bench_devs[BENCH_DEVS];
+static struct dummy_device *bench_hubs[BENCH_HUBS];
+static struct urb *bench_urbs[BENCH_DEVS];
+static uint8_t bench_bufs[BENCH_DEVS][BENCH_REPORT];
+static atomic_t bench_reports;
+static int bench_running;
+
+static void bench_complete(struct urb *urb)
+{
+	if (urb->status)
+		return;
+	rt_atomic_add(&bench_reports, 1);
+	if (bench_running)
+		usb_submit_urb(urb);
+}
+
+static rt_uint64_t bench_cpu_usecs(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+	return (rt_uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static long bench_switches(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+static void bench_poll(struct sim_driver *sdrv, int ms, int batched)
+{
+	rt_uint64_t start, cpu, usecs;
+	struct usb_device *udev;
+	long switches;
+	unsigned int flags = batched ? URB_NO_INTERRUPT : 0;
+	const char *mode = batched ? "URB_NO_INTERRUPT" : "plain";
+	rt_uint32_t reports;
+	char name[64];
+	int i;
+
+	for (i = 0; i < BENCH_DEVS; i++) {
+		udev = sdrv->intf[i]->udev;
+		usb_fill_int_urb(bench_urbs[i], udev, usb_rcvintpipe(udev, 1),
+				bench_bufs[i], BENCH_REPORT, bench_complete,
+				RT_NULL, 4);
+		bench_urbs[i]->transfer_flags = flags;
+	}
+
+	rt_atomic_store(&bench_reports, 0);
+	bench_running = 1;
+	start = sim_usecs();
+	cpu = bench_cpu_usecs();
+	switches = bench_switches();
+	for (i = 0; i < BENCH_DEVS; i++)
+		SIM_CHECK(usb_submit_urb(bench_urbs[i]) == 0);
+	rt_thread_mdelay(ms);
+	reports = rt_atomic_load(&bench_reports);
+	switches = bench_switches() - switches;
+	cpu = bench_cpu_usecs() - cpu;
+	usecs = sim_usecs() - start;
+	bench_running = 0;
+	for (i = 0; i < BENCH_DEVS; i++)
+		usb_kill_urb(bench_urbs[i]);
+	SIM_CHECK(reports > 0);
+
+	rt_snprintf(name, sizeof(name), "reports, %s", mode);
+	sim_report(name, reports * 1e6 / usecs, "/s");
+	rt_snprintf(name, sizeof(name), "cpu time, %s", mode);
+	sim_report(name, cpu * 1000.0 / usecs, "ms/s");
+	rt_snprintf(name, sizeof(name), "context switches, %s", mode);
+	sim_report(name, (double)switches / reports, "/report");
+}
+
+int main(int argc, char **argv)
+{
+	int ms = sim_quick(argc, argv) ? 300 : 5000;
+	struct sim_driver sdrv;
+	struct usb_hcd *hcd;
+	int i;
+
+	hcd = sim_start();
+	sim_driver_register(&sdrv, BENCH_VID, BENCH_PID);
+	for (i = 0; i < BENCH_HUBS; i++) {
+		bench_hubs[i] = dummy_hub_create(DUMMY_HUB_PORTS);
+		SIM_CHECK(bench_hubs[i] != RT_NULL);
+	}
+	/* six devices on each hub of the root, two on each one below */
+	for (i = 0; i < BENCH_HUBS / 2; i++)
+		SIM_CHECK(dummy_hub_connect(bench_hubs[i], DUMMY_HUB_PORTS,
+				bench_hubs[i + BENCH_HUBS / 2]) == 0);
+	for (i = 0; i < BENCH_DEVS; i++) {
+		sim_device_init(&bench_devs[i], USB_SPEED_HIGH, BENCH_VID,
+				BENCH_PID, 0x03, bench_eps, 1);
+		if (i < 24)
+			SIM_CHECK(dummy_hub_connect(bench_hubs[i % 4],
+					i / 4 + 1, &bench_devs[i].vdev) == 0);
+		else
+			SIM_CHECK(dummy_hub_connect(bench_hubs[4 + i % 4],
+					(i - 24) / 4 + 1,
+					&bench_devs[i].vdev) == 0);
+		bench_urbs[i] = usb_alloc_urb(0);
+		SIM_CHECK(bench_urbs[i] != RT_NULL);
+	}
+	for (i = 0; i < BENCH_HUBS / 2; i++)
+		SIM_CHECK(dummy_hcd_connect(hcd, i + 1, bench_hubs[i]) == 0);
+	for (i = 0; i < BENCH_DEVS; i++)
+		SIM_CHECK(sim_wait_probe(&sdrv, 10000) != RT_NULL);
+
+	bench_poll(&sdrv, ms, 0);
+	bench_poll(&sdrv, ms, 1);
+
+	for (i = 0; i < BENCH_DEVS; i++)
+		usb_free_urb(bench_urbs[i]);
+	for (i = 0; i < BENCH_HUBS / 2; i++)
+		dummy_hcd_disconnect(hcd, i + 1);
+	for (i = 0; i < BENCH_DEVS; i++)
+		SIM_CHECK(sim_wait_disconnect(&sdrv, 5000) == 0);
+	/* the hubs go after the devices behind them, bottom tier first */
+	rt_thread_mdelay(200);
+	for (i = BENCH_HUBS - 1; i >= 0; i--)
+		dummy_hub_destroy(bench_hubs[i]);
+	sim_driver_unregister(&sdrv);
+	for (i = 0; i < BENCH_DEVS; i++)
+		sim_device_release(&bench_devs[i]);
+	return 0;
+}
@@ -0,0 +1,277 @@
+/*
+ * bench_msc.c - mass storage IOPS through the sector cache
+ *
+ * A simulated Bulk-Only stick with a 16 MiB RAM disk behind usb-storage,
+ * read and written one 512 byte sector per rt_device call: sequential
+ * reads and writes, like a data logger appending records, and random
+ * ones over the whole disk.  The stick takes a frame to work on each
+ * command, NAKing its CSW until then, so what the cache saves in
+ * commands shows up as IOPS.  Reported with each run are the READ(10)
+ * and WRITE(10) commands the stick saw per sector asked for.
+ */
+
+#include "sim.h"
+#include "usb_storage.h"
+
+#define BENCH_VID	0x1d6b
+#define BENCH_PID	0x0112
+#define BENCH_SECTOR	512
+#define BENCH_SECTORS	32768		/* 16 MiB */
+
+static const struct sim_ep bench_eps[] = {
+	{ USB_DIR_IN | 1, USB_EP_ATTR_BULK, 512, 0 },
+	{ 2, USB_EP_ATTR_BULK, 512, 0 },
+};
+
+/*-------------------------------------------------------------------------*/
+
+/* the stick's side, frame timer context only */
+enum bench_bot_state {
+	BOT_CBW,
+	BOT_DATA_IN,
+	BOT_DATA_OUT,
+	BOT_CSW,
+};
+
+struct bench_bot {
+	struct sim_device	sd;
+	uint8_t			*disk;
+	enum bench_bot_state	state;
+	struct bulk_cs_wrap	csw;
+	uint8_t			reply[36];
+	uint8_t			*data;		/* of the data phase */
+	rt_uint32_t		left;
+	int			busy;		/* NAK the CSW once */
+	rt_uint32_t		reads;		/* READ(10) commands */
+	rt_uint32_t		writes;		/* WRITE(10) commands */
+};
+
+static struct bench_bot bench_bot;
+
+static rt_uint32_t bench_be32(const uint8_t *p)
+{
+	return ((rt_uint32_t)p[0] << 24) | ((rt_uint32_t)p[1] << 16) |
+			((rt_uint32_t)p[2] << 8) | p[3];
+}
+
+static void bench_bot_command(struct bench_bot *bot,
+		const struct bulk_cb_wrap *cbw)
+{
+	rt_uint32_t want = le32_to_cpu(cbw->DataTransferLength);
+	rt_uint32_t lba, count, have = 0;
+	const uint8_t *cdb = cbw->CDB;
+	int status = US_BULK_STAT_OK;
+
+	rt_memset(bot->reply, 0, sizeof(bot->reply));
+	bot->data = bot->reply;
+	switch (cdb[0]) {
+	case 0x12:			/* INQUIRY */
+		bot->reply[1] = 0x80;	/* removable */
+		bot->reply[4] = 31;
+		have = 36;
+		break;
+	case 0x25:			/* READ CAPACITY(10) */
+		bot->reply[0] = (BENCH_SECTORS - 1) >> 24;
+		bot->reply[1] = (BENCH_SECTORS - 1) >> 16;
+		bot->reply[2] = (BENCH_SECTORS - 1) >> 8;
+		bot->reply[3] = (BENCH_SECTORS - 1) & 0xff;
+		bot->reply[6] = BENCH_SECTOR >> 8;
+		have = 8;
+		break;
+	case 0x03:			/* REQUEST SENSE */
+		bot->reply[0] = 0x70;
+		bot->reply[7] = 10;
+		have = 18;
+		break;
+	case 0x28:			/* READ(10) */
+	case 0x2a:			/* WRITE(10) */
+		lba = bench_be32(cdb + 2);
+		count = (cdb[7] << 8) | cdb[8];
+		if (lba + count > BENCH_SECTORS) {
+			status = US_BULK_STAT_FAIL;
+			break;
+		}
+		bot->data = bot->disk + lba * BENCH_SECTOR;
+		have = count * BENCH_SECTOR;
+		if (cdb[0] == 0x28)
+			bot->reads++;
+		else
+			bot->writes++;
+		break;
+	}
+
+	bot->csw.Signature = cpu_to_le32(US_BULK_CS_SIGN);
+	bot->csw.Tag = cbw->Tag;
+	bot->csw.Residue = cpu_to_le32(want > have ? want - have : 0);
+	bot->csw.Status = status;
+	bot->left = have < want ? have : want;
+	bot->busy = 1;
+	if (!bot->left || status != US_BULK_STAT_OK)
+		bot->state = BOT_CSW;
+	else if (cbw->Flags & US_BULK_FLAG_IN)
+		bot->state = BOT_DATA_IN;
+	else
+		bot->state = BOT_DATA_OUT;
+}
+
+static int bench_bot_transfer(struct dummy_device *vdev, uint8_t epaddr,
+		void *buf, int len)
+{
+	struct bench_bot *bot = rt_container_of(vdev, struct bench_bot,
+			sd.vdev);
+	int in = (epaddr & USB_DIR_IN) != 0;
+
+	switch (bot->state) {
+	case BOT_CBW:
+		if (in)
+			return -EAGAIN;
+		if (len != US_BULK_CB_WRAP_LEN ||
+				le32_to_cpu(((struct bulk_cb_wrap *)buf)->
+				Signature) != US_BULK_CB_SIGN)
+			return -EPIPE;
+		bench_bot_command(bot, buf);
+		return len;
+	case BOT_DATA_IN:
+	case BOT_DATA_OUT:
+		if (in != (bot->state == BOT_DATA_IN))
+			return -EAGAIN;
+		if ((rt_uint32_t)len > bot->left)
+			len = bot->left;
+		if (in)
+			rt_memcpy(buf, bot->data, len);
+		else
+			rt_memcpy(bot->data, buf, len);
+		bot->data += len;
+		bot->left -= len;
+		if (!bot->left)
+			bot->state = BOT_CSW;
+		return len;
+	case BOT_CSW:
+		if (!in)
+			return -EAGAIN;
+		if (bot->busy) {
+			bot->busy = 0;
+			return -EAGAIN;
+		}
+		rt_memcpy(buf, &bot->csw, US_BULK_CS_WRAP_LEN);
+		bot->state = BOT_CBW;
+		return US_BULK_CS_WRAP_LEN;
+	}
+	return -EPIPE;
+}
+
+static int bench_bot_setup(struct dummy_device *vdev,
+		const struct usb_ctrlrequest *req, void *buf)
+{
+	struct bench_bot *bot = rt_container_of(vdev, struct bench_bot,
+			sd.vdev);
+
+	switch (req->bRequest) {
+	case US_BULK_GET_MAX_LUN:
+		*(uint8_t *)buf = 0;
+		return 1;
+	case US_BULK_RESET_REQUEST:
+		bot->state = BOT_CBW;
+		return 0;
+	}
+	if (req->bRequestType & USB_DIR_IN) {
+		rt_memset(buf, 0, req->wLength);
+		return req->wLength;
+	}
+	return 0;
+}
+
+/*-------------------------------------------------------------------------*/
+
+static rt_off_t bench_pos(int random, unsigned int *seed, int i)
+{
+	if (!random)
+		return i;
+	*seed = *seed * 1103515245 + 12345;
+	return (*seed >> 8) % BENCH_SECTORS;
+}
+
+static void bench_io(rt_device_t dev, const char *what, int write,
+		int random, int n)
+{
+	rt_uint32_t reads = bench_bot.reads, writes = bench_bot.writes;
+	static uint8_t buf[BENCH_SECTOR];
+	rt_uint64_t start, usecs;
+	unsigned int seed = 1;
+	rt_off_t pos;
+	char name[64];
+	int i;
+
+	start = sim_usecs();
+	for (i = 0; i < n; i++) {
+		pos = bench_pos(random, &seed, i);
+		if (write) {
+			rt_memset(buf, (uint8_t)~pos, sizeof(buf));
+			SIM_CHECK(rt_device_write(dev, pos, buf, 1) == 1);
+		} else {
+			SIM_CHECK(rt_device_read(dev, pos, buf, 1) == 1);
+			SIM_CHECK(!rt_memcmp(buf, bench_bot.disk +
+					pos * BENCH_SECTOR, sizeof(buf)));
+		}
+	}
+	if (write)
+		SIM_CHECK(rt_device_control(dev, RT_DEVICE_CTRL_BLK_SYNC,
+				RT_NULL) == RT_EOK);
+	usecs = sim_usecs() - start;
+
+	/* written through to the stick by the sync */
+	for (seed = 1, i = 0; write && i < n; i++) {
+		pos = bench_pos(random, &seed, i);
+		SIM_CHECK(bench_bot.disk[pos * BENCH_SECTOR] == (uint8_t)~pos);
+		SIM_CHECK(bench_bot.disk[pos * BENCH_SECTOR + BENCH_SECTOR -
+				1] == (uint8_t)~pos);
+	}
+
+	sim_report(what, n * 1e6 / usecs, "IOPS");
+	rt_snprintf(name, sizeof(name), "%s, commands", what);
+	sim_report(name, (double)(bench_bot.reads - reads +
+			bench_bot.writes - writes) / n, "/sector");
+}
+
+int main(int argc, char **argv)
+{
+	int n = sim_quick(argc, argv) ? 256 : 8192;
+	struct usb_hcd *hcd;
+	rt_device_t dev;
+	int i;
+
+	hcd = sim_start();
+	sim_device_init(&bench_bot.sd, USB_SPEED_HIGH, BENCH_VID, BENCH_PID,
+			USB_CLASS_MASS_STORAGE, bench_eps, 2);
+	/* bInterfaceSubClass and bInterfaceProtocol */
+	bench_bot.sd.config[USB_DESC_LENGTH_CONFIG + 6] = US_SC_SCSI;
+	bench_bot.sd.config[USB_DESC_LENGTH_CONFIG + 7] = US_PR_BULK;
+	bench_bot.sd.ops.transfer = bench_bot_transfer;
+	bench_bot.sd.ops.setup = bench_bot_setup;
+	bench_bot.disk = malloc(BENCH_SECTORS * BENCH_SECTOR);
+	SIM_CHECK(bench_bot.disk != RT_NULL);
+	for (i = 0; i < BENCH_SECTORS * BENCH_SECTOR; i++)
+		bench_bot.disk[i] = (uint8_t)(i / BENCH_SECTOR);
+
+	SIM_CHECK(dummy_hcd_connect(hcd, 1, &bench_bot.sd.vdev) == 0);
+	for (i = 0; !(dev = rt_device_find("ud0-0")); i++) {
+		SIM_CHECK(i < 5000);
+		rt_thread_mdelay(1);
+	}
+	SIM_CHECK(rt_device_open(dev, RT_DEVICE_OFLAG_RDWR) == RT_EOK);
+
+	bench_io(dev, "sequential read", 0, 0, n);
+	bench_io(dev, "random read", 0, 1, n / 8);
+	bench_io(dev, "sequential write", 1, 0, n);
+	bench_io(dev, "random write", 1, 1, n / 8);
+
+	SIM_CHECK(rt_device_close(dev) == RT_EOK);
+	dummy_hcd_disconnect(hcd, 1);
+	for (i = 0; rt_device_find("ud0-0"); i++) {
+		SIM_CHECK(i < 5000);
+		rt_thread_mdelay(1);
+	}
+	free(bench_bot.disk);
+	sim_device_release(&bench_bot.sd);
+	return 0;
+}
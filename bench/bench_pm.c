@@ -0,0 +1,97 @@
+/*
+ * bench_pm.c - autosuspend delay against first-urb latency
+ *
+ * A device read with one bulk transfer at a time, with idle gaps of 10
+ * to 300 ms in between, like a sensor polled now and then.  For each
+ * autosuspend delay reported are the share of the idle time the device
+ * spent suspended, sampled every millisecond, how often a transfer had
+ * to resume it first, and the mean time a transfer took, resume
+ * included; the resume latency is the one pm.c measures.  A short delay
+ * saves power at the cost of first-urb latency on every gap.
+ */
+
+#include "sim.h"
+
+#define BENCH_VID	0x1d6b
+#define BENCH_PID	0x0116
+#define BENCH_LEN	512
+
+static const struct sim_ep bench_eps[] = {
+	{ USB_DIR_IN | 1, USB_EP_ATTR_BULK, BENCH_LEN, 0 },
+};
+
+static void bench_run(struct usb_device *udev, int delay, int n)
+{
+	static uint8_t buf[BENCH_LEN];
+	struct usb_pm_stats before, after;
+	rt_uint64_t start, busy = 0;
+	unsigned int seed = 1;
+	int i, ms, gap, asleep = 0, idle = 0, actual;
+	char label[32], name[64];
+
+	usb_pm_set_autosuspend(udev, delay);
+	usb_pm_get_stats(udev, &before);
+	for (i = 0; i < n; i++) {
+		seed = seed * 1103515245 + 12345;
+		gap = 10 + (seed >> 8) % 291;
+		for (ms = 0; ms < gap; ms++) {
+			rt_thread_mdelay(1);
+			if (udev->state == USB_STATE_SUSPENDED)
+				asleep++;
+			idle++;
+		}
+		start = sim_usecs();
+		SIM_CHECK(usb_bulk_msg(udev, usb_rcvbulkpipe(udev, 1), buf,
+				sizeof(buf), &actual, 1000) == 0);
+		busy += sim_usecs() - start;
+		SIM_CHECK(actual == BENCH_LEN);
+	}
+	usb_pm_get_stats(udev, &after);
+
+	if (delay < 0)
+		rt_snprintf(label, sizeof(label), "never");
+	else
+		rt_snprintf(label, sizeof(label), "%d ms", delay);
+	rt_snprintf(name, sizeof(name), "autosuspend %s, suspended", label);
+	sim_report(name, 100.0 * asleep / idle, "% idle");
+	rt_snprintf(name, sizeof(name), "autosuspend %s, resumes", label);
+	sim_report(name, 100.0 * (after.resumes - before.resumes) / n,
+			"% transfers");
+	rt_snprintf(name, sizeof(name), "autosuspend %s, transfer", label);
+	sim_report(name, busy / 1000.0 / n, "ms");
+	if (after.resumes == before.resumes)
+		return;
+	rt_snprintf(name, sizeof(name), "autosuspend %s, resume", label);
+	sim_report(name, (after.lat_sum - before.lat_sum) / 1000.0 /
+			(after.resumes - before.resumes), "ms");
+}
+
+int main(int argc, char **argv)
+{
+	static const int delays[] = { 20, 50, 100, 200, 500, -1 };
+	int n = sim_quick(argc, argv) ? 4 : 50;
+	struct usb_interface *intf;
+	struct sim_driver sdrv;
+	struct usb_device *udev;
+	struct sim_device sd;
+	struct usb_hcd *hcd;
+	unsigned int i;
+
+	hcd = sim_start();
+	sim_driver_register(&sdrv, BENCH_VID, BENCH_PID);
+	sim_device_init(&sd, USB_SPEED_HIGH, BENCH_VID, BENCH_PID, 0xff,
+			bench_eps, 1);
+	SIM_CHECK(dummy_hcd_connect(hcd, 1, &sd.vdev) == 0);
+	intf = sim_wait_probe(&sdrv, 2000);
+	SIM_CHECK(intf != RT_NULL);
+	udev = intf->udev;
+
+	for (i = 0; i < sizeof(delays) / sizeof(delays[0]); i++)
+		bench_run(udev, delays[i], n);
+
+	dummy_hcd_disconnect(hcd, 1);
+	SIM_CHECK(sim_wait_disconnect(&sdrv, 2000) == 0);
+	sim_driver_unregister(&sdrv);
+	sim_device_release(&sd);
+	return 0;
+}
@@ -0,0 +1,222 @@
+/*
+ * bench_submit.c - the urb submit and giveback path
+ *
+ * Small bulk IN urbs on one high-speed endpoint: what usb_submit_urb()
+ * costs the caller, submit-to-complete latency of a lone urb, and urbs
+ * per second with many in flight, resubmitted from their completion
+ * handlers or by several threads sharing the endpoint.  Latency is
+ * dominated by the dummy_hcd's 1 ms frame; the submit cost and the rate
+ * are what the ring and the giveback workers decide.
+ */
+
+#include "sim.h"
+
+#define BENCH_VID	0x1d6b
+#define BENCH_PID	0x0105
+#define BENCH_LEN	64
+#define BENCH_URBS	16	/* in flight, below USB_URB_RING_SIZE */
+#define BENCH_THREADS	4
+
+static const struct sim_ep bench_eps[] = {
+	{ USB_DIR_IN | 1, USB_EP_ATTR_BULK, 512, 0 },
+};
+
+struct bench_ctx {
+	struct rt_semaphore	done;
+	rt_uint64_t		submitted;	/* usecs, lone urb */
+	rt_uint64_t		latency;
+	int			left;		/* resubmissions to go */
+	atomic_t		completed;
+};
+
+static void bench_lone_complete(struct urb *urb)
+{
+	struct bench_ctx *ctx = urb->context;
+
+	ctx->latency += sim_usecs() - ctx->submitted;
+	rt_sem_release(&ctx->done);
+}
+
+static void bench_latency(struct usb_device *udev, struct urb *urb, int n)
+{
+	struct bench_ctx ctx = { 0 };
+	rt_uint64_t start, cost = 0;
+	int i;
+
+	rt_sem_init(&ctx.done, "bench", 0, RT_IPC_FLAG_FIFO);
+	urb->complete = bench_lone_complete;
+	urb->context = &ctx;
+	for (i = 0; i < n; i++) {
+		start = ctx.submitted = sim_usecs();
+		SIM_CHECK(usb_submit_urb(urb) == 0);
+		cost += sim_usecs() - start;
+		SIM_CHECK(rt_sem_take(&ctx.done, 1000) == RT_EOK);
+		SIM_CHECK(urb->status == 0);
+	}
+	rt_sem_detach(&ctx.done);
+	sim_report("usb_submit_urb, lone urb", (double)cost * 1000 / n, "ns");
+	sim_report("submit-to-complete, lone urb",
+			(double)ctx.latency / n, "us");
+}
+
+/* resubmits itself until the budget is used up */
+static void bench_chain_complete(struct urb *urb)
+{
+	struct bench_ctx *ctx = urb->context;
+
+	if (urb->status)
+		return;
+	rt_atomic_add(&ctx->completed, 1);
+	if (rt_atomic_sub(&ctx->left, 1) > 0 && usb_submit_urb(urb) == 0)
+		return;
+	rt_sem_release(&ctx->done);
+}
+
+static void bench_chained(struct urb **urbs, int n)
+{
+	struct bench_ctx ctx = { 0 };
+	rt_uint64_t start, usecs;
+	int i;
+
+	rt_sem_init(&ctx.done, "bench", 0, RT_IPC_FLAG_FIFO);
+	rt_atomic_store(&ctx.left, n - BENCH_URBS);
+	start = sim_usecs();
+	for (i = 0; i < BENCH_URBS; i++) {
+		urbs[i]->complete = bench_chain_complete;
+		urbs[i]->context = &ctx;
+		SIM_CHECK(usb_submit_urb(urbs[i]) == 0);
+	}
+	for (i = 0; i < BENCH_URBS; i++)
+		SIM_CHECK(rt_sem_take(&ctx.done, 5000) == RT_EOK);
+	usecs = sim_usecs() - start;
+	rt_sem_detach(&ctx.done);
+	SIM_CHECK(rt_atomic_load(&ctx.completed) >= n - BENCH_URBS);
+	sim_report("urbs/s, 16 in flight, resubmit in complete",
+			rt_atomic_load(&ctx.completed) * 1e6 / usecs, "/s");
+}
+
+/*-------------------------------------------------------------------------*/
+
+struct bench_thread {
+	struct bench_ctx	ctx;
+	struct urb		**urbs;		/* BENCH_URBS / BENCH_THREADS */
+	int			n;
+	rt_uint64_t		cost;		/* usecs in usb_submit_urb() */
+	struct rt_semaphore	*finished;
+};
+
+static void bench_thread_complete(struct urb *urb)
+{
+	struct bench_ctx *ctx = urb->context;
+
+	rt_sem_release(&ctx->done);
+}
+
+static void bench_thread_entry(void *parameter)
+{
+	struct bench_thread *t = parameter;
+	int per = BENCH_URBS / BENCH_THREADS, i;
+	rt_uint64_t start;
+
+	for (i = 0; i < t->n; i++) {
+		/* the first round goes out at once, then one per completion */
+		if (i >= per)
+			SIM_CHECK(rt_sem_take(&t->ctx.done, 1000) == RT_EOK);
+		start = sim_usecs();
+		SIM_CHECK(usb_submit_urb(t->urbs[i % per]) == 0);
+		t->cost += sim_usecs() - start;
+	}
+	for (i = 0; i < per; i++)
+		SIM_CHECK(rt_sem_take(&t->ctx.done, 1000) == RT_EOK);
+	rt_sem_release(t->finished);
+}
+
+/* several threads submitting to the same endpoint */
+static void bench_threads(struct urb **urbs, int n)
+{
+	struct bench_thread threads[BENCH_THREADS];
+	struct rt_semaphore finished;
+	rt_uint64_t start, usecs, cost = 0;
+	rt_thread_t tid;
+	int i, j;
+
+	rt_sem_init(&finished, "bench", 0, RT_IPC_FLAG_FIFO);
+	for (i = 0; i < BENCH_THREADS; i++) {
+		rt_memset(&threads[i], 0, sizeof(threads[i]));
+		rt_sem_init(&threads[i].ctx.done, "bench", 0,
+				RT_IPC_FLAG_FIFO);
+		threads[i].urbs = &urbs[i * (BENCH_URBS / BENCH_THREADS)];
+		threads[i].n = n / BENCH_THREADS;
+		threads[i].finished = &finished;
+		for (j = 0; j < BENCH_URBS / BENCH_THREADS; j++) {
+			threads[i].urbs[j]->complete = bench_thread_complete;
+			threads[i].urbs[j]->context = &threads[i].ctx;
+		}
+	}
+
+	start = sim_usecs();
+	for (i = 0; i < BENCH_THREADS; i++) {
+		tid = rt_thread_create("bench", bench_thread_entry,
+				&threads[i], 4096, 10, 10);
+		SIM_CHECK(tid != RT_NULL);
+		rt_thread_startup(tid);
+	}
+	for (i = 0; i < BENCH_THREADS; i++)
+		SIM_CHECK(rt_sem_take(&finished, 10000) == RT_EOK);
+	usecs = sim_usecs() - start;
+
+	for (i = 0; i < BENCH_THREADS; i++) {
+		cost += threads[i].cost;
+		rt_sem_detach(&threads[i].ctx.done);
+	}
+	rt_sem_detach(&finished);
+	sim_report("urbs/s, 4 threads on one endpoint",
+			(double)(n / BENCH_THREADS * BENCH_THREADS) * 1e6 /
+				usecs, "/s");
+	sim_report("usb_submit_urb, 4 threads",
+			(double)cost * 1000 /
+				(n / BENCH_THREADS * BENCH_THREADS), "ns");
+}
+
+int main(int argc, char **argv)
+{
+	int n = sim_quick(argc, argv) ? 200 : 20000;
+	static uint8_t bufs[BENCH_URBS][BENCH_LEN];
+	struct urb *urbs[BENCH_URBS];
+	struct sim_driver sdrv;
+	struct sim_device sd;
+	struct usb_interface *intf;
+	struct usb_device *udev;
+	struct usb_hcd *hcd;
+	int i;
+
+	hcd = sim_start();
+	sim_driver_register(&sdrv, BENCH_VID, BENCH_PID);
+	sim_device_init(&sd, USB_SPEED_HIGH, BENCH_VID, BENCH_PID, 0xff,
+			bench_eps, 1);
+	SIM_CHECK(dummy_hcd_connect(hcd, 1, &sd.vdev) == 0);
+	intf = sim_wait_probe(&sdrv, 2000);
+	SIM_CHECK(intf != RT_NULL);
+	udev = intf->udev;
+
+	for (i = 0; i < BENCH_URBS; i++) {
+		urbs[i] = usb_alloc_urb(0);
+		SIM_CHECK(urbs[i] != RT_NULL);
+		usb_fill_bulk_urb(urbs[i], udev, usb_rcvbulkpipe(udev, 1),
+				bufs[i], BENCH_LEN, RT_NULL, RT_NULL);
+	}
+
+	bench_latency(udev, urbs[0], sim_quick(argc, argv) ? 20 : 500);
+	bench_chained(urbs, n);
+	bench_threads(urbs, n);
+
+	for (i = 0; i < BENCH_URBS; i++) {
+		usb_kill_urb(urbs[i]);
+		usb_free_urb(urbs[i]);
+	}
+	dummy_hcd_disconnect(hcd, 1);
+	SIM_CHECK(sim_wait_disconnect(&sdrv, 2000) == 0);
+	sim_driver_unregister(&sdrv);
+	sim_device_release(&sd);
+	return 0;
+}
@@ -0,0 +1,168 @@
+/*
+ * bench_trace.c - what the urb instrumentation costs
+ *
+ * The trace hooks of one urb, a submit record and a giveback with its
+ * endpoint counters and record, timed in a loop by one thread and by
+ * several logging into the same ring, which is what a uniprocessor
+ * target does.  Then usb_submit_urb() and submit-to-complete of small
+ * bulk urbs with the ring on and switched off by "usb_trace off", where
+ * only the counters are left.  Built without CONFIG_USB_TRACE the hooks
+ * are empty and just the baseline is reported.
+ */
+
+#include "sim.h"
+
+#include <finsh.h>
+
+#define BENCH_VID	0x1d6b
+#define BENCH_PID	0x010d
+#define BENCH_LEN	64
+#define BENCH_THREADS	4
+
+static const struct sim_ep bench_eps[] = {
+	{ USB_DIR_IN | 1, USB_EP_ATTR_BULK, 512, 0 },
+};
+
+static struct rt_semaphore bench_done;
+static rt_uint64_t bench_submitted;
+static rt_uint64_t bench_latency;
+
+static void bench_complete(struct urb *urb)
+{
+	bench_latency += sim_usecs() - bench_submitted;
+	rt_sem_release(&bench_done);
+}
+
+static void bench_submit(struct urb *urb, int n, const char *what)
+{
+	rt_uint64_t start, cost = 0;
+	char name[64];
+	int i;
+
+	bench_latency = 0;
+	for (i = 0; i < n; i++) {
+		start = bench_submitted = sim_usecs();
+		SIM_CHECK(usb_submit_urb(urb) == 0);
+		cost += sim_usecs() - start;
+		SIM_CHECK(rt_sem_take(&bench_done, 1000) == RT_EOK);
+		SIM_CHECK(urb->status == 0);
+	}
+	rt_snprintf(name, sizeof(name), "usb_submit_urb, %s", what);
+	sim_report(name, (double)cost * 1000 / n, "ns");
+	rt_snprintf(name, sizeof(name), "submit-to-complete, %s", what);
+	sim_report(name, (double)bench_latency / n, "us");
+}
+
+#ifdef CONFIG_USB_TRACE
+
+static struct rt_semaphore bench_finished;
+static int bench_rounds;
+
+/* an urb of its own each, they only share the ring */
+static void bench_hooks_entry(void *parameter)
+{
+	struct urb *proto = parameter, *urb;
+	int i;
+
+	urb = usb_alloc_urb(0);
+	SIM_CHECK(urb != RT_NULL);
+	usb_fill_bulk_urb(urb, proto->dev, proto->pipe, RT_NULL, BENCH_LEN,
+			bench_complete, RT_NULL);
+	urb->ep = proto->ep;
+	urb->actual_length = BENCH_LEN;
+	for (i = 0; i < bench_rounds; i++) {
+		usb_trace_start(urb);
+		usb_trace_submit(urb, 0);
+		usb_trace_giveback(urb);
+	}
+	usb_free_urb(urb);
+	rt_sem_release(&bench_finished);
+}
+
+static void bench_hooks(struct urb *urb, int nthreads)
+{
+	rt_uint64_t start, usecs;
+	rt_thread_t tid;
+	char name[64];
+	int i;
+
+	start = sim_usecs();
+	for (i = 0; i < nthreads; i++) {
+		tid = rt_thread_create("trace", bench_hooks_entry, urb, 4096,
+				10, 10);
+		SIM_CHECK(tid != RT_NULL);
+		rt_thread_startup(tid);
+	}
+	for (i = 0; i < nthreads; i++)
+		SIM_CHECK(rt_sem_take(&bench_finished, 60000) == RT_EOK);
+	usecs = sim_usecs() - start;
+
+	rt_snprintf(name, sizeof(name), "trace hooks per urb, %d thread%s",
+			nthreads, nthreads > 1 ? "s" : "");
+	sim_report(name, (double)usecs * 1000 / bench_rounds / nthreads,
+			"ns");
+}
+
+static void bench_msh(const char *cmd)
+{
+	char buf[32];
+
+	rt_strncpy(buf, cmd, sizeof(buf));
+	SIM_CHECK(msh_exec(buf, rt_strlen(buf)) == 0);
+}
+
+#endif /* CONFIG_USB_TRACE */
+
+int main(int argc, char **argv)
+{
+	int quick = sim_quick(argc, argv);
+	int n = quick ? 50 : 2000;
+	static uint8_t buf[BENCH_LEN];
+	struct usb_interface *intf;
+	struct sim_driver sdrv;
+	struct usb_device *udev;
+	struct sim_device sd;
+	struct usb_hcd *hcd;
+	struct urb *urb;
+
+	hcd = sim_start();
+	sim_driver_register(&sdrv, BENCH_VID, BENCH_PID);
+	sim_device_init(&sd, USB_SPEED_HIGH, BENCH_VID, BENCH_PID, 0xff,
+			bench_eps, 1);
+	SIM_CHECK(dummy_hcd_connect(hcd, 1, &sd.vdev) == 0);
+	intf = sim_wait_probe(&sdrv, 2000);
+	SIM_CHECK(intf != RT_NULL);
+	udev = intf->udev;
+
+	rt_sem_init(&bench_done, "bench", 0, RT_IPC_FLAG_FIFO);
+	urb = usb_alloc_urb(0);
+	SIM_CHECK(urb != RT_NULL);
+	usb_fill_bulk_urb(urb, udev, usb_rcvbulkpipe(udev, 1), buf,
+			BENCH_LEN, bench_complete, RT_NULL);
+
+#ifdef CONFIG_USB_TRACE
+	bench_submit(urb, n, "trace on");
+	bench_msh("usb_trace off");
+	bench_submit(urb, n, "trace off");
+	bench_msh("usb_trace on");
+
+	/* the urb knows its endpoint now */
+	SIM_CHECK(urb->ep == udev->ep_in[1]);
+	bench_rounds = quick ? 10000 : 1000000;
+	rt_sem_init(&bench_finished, "bench", 0, RT_IPC_FLAG_FIFO);
+	bench_hooks(urb, 1);
+	bench_hooks(urb, BENCH_THREADS);
+	rt_sem_detach(&bench_finished);
+	bench_msh("usb_trace clear");
+#else
+	bench_submit(urb, n, "trace compiled out");
+#endif
+
+	usb_free_urb(urb);
+	rt_sem_detach(&bench_done);
+	dummy_hcd_disconnect(hcd, 1);
+	SIM_CHECK(sim_wait_disconnect(&sdrv, 2000) == 0);
+	sim_driver_unregister(&sdrv);
+	sim_device_release(&sd);
+	return 0;
+}
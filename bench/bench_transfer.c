@@ -0,0 +1,136 @@
+/*
+ * bench_transfer.c - throughput and latency of the basic transfer paths
+ *
+ * One high-speed source/sink device on a dummy_hcd: control round trip
+ * latency, blocking bulk IN and OUT throughput, and the same with eight
+ * urbs kept in flight.  Bus time is simulated, so throughput is bounded
+ * by the dummy's frame budget and latency by its 1 ms frame; what these
+ * numbers show is how much of that the stack leaves unused.
+ */
+
+#include "sim.h"
+
+#define BENCH_VID	0x1d6b
+#define BENCH_PID	0x0104
+#define BENCH_URBS	8
+#define BENCH_XFER	16384
+
+static const struct sim_ep bench_eps[] = {
+	{ USB_DIR_IN | 1, USB_EP_ATTR_BULK, 512, 0 },
+	{ 2, USB_EP_ATTR_BULK, 512, 0 },
+};
+
+static struct rt_semaphore bench_done;
+static rt_uint64_t bench_bytes;
+
+static void bench_ctrl(struct usb_device *udev, int n)
+{
+	rt_uint64_t start, usecs;
+	uint8_t status[2];
+	int i;
+
+	start = sim_usecs();
+	for (i = 0; i < n; i++)
+		SIM_CHECK(usb_control_msg(udev, usb_rcvctrlpipe(udev, 0),
+				USB_REQ_GET_STATUS, USB_DIR_IN, 0, 0, status,
+				2, 1000) == 2);
+	usecs = sim_usecs() - start;
+	sim_report("control GET_STATUS latency", (double)usecs / n, "us");
+	sim_report("control transfers", n * 1e6 / usecs, "/s");
+}
+
+static void bench_bulk_sync(struct usb_device *udev, unsigned int pipe,
+		const char *name, int n)
+{
+	rt_uint64_t start, usecs;
+	static uint8_t buf[BENCH_XFER];
+	int i, actual;
+
+	start = sim_usecs();
+	for (i = 0; i < n; i++) {
+		SIM_CHECK(usb_bulk_msg(udev, pipe, buf, sizeof(buf), &actual,
+				1000) == 0);
+		SIM_CHECK(actual == sizeof(buf));
+	}
+	usecs = sim_usecs() - start;
+	sim_report(name, (double)n * sizeof(buf) / usecs, "MB/s");
+}
+
+static void bench_complete(struct urb *urb)
+{
+	if (urb->status)
+		return;
+	bench_bytes += urb->actual_length;
+	rt_sem_release(&bench_done);
+}
+
+static void bench_bulk_async(struct usb_device *udev, unsigned int pipe,
+		const char *name, int n)
+{
+	struct urb *urbs[BENCH_URBS];
+	rt_uint64_t start, usecs;
+	int i;
+
+	rt_sem_init(&bench_done, "bench", 0, RT_IPC_FLAG_FIFO);
+	bench_bytes = 0;
+	for (i = 0; i < BENCH_URBS; i++) {
+		urbs[i] = usb_alloc_urb(0);
+		SIM_CHECK(urbs[i] != RT_NULL);
+		usb_fill_bulk_urb(urbs[i], udev, pipe, malloc(BENCH_XFER),
+				BENCH_XFER, bench_complete, RT_NULL);
+	}
+
+	start = sim_usecs();
+	for (i = 0; i < BENCH_URBS; i++)
+		SIM_CHECK(usb_submit_urb(urbs[i]) == 0);
+	for (i = 0; i < n; i++) {
+		SIM_CHECK(rt_sem_take(&bench_done, 1000) == RT_EOK);
+		/* resubmit in the order they complete */
+		if (i + BENCH_URBS < n)
+			SIM_CHECK(usb_submit_urb(urbs[i % BENCH_URBS]) == 0);
+	}
+	usecs = sim_usecs() - start;
+	sim_report(name, (double)bench_bytes / usecs, "MB/s");
+	sim_report("submit-to-complete, 8 in flight",
+			(double)usecs * BENCH_URBS / n, "us");
+
+	for (i = 0; i < BENCH_URBS; i++) {
+		usb_kill_urb(urbs[i]);
+		free(urbs[i]->transfer_buffer);
+		usb_free_urb(urbs[i]);
+	}
+	rt_sem_detach(&bench_done);
+}
+
+int main(int argc, char **argv)
+{
+	int n = sim_quick(argc, argv) ? 20 : 500;
+	struct sim_driver sdrv;
+	struct sim_device sd;
+	struct usb_interface *intf;
+	struct usb_device *udev;
+	struct usb_hcd *hcd;
+
+	hcd = sim_start();
+	sim_driver_register(&sdrv, BENCH_VID, BENCH_PID);
+	sim_device_init(&sd, USB_SPEED_HIGH, BENCH_VID, BENCH_PID, 0xff,
+			bench_eps, 2);
+	SIM_CHECK(dummy_hcd_connect(hcd, 1, &sd.vdev) == 0);
+	intf = sim_wait_probe(&sdrv, 2000);
+	SIM_CHECK(intf != RT_NULL);
+	udev = intf->udev;
+
+	bench_ctrl(udev, n);
+	bench_bulk_sync(udev, usb_rcvbulkpipe(udev, 1),
+			"bulk IN, usb_bulk_msg", n / 4 + 1);
+	bench_bulk_sync(udev, usb_sndbulkpipe(udev, 2),
+			"bulk OUT, usb_bulk_msg", n / 4 + 1);
+	bench_bulk_async(udev, usb_rcvbulkpipe(udev, 1),
+			"bulk IN, 8 urbs in flight", n);
+
+	dummy_hcd_disconnect(hcd, 1);
+	SIM_CHECK(sim_wait_disconnect(&sdrv, 2000) == 0);
+	sim_driver_unregister(&sdrv);
+	sim_device_release(&sd);
+	return 0;
+}
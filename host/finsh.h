@@ -0,0 +1,37 @@
+#ifndef __FINSH_H__
+#define __FINSH_H__
+
+#include <rtthread.h>
+
+/*
+ * The shell isn't built on the host; commands stay callable from tests
+ * through msh_exec(), which looks them up in the table the exports
+ * fill at start-up.
+ */
+typedef long (*syscall_func)(void);
+
+struct finsh_syscall {
+	struct finsh_syscall *next;
+	const char	*name;
+	const char	*desc;
+	syscall_func	func;
+};
+
+void finsh_syscall_register(struct finsh_syscall *call);
+int msh_exec(char *cmd, rt_size_t length);
+
+#define MSH_FUNCTION_EXPORT_CMD(name, cmd, desc)			\
+	static struct finsh_syscall __fsym_##cmd = {			\
+		RT_NULL, #cmd, #desc, (syscall_func)&name		\
+	};								\
+	static void __attribute__((constructor)) __fsym_reg_##cmd(void) \
+	{								\
+		finsh_syscall_register(&__fsym_##cmd);			\
+	}
+
+#define MSH_CMD_EXPORT(command, desc) \
+	MSH_FUNCTION_EXPORT_CMD(command, command, desc)
+#define MSH_CMD_EXPORT_ALIAS(command, alias, desc) \
+	MSH_FUNCTION_EXPORT_CMD(command, alias, desc)
+
+#endif /* __FINSH_H__ */
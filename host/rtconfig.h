@@ -0,0 +1,16 @@
+#ifndef RT_CONFIG_H__
+#define RT_CONFIG_H__
+
+/*
+ * Kernel configuration of the host build, see host/README.  The stack's
+ * own CONFIG_USB_* options come from CMakeLists.txt.
+ */
+#define RT_NAME_MAX		8
+#define RT_ALIGN_SIZE		8
+#define RT_TICK_PER_SECOND	1000
+#define RT_CPUS_NR		1
+
+#define RT_USING_DEVICE_OPS
+#define RT_USING_FINSH
+
+#endif /* RT_CONFIG_H__ */
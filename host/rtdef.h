@@ -0,0 +1,314 @@
+#ifndef __RT_DEF_H__
+#define __RT_DEF_H__
+
+/*
+ * The RT-Thread types the stack uses, laid over POSIX threads for the
+ * host build.  Names and values follow rtdef.h of RT-Thread 5.x; the
+ * kernel objects carry pthread state in place of the scheduler's.
+ */
+
+#include <rtconfig.h>
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <pthread.h>
+
+typedef int8_t				rt_int8_t;
+typedef int16_t				rt_int16_t;
+typedef int32_t				rt_int32_t;
+typedef int64_t				rt_int64_t;
+typedef uint8_t				rt_uint8_t;
+typedef uint16_t			rt_uint16_t;
+typedef uint32_t			rt_uint32_t;
+typedef uint64_t			rt_uint64_t;
+typedef int				rt_bool_t;
+typedef long				rt_base_t;
+typedef unsigned long			rt_ubase_t;
+typedef rt_base_t			rt_err_t;
+typedef rt_uint32_t			rt_time_t;
+typedef rt_uint32_t			rt_tick_t;
+typedef rt_base_t			rt_flag_t;
+typedef rt_ubase_t			rt_size_t;
+typedef rt_base_t			rt_ssize_t;
+typedef rt_base_t			rt_off_t;
+typedef rt_base_t			rt_atomic_t;
+
+#define RT_TRUE				1
+#define RT_FALSE			0
+#define RT_NULL				0
+
+#define RT_UINT32_MAX			0xffffffff
+#define RT_TICK_MAX			RT_UINT32_MAX
+
+#define rt_inline			static __inline
+#define rt_used				__attribute__((used))
+#define rt_weak				__attribute__((weak))
+#define RT_WEAK				rt_weak
+#define RT_UNUSED(x)			((void)(x))
+
+#define RT_ALIGN(size, align)		(((size) + (align) - 1) & ~((align) - 1))
+#define RT_ALIGN_DOWN(size, align)	((size) & ~((align) - 1))
+
+#define rt_container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - (unsigned long)(&((type *)0)->member)))
+
+/* error codes, returned negated */
+#define RT_EOK				0
+#define RT_ERROR			1
+#define RT_ETIMEOUT			2
+#define RT_EFULL			3
+#define RT_EEMPTY			4
+#define RT_ENOMEM			5
+#define RT_ENOSYS			6
+#define RT_EBUSY			7
+#define RT_EIO				8
+#define RT_EINTR			9
+#define RT_EINVAL			10
+
+#define RT_WAITING_FOREVER		-1
+#define RT_WAITING_NO			0
+
+struct rt_list_node {
+	struct rt_list_node *next;
+	struct rt_list_node *prev;
+};
+typedef struct rt_list_node rt_list_t;
+
+struct rt_slist_node {
+	struct rt_slist_node *next;
+};
+typedef struct rt_slist_node rt_slist_t;
+
+struct rt_object {
+	char		name[RT_NAME_MAX];
+	rt_uint8_t	type;
+	rt_uint8_t	flag;
+	rt_list_t	list;
+};
+typedef struct rt_object *rt_object_t;
+
+/*
+ * threads
+ */
+struct rt_thread {
+	struct rt_object parent;
+	pthread_t	tid;
+	void		(*entry)(void *parameter);
+	void		*parameter;
+	rt_uint8_t	current_priority;
+	rt_uint8_t	stat;
+#define RT_THREAD_INIT			0x00
+#define RT_THREAD_RUNNING		0x03
+#define RT_THREAD_CLOSE			0x04
+	rt_uint8_t	dynamic;	/* created, freed when it exits */
+	rt_err_t	error;
+};
+typedef struct rt_thread *rt_thread_t;
+
+/*
+ * timers; soft timers run on the timer thread, which is the only kind
+ * the host has
+ */
+#define RT_TIMER_FLAG_DEACTIVATED	0x0
+#define RT_TIMER_FLAG_ACTIVATED		0x1
+#define RT_TIMER_FLAG_ONE_SHOT		0x0
+#define RT_TIMER_FLAG_PERIODIC		0x2
+#define RT_TIMER_FLAG_HARD_TIMER	0x0
+#define RT_TIMER_FLAG_SOFT_TIMER	0x4
+
+#define RT_TIMER_CTRL_SET_TIME		0x0
+#define RT_TIMER_CTRL_GET_TIME		0x1
+#define RT_TIMER_CTRL_SET_ONESHOT	0x2
+#define RT_TIMER_CTRL_SET_PERIODIC	0x3
+#define RT_TIMER_CTRL_GET_STATE		0x4
+
+struct rt_timer {
+	struct rt_object parent;
+	rt_list_t	row;		/* on the timer thread's list */
+	void		(*timeout_func)(void *parameter);
+	void		*parameter;
+	rt_tick_t	init_tick;
+	rt_tick_t	timeout_tick;
+};
+typedef struct rt_timer *rt_timer_t;
+
+/*
+ * IPC objects
+ */
+#define RT_IPC_FLAG_FIFO		0x00
+#define RT_IPC_FLAG_PRIO		0x01
+
+#define RT_IPC_CMD_UNKNOWN		0x00
+#define RT_IPC_CMD_RESET		0x01
+
+struct rt_ipc_object {
+	struct rt_object parent;
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	rt_uint32_t	waiters;
+	rt_uint32_t	generation;	/* bumped by detach and reset */
+};
+
+struct rt_semaphore {
+	struct rt_ipc_object parent;
+	rt_uint32_t	value;
+};
+typedef struct rt_semaphore *rt_sem_t;
+
+struct rt_mutex {
+	struct rt_ipc_object parent;
+	rt_thread_t	owner;
+	rt_uint32_t	hold;		/* recursion depth */
+};
+typedef struct rt_mutex *rt_mutex_t;
+
+#define RT_EVENT_FLAG_AND		0x01
+#define RT_EVENT_FLAG_OR		0x02
+#define RT_EVENT_FLAG_CLEAR		0x04
+
+struct rt_event {
+	struct rt_ipc_object parent;
+	rt_uint32_t	set;
+};
+typedef struct rt_event *rt_event_t;
+
+/*
+ * memory
+ */
+struct rt_memheap {
+	struct rt_object parent;
+	void		*start_addr;
+	rt_size_t	pool_size;
+	rt_size_t	available_size;
+	rt_size_t	max_used_size;
+	pthread_mutex_t	lock;
+};
+
+/*
+ * devices
+ */
+enum rt_device_class_type {
+	RT_Device_Class_Char = 0,
+	RT_Device_Class_Block,
+	RT_Device_Class_NetIf,
+	RT_Device_Class_MTD,
+	RT_Device_Class_CAN,
+	RT_Device_Class_RTC,
+	RT_Device_Class_Sound,
+	RT_Device_Class_Graphic,
+	RT_Device_Class_I2CBUS,
+	RT_Device_Class_USBDevice,
+	RT_Device_Class_USBHost,
+	RT_Device_Class_USBOTG,
+	RT_Device_Class_Miscellaneous = 21,
+	RT_Device_Class_Unknown = 30,
+};
+
+#define RT_DEVICE_FLAG_DEACTIVATE	0x000
+#define RT_DEVICE_FLAG_RDONLY		0x001
+#define RT_DEVICE_FLAG_WRONLY		0x002
+#define RT_DEVICE_FLAG_RDWR		0x003
+#define RT_DEVICE_FLAG_REMOVABLE	0x004
+#define RT_DEVICE_FLAG_STANDALONE	0x008
+#define RT_DEVICE_FLAG_ACTIVATED	0x010
+#define RT_DEVICE_FLAG_SUSPENDED	0x020
+#define RT_DEVICE_FLAG_STREAM		0x040
+#define RT_DEVICE_FLAG_INT_RX		0x100
+#define RT_DEVICE_FLAG_DMA_RX		0x200
+#define RT_DEVICE_FLAG_INT_TX		0x400
+#define RT_DEVICE_FLAG_DMA_TX		0x800
+
+#define RT_DEVICE_OFLAG_CLOSE		0x000
+#define RT_DEVICE_OFLAG_RDONLY		0x001
+#define RT_DEVICE_OFLAG_WRONLY		0x002
+#define RT_DEVICE_OFLAG_RDWR		0x003
+#define RT_DEVICE_OFLAG_OPEN		0x008
+#define RT_DEVICE_OFLAG_MASK		0xf0f
+
+#define RT_DEVICE_CTRL_RESUME		0x01
+#define RT_DEVICE_CTRL_SUSPEND		0x02
+#define RT_DEVICE_CTRL_CONFIG		0x03
+#define RT_DEVICE_CTRL_BLK_GETGEOME	0x10
+#define RT_DEVICE_CTRL_BLK_SYNC		0x11
+#define RT_DEVICE_CTRL_BLK_ERASE	0x12
+#define RT_DEVICE_CTRL_BLK_AUTOREFRESH	0x13
+
+typedef struct rt_device *rt_device_t;
+
+#ifdef RT_USING_DEVICE_OPS
+struct rt_device_ops {
+	rt_err_t	(*init)(rt_device_t dev);
+	rt_err_t	(*open)(rt_device_t dev, rt_uint16_t oflag);
+	rt_err_t	(*close)(rt_device_t dev);
+	rt_ssize_t	(*read)(rt_device_t dev, rt_off_t pos, void *buffer,
+				rt_size_t size);
+	rt_ssize_t	(*write)(rt_device_t dev, rt_off_t pos,
+				const void *buffer, rt_size_t size);
+	rt_err_t	(*control)(rt_device_t dev, int cmd, void *args);
+};
+#endif
+
+struct rt_device {
+	struct rt_object parent;
+	enum rt_device_class_type type;
+	rt_uint16_t	flag;
+	rt_uint16_t	open_flag;
+	rt_uint8_t	ref_count;
+	rt_uint8_t	device_id;
+
+	rt_err_t	(*rx_indicate)(rt_device_t dev, rt_size_t size);
+	rt_err_t	(*tx_complete)(rt_device_t dev, void *buffer);
+
+#ifdef RT_USING_DEVICE_OPS
+	const struct rt_device_ops *ops;
+#else
+	rt_err_t	(*init)(rt_device_t dev);
+	rt_err_t	(*open)(rt_device_t dev, rt_uint16_t oflag);
+	rt_err_t	(*close)(rt_device_t dev);
+	rt_ssize_t	(*read)(rt_device_t dev, rt_off_t pos, void *buffer,
+				rt_size_t size);
+	rt_ssize_t	(*write)(rt_device_t dev, rt_off_t pos,
+				const void *buffer, rt_size_t size);
+	rt_err_t	(*control)(rt_device_t dev, int cmd, void *args);
+#endif
+	void		*user_data;
+};
+
+struct rt_device_blk_geometry {
+	rt_uint64_t	sector_count;
+	rt_uint32_t	bytes_per_sector;
+	rt_uint32_t	block_size;
+};
+
+/*
+ * automatic initialization, see rt_components_init()
+ */
+typedef int (*init_fn_t)(void);
+
+struct rt_init_desc {
+	struct rt_init_desc *next;
+	init_fn_t	fn;
+	const char	*fn_name;
+	int		level;
+};
+
+void rt_components_register(struct rt_init_desc *desc);
+
+#define INIT_EXPORT(fn, lv)						\
+	static struct rt_init_desc __rt_init_desc_##fn = {		\
+		RT_NULL, fn, #fn, lv					\
+	};								\
+	static void __attribute__((constructor)) __rt_init_##fn(void)	\
+	{								\
+		rt_components_register(&__rt_init_desc_##fn);		\
+	}
+
+#define INIT_BOARD_EXPORT(fn)		INIT_EXPORT(fn, 1)
+#define INIT_PREV_EXPORT(fn)		INIT_EXPORT(fn, 2)
+#define INIT_DEVICE_EXPORT(fn)		INIT_EXPORT(fn, 3)
+#define INIT_COMPONENT_EXPORT(fn)	INIT_EXPORT(fn, 4)
+#define INIT_ENV_EXPORT(fn)		INIT_EXPORT(fn, 5)
+#define INIT_APP_EXPORT(fn)		INIT_EXPORT(fn, 6)
+
+#endif /* __RT_DEF_H__ */
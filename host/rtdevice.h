@@ -0,0 +1,22 @@
+#ifndef __RT_DEVICE_H__
+#define __RT_DEVICE_H__
+
+#include <rtthread.h>
+
+/*
+ * the completion of components/drivers/ipc; one waiter at a time
+ */
+struct rt_completion {
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	rt_uint32_t	flag;
+#define RT_UNCOMPLETED		0
+#define RT_COMPLETED		1
+};
+
+void rt_completion_init(struct rt_completion *completion);
+rt_err_t rt_completion_wait(struct rt_completion *completion,
+		rt_int32_t timeout);
+void rt_completion_done(struct rt_completion *completion);
+
+#endif /* __RT_DEVICE_H__ */
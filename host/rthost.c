@@ -0,0 +1,1108 @@
+/*
+ * rthost.c - the RT-Thread kernel services the stack uses, on POSIX
+ * threads
+ *
+ * Good enough to run the stack, dummy_hcd and the tests on a development
+ * machine, not a kernel: priorities are ignored, every timer is a soft
+ * timer run by one timer thread, and interrupt-off sections share one
+ * global lock (see rthw.h).  A tick is a millisecond.
+ */
+
+#include <rthw.h>
+#include <rtdevice.h>
+#include <finsh.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+
+static pthread_mutex_t rt_hw_lock;
+static pthread_once_t rt_host_once = PTHREAD_ONCE_INIT;
+static struct timespec rt_host_epoch;
+
+static __thread rt_thread_t rt_current_thread;
+static __thread rt_uint8_t rt_interrupt_nest;
+
+static void rt_host_setup(void)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&rt_hw_lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+	clock_gettime(CLOCK_MONOTONIC, &rt_host_epoch);
+}
+
+rt_inline void rt_host_init(void)
+{
+	pthread_once(&rt_host_once, rt_host_setup);
+}
+
+static void rt_object_name(struct rt_object *object, const char *name)
+{
+	snprintf(object->name, RT_NAME_MAX, "%s", name ? name : "");
+}
+
+static void rt_cond_init(pthread_cond_t *cond)
+{
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+/* absolute CLOCK_MONOTONIC time @ticks from now */
+static void rt_deadline(struct timespec *ts, rt_int32_t ticks)
+{
+	clock_gettime(CLOCK_MONOTONIC, ts);
+	ts->tv_sec += ticks / RT_TICK_PER_SECOND;
+	ts->tv_nsec += (long)(ticks % RT_TICK_PER_SECOND) *
+			(1000000000L / RT_TICK_PER_SECOND);
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+/* waits on @cond until woken or @deadline; 0 or ETIMEDOUT */
+static int rt_cond_wait(pthread_cond_t *cond, pthread_mutex_t *lock,
+		rt_int32_t timeout, const struct timespec *deadline)
+{
+	int ret;
+
+	pthread_cleanup_push((void (*)(void *))pthread_mutex_unlock, lock);
+	if (timeout < 0)
+		ret = pthread_cond_wait(cond, lock);
+	else
+		ret = pthread_cond_timedwait(cond, lock, deadline);
+	pthread_cleanup_pop(0);
+	return ret;
+}
+
+/*-------------------------------------------------------------------------*/
+
+/*
+ * interrupts and scheduler lock
+ */
+
+rt_base_t rt_hw_interrupt_disable(void)
+{
+	rt_host_init();
+	pthread_mutex_lock(&rt_hw_lock);
+	return 0;
+}
+
+void rt_hw_interrupt_enable(rt_base_t level)
+{
+	RT_UNUSED(level);
+	pthread_mutex_unlock(&rt_hw_lock);
+}
+
+void rt_enter_critical(void)
+{
+	rt_hw_interrupt_disable();
+}
+
+void rt_exit_critical(void)
+{
+	rt_hw_interrupt_enable(0);
+}
+
+void rt_interrupt_enter(void)
+{
+	rt_interrupt_nest++;
+}
+
+void rt_interrupt_leave(void)
+{
+	rt_interrupt_nest--;
+}
+
+rt_uint8_t rt_interrupt_get_nest(void)
+{
+	return rt_interrupt_nest;
+}
+
+/*-------------------------------------------------------------------------*/
+
+/*
+ * threads
+ */
+
+static void rt_thread_cleanup(void *parameter)
+{
+	rt_thread_t thread = parameter;
+
+	thread->stat = RT_THREAD_CLOSE;
+	if (thread->dynamic)
+		free(thread);
+}
+
+static void *rt_thread_trampoline(void *parameter)
+{
+	rt_thread_t thread = parameter;
+
+	rt_current_thread = thread;
+	pthread_cleanup_push(rt_thread_cleanup, thread);
+	thread->entry(thread->parameter);
+	pthread_cleanup_pop(1);
+	return RT_NULL;
+}
+
+rt_thread_t rt_thread_create(const char *name,
+		void (*entry)(void *parameter), void *parameter,
+		rt_uint32_t stack_size, rt_uint8_t priority, rt_uint32_t tick)
+{
+	rt_thread_t thread;
+
+	rt_host_init();
+	thread = calloc(1, sizeof(*thread));
+	if (!thread)
+		return RT_NULL;
+	rt_object_name(&thread->parent, name);
+	thread->entry = entry;
+	thread->parameter = parameter;
+	thread->current_priority = priority;
+	thread->stat = RT_THREAD_INIT;
+	thread->dynamic = 1;
+	return thread;
+}
+
+rt_err_t rt_thread_startup(rt_thread_t thread)
+{
+	pthread_attr_t attr;
+	int ret;
+
+	if (thread->stat != RT_THREAD_INIT)
+		return -RT_ERROR;
+	thread->stat = RT_THREAD_RUNNING;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	ret = pthread_create(&thread->tid, &attr, rt_thread_trampoline,
+			thread);
+	pthread_attr_destroy(&attr);
+	if (ret) {
+		thread->stat = RT_THREAD_INIT;
+		return -RT_ERROR;
+	}
+	return RT_EOK;
+}
+
+/*
+ * A running thread is cancelled at its next blocking call, which is
+ * where an RT-Thread thread would be sitting when another one deletes
+ * it.
+ */
+rt_err_t rt_thread_delete(rt_thread_t thread)
+{
+	if (thread->stat == RT_THREAD_INIT) {
+		free(thread);
+		return RT_EOK;
+	}
+	if (thread == rt_current_thread)
+		pthread_exit(RT_NULL);
+	pthread_cancel(thread->tid);
+	return RT_EOK;
+}
+
+rt_thread_t rt_thread_self(void)
+{
+	rt_thread_t thread = rt_current_thread;
+
+	/* main() and other threads the shim didn't start */
+	if (!thread) {
+		thread = calloc(1, sizeof(*thread));
+		if (!thread)
+			abort();
+		rt_object_name(&thread->parent, "main");
+		thread->tid = pthread_self();
+		thread->stat = RT_THREAD_RUNNING;
+		rt_current_thread = thread;
+	}
+	return thread;
+}
+
+rt_err_t rt_thread_yield(void)
+{
+	sched_yield();
+	return RT_EOK;
+}
+
+rt_err_t rt_thread_delay(rt_tick_t tick)
+{
+	struct timespec ts;
+
+	ts.tv_sec = tick / RT_TICK_PER_SECOND;
+	ts.tv_nsec = (long)(tick % RT_TICK_PER_SECOND) *
+			(1000000000L / RT_TICK_PER_SECOND);
+	while (nanosleep(&ts, &ts) && errno == EINTR)
+		;
+	return RT_EOK;
+}
+
+rt_err_t rt_thread_mdelay(rt_int32_t ms)
+{
+	return rt_thread_delay(rt_tick_from_millisecond(ms));
+}
+
+/*-------------------------------------------------------------------------*/
+
+/*
+ * clock and timers
+ */
+
+rt_tick_t rt_tick_get(void)
+{
+	struct timespec now;
+
+	rt_host_init();
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (rt_tick_t)((now.tv_sec - rt_host_epoch.tv_sec) *
+			RT_TICK_PER_SECOND + (now.tv_nsec -
+			rt_host_epoch.tv_nsec) /
+			(1000000000L / RT_TICK_PER_SECOND));
+}
+
+rt_tick_t rt_tick_from_millisecond(rt_int32_t ms)
+{
+	if (ms < 0)
+		return (rt_tick_t)RT_WAITING_FOREVER;
+	return (rt_tick_t)ms * RT_TICK_PER_SECOND / 1000;
+}
+
+static pthread_mutex_t rt_timer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rt_timer_cond;
+static pthread_once_t rt_timer_once = PTHREAD_ONCE_INIT;
+static rt_list_t rt_timer_list = RT_LIST_OBJECT_INIT(rt_timer_list);
+static rt_timer_t rt_timer_running;	/* callback in progress */
+static int rt_timer_running_gone;	/* ... and detached meanwhile */
+
+#define rt_tick_before(a, b)	((rt_int32_t)((a) - (b)) < 0)
+
+/* caller holds rt_timer_lock */
+static void rt_timer_insert(rt_timer_t timer)
+{
+	rt_list_t *pos;
+
+	timer->timeout_tick = rt_tick_get() + timer->init_tick;
+	rt_list_for_each(pos, &rt_timer_list) {
+		if (rt_tick_before(timer->timeout_tick,
+				rt_list_entry(pos, struct rt_timer,
+				row)->timeout_tick))
+			break;
+	}
+	rt_list_insert_before(pos, &timer->row);
+	timer->parent.flag |= RT_TIMER_FLAG_ACTIVATED;
+	pthread_cond_signal(&rt_timer_cond);
+}
+
+static void *rt_timer_thread(void *parameter)
+{
+	struct timespec deadline;
+	rt_timer_t timer;
+	rt_tick_t now;
+
+	RT_UNUSED(parameter);
+	pthread_mutex_lock(&rt_timer_lock);
+	for (;;) {
+		if (rt_list_isempty(&rt_timer_list)) {
+			pthread_cond_wait(&rt_timer_cond, &rt_timer_lock);
+			continue;
+		}
+		timer = rt_list_first_entry(&rt_timer_list, struct rt_timer,
+				row);
+		now = rt_tick_get();
+		if (rt_tick_before(now, timer->timeout_tick)) {
+			rt_deadline(&deadline, timer->timeout_tick - now);
+			pthread_cond_timedwait(&rt_timer_cond, &rt_timer_lock,
+					&deadline);
+			continue;
+		}
+
+		rt_list_remove(&timer->row);
+		if (!(timer->parent.flag & RT_TIMER_FLAG_PERIODIC))
+			timer->parent.flag &= ~RT_TIMER_FLAG_ACTIVATED;
+		rt_timer_running = timer;
+		rt_timer_running_gone = 0;
+		pthread_mutex_unlock(&rt_timer_lock);
+
+		timer->timeout_func(timer->parameter);
+
+		pthread_mutex_lock(&rt_timer_lock);
+		rt_timer_running = RT_NULL;
+		if (rt_timer_running_gone)
+			continue;
+		/* restarted or stopped by the callback otherwise */
+		if ((timer->parent.flag & RT_TIMER_FLAG_PERIODIC) &&
+				(timer->parent.flag & RT_TIMER_FLAG_ACTIVATED) &&
+				rt_list_isempty(&timer->row))
+			rt_timer_insert(timer);
+	}
+	return RT_NULL;
+}
+
+static void rt_timer_setup(void)
+{
+	pthread_t tid;
+
+	rt_cond_init(&rt_timer_cond);
+	if (pthread_create(&tid, RT_NULL, rt_timer_thread, RT_NULL))
+		abort();
+	pthread_detach(tid);
+}
+
+void rt_timer_init(rt_timer_t timer, const char *name,
+		void (*timeout)(void *parameter), void *parameter,
+		rt_tick_t time, rt_uint8_t flag)
+{
+	rt_host_init();
+	pthread_once(&rt_timer_once, rt_timer_setup);
+	rt_object_name(&timer->parent, name);
+	timer->parent.flag = flag & ~RT_TIMER_FLAG_ACTIVATED;
+	timer->timeout_func = timeout;
+	timer->parameter = parameter;
+	timer->init_tick = time;
+	timer->timeout_tick = 0;
+	rt_list_init(&timer->row);
+}
+
+/*
+ * Like the kernel's, stop and detach don't wait for a callback that is
+ * already running.
+ */
+rt_err_t rt_timer_detach(rt_timer_t timer)
+{
+	pthread_mutex_lock(&rt_timer_lock);
+	rt_list_remove(&timer->row);
+	timer->parent.flag &= ~RT_TIMER_FLAG_ACTIVATED;
+	if (timer == rt_timer_running)
+		rt_timer_running_gone = 1;
+	pthread_mutex_unlock(&rt_timer_lock);
+	return RT_EOK;
+}
+
+rt_err_t rt_timer_start(rt_timer_t timer)
+{
+	pthread_mutex_lock(&rt_timer_lock);
+	rt_list_remove(&timer->row);
+	rt_timer_insert(timer);
+	pthread_mutex_unlock(&rt_timer_lock);
+	return RT_EOK;
+}
+
+rt_err_t rt_timer_stop(rt_timer_t timer)
+{
+	rt_err_t ret = RT_EOK;
+
+	pthread_mutex_lock(&rt_timer_lock);
+	if (!(timer->parent.flag & RT_TIMER_FLAG_ACTIVATED))
+		ret = -RT_ERROR;
+	rt_list_remove(&timer->row);
+	timer->parent.flag &= ~RT_TIMER_FLAG_ACTIVATED;
+	pthread_mutex_unlock(&rt_timer_lock);
+	return ret;
+}
+
+rt_err_t rt_timer_control(rt_timer_t timer, int cmd, void *arg)
+{
+	pthread_mutex_lock(&rt_timer_lock);
+	switch (cmd) {
+	case RT_TIMER_CTRL_SET_TIME:
+		timer->init_tick = *(rt_tick_t *)arg;
+		break;
+	case RT_TIMER_CTRL_GET_TIME:
+		*(rt_tick_t *)arg = timer->init_tick;
+		break;
+	case RT_TIMER_CTRL_SET_ONESHOT:
+		timer->parent.flag &= ~RT_TIMER_FLAG_PERIODIC;
+		break;
+	case RT_TIMER_CTRL_SET_PERIODIC:
+		timer->parent.flag |= RT_TIMER_FLAG_PERIODIC;
+		break;
+	case RT_TIMER_CTRL_GET_STATE:
+		*(rt_uint32_t *)arg = timer->parent.flag &
+				RT_TIMER_FLAG_ACTIVATED;
+		break;
+	}
+	pthread_mutex_unlock(&rt_timer_lock);
+	return RT_EOK;
+}
+
+/*-------------------------------------------------------------------------*/
+
+/*
+ * IPC
+ */
+
+static void rt_ipc_init(struct rt_ipc_object *ipc, const char *name)
+{
+	rt_host_init();
+	rt_object_name(&ipc->parent, name);
+	pthread_mutex_init(&ipc->lock, RT_NULL);
+	rt_cond_init(&ipc->cond);
+	ipc->waiters = 0;
+	ipc->generation = 0;
+}
+
+/*
+ * Waiters that detach or a reset wakes fail with -RT_ERROR, the object
+ * may go away under them; like the kernel, the shim doesn't destroy
+ * anything a woken waiter still has to touch.
+ */
+static void rt_ipc_wake_all(struct rt_ipc_object *ipc)
+{
+	ipc->generation++;
+	pthread_cond_broadcast(&ipc->cond);
+}
+
+/* caller holds ipc->lock; 0, -RT_ETIMEOUT or -RT_ERROR */
+static rt_err_t rt_ipc_wait(struct rt_ipc_object *ipc, rt_int32_t timeout,
+		const struct timespec *deadline)
+{
+	rt_uint32_t generation = ipc->generation;
+	int ret;
+
+	if (timeout == 0)
+		return -RT_ETIMEOUT;
+	ipc->waiters++;
+	ret = rt_cond_wait(&ipc->cond, &ipc->lock, timeout, deadline);
+	ipc->waiters--;
+	if (ipc->generation != generation)
+		return -RT_ERROR;
+	return ret == ETIMEDOUT ? -RT_ETIMEOUT : RT_EOK;
+}
+
+rt_err_t rt_sem_init(rt_sem_t sem, const char *name, rt_uint32_t value,
+		rt_uint8_t flag)
+{
+	rt_ipc_init(&sem->parent, name);
+	sem->parent.parent.flag = flag;
+	sem->value = value;
+	return RT_EOK;
+}
+
+rt_err_t rt_sem_detach(rt_sem_t sem)
+{
+	pthread_mutex_lock(&sem->parent.lock);
+	rt_ipc_wake_all(&sem->parent);
+	pthread_mutex_unlock(&sem->parent.lock);
+	return RT_EOK;
+}
+
+rt_err_t rt_sem_take(rt_sem_t sem, rt_int32_t timeout)
+{
+	struct timespec deadline;
+	rt_err_t err = RT_EOK;
+
+	if (timeout > 0)
+		rt_deadline(&deadline, timeout);
+	pthread_mutex_lock(&sem->parent.lock);
+	while (!sem->value) {
+		err = rt_ipc_wait(&sem->parent, timeout, &deadline);
+		if (err)
+			break;
+	}
+	if (!err)
+		sem->value--;
+	pthread_mutex_unlock(&sem->parent.lock);
+	return err;
+}
+
+rt_err_t rt_sem_trytake(rt_sem_t sem)
+{
+	return rt_sem_take(sem, RT_WAITING_NO);
+}
+
+rt_err_t rt_sem_release(rt_sem_t sem)
+{
+	pthread_mutex_lock(&sem->parent.lock);
+	if (sem->value == 0xffff) {
+		pthread_mutex_unlock(&sem->parent.lock);
+		return -RT_EFULL;
+	}
+	sem->value++;
+	pthread_cond_signal(&sem->parent.cond);
+	pthread_mutex_unlock(&sem->parent.lock);
+	return RT_EOK;
+}
+
+rt_err_t rt_sem_control(rt_sem_t sem, int cmd, void *arg)
+{
+	if (cmd != RT_IPC_CMD_RESET)
+		return -RT_ERROR;
+	pthread_mutex_lock(&sem->parent.lock);
+	rt_ipc_wake_all(&sem->parent);
+	sem->value = (rt_uint32_t)(rt_ubase_t)arg;
+	pthread_mutex_unlock(&sem->parent.lock);
+	return RT_EOK;
+}
+
+rt_err_t rt_mutex_init(rt_mutex_t mutex, const char *name, rt_uint8_t flag)
+{
+	rt_ipc_init(&mutex->parent, name);
+	mutex->parent.parent.flag = flag;
+	mutex->owner = RT_NULL;
+	mutex->hold = 0;
+	return RT_EOK;
+}
+
+rt_err_t rt_mutex_detach(rt_mutex_t mutex)
+{
+	pthread_mutex_lock(&mutex->parent.lock);
+	rt_ipc_wake_all(&mutex->parent);
+	pthread_mutex_unlock(&mutex->parent.lock);
+	return RT_EOK;
+}
+
+rt_mutex_t rt_mutex_create(const char *name, rt_uint8_t flag)
+{
+	rt_mutex_t mutex;
+
+	mutex = malloc(sizeof(*mutex));
+	if (mutex)
+		rt_mutex_init(mutex, name, flag);
+	return mutex;
+}
+
+rt_err_t rt_mutex_delete(rt_mutex_t mutex)
+{
+	rt_mutex_detach(mutex);
+	free(mutex);
+	return RT_EOK;
+}
+
+rt_err_t rt_mutex_take(rt_mutex_t mutex, rt_int32_t timeout)
+{
+	rt_thread_t self = rt_thread_self();
+	struct timespec deadline;
+	rt_err_t err = RT_EOK;
+
+	if (timeout > 0)
+		rt_deadline(&deadline, timeout);
+	pthread_mutex_lock(&mutex->parent.lock);
+	if (mutex->owner == self) {
+		mutex->hold++;
+	} else {
+		while (mutex->owner) {
+			err = rt_ipc_wait(&mutex->parent, timeout, &deadline);
+			if (err)
+				break;
+		}
+		if (!err) {
+			mutex->owner = self;
+			mutex->hold = 1;
+		}
+	}
+	pthread_mutex_unlock(&mutex->parent.lock);
+	return err;
+}
+
+rt_err_t rt_mutex_trytake(rt_mutex_t mutex)
+{
+	return rt_mutex_take(mutex, RT_WAITING_NO);
+}
+
+rt_err_t rt_mutex_release(rt_mutex_t mutex)
+{
+	rt_err_t err = RT_EOK;
+
+	pthread_mutex_lock(&mutex->parent.lock);
+	if (mutex->owner != rt_thread_self()) {
+		err = -RT_ERROR;
+	} else if (--mutex->hold == 0) {
+		mutex->owner = RT_NULL;
+		pthread_cond_signal(&mutex->parent.cond);
+	}
+	pthread_mutex_unlock(&mutex->parent.lock);
+	return err;
+}
+
+rt_err_t rt_event_init(rt_event_t event, const char *name, rt_uint8_t flag)
+{
+	rt_ipc_init(&event->parent, name);
+	event->parent.parent.flag = flag;
+	event->set = 0;
+	return RT_EOK;
+}
+
+rt_err_t rt_event_detach(rt_event_t event)
+{
+	pthread_mutex_lock(&event->parent.lock);
+	rt_ipc_wake_all(&event->parent);
+	pthread_mutex_unlock(&event->parent.lock);
+	return RT_EOK;
+}
+
+rt_err_t rt_event_send(rt_event_t event, rt_uint32_t set)
+{
+	pthread_mutex_lock(&event->parent.lock);
+	event->set |= set;
+	pthread_cond_broadcast(&event->parent.cond);
+	pthread_mutex_unlock(&event->parent.lock);
+	return RT_EOK;
+}
+
+rt_inline int rt_event_match(rt_event_t event, rt_uint32_t set,
+		rt_uint8_t opt)
+{
+	if (opt & RT_EVENT_FLAG_AND)
+		return (event->set & set) == set;
+	return (event->set & set) != 0;
+}
+
+rt_err_t rt_event_recv(rt_event_t event, rt_uint32_t set, rt_uint8_t opt,
+		rt_int32_t timeout, rt_uint32_t *recved)
+{
+	struct timespec deadline;
+	rt_err_t err = RT_EOK;
+
+	if (timeout > 0)
+		rt_deadline(&deadline, timeout);
+	pthread_mutex_lock(&event->parent.lock);
+	while (!rt_event_match(event, set, opt)) {
+		err = rt_ipc_wait(&event->parent, timeout, &deadline);
+		if (err)
+			break;
+	}
+	if (!err) {
+		if (recved)
+			*recved = event->set & set;
+		if (opt & RT_EVENT_FLAG_CLEAR)
+			event->set &= ~set;
+	}
+	pthread_mutex_unlock(&event->parent.lock);
+	return err;
+}
+
+void rt_completion_init(struct rt_completion *completion)
+{
+	rt_host_init();
+	pthread_mutex_init(&completion->lock, RT_NULL);
+	rt_cond_init(&completion->cond);
+	completion->flag = RT_UNCOMPLETED;
+}
+
+rt_err_t rt_completion_wait(struct rt_completion *completion,
+		rt_int32_t timeout)
+{
+	struct timespec deadline;
+	rt_err_t err = RT_EOK;
+	int ret;
+
+	if (timeout > 0)
+		rt_deadline(&deadline, timeout);
+	pthread_mutex_lock(&completion->lock);
+	while (completion->flag != RT_COMPLETED) {
+		if (timeout == 0) {
+			err = -RT_ETIMEOUT;
+			break;
+		}
+		ret = rt_cond_wait(&completion->cond, &completion->lock,
+				timeout, &deadline);
+		if (ret == ETIMEDOUT && completion->flag != RT_COMPLETED) {
+			err = -RT_ETIMEOUT;
+			break;
+		}
+	}
+	if (!err)
+		completion->flag = RT_UNCOMPLETED;
+	pthread_mutex_unlock(&completion->lock);
+	return err;
+}
+
+void rt_completion_done(struct rt_completion *completion)
+{
+	pthread_mutex_lock(&completion->lock);
+	completion->flag = RT_COMPLETED;
+	pthread_cond_broadcast(&completion->cond);
+	pthread_mutex_unlock(&completion->lock);
+}
+
+/*-------------------------------------------------------------------------*/
+
+/*
+ * memory
+ */
+
+/* like the kernel's RT_USING_HOOK hooks, called for every block */
+static void (*rt_malloc_hook)(void *ptr, rt_size_t size);
+static void (*rt_free_hook)(void *ptr);
+
+void rt_malloc_sethook(void (*hook)(void *ptr, rt_size_t size))
+{
+	rt_malloc_hook = hook;
+}
+
+void rt_free_sethook(void (*hook)(void *ptr))
+{
+	rt_free_hook = hook;
+}
+
+void *rt_malloc(rt_size_t size)
+{
+	void *ptr = malloc(size);
+
+	if (rt_malloc_hook)
+		rt_malloc_hook(ptr, size);
+	return ptr;
+}
+
+void *rt_calloc(rt_size_t count, rt_size_t size)
+{
+	void *ptr = calloc(count, size);
+
+	if (rt_malloc_hook)
+		rt_malloc_hook(ptr, count * size);
+	return ptr;
+}
+
+void *rt_realloc(void *ptr, rt_size_t newsize)
+{
+	void *nptr = realloc(ptr, newsize);
+
+	if (rt_malloc_hook && nptr != ptr)
+		rt_malloc_hook(nptr, newsize);
+	return nptr;
+}
+
+void rt_free(void *ptr)
+{
+	if (rt_free_hook && ptr)
+		rt_free_hook(ptr);
+	free(ptr);
+}
+
+void *rt_malloc_align(rt_size_t size, rt_size_t align)
+{
+	void *ptr;
+
+	if (align < sizeof(void *))
+		align = sizeof(void *);
+	if (posix_memalign(&ptr, align, RT_ALIGN(size, align)))
+		ptr = RT_NULL;
+	if (rt_malloc_hook)
+		rt_malloc_hook(ptr, size);
+	return ptr;
+}
+
+void rt_free_align(void *ptr)
+{
+	if (rt_free_hook && ptr)
+		rt_free_hook(ptr);
+	free(ptr);
+}
+
+/*
+ * A memheap only keeps the books here: blocks come from malloc(), the
+ * heap's size is what limits them.
+ */
+struct rt_memheap_item {
+	struct rt_memheap *heap;
+	rt_size_t	size;
+	rt_uint64_t	pad;		/* keeps the block 16 aligned */
+};
+
+rt_err_t rt_memheap_init(struct rt_memheap *memheap, const char *name,
+		void *start_addr, rt_size_t size)
+{
+	rt_object_name(&memheap->parent, name);
+	memheap->start_addr = start_addr;
+	memheap->pool_size = size;
+	memheap->available_size = size;
+	memheap->max_used_size = 0;
+	pthread_mutex_init(&memheap->lock, RT_NULL);
+	return RT_EOK;
+}
+
+rt_err_t rt_memheap_detach(struct rt_memheap *heap)
+{
+	RT_UNUSED(heap);
+	return RT_EOK;
+}
+
+void *rt_memheap_alloc(struct rt_memheap *heap, rt_size_t size)
+{
+	struct rt_memheap_item *item;
+	rt_size_t used;
+
+	size = RT_ALIGN(size, RT_ALIGN_SIZE) + sizeof(*item);
+	pthread_mutex_lock(&heap->lock);
+	if (size > heap->available_size) {
+		pthread_mutex_unlock(&heap->lock);
+		return RT_NULL;
+	}
+	heap->available_size -= size;
+	used = heap->pool_size - heap->available_size;
+	if (used > heap->max_used_size)
+		heap->max_used_size = used;
+	pthread_mutex_unlock(&heap->lock);
+
+	item = malloc(size);
+	if (!item) {
+		pthread_mutex_lock(&heap->lock);
+		heap->available_size += size;
+		pthread_mutex_unlock(&heap->lock);
+		return RT_NULL;
+	}
+	item->heap = heap;
+	item->size = size;
+	return item + 1;
+}
+
+void rt_memheap_free(void *ptr)
+{
+	struct rt_memheap_item *item;
+	struct rt_memheap *heap;
+
+	if (!ptr)
+		return;
+	item = (struct rt_memheap_item *)ptr - 1;
+	heap = item->heap;
+	pthread_mutex_lock(&heap->lock);
+	heap->available_size += item->size;
+	pthread_mutex_unlock(&heap->lock);
+	free(item);
+}
+
+/*-------------------------------------------------------------------------*/
+
+/*
+ * devices
+ */
+
+static pthread_mutex_t rt_device_lock = PTHREAD_MUTEX_INITIALIZER;
+static rt_list_t rt_device_list = RT_LIST_OBJECT_INIT(rt_device_list);
+
+#ifdef RT_USING_DEVICE_OPS
+#define device_op(dev, op)	((dev)->ops ? (dev)->ops->op : RT_NULL)
+#else
+#define device_op(dev, op)	((dev)->op)
+#endif
+
+static rt_device_t rt_device_lookup(const char *name)
+{
+	rt_device_t dev;
+
+	rt_list_for_each_entry(dev, &rt_device_list, parent.list) {
+		if (!rt_strncmp(dev->parent.name, name, RT_NAME_MAX))
+			return dev;
+	}
+	return RT_NULL;
+}
+
+rt_err_t rt_device_register(rt_device_t dev, const char *name,
+		rt_uint16_t flags)
+{
+	rt_err_t err = RT_EOK;
+
+	pthread_mutex_lock(&rt_device_lock);
+	if (rt_device_lookup(name)) {
+		err = -RT_ERROR;
+	} else {
+		rt_object_name(&dev->parent, name);
+		dev->flag = flags;
+		dev->ref_count = 0;
+		dev->open_flag = 0;
+		rt_list_insert_before(&rt_device_list, &dev->parent.list);
+	}
+	pthread_mutex_unlock(&rt_device_lock);
+	return err;
+}
+
+rt_err_t rt_device_unregister(rt_device_t dev)
+{
+	pthread_mutex_lock(&rt_device_lock);
+	rt_list_remove(&dev->parent.list);
+	pthread_mutex_unlock(&rt_device_lock);
+	return RT_EOK;
+}
+
+rt_device_t rt_device_find(const char *name)
+{
+	rt_device_t dev;
+
+	pthread_mutex_lock(&rt_device_lock);
+	dev = rt_device_lookup(name);
+	pthread_mutex_unlock(&rt_device_lock);
+	return dev;
+}
+
+rt_err_t rt_device_open(rt_device_t dev, rt_uint16_t oflag)
+{
+	rt_err_t err = RT_EOK;
+
+	if (!(dev->flag & RT_DEVICE_FLAG_ACTIVATED)) {
+		if (device_op(dev, init))
+			err = device_op(dev, init)(dev);
+		if (err)
+			return err;
+		dev->flag |= RT_DEVICE_FLAG_ACTIVATED;
+	}
+	if ((dev->flag & RT_DEVICE_FLAG_STANDALONE) &&
+			(dev->open_flag & RT_DEVICE_OFLAG_OPEN))
+		return -RT_EBUSY;
+	if (device_op(dev, open))
+		err = device_op(dev, open)(dev, oflag);
+	else
+		dev->open_flag = oflag & RT_DEVICE_OFLAG_MASK;
+	if (err == RT_EOK || err == -RT_ENOSYS) {
+		dev->open_flag |= RT_DEVICE_OFLAG_OPEN;
+		dev->ref_count++;
+		err = RT_EOK;
+	}
+	return err;
+}
+
+rt_err_t rt_device_close(rt_device_t dev)
+{
+	rt_err_t err = RT_EOK;
+
+	if (dev->ref_count == 0)
+		return -RT_ERROR;
+	if (--dev->ref_count != 0)
+		return RT_EOK;
+	if (device_op(dev, close))
+		err = device_op(dev, close)(dev);
+	if (err == RT_EOK || err == -RT_ENOSYS)
+		dev->open_flag = RT_DEVICE_OFLAG_CLOSE;
+	return err;
+}
+
+rt_ssize_t rt_device_read(rt_device_t dev, rt_off_t pos, void *buffer,
+		rt_size_t size)
+{
+	if (dev->ref_count == 0 || !device_op(dev, read))
+		return 0;
+	return device_op(dev, read)(dev, pos, buffer, size);
+}
+
+rt_ssize_t rt_device_write(rt_device_t dev, rt_off_t pos,
+		const void *buffer, rt_size_t size)
+{
+	if (dev->ref_count == 0 || !device_op(dev, write))
+		return 0;
+	return device_op(dev, write)(dev, pos, buffer, size);
+}
+
+rt_err_t rt_device_control(rt_device_t dev, int cmd, void *arg)
+{
+	if (!device_op(dev, control))
+		return -RT_ENOSYS;
+	return device_op(dev, control)(dev, cmd, arg);
+}
+
+/*-------------------------------------------------------------------------*/
+
+/*
+ * start-up, shell and console
+ */
+
+static struct rt_init_desc *rt_init_list;
+
+void rt_components_register(struct rt_init_desc *desc)
+{
+	struct rt_init_desc **pos = &rt_init_list;
+
+	/* by level, in link order within one */
+	while (*pos && (*pos)->level <= desc->level)
+		pos = &(*pos)->next;
+	desc->next = *pos;
+	*pos = desc;
+}
+
+/* runs the INIT_*_EXPORT() functions, once */
+void rt_components_init(void)
+{
+	static int done;
+	struct rt_init_desc *desc;
+
+	rt_host_init();
+	if (done)
+		return;
+	done = 1;
+	for (desc = rt_init_list; desc; desc = desc->next)
+		desc->fn();
+}
+
+static struct finsh_syscall *finsh_syscall_list;
+
+void finsh_syscall_register(struct finsh_syscall *call)
+{
+	call->next = finsh_syscall_list;
+	finsh_syscall_list = call;
+}
+
+#define FINSH_ARG_MAX	8
+
+int msh_exec(char *cmd, rt_size_t length)
+{
+	char *argv[FINSH_ARG_MAX];
+	struct finsh_syscall *call;
+	rt_size_t i = 0;
+	int argc = 0;
+
+	while (i < length && cmd[i] && argc < FINSH_ARG_MAX) {
+		while (i < length && cmd[i] == ' ')
+			cmd[i++] = '\0';
+		if (i >= length || !cmd[i])
+			break;
+		argv[argc++] = &cmd[i];
+		while (i < length && cmd[i] && cmd[i] != ' ')
+			i++;
+	}
+	if (i < length)
+		cmd[i] = '\0';
+	if (!argc)
+		return -RT_ERROR;
+	for (call = finsh_syscall_list; call; call = call->next) {
+		if (!rt_strcmp(call->name, argv[0]))
+			return ((int (*)(int, char **))call->func)(argc, argv);
+	}
+	return -RT_ERROR;
+}
+
+/* a function, not strncpy(): names are cut to RT_NAME_MAX on purpose */
+char *rt_strncpy(char *dst, const char *src, rt_size_t n)
+{
+	return strncpy(dst, src, n);
+}
+
+int rt_vsnprintf(char *buf, rt_size_t size, const char *fmt, va_list args)
+{
+	return vsnprintf(buf, size, fmt, args);
+}
+
+int rt_snprintf(char *buf, rt_size_t size, const char *fmt, ...)
+{
+	va_list args;
+	int n;
+
+	va_start(args, fmt);
+	n = vsnprintf(buf, size, fmt, args);
+	va_end(args);
+	return n;
+}
+
+int rt_kprintf(const char *fmt, ...)
+{
+	va_list args;
+	int n;
+
+	va_start(args, fmt);
+	n = vprintf(fmt, args);
+	va_end(args);
+	fflush(stdout);
+	return n;
+}
+
+void rt_assert_handler(const char *ex, const char *func, rt_size_t line)
+{
+	fprintf(stderr, "(%s) assertion failed at function:%s, line number:%lu\n",
+			ex, func, (unsigned long)line);
+	abort();
+}
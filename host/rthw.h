@@ -0,0 +1,22 @@
+#ifndef __RT_HW_H__
+#define __RT_HW_H__
+
+#include <rtthread.h>
+
+/*
+ * The host has no interrupts: "disabling" them takes one global
+ * recursive lock, which every other rt_hw_interrupt_disable() and the
+ * scheduler lock (rt_enter_critical()) share.  That keeps the sections
+ * the stack protects this way atomic against each other, as on a single
+ * core, and lets a test play interrupt handler between
+ * rt_interrupt_enter() and rt_interrupt_leave().
+ */
+rt_base_t rt_hw_interrupt_disable(void);
+void rt_hw_interrupt_enable(rt_base_t level);
+
+#define rt_hw_cpu_id()		0
+#define rt_hw_dmb()		__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define rt_hw_dsb()		__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define rt_hw_isb()		__atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#endif /* __RT_HW_H__ */
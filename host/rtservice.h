@@ -0,0 +1,85 @@
+#ifndef __RT_SERVICE_H__
+#define __RT_SERVICE_H__
+
+/* the intrusive lists of rtservice.h */
+
+#define RT_LIST_OBJECT_INIT(object) { &(object), &(object) }
+
+rt_inline void rt_list_init(rt_list_t *l)
+{
+	l->next = l->prev = l;
+}
+
+rt_inline void rt_list_insert_after(rt_list_t *l, rt_list_t *n)
+{
+	l->next->prev = n;
+	n->next = l->next;
+	l->next = n;
+	n->prev = l;
+}
+
+rt_inline void rt_list_insert_before(rt_list_t *l, rt_list_t *n)
+{
+	l->prev->next = n;
+	n->prev = l->prev;
+	l->prev = n;
+	n->next = l;
+}
+
+rt_inline void rt_list_remove(rt_list_t *n)
+{
+	n->next->prev = n->prev;
+	n->prev->next = n->next;
+	n->next = n->prev = n;
+}
+
+rt_inline int rt_list_isempty(const rt_list_t *l)
+{
+	return l->next == l;
+}
+
+rt_inline unsigned int rt_list_len(const rt_list_t *l)
+{
+	unsigned int len = 0;
+	const rt_list_t *p = l;
+
+	while (p->next != l) {
+		p = p->next;
+		len++;
+	}
+	return len;
+}
+
+#define rt_list_entry(node, type, member) \
+	rt_container_of(node, type, member)
+
+#define rt_list_for_each(pos, head) \
+	for (pos = (head)->next; pos != (head); pos = pos->next)
+
+#define rt_list_for_each_safe(pos, n, head) \
+	for (pos = (head)->next, n = pos->next; pos != (head); \
+		pos = n, n = pos->next)
+
+#define rt_list_for_each_entry(pos, head, member) \
+	for (pos = rt_list_entry((head)->next, __typeof__(*pos), member); \
+		&pos->member != (head); \
+		pos = rt_list_entry(pos->member.next, __typeof__(*pos), member))
+
+#define rt_list_for_each_entry_safe(pos, n, head, member) \
+	for (pos = rt_list_entry((head)->next, __typeof__(*pos), member), \
+		n = rt_list_entry(pos->member.next, __typeof__(*pos), member); \
+		&pos->member != (head); \
+		pos = n, n = rt_list_entry(n->member.next, __typeof__(*n), member))
+
+#define rt_list_first_entry(ptr, type, member) \
+	rt_list_entry((ptr)->next, type, member)
+
+rt_inline void rt_slist_init(rt_slist_t *l)
+{
+	l->next = RT_NULL;
+}
+
+#define rt_slist_entry(node, type, member) \
+	rt_container_of(node, type, member)
+
+#endif /* __RT_SERVICE_H__ */
@@ -0,0 +1,146 @@
+#ifndef __RT_THREAD_H__
+#define __RT_THREAD_H__
+
+/*
+ * Host build of the RT-Thread kernel API subset the stack uses, see
+ * host/README.  Implemented in rthost.c.
+ */
+
+#include <rtdef.h>
+#include <rtservice.h>
+
+#include <string.h>
+
+void rt_components_init(void);
+
+/*
+ * threads
+ */
+rt_thread_t rt_thread_create(const char *name,
+		void (*entry)(void *parameter), void *parameter,
+		rt_uint32_t stack_size, rt_uint8_t priority, rt_uint32_t tick);
+rt_err_t rt_thread_delete(rt_thread_t thread);
+rt_err_t rt_thread_startup(rt_thread_t thread);
+rt_thread_t rt_thread_self(void);
+rt_err_t rt_thread_yield(void);
+rt_err_t rt_thread_delay(rt_tick_t tick);
+rt_err_t rt_thread_mdelay(rt_int32_t ms);
+
+void rt_enter_critical(void);
+void rt_exit_critical(void);
+
+void rt_interrupt_enter(void);
+void rt_interrupt_leave(void);
+rt_uint8_t rt_interrupt_get_nest(void);
+
+/*
+ * clock and timers
+ */
+rt_tick_t rt_tick_get(void);
+rt_tick_t rt_tick_from_millisecond(rt_int32_t ms);
+
+void rt_timer_init(rt_timer_t timer, const char *name,
+		void (*timeout)(void *parameter), void *parameter,
+		rt_tick_t time, rt_uint8_t flag);
+rt_err_t rt_timer_detach(rt_timer_t timer);
+rt_err_t rt_timer_start(rt_timer_t timer);
+rt_err_t rt_timer_stop(rt_timer_t timer);
+rt_err_t rt_timer_control(rt_timer_t timer, int cmd, void *arg);
+
+/*
+ * IPC
+ */
+rt_err_t rt_sem_init(rt_sem_t sem, const char *name, rt_uint32_t value,
+		rt_uint8_t flag);
+rt_err_t rt_sem_detach(rt_sem_t sem);
+rt_err_t rt_sem_take(rt_sem_t sem, rt_int32_t timeout);
+rt_err_t rt_sem_trytake(rt_sem_t sem);
+rt_err_t rt_sem_release(rt_sem_t sem);
+rt_err_t rt_sem_control(rt_sem_t sem, int cmd, void *arg);
+
+rt_err_t rt_mutex_init(rt_mutex_t mutex, const char *name, rt_uint8_t flag);
+rt_err_t rt_mutex_detach(rt_mutex_t mutex);
+rt_mutex_t rt_mutex_create(const char *name, rt_uint8_t flag);
+rt_err_t rt_mutex_delete(rt_mutex_t mutex);
+rt_err_t rt_mutex_take(rt_mutex_t mutex, rt_int32_t timeout);
+rt_err_t rt_mutex_trytake(rt_mutex_t mutex);
+rt_err_t rt_mutex_release(rt_mutex_t mutex);
+
+rt_err_t rt_event_init(rt_event_t event, const char *name, rt_uint8_t flag);
+rt_err_t rt_event_detach(rt_event_t event);
+rt_err_t rt_event_send(rt_event_t event, rt_uint32_t set);
+rt_err_t rt_event_recv(rt_event_t event, rt_uint32_t set, rt_uint8_t opt,
+		rt_int32_t timeout, rt_uint32_t *recved);
+
+/*
+ * memory
+ */
+void *rt_malloc(rt_size_t size);
+void *rt_calloc(rt_size_t count, rt_size_t size);
+void *rt_realloc(void *ptr, rt_size_t newsize);
+void rt_free(void *ptr);
+void *rt_malloc_align(rt_size_t size, rt_size_t align);
+void rt_free_align(void *ptr);
+void rt_malloc_sethook(void (*hook)(void *ptr, rt_size_t size));
+void rt_free_sethook(void (*hook)(void *ptr));
+
+rt_err_t rt_memheap_init(struct rt_memheap *memheap, const char *name,
+		void *start_addr, rt_size_t size);
+rt_err_t rt_memheap_detach(struct rt_memheap *heap);
+void *rt_memheap_alloc(struct rt_memheap *heap, rt_size_t size);
+void rt_memheap_free(void *ptr);
+
+/*
+ * devices
+ */
+rt_err_t rt_device_register(rt_device_t dev, const char *name,
+		rt_uint16_t flags);
+rt_err_t rt_device_unregister(rt_device_t dev);
+rt_device_t rt_device_find(const char *name);
+rt_err_t rt_device_open(rt_device_t dev, rt_uint16_t oflag);
+rt_err_t rt_device_close(rt_device_t dev);
+rt_ssize_t rt_device_read(rt_device_t dev, rt_off_t pos, void *buffer,
+		rt_size_t size);
+rt_ssize_t rt_device_write(rt_device_t dev, rt_off_t pos,
+		const void *buffer, rt_size_t size);
+rt_err_t rt_device_control(rt_device_t dev, int cmd, void *arg);
+
+/*
+ * kernel services
+ */
+int rt_kprintf(const char *fmt, ...);
+int rt_snprintf(char *buf, rt_size_t size, const char *fmt, ...);
+int rt_vsnprintf(char *buf, rt_size_t size, const char *fmt, va_list args);
+char *rt_strncpy(char *dst, const char *src, rt_size_t n);
+
+#define rt_memset(s, c, n)		memset(s, c, n)
+#define rt_memcpy(d, s, n)		memcpy(d, s, n)
+#define rt_memmove(d, s, n)		memmove(d, s, n)
+#define rt_memcmp(a, b, n)		memcmp(a, b, n)
+#define rt_strlen(s)			strlen(s)
+#define rt_strcmp(a, b)			strcmp(a, b)
+#define rt_strncmp(a, b, n)		strncmp(a, b, n)
+
+#define RT_ASSERT(EX)							\
+	do {								\
+		if (!(EX))						\
+			rt_assert_handler(#EX, __func__, __LINE__);	\
+	} while (0)
+void rt_assert_handler(const char *ex, const char *func, rt_size_t line);
+
+/*
+ * atomics, the rtatomic.h interface; add and sub return the old value
+ */
+#define rt_atomic_load(ptr)		__atomic_load_n(ptr, __ATOMIC_SEQ_CST)
+#define rt_atomic_store(ptr, v)		__atomic_store_n(ptr, v, __ATOMIC_SEQ_CST)
+#define rt_atomic_add(ptr, v)		__atomic_fetch_add(ptr, v, __ATOMIC_SEQ_CST)
+#define rt_atomic_sub(ptr, v)		__atomic_fetch_sub(ptr, v, __ATOMIC_SEQ_CST)
+#define rt_atomic_and(ptr, v)		__atomic_fetch_and(ptr, v, __ATOMIC_SEQ_CST)
+#define rt_atomic_or(ptr, v)		__atomic_fetch_or(ptr, v, __ATOMIC_SEQ_CST)
+#define rt_atomic_xor(ptr, v)		__atomic_fetch_xor(ptr, v, __ATOMIC_SEQ_CST)
+#define rt_atomic_exchange(ptr, v)	__atomic_exchange_n(ptr, v, __ATOMIC_SEQ_CST)
+#define rt_atomic_compare_exchange_strong(ptr, old, new) \
+	__atomic_compare_exchange_n(ptr, old, new, 0, __ATOMIC_SEQ_CST, \
+			__ATOMIC_SEQ_CST)
+
+#endif /* __RT_THREAD_H__ */
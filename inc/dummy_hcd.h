@@ -0,0 +1,104 @@
+#ifndef __USB_DUMMY_HCD_H__
+#define __USB_DUMMY_HCD_H__
+
+#include "hcd.h"
+
+/*
+ * Software host controller, see dummy_hcd.c.
+ *
+ * Virtual devices are plugged into the root hub's ports, or into virtual
+ * hubs on them, up to the stack's HUB_MAX_DEPTH tiers.  The controller
+ * answers the standard requests from the descriptors given here and
+ * hands everything else to the device's callbacks, one packet at a time
+ * for data endpoints.
+ */
+#ifndef DUMMY_HCD_PORTS
+#define DUMMY_HCD_PORTS		4	/* at most 7 */
+#endif
+#define DUMMY_HUB_PORTS		7	/* at most, one status byte */
+#define DUMMY_MAX_PACKET	1024
+
+struct dummy_device;
+
+struct dummy_device_ops {
+	/* a control request the controller does not answer itself, and
+	 * SET_CONFIGURATION/SET_INTERFACE after it has reset the
+	 * endpoints.  For IN requests fill @buf with up to wLength bytes.
+	 * Return the data length, -EAGAIN to NAK until the next frame or
+	 * -EPIPE to stall.
+	 */
+	int	(*setup) (struct dummy_device *vdev,
+			const struct usb_ctrlrequest *req, void *buf);
+	/* one packet on a bulk, interrupt or isochronous endpoint; @len is
+	 * at most wMaxPacketSize.  IN fills @buf, OUT consumes it.  Return
+	 * the bytes moved (less than @len ends an IN transfer), -EAGAIN to
+	 * NAK or -EPIPE to stall.
+	 */
+	int	(*transfer) (struct dummy_device *vdev, uint8_t epaddr,
+			void *buf, int len);
+	/* bulk streams: the stream the device moves data on next, 0 if
+	 * none is ready.  Without it the streams that have urbs queued
+	 * take turns.
+	 */
+	int	(*next_stream) (struct dummy_device *vdev, uint8_t epaddr);
+};
+
+/*
+ * Injected faults, counted over the device's data packets.  NAKs and
+ * toggle errors are retried like on the wire; three toggle errors in a
+ * row fail the urb with -EPROTO.  A hung device fails every packet and
+ * control request with -EPROTO until a port reset brings it back, after
+ * hang_resets resets that didn't; that is what recovery.c is for.
+ */
+struct dummy_faults {
+	rt_uint16_t	nak_every;	/* NAK every Nth packet, 0 = never */
+	rt_uint16_t	toggle_every;	/* toggle error every Nth packet */
+	rt_uint32_t	stall_after;	/* stall stall_ep once, at packet N */
+	uint8_t		stall_ep;	/* bEndpointAddress */
+	rt_uint32_t	latency_us;	/* bus time added to every packet */
+	rt_uint32_t	hang_after;	/* hang once, at packet N */
+	rt_uint16_t	hang_resets;	/* port resets it stays hung through */
+};
+
+struct dummy_device {
+	int			speed;		/* USB_SPEED_LOW/FULL/HIGH */
+	const struct usb_device_descriptor *device;
+	const uint8_t * const	*configs;	/* bNumConfigurations entries */
+	const char * const	*strings;	/* string descriptor 1..n */
+	int			nstrings;
+	const struct dummy_device_ops *ops;
+	struct dummy_faults	faults;
+	void			*priv;
+
+	/* controller state */
+	uint8_t			address;
+	uint8_t			config;		/* bConfigurationValue */
+	rt_uint32_t		packets;	/* data packets so far */
+	uint8_t			hung;		/* see struct dummy_faults */
+};
+
+struct dummy_hcd_stats {
+	rt_uint32_t frames;
+	rt_uint32_t packets;		/* data packets attempted */
+	rt_uint32_t bytes;		/* data moved */
+	rt_uint32_t naks;
+	rt_uint32_t stalls;
+	rt_uint32_t toggle_errors;
+	rt_uint32_t hangs;		/* packets and requests unanswered */
+};
+
+struct usb_hcd *dummy_hcd_create(const char *name);
+void dummy_hcd_destroy(struct usb_hcd *hcd);
+int dummy_hcd_connect(struct usb_hcd *hcd, int port1,
+		struct dummy_device *vdev);
+void dummy_hcd_disconnect(struct usb_hcd *hcd, int port1);
+void dummy_hcd_get_stats(struct usb_hcd *hcd,
+		struct dummy_hcd_stats *stats);
+
+struct dummy_device *dummy_hub_create(int nports);
+void dummy_hub_destroy(struct dummy_device *vdev);
+int dummy_hub_connect(struct dummy_device *vdev, int port1,
+		struct dummy_device *child);
+void dummy_hub_disconnect(struct dummy_device *vdev, int port1);
+
+#endif /* __USB_DUMMY_HCD_H__ */
@@ -3,6 +3,93 @@
 
 #include "usb_host.h"
 
+struct usb_hcd;
+
+/* diagnostics for bring-up, compiled out unless CONFIG_USB_DEBUG */
+#ifdef CONFIG_USB_DEBUG
+#define usb_dbg(fmt, ...)	rt_kprintf(fmt, ##__VA_ARGS__)
+#else
+#define usb_dbg(fmt, ...)						\
+	do {								\
+		if (0)							\
+			rt_kprintf(fmt, ##__VA_ARGS__);			\
+	} while (0)
+#endif
+
+/*
+ * Deferred URB giveback.
+ *
+ * With HCD_BH set, usb_hcd_giveback_urb() only links the urb onto one of
+ * two bottom half queues; a worker thread per queue runs the completion
+ * handlers in batches.  Isochronous and interrupt urbs go to the high
+ * priority worker, control and bulk urbs to the low priority one.
+ *
+ * An hcd that also sets HCD_BH_BATCH calls usb_hcd_giveback_flush() at
+ * the end of every frame or interrupt.  Urbs that completed without
+ * error and carry URB_NO_INTERRUPT then don't wake the worker
+ * themselves; the flush does, once for everything that frame finished.
+ * Thirty HID devices polled every frame cost one context switch per
+ * frame instead of thirty.
+ */
+#ifndef USB_BH_HIGH_PRIORITY
+#define USB_BH_HIGH_PRIORITY	4
+#endif
+#ifndef USB_BH_LOW_PRIORITY
+#define USB_BH_LOW_PRIORITY	16
+#endif
+#ifndef USB_BH_STACK_SIZE
+#define USB_BH_STACK_SIZE	2048
+#endif
+
+/* the flags are plain bytes, written with interrupts off only */
+struct giveback_urb_bh {
+	rt_bool_t stopping;		/* worker exits after this batch */
+	rt_bool_t deferred;		/* head holds urbs, nobody woke the
+					 * worker yet */
+	rt_list_t head;			/* given back, handler not yet run */
+	struct rt_semaphore wakeup;	/* released when head was empty or
+					 * deferred */
+	struct rt_completion exited;	/* done as the worker returns */
+	rt_thread_t thread;
+};
+
+/*
+ * Transfer buffer pools, see buffer.c.
+ *
+ * Small buffers come from fixed-size slabs, one per size class, carved
+ * out of one cache-line aligned region when the hcd is added.  Alloc and
+ * free are a free-list pop/push with interrupts off, so both are O(1)
+ * and usable from the hcd's interrupt handler.  An empty slab fails the
+ * allocation instead of falling back to the heap; size HCD_POOL_BLOCKS
+ * for the urbs a board keeps in flight.
+ */
+#ifndef USB_DMA_ALIGN
+#define USB_DMA_ALIGN		USB_CACHE_LINE
+#endif
+#ifndef HCD_POOL_BLOCKS
+#define HCD_POOL_BLOCKS		{ 32, 16, 8, 4 }	/* blocks per class */
+#endif
+
+struct dma_pool {
+	rt_size_t size;			/* block size */
+	rt_size_t blocks;		/* number of blocks */
+	char *vaddr;			/* first block */
+	void *free_list;		/* unused blocks, linked through
+					 * their first word */
+	rt_size_t in_use;
+	rt_size_t high_water;		/* most blocks ever in use */
+	rt_size_t failures;		/* allocations that found the pool
+					 * empty */
+};
+
+struct hcd_buffer_stats {
+	rt_size_t size;
+	rt_size_t blocks;
+	rt_size_t in_use;
+	rt_size_t high_water;
+	rt_size_t failures;
+};
+
 struct usb_hcd {
 
 	/*
@@ -16,12 +103,15 @@ struct usb_hcd {
 						 * hcd->driver->flags & HCD_MASK
 						 */
 
-	struct timer_list	rh_timer;	/* drives root-hub polling */
+	struct rt_timer		rh_timer;	/* polls the root hub when the
+						 * hc has no port interrupt */
 	struct urb		*status_urb;	/* the current status urb */
-#ifdef CONFIG_PM
-	struct work_struct	wakeup_work;	/* for remote wakeup */
-#endif
-	struct work_struct	died_work;	/* for when the device dies */
+
+	/* root hub control replies are built here, one at a time; the
+	 * longest is a string descriptor */
+#define USB_RH_BUF_SIZE		256
+	rt_mutex_t		rh_mutex;
+	uint8_t			rh_buf[USB_RH_BUF_SIZE];
 
 	/*
 	 * hardware info/state
@@ -43,7 +133,8 @@ struct usb_hcd {
 #define HCD_FLAG_HW_ACCESSIBLE		0	/* at full power */
 #define HCD_FLAG_POLL_RH		2	/* poll for rh status? */
 #define HCD_FLAG_POLL_PENDING		3	/* status has changed? */
-#define HCD_FLAG_WAKEUP_PENDING		4	/* root hub is resuming? */
+#define HCD_FLAG_WAKEUP_PENDING		4	/* root port signals resume,
+						 * see usb_hcd_resume_root_hub() */
 #define HCD_FLAG_RH_RUNNING		5	/* root hub is running? */
 #define HCD_FLAG_DEAD			6	/* controller has died? */
 #define HCD_FLAG_INTF_AUTHORIZED	7	/* authorize interfaces? */
@@ -66,13 +157,6 @@ struct usb_hcd {
 #define HCD_INTF_AUTHORIZED(hcd) \
 	((hcd)->flags & (1U << HCD_FLAG_INTF_AUTHORIZED))
 
-	/*
-	 * Specifies if devices are authorized by default
-	 * or they require explicit user space authorization; this bit is
-	 * settable through /sys/class/usb_host/X/authorized_default
-	 */
-	enum usb_dev_authorize_policy dev_policy;
-
 	/* Flags that get set only during HCD registration or removal. */
 	unsigned		rh_registered:1;/* is root hub registered? */
 	unsigned		rh_pollable:1;	/* may we poll the root hub? */
@@ -97,9 +181,9 @@ struct usb_hcd {
 			/* wakeup requests from downstream aren't received */
 
 	unsigned int		irq;		/* irq allocated */
-	void __iomem		*regs;		/* device memory/io */
-	resource_size_t		rsrc_start;	/* memory/io resource start */
-	resource_size_t		rsrc_len;	/* memory/io resource length */
+	void			*regs;		/* device memory/io */
+	rt_ubase_t		rsrc_start;	/* memory/io resource start */
+	rt_ubase_t		rsrc_len;	/* memory/io resource length */
 	unsigned		power_budget;	/* in mA, 0 = no limit */
 
 	struct giveback_urb_bh  high_prio_bh;
@@ -116,8 +200,8 @@ struct usb_hcd {
 	 * bandwidth_mutex should be dropped after a successful control message
 	 * to the device, or resetting the bandwidth after a failed attempt.
 	 */
-	struct mutex		*address0_mutex;
-	struct mutex		*bandwidth_mutex;
+	rt_mutex_t		address0_mutex;
+	rt_mutex_t		bandwidth_mutex;
 	struct usb_hcd		*shared_hcd;
 	struct usb_hcd		*primary_hcd;
 
@@ -140,7 +224,7 @@ struct usb_hcd {
 #define	HC_IS_SUSPENDED(state) ((state) & __SUSPEND)
 
 	/* memory pool for HCs having local memory, or %NULL */
-	struct gen_pool         *localmem_pool;
+	struct rt_memheap       *localmem_pool;
 
 	/* more shared queuing code would be good; it should support
 	 * smarter scheduling, handle transaction translators, etc;
@@ -152,7 +236,243 @@ struct usb_hcd {
 	 * this structure.
 	 */
 	unsigned long hcd_priv[]
-			__attribute__ ((aligned(sizeof(s64))));
+			__attribute__ ((aligned(sizeof(rt_uint64_t))));
 };
 
+#define bus_to_hcd(bus)	rt_container_of(bus, struct usb_hcd, self)
+#define hcd_to_bus(hcd)	(&(hcd)->self)
+
+/* (bRequestType << 8) of standard requests, as in typeReq */
+#define DeviceRequest \
+	((USB_DIR_IN | USB_REQ_TYPE_STANDARD | USB_REQ_TYPE_DEVICE) << 8)
+#define DeviceOutRequest \
+	((USB_DIR_OUT | USB_REQ_TYPE_STANDARD | USB_REQ_TYPE_DEVICE) << 8)
+#define InterfaceRequest \
+	((USB_DIR_IN | USB_REQ_TYPE_STANDARD | USB_REQ_TYPE_INTERFACE) << 8)
+#define InterfaceOutRequest \
+	((USB_DIR_OUT | USB_REQ_TYPE_STANDARD | USB_REQ_TYPE_INTERFACE) << 8)
+#define EndpointRequest \
+	((USB_DIR_IN | USB_REQ_TYPE_STANDARD | USB_REQ_TYPE_ENDPOINT) << 8)
+#define EndpointOutRequest \
+	((USB_DIR_OUT | USB_REQ_TYPE_STANDARD | USB_REQ_TYPE_ENDPOINT) << 8)
+
+struct hc_driver {
+	const char	*description;	/* "ehci-hcd" etc */
+	const char	*product_desc;	/* product/vendor string */
+	rt_size_t	hcd_priv_size;	/* size of private data */
+
+	/* irq handler */
+	void	(*irq) (struct usb_hcd *hcd);
+
+	int	flags;
+#define	HCD_MEMORY	0x0001		/* HC regs use memory (else I/O) */
+#define	HCD_LOCAL_MEM	0x0002		/* HC needs local memory */
+#define	HCD_SHARED	0x0004		/* Two (or more) usb_hcds share HW */
+#define	HCD_USB11	0x0010		/* USB 1.1 */
+#define	HCD_USB2	0x0020		/* USB 2.0 */
+#define	HCD_MASK	0x0070
+#define	HCD_BH		0x0100		/* URB complete in BH context */
+#define	HCD_BH_BATCH	0x0200		/* calls usb_hcd_giveback_flush() */
+
+	/* called to init HCD and root hub */
+	int	(*reset) (struct usb_hcd *hcd);
+	int	(*start) (struct usb_hcd *hcd);
+
+	/* cleanly make HCD stop writing memory and doing I/O */
+	void	(*stop) (struct usb_hcd *hcd);
+
+	/* return current frame number */
+	int	(*get_frame_number) (struct usb_hcd *hcd);
+
+	/* new urbs were published on ep->ring.  Called from the
+	 * submitter's context after the ring head moved, must not sleep;
+	 * the driver drains the ring with usb_hcd_ep_next_urb().
+	 */
+	void	(*endpoint_kick) (struct usb_hcd *hcd,
+			struct usb_host_endpoint *ep);
+	/* urb->unlinked is already set.  An urb still on ep->ring needs
+	 * nothing, usb_hcd_ep_next_urb() gives it back; an urb the
+	 * driver already owns must be stopped and given back.
+	 */
+	int	(*urb_dequeue) (struct usb_hcd *hcd, struct urb *urb,
+			int status);
+
+	/* bulk streams, see usb_alloc_streams().  alloc_streams returns
+	 * the number of stream IDs each endpoint got; free_streams gives
+	 * back whatever is still queued on them.
+	 */
+	int	(*alloc_streams) (struct usb_hcd *hcd, struct usb_device *udev,
+			struct usb_host_endpoint **eps, unsigned int num_eps,
+			unsigned int num_streams);
+	int	(*free_streams) (struct usb_hcd *hcd, struct usb_device *udev,
+			struct usb_host_endpoint **eps, unsigned int num_eps);
+
+	/* hw synch, freeing endpoint resources that urb_dequeue can't */
+	void	(*endpoint_disable) (struct usb_hcd *hcd,
+			struct usb_host_endpoint *ep);
+
+	/* (optional) reset any endpoint state such as sequence number
+	   and current window */
+	void	(*endpoint_reset) (struct usb_hcd *hcd,
+			struct usb_host_endpoint *ep);
+
+	/* root hub support.  hub_status_data fills in the hub's status
+	 * change bitmap and returns its length, 0 if nothing changed; it
+	 * is called from usb_hcd_poll_rh_status() and must not sleep.
+	 */
+	int	(*hub_status_data) (struct usb_hcd *hcd, char *buf);
+	int	(*hub_control) (struct usb_hcd *hcd,
+			uint16_t typeReq, uint16_t wValue, uint16_t wIndex,
+			char *buf, uint16_t wLength);
+};
+
+struct usb_hcd *usb_create_hcd(const struct hc_driver *driver,
+		const char *bus_name);
+void usb_put_hcd(struct usb_hcd *hcd);
+int usb_add_hcd(struct usb_hcd *hcd);
+void usb_remove_hcd(struct usb_hcd *hcd);
+
+int hcd_buffer_create(struct usb_hcd *hcd);
+void hcd_buffer_destroy(struct usb_hcd *hcd);
+void *hcd_buffer_alloc(struct usb_bus *bus, rt_size_t size, dma_addr_t *dma);
+void hcd_buffer_free(struct usb_bus *bus, rt_size_t size,
+		void *addr, dma_addr_t dma);
+int hcd_buffer_get_stats(struct usb_bus *bus,
+		struct hcd_buffer_stats *stats, int count);
+
+/*
+ * Walks the data stage of a scatter-gather urb in pieces no larger than
+ * the hcd asks for, e.g. one packet or one fifo load.  A packet that
+ * straddles two segments comes back as two pieces.
+ */
+struct usb_sg_iter {
+	struct scatterlist *sg;		/* current segment */
+	int nents;			/* segments left, including sg */
+	unsigned int offset;		/* bytes of sg already consumed */
+};
+
+rt_inline void usb_sg_iter_init(struct usb_sg_iter *iter, struct urb *urb)
+{
+	iter->sg = urb->sg;
+	iter->nents = urb->num_mapped_sgs;
+	iter->offset = 0;
+}
+
+/* returns the length of the next piece and its address in *buf, 0 at end */
+rt_inline unsigned int usb_sg_iter_next(struct usb_sg_iter *iter,
+		unsigned int max, void **buf)
+{
+	unsigned int len;
+
+	while (iter->nents && iter->offset == iter->sg->length) {
+		iter->sg++;
+		iter->nents--;
+		iter->offset = 0;
+	}
+	if (!iter->nents)
+		return 0;
+
+	len = iter->sg->length - iter->offset;
+	if (len > max)
+		len = max;
+	*buf = (char *)iter->sg->buf + iter->offset;
+	iter->offset += len;
+	return len;
+}
+
+/*
+ * Frame numbers, as returned by hc_driver->get_frame_number(), are 11
+ * bits and wrap; compare them with usb_frame_diff().
+ */
+#define USB_FRAME_MASK		0x7ff
+#define USB_ISO_SLOP		2	/* frames an ASAP urb starts ahead */
+#define USB_ISO_HORIZON		512	/* frames an urb may end ahead */
+
+/* @a - @b in frames, negative if @a is earlier */
+rt_inline int usb_frame_diff(int a, int b)
+{
+	int d = (a - b) & USB_FRAME_MASK;
+
+	return d > USB_FRAME_MASK / 2 ? d - (USB_FRAME_MASK + 1) : d;
+}
+
+/* frames from one packet of a periodic endpoint to the next; high speed
+ * intervals under a frame count as one */
+rt_inline int usb_ep_frame_interval(struct usb_device *udev,
+		struct usb_host_endpoint *ep)
+{
+	int interval = ep->desc.bInterval;
+	int isoc = (ep->desc.bmAttributes & USB_EP_ATTR_TYPE_MASK) ==
+			USB_EP_ATTR_ISOC;
+
+	if (interval < 1)
+		interval = 1;
+	if (interval > 16 && (isoc || udev->speed == USB_SPEED_HIGH))
+		interval = 16;
+	if (udev->speed == USB_SPEED_HIGH)
+		interval = (1 << (interval - 1)) / 8;	/* uframes to frames */
+	else if (isoc)
+		interval = 1 << (interval - 1);
+	return interval ? interval : 1;
+}
+
+/* periodic bandwidth, see bandwidth.c */
+int usb_calc_bus_time(int speed, int is_input, int isoc, int bytecount);
+int usb_hcd_check_bandwidth(struct usb_device *udev,
+		struct usb_host_endpoint **old_eps, int old_count,
+		struct usb_host_endpoint **new_eps, int new_count);
+void usb_bandwidth_init(struct usb_hcd *hcd);
+int usb_bandwidth_reserve(struct usb_bus *bus,
+		struct usb_host_endpoint **eps, int count);
+void usb_bandwidth_release(struct usb_bus *bus,
+		struct usb_host_endpoint **eps, int count);
+void usb_bandwidth_get_stats(struct usb_bus *bus,
+		struct usb_bandwidth_stats *stats);
+
+/*
+ * Instrumentation hooks, see trace.c.  Hcds report each NAK'd attempt
+ * with usb_hcd_trace_nak(); the core does the rest.
+ */
+#ifdef CONFIG_USB_TRACE
+void usb_trace_submit(struct urb *urb, int status);
+void usb_trace_giveback(struct urb *urb);
+#define usb_trace_start(urb)	((urb)->submit_time = usb_trace_clock())
+#define usb_hcd_trace_nak(ep)	((ep)->stats.naks++)
+#else
+#define usb_trace_start(urb)		do { } while (0)
+#define usb_trace_submit(urb, status)	do { } while (0)
+#define usb_trace_giveback(urb)		do { } while (0)
+#define usb_hcd_trace_nak(ep)		do { } while (0)
+#endif
+
+/*
+ * urbs in flight per device, for the idle check of pm.c.  An interrupt
+ * IN urb is parked until the device has something to say, so as in
+ * Linux it does not keep the device awake; its completion does.
+ */
+#define usb_pm_counts(urb)						\
+	(!usb_pipeint((urb)->pipe) || !usb_pipein((urb)->pipe))
+#ifdef CONFIG_USB_PM
+#define usb_pm_busy(udev)	rt_atomic_add(&(udev)->pm.active, 1)
+#define usb_pm_idle(udev)	rt_atomic_sub(&(udev)->pm.active, 1)
+#else
+#define usb_pm_busy(udev)	((void)(udev))
+#define usb_pm_idle(udev)	((void)(udev))
+#endif
+
+/* submit / giveback, see hcd.c */
+int usb_hcd_submit_urb(struct urb *urb);
+int usb_hcd_unlink_urb(struct urb *urb, int status);
+int usb_hcd_link_urb_to_ep(struct usb_hcd *hcd, struct urb *urb);
+struct urb *usb_hcd_ep_next_urb(struct usb_hcd *hcd,
+		struct usb_host_endpoint *ep);
+void usb_hcd_giveback_urb(struct usb_hcd *hcd, struct urb *urb, int status);
+void usb_hcd_giveback_flush(struct usb_hcd *hcd);
+int usb_hcd_requeue_urb(struct urb *urb);
+void usb_hcd_poll_rh_status(struct usb_hcd *hcd);
+void usb_hcd_resume_root_hub(struct usb_hcd *hcd);
+rt_bool_t usb_hcd_can_sleep(struct usb_hcd *hcd);
+void usb_kill_urb_wakeup(struct urb *urb);
+void usb_anchor_wakeup(struct usb_anchor *anchor);
+
 #endif /* __USB_HCD_H__ */
@@ -0,0 +1,194 @@
+#ifndef __USB_HUB_H__
+#define __USB_HUB_H__
+
+#include "usb_host.h"
+
+/*
+ * Hub request types
+ */
+#define USB_RT_HUB	(USB_REQ_TYPE_CLASS | USB_REQ_TYPE_DEVICE)
+#define USB_RT_PORT	(USB_REQ_TYPE_CLASS | USB_REQ_TYPE_OTHER)
+
+/*
+ * wValue for hub and port class requests
+ */
+#define C_HUB_LOCAL_POWER		0
+#define C_HUB_OVER_CURRENT		1
+
+#define USB_PORT_FEAT_CONNECTION	0
+#define USB_PORT_FEAT_ENABLE		1
+#define USB_PORT_FEAT_SUSPEND		2
+#define USB_PORT_FEAT_OVER_CURRENT	3
+#define USB_PORT_FEAT_RESET		4
+#define USB_PORT_FEAT_POWER		8
+#define USB_PORT_FEAT_LOWSPEED		9
+#define USB_PORT_FEAT_C_CONNECTION	16
+#define USB_PORT_FEAT_C_ENABLE		17
+#define USB_PORT_FEAT_C_SUSPEND		18
+#define USB_PORT_FEAT_C_OVER_CURRENT	19
+#define USB_PORT_FEAT_C_RESET		20
+
+/*
+ * wPortStatus bit field
+ */
+#define USB_PORT_STAT_CONNECTION	0x0001
+#define USB_PORT_STAT_ENABLE		0x0002
+#define USB_PORT_STAT_SUSPEND		0x0004
+#define USB_PORT_STAT_OVERCURRENT	0x0008
+#define USB_PORT_STAT_RESET		0x0010
+#define USB_PORT_STAT_POWER		0x0100
+#define USB_PORT_STAT_LOW_SPEED		0x0200
+#define USB_PORT_STAT_HIGH_SPEED	0x0400
+
+/*
+ * wPortChange bit field
+ */
+#define USB_PORT_STAT_C_CONNECTION	0x0001
+#define USB_PORT_STAT_C_ENABLE		0x0002
+#define USB_PORT_STAT_C_SUSPEND		0x0004
+#define USB_PORT_STAT_C_OVERCURRENT	0x0008
+#define USB_PORT_STAT_C_RESET		0x0010
+
+/*
+ * wHubStatus / wHubChange bit field
+ */
+#define HUB_STATUS_LOCAL_POWER		0x0001
+#define HUB_STATUS_OVERCURRENT		0x0002
+#define HUB_CHANGE_LOCAL_POWER		0x0001
+#define HUB_CHANGE_OVERCURRENT		0x0002
+
+/*
+ * typeReq values handed to hc_driver->hub_control() for the root hub
+ */
+#define ClearHubFeature		(0x2000 | USB_REQ_CLEAR_FEATURE)
+#define ClearPortFeature	(0x2300 | USB_REQ_CLEAR_FEATURE)
+#define GetHubDescriptor	(0xa000 | USB_REQ_GET_DESCRIPTOR)
+#define GetHubStatus		(0xa000 | USB_REQ_GET_STATUS)
+#define GetPortStatus		(0xa300 | USB_REQ_GET_STATUS)
+#define SetHubFeature		(0x2000 | USB_REQ_SET_FEATURE)
+#define SetPortFeature		(0x2300 | USB_REQ_SET_FEATURE)
+
+struct __attribute__((__packed__)) usb_port_status {
+	uint16_t wPortStatus;
+	uint16_t wPortChange;
+};
+
+struct __attribute__((__packed__)) usb_hub_status {
+	uint16_t wHubStatus;
+	uint16_t wHubChange;
+};
+
+#define USB_DT_HUB_NONVAR_SIZE		7
+
+struct __attribute__((__packed__)) usb_hub_descriptor {
+	uint8_t  bDescLength;
+	uint8_t  bDescriptorType;
+	uint8_t  bNbrPorts;
+	uint16_t wHubCharacteristics;
+	uint8_t  bPwrOn2PwrGood;
+	uint8_t  bHubContrCurrent;
+
+	/* 2.0 hubs: DeviceRemovable and PortPwrCtrlMask bitmaps */
+	uint8_t  DeviceRemovable[(USB_MAXCHILDREN + 1 + 7) / 8];
+	uint8_t  PortPwrCtrlMask[(USB_MAXCHILDREN + 1 + 7) / 8];
+};
+
+/*
+ * Timing, in milliseconds.  A connection is accepted once the port has
+ * reported the same connect state for HUB_DEBOUNCE_STABLE; the port is
+ * looked at again every HUB_DEBOUNCE_STEP meanwhile, without holding up
+ * other ports or hubs.
+ */
+#define HUB_DEBOUNCE_STEP		25
+#define HUB_DEBOUNCE_STABLE		100
+#define HUB_RESET_TIMEOUT		500
+#define HUB_SHORT_RESET_TIME		10
+#define HUB_ROOT_RESET_TIME		60	/* times are in msec */
+
+#define HUB_MAX_DEPTH			5	/* tiers below the root hub */
+
+#ifndef USB_HUB_THREAD_PRIORITY
+#define USB_HUB_THREAD_PRIORITY		12
+#endif
+#ifndef USB_HUB_THREAD_STACK_SIZE
+#define USB_HUB_THREAD_STACK_SIZE	4096
+#endif
+
+/*
+ * Enumeration workers.  The hub thread resets a new device and gives it
+ * an address; descriptors, strings and configuration are then read by
+ * one of these, so several devices come up at the same time.
+ */
+#ifndef USB_HUB_ENUM_THREADS
+#define USB_HUB_ENUM_THREADS		4
+#endif
+
+struct hub_enum_job;
+
+struct usb_port {
+	struct usb_device *child;
+	struct hub_enum_job *enum_job;	/* child still being enumerated */
+	rt_tick_t debounce_start;	/* connect state last changed */
+	unsigned debouncing:1;		/* waiting for a stable state */
+	unsigned connected:1;		/* connect state last seen */
+	unsigned enum_tries:2;		/* failed enumerations in a row */
+	unsigned reenum:1;		/* enumerating for recovery.c */
+	rt_uint32_t reenum_start;	/* usb_trace_clock() then */
+};
+
+struct usb_hub {
+	struct usb_device	*hdev;
+	struct usb_interface	*intf;
+	struct usb_hub_descriptor *descriptor;	/* class descriptor */
+	int			nports;
+
+	struct urb		*urb;		/* for interrupt polling pipe */
+	uint8_t			*buffer;	/* status change bitmap */
+	int			buffer_len;
+	int			nerrors;	/* in a row */
+
+	union {
+		struct usb_hub_status	hub;
+		struct usb_port_status	port;
+	}			*status;	/* buffer for status reports */
+
+	/* bit 0 is the hub itself, bit N port N */
+	atomic_t		event_bits;	/* set from the status urb */
+	rt_uint32_t		debounce_bits;	/* hub thread only */
+
+	rt_list_t		event_list;	/* hubs with pending work */
+	struct rt_timer		debounce_timer;	/* rescans debouncing ports */
+
+	struct usb_port		*ports;
+
+	unsigned		quiescing:1;
+	unsigned		disconnected:1;
+};
+
+rt_inline struct usb_hub *usb_hub_to_struct_hub(struct usb_device *hdev)
+{
+	if (!hdev || !hdev->actconfig || !hdev->maxchild)
+		return RT_NULL;
+	return hdev->actconfig->interface[0]->driver_data;
+}
+
+int usb_hub_init(void);
+void usb_hub_cleanup(void);
+int usb_new_device(struct usb_device *udev);
+void usb_disconnect(struct usb_device **pdev);
+void usb_hub_for_each_device(struct usb_bus *bus,
+		void (*fn)(struct usb_device *udev, void *arg), void *arg);
+int usb_hub_clear_port_feature(struct usb_device *hdev, int port1,
+		int feature);
+int usb_hub_set_port_feature(struct usb_device *hdev, int port1,
+		int feature);
+void usb_hub_kick(void);
+rt_bool_t usb_hub_thread_self(void);
+int usb_reset_device(struct usb_device *udev);
+int usb_hub_reenumerate(struct usb_device *udev);
+#ifdef CONFIG_USB_PM
+int usb_hub_port_suspend(struct usb_device *udev);
+int usb_hub_port_resume(struct usb_device *udev);
+#endif
+
+#endif /* __USB_HUB_H__ */
@@ -1,6 +1,16 @@
 #ifndef __USB_URB_H__
 #define __USB_URB_H__
 
+#include "usb_common.h"
+
+struct urb;
+struct usb_device;
+struct usb_host_endpoint;
+struct usb_anchor;
+struct usb_urb_pool;
+
+typedef void (*usb_complete_t)(struct urb *);
+
 /*
  * urb->transfer_flags:
  *
@@ -20,25 +30,202 @@
 #define URB_DIR_OUT  0
 #define URB_DIR_MASK  URB_DIR_IN
 
+/*
+ * Pipe layout, as in the linux usb core plus the device's speed:
+ *  - direction:	bit 7		(0 = Host-to-Device [Out],
+ *					 1 = Device-to-Host [In])
+ *  - device address:	bits 8-14
+ *  - endpoint:		bits 15-18
+ *  - speed:		bits 20-22	(enum usb_device_speed)
+ *  - pipe type:	bits 30-31	(00 = isochronous, 01 = interrupt,
+ *					 10 = control, 11 = bulk)
+ *
+ * Every field is a shift and a mask away, and direction plus endpoint
+ * number give the endpoint's slot in usb_device->ep_table directly.
+ */
+#define PIPE_ISOCHRONOUS		0
+#define PIPE_INTERRUPT			1
+#define PIPE_CONTROL			2
+#define PIPE_BULK			3
+
+#define usb_pipein(pipe)	((pipe) & USB_DIR_IN)
+#define usb_pipeout(pipe)	(!usb_pipein(pipe))
+
+#define usb_pipedevice(pipe)	(((pipe) >> 8) & 0x7f)
+#define usb_pipeendpoint(pipe)	(((pipe) >> 15) & 0xf)
+#define usb_pipespeed(pipe)	(((pipe) >> 20) & 7)
+
+#define usb_pipetype(pipe)	(((pipe) >> 30) & 3)
+#define usb_pipeisoc(pipe)	(usb_pipetype((pipe)) == PIPE_ISOCHRONOUS)
+#define usb_pipeint(pipe)	(usb_pipetype((pipe)) == PIPE_INTERRUPT)
+#define usb_pipecontrol(pipe)	(usb_pipetype((pipe)) == PIPE_CONTROL)
+#define usb_pipebulk(pipe)	(usb_pipetype((pipe)) == PIPE_BULK)
+
+/* slot in usb_device->ep_table and ->ep_state: OUT endpoints at their
+ * number, IN endpoints at 16 + their number */
+#define usb_pipe_epidx(pipe)	((((pipe) >> 3) & 0x10) | usb_pipeendpoint(pipe))
+
+rt_inline unsigned int usb_pipe_encode(unsigned int type, unsigned int devnum,
+		unsigned int epaddr, unsigned int speed)
+{
+	return (type << 30) | ((speed & 7) << 20) |
+			((epaddr & 0xf) << 15) | ((devnum & 0x7f) << 8) |
+			(epaddr & USB_DIR_IN);
+}
+
+/* pipe type of an endpoint: descriptors order their transfer types
+ * ctrl, iso, bulk, int and pipes iso, int, ctrl, bulk */
+rt_inline unsigned int
+usb_endpoint_pipetype(const struct usb_endpoint_descriptor *desc)
+{
+	return (0x72 >> ((desc->bmAttributes & USB_EP_ATTR_TYPE_MASK) * 2)) & 3;
+}
+
+#define __create_pipe(dev, endpoint) \
+	(((unsigned int)(dev)->devnum << 8) | \
+	 ((unsigned int)(endpoint) << 15) | \
+	 ((unsigned int)(dev)->speed << 20))
+
+#define usb_sndctrlpipe(dev, endpoint)	\
+	((PIPE_CONTROL << 30) | __create_pipe(dev, endpoint))
+#define usb_rcvctrlpipe(dev, endpoint)	\
+	((PIPE_CONTROL << 30) | __create_pipe(dev, endpoint) | USB_DIR_IN)
+#define usb_sndisocpipe(dev, endpoint)	\
+	((PIPE_ISOCHRONOUS << 30) | __create_pipe(dev, endpoint))
+#define usb_rcvisocpipe(dev, endpoint)	\
+	((PIPE_ISOCHRONOUS << 30) | __create_pipe(dev, endpoint) | USB_DIR_IN)
+#define usb_sndbulkpipe(dev, endpoint)	\
+	((PIPE_BULK << 30) | __create_pipe(dev, endpoint))
+#define usb_rcvbulkpipe(dev, endpoint)	\
+	((PIPE_BULK << 30) | __create_pipe(dev, endpoint) | USB_DIR_IN)
+#define usb_sndintpipe(dev, endpoint)	\
+	((PIPE_INTERRUPT << 30) | __create_pipe(dev, endpoint))
+#define usb_rcvintpipe(dev, endpoint)	\
+	((PIPE_INTERRUPT << 30) | __create_pipe(dev, endpoint) | USB_DIR_IN)
+
+/*
+ * One segment of a scatter-gather transfer.  urb->sg points at an array
+ * of urb->num_sgs of these; the stack never copies them into a bounce
+ * buffer, the hcd moves data segment by segment.
+ */
+struct scatterlist {
+	void *buf;			/* cpu address of the segment */
+	unsigned int length;		/* bytes in the segment */
+	dma_addr_t dma_address;		/* bus address, set on submit */
+};
+
+#define for_each_sg(sglist, sg, nr, __i)	\
+	for (__i = 0, sg = (sglist); __i < (nr); __i++, sg++)
+
+rt_inline void sg_init_table(struct scatterlist *sgl, unsigned int nents)
+{
+	rt_memset(sgl, 0, sizeof(*sgl) * nents);
+}
+
+rt_inline void sg_set_buf(struct scatterlist *sg, void *buf,
+			  unsigned int buflen)
+{
+	sg->buf = buf;
+	sg->length = buflen;
+}
+
+struct usb_iso_packet_descriptor {
+	unsigned int offset;
+	unsigned int length;		/* expected length */
+	unsigned int actual_length;
+	int status;
+};
+
+/*
+ * Per-endpoint submission ring.
+ *
+ * Any number of submitters may share an endpoint: ep0 is used by the hub
+ * thread, the enumeration workers and drivers at once, two threads may
+ * write to one bulk endpoint, and recovery and resume requeue urbs.  A
+ * submitter claims a position by compare-and-swap on head, fills the
+ * slot and then publishes it through the slot's sequence number.  The
+ * host controller driver is the only consumer: it takes a slot once its
+ * sequence says it's filled and hands it back for the next lap.  No lock
+ * is taken on either side, and a submitter that is preempted between
+ * claim and publish only holds up the consumer, which finds the slot on
+ * the kick that follows the publish.
+ *
+ * Sequence numbers are stored minus the slot index, so a zeroed ring is
+ * an empty one.  Isochronous endpoints still need their submitters
+ * serialized: where an urb goes in the schedule depends on the one
+ * before, see usb_hcd_iso_schedule().
+ */
+#define USB_URB_RING_SIZE	32	/* must be a power of two */
+
+struct usb_urb_ring {
+	atomic_t head;			/* next position to claim */
+	atomic_t tail;			/* next position to drain, consumer only */
+	atomic_t seq[USB_URB_RING_SIZE];	/* position + 1 once filled,
+						 * + size once drained */
+	struct urb *slot[USB_URB_RING_SIZE];
+};
+
+/*
+ * Anchors keep track of a driver's in-flight urbs, so that all of them
+ * can be killed or waited for at once, e.g. on disconnect.  An anchored
+ * urb holds a reference that is dropped when it is given back, right
+ * before its completion handler runs; a handler that resubmits has to
+ * anchor the urb again.
+ */
+struct usb_anchor {
+	rt_list_t urb_list;
+	atomic_t suspend_wakeups;	/* handlers of unanchored urbs running */
+};
+
+#define USB_ANCHOR_INIT(name)	{ RT_LIST_OBJECT_INIT((name).urb_list) }
+
+rt_inline void init_usb_anchor(struct usb_anchor *anchor)
+{
+	rt_memset(anchor, 0, sizeof(*anchor));
+	rt_list_init(&anchor->urb_list);
+}
+
+/*
+ * Pre-allocated urbs for one endpoint, see urb.c.
+ *
+ * All urbs of a pool, with room for iso_packets descriptors each, live
+ * in one block.  usb_urb_pool_get() hands out a fresh urb and anchors
+ * it on the pool; when its last reference is dropped, usually by the
+ * core after giveback, the urb goes back on the free list instead of to
+ * the heap.  Get and recycle are O(1) and safe in interrupt context.
+ */
+struct usb_urb_pool {
+	struct usb_device *dev;
+	unsigned int pipe;
+	int iso_packets;		/* descriptors per urb */
+	int count;			/* urbs in the pool */
+	rt_size_t stride;		/* bytes per urb */
+	atomic_t avail;			/* urbs on the free list */
+	rt_list_t free_list;
+	struct usb_anchor anchor;	/* urbs handed out */
+	void *mem;
+};
 
 struct urb {
 	/* private: usb core and host controller only fields in the urb */
+	atomic_t kref;			/* reference count of the URB */
 	int unlinked;			/* unlink error code */
 	void *hcpriv;			/* private data for host controller */
 	atomic_t use_count;		/* concurrent submissions counter */
 	atomic_t reject;		/* submissions will fail */
 
 	/* public: documented fields in the urb that can be used by drivers */
-	struct list_head urb_list;	/* list head for use by the urb's
+	rt_list_t urb_list;		/* list head for use by the urb's
 					 * current owner */
-	struct list_head anchor_list;	/* the URB may be anchored */
+	rt_list_t anchor_list;		/* the URB may be anchored */
 	struct usb_anchor *anchor;
+	struct usb_urb_pool *pool;	/* (internal) pool the urb belongs to */
 	struct usb_device *dev;		/* (in) pointer to associated device */
 	struct usb_host_endpoint *ep;	/* (internal) pointer to endpoint */
 	unsigned int pipe;		/* (in) pipe information */
 	unsigned int stream_id;		/* (in) stream ID */
 	int status;			/* (return) non-ISO status */
-    
+
 
 	unsigned int transfer_flags;	/* (in) URB_SHORT_NOT_OK | ...*/
 	void *transfer_buffer;		/* (in) associated data buffer */
@@ -57,8 +244,179 @@ struct urb {
 	int error_count;		/* (return) number of ISO errors */
 	void *context;			/* (in) context for completion */
 	usb_complete_t complete;	/* (in) completion routine */
+#ifdef CONFIG_USB_TRACE
+	rt_uint32_t submit_time;	/* (internal) usb_trace_clock() */
+#endif
 	struct usb_iso_packet_descriptor iso_frame_desc[];
 					/* (in) ISO ONLY */
 };
 
+rt_inline void usb_fill_control_urb(struct urb *urb,
+				    struct usb_device *dev,
+				    unsigned int pipe,
+				    unsigned char *setup_packet,
+				    void *transfer_buffer,
+				    int buffer_length,
+				    usb_complete_t complete_fn,
+				    void *context)
+{
+	urb->dev = dev;
+	urb->pipe = pipe;
+	urb->setup_packet = setup_packet;
+	urb->transfer_buffer = transfer_buffer;
+	urb->transfer_buffer_length = buffer_length;
+	urb->complete = complete_fn;
+	urb->context = context;
+}
+
+rt_inline void usb_fill_bulk_urb(struct urb *urb,
+				 struct usb_device *dev,
+				 unsigned int pipe,
+				 void *transfer_buffer,
+				 int buffer_length,
+				 usb_complete_t complete_fn,
+				 void *context)
+{
+	urb->dev = dev;
+	urb->pipe = pipe;
+	urb->transfer_buffer = transfer_buffer;
+	urb->transfer_buffer_length = buffer_length;
+	urb->complete = complete_fn;
+	urb->context = context;
+}
+
+rt_inline void usb_fill_int_urb(struct urb *urb,
+				struct usb_device *dev,
+				unsigned int pipe,
+				void *transfer_buffer,
+				int buffer_length,
+				usb_complete_t complete_fn,
+				void *context,
+				int interval)
+{
+	urb->dev = dev;
+	urb->pipe = pipe;
+	urb->transfer_buffer = transfer_buffer;
+	urb->transfer_buffer_length = buffer_length;
+	urb->complete = complete_fn;
+	urb->context = context;
+	urb->interval = interval;
+	urb->start_frame = -1;
+}
+
+/*
+ * A continuously running isochronous stream, see iso.c.  Its urbs
+ * resubmit themselves from their completion, so the schedule stays
+ * nurbs * packets intervals ahead of the bus.
+ */
+#define USB_ISO_STREAM_URBS	8
+
+struct usb_iso_stream {
+	struct usb_device *dev;
+	struct usb_host_endpoint *ep;
+	unsigned int pipe;
+	int nurbs;
+	int packets;			/* per urb */
+	int packet_size;
+	/* every urb given back goes through here first: consume an IN
+	 * urb's packets, look at an OUT urb's errors */
+	void (*complete)(struct usb_iso_stream *stream, struct urb *urb);
+	/* optional, fills an OUT urb before each submission */
+	void (*prepare)(struct usb_iso_stream *stream, struct urb *urb);
+	void *context;
+	atomic_t running;
+	atomic_t active;		/* urbs submitted */
+	int error;			/* last failed resubmission */
+	struct urb *urbs[USB_ISO_STREAM_URBS];
+};
+
+/*
+ * A bulk endpoint as a byte FIFO, see bulk.c; unrelated to the USB 3
+ * bulk streams of usb_alloc_streams().  nurbs urbs of buf_size bytes
+ * each are kept in flight: IN urbs are resubmitted as soon as they have
+ * been read, OUT urbs are refilled as soon as they have been sent.
+ */
+#define USB_BULK_FIFO_URBS	8
+
+/* usb_bulk_fifo rt_device control commands */
+#define USB_BULK_FIFO_CTRL_TIMEOUT	0x20	/* args: int *, msecs */
+#define USB_BULK_FIFO_CTRL_FLUSH	0x21	/* wait for OUT urbs */
+
+struct usb_bulk_fifo {
+	struct rt_device parent;	/* see usb_bulk_fifo_register() */
+	struct usb_device *dev;
+	struct usb_bus *bus;		/* the buffers come from */
+	unsigned int pipe;
+	int nurbs;
+	int buf_size;			/* per urb, whole packets */
+	unsigned int flags;		/* URB_SHORT_NOT_OK for IN,
+					 * URB_ZERO_PACKET for OUT */
+	int timeout;			/* msecs for the rt_device, 0 is
+					 * forever */
+	/* optional, called whenever an urb becomes ready */
+	void (*notify)(struct usb_bulk_fifo *fifo, struct urb *urb);
+	void *context;			/* for the caller */
+	struct rt_semaphore ready;	/* counts ready_q */
+	struct rt_mutex lock;		/* one reader or writer at a time */
+	atomic_t running;
+	/* IN urbs ready to be read, OUT urbs free to be filled */
+	struct urb *ready_q[USB_BULK_FIFO_URBS];
+	unsigned int ready_head;
+	unsigned int ready_tail;
+	struct urb *cur;		/* IN urb being read */
+	int offset;			/* bytes of cur already read */
+	int error;			/* first failed OUT urb */
+	struct urb *urbs[USB_BULK_FIFO_URBS];
+};
+
+void usb_init_urb(struct urb *urb);
+struct urb *usb_alloc_urb(int iso_packets);
+void usb_free_urb(struct urb *urb);
+struct urb *usb_get_urb(struct urb *urb);
+int usb_submit_urb(struct urb *urb);
+int usb_unlink_urb(struct urb *urb);
+void usb_kill_urb(struct urb *urb);
+
+void usb_anchor_urb(struct urb *urb, struct usb_anchor *anchor);
+void usb_unanchor_urb(struct urb *urb);
+void usb_kill_anchored_urbs(struct usb_anchor *anchor);
+void usb_unlink_anchored_urbs(struct usb_anchor *anchor);
+void usb_scuttle_anchored_urbs(struct usb_anchor *anchor);
+struct urb *usb_get_from_anchor(struct usb_anchor *anchor);
+int usb_anchor_empty(struct usb_anchor *anchor);
+int usb_wait_anchor_empty_timeout(struct usb_anchor *anchor,
+		unsigned int timeout);
+
+int usb_urb_pool_init(struct usb_urb_pool *pool, struct usb_device *dev,
+		unsigned int pipe, int count, int iso_packets);
+struct urb *usb_urb_pool_get(struct usb_urb_pool *pool);
+int usb_urb_pool_release(struct usb_urb_pool *pool, unsigned int timeout);
+
+int usb_iso_stream_init(struct usb_iso_stream *stream,
+		struct usb_device *dev, unsigned int pipe, int nurbs,
+		int packets, int packet_size,
+		void (*complete)(struct usb_iso_stream *, struct urb *),
+		void *context);
+int usb_iso_stream_start(struct usb_iso_stream *stream);
+void usb_iso_stream_stop(struct usb_iso_stream *stream);
+void usb_iso_stream_release(struct usb_iso_stream *stream);
+
+int usb_bulk_fifo_init(struct usb_bulk_fifo *fifo,
+		struct usb_device *dev, unsigned int pipe, int nurbs,
+		int buf_size, unsigned int flags);
+int usb_bulk_fifo_start(struct usb_bulk_fifo *fifo);
+void usb_bulk_fifo_stop(struct usb_bulk_fifo *fifo);
+void usb_bulk_fifo_disconnect(struct usb_bulk_fifo *fifo);
+void usb_bulk_fifo_release(struct usb_bulk_fifo *fifo);
+rt_ssize_t usb_bulk_fifo_read(struct usb_bulk_fifo *fifo, void *buf,
+		rt_size_t size, int timeout);
+struct urb *usb_bulk_fifo_get(struct usb_bulk_fifo *fifo, int timeout);
+void usb_bulk_fifo_put(struct usb_bulk_fifo *fifo, struct urb *urb);
+rt_ssize_t usb_bulk_fifo_write(struct usb_bulk_fifo *fifo,
+		const void *buf, rt_size_t size, int timeout);
+int usb_bulk_fifo_flush(struct usb_bulk_fifo *fifo, int timeout);
+int usb_bulk_fifo_register(struct usb_bulk_fifo *fifo,
+		const char *name);
+void usb_bulk_fifo_unregister(struct usb_bulk_fifo *fifo);
+
 #endif /* __USB_URB_H__ */
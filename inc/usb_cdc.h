@@ -0,0 +1,141 @@
+#ifndef __USB_CDC_H__
+#define __USB_CDC_H__
+
+#include "usb_host.h"
+#ifdef RT_USING_LWIP
+#include <netif/ethernetif.h>
+#endif
+
+/*
+ * Communications Device Class, ACM and Ethernet (ECM) functions, see
+ * cdc.c.  An ACM function becomes a character rt_device "ttyACM<n>", an
+ * ECM function an lwIP interface "ue<n>" when lwIP is there.
+ */
+#define USB_CDC_SUBCLASS_ACM		0x02
+#define USB_CDC_SUBCLASS_ETHERNET	0x06
+
+/* class specific interface descriptors */
+#define USB_DT_CS_INTERFACE		0x24
+#define USB_CDC_UNION_TYPE		0x06
+#define USB_CDC_ETHERNET_TYPE		0x0f
+
+struct __attribute__((__packed__)) usb_cdc_union_desc {
+	uint8_t  bLength;
+	uint8_t  bDescriptorType;
+	uint8_t  bDescriptorSubType;
+	uint8_t  bMasterInterface0;
+	uint8_t  bSlaveInterface0;
+};
+
+struct __attribute__((__packed__)) usb_cdc_ether_desc {
+	uint8_t  bLength;
+	uint8_t  bDescriptorType;
+	uint8_t  bDescriptorSubType;
+	uint8_t  iMACAddress;
+	uint32_t bmEthernetStatistics;
+	uint16_t wMaxSegmentSize;
+	uint16_t wNumberMCFilters;
+	uint8_t  bNumberPowerFilters;
+};
+
+/* class requests */
+#define USB_CDC_REQ_SET_LINE_CODING		0x20
+#define USB_CDC_REQ_SET_CONTROL_LINE_STATE	0x22
+#define USB_CDC_SET_ETHERNET_PACKET_FILTER	0x43
+
+#define USB_CDC_CTRL_DTR			0x01
+#define USB_CDC_CTRL_RTS			0x02
+
+#define USB_CDC_PACKET_TYPE_ALL_MULTICAST	0x02
+#define USB_CDC_PACKET_TYPE_DIRECTED		0x04
+#define USB_CDC_PACKET_TYPE_BROADCAST		0x08
+
+struct __attribute__((__packed__)) usb_cdc_line_coding {
+	uint32_t dwDTERate;
+	uint8_t  bCharFormat;		/* 0: 1 stop bit, 1: 1.5, 2: 2 */
+	uint8_t  bParityType;		/* 0: none, 1: odd, 2: even, ... */
+	uint8_t  bDataBits;
+};
+
+/*
+ * Receive buffers are urbs of a bulk fifo and are lent out as they
+ * are: to ACM users through USB_CDC_CTRL_RX_GET, to lwIP as pbufs.
+ * Nothing is copied, and while all of them are lent out the device is
+ * NAKed.  USB_CDC_RX_SIZE must hold an Ethernet frame for ECM.  The
+ * rx and tx buffers come from the hcd's 2048 byte slab, so its
+ * HCD_POOL_BLOCKS entry must cover USB_CDC_RX_URBS + USB_CDC_TX_URBS
+ * per function.
+ */
+#ifndef USB_CDC_RX_URBS
+#define USB_CDC_RX_URBS		8	/* up to USB_BULK_FIFO_URBS */
+#endif
+#ifndef USB_CDC_RX_SIZE
+#define USB_CDC_RX_SIZE		2048
+#endif
+#ifndef USB_CDC_TX_URBS
+#define USB_CDC_TX_URBS		4
+#endif
+#ifndef USB_CDC_TX_SIZE
+#define USB_CDC_TX_SIZE		2048
+#endif
+#ifndef USB_CDC_CLOSE_TIMEOUT
+#define USB_CDC_CLOSE_TIMEOUT	1000	/* msecs close waits for tx */
+#endif
+#define USB_CDC_ETH_FRAME	1514
+
+/* ACM rt_device control commands */
+#define USB_CDC_CTRL_LINE_CODING	0x30	/* args: struct
+						 * usb_cdc_line_coding * */
+#define USB_CDC_CTRL_RX_GET		0x31	/* args: struct usb_cdc_rx_buf * */
+#define USB_CDC_CTRL_RX_PUT		0x32	/* args: struct usb_cdc_rx_buf * */
+#define USB_CDC_CTRL_TIMEOUT		0x33	/* args: int *, msecs */
+
+/* a lent receive buffer, valid until USB_CDC_CTRL_RX_PUT */
+struct usb_cdc_rx_buf {
+	void *data;
+	rt_size_t len;			/* 0 if the transfer failed */
+	void *cookie;
+};
+
+/* what ACM and ECM functions share */
+struct usb_cdc {
+	struct usb_device *udev;
+	struct usb_interface *control;	/* bound to the driver */
+	struct usb_interface *data;	/* claimed along with it */
+	int index;			/* the <n> in the device name */
+	struct usb_bulk_fifo rx;
+	struct usb_bulk_fifo tx;
+};
+
+struct usb_acm {
+	struct rt_device parent;
+	struct usb_cdc cdc;
+	struct usb_cdc_line_coding line;
+	int timeout;			/* msecs for write, 0 is forever */
+};
+
+#ifdef RT_USING_LWIP
+struct usb_ecm;
+
+/* an rx urb lent to lwIP */
+struct usb_ecm_pbuf {
+	struct pbuf_custom pc;
+	struct usb_ecm *ecm;
+	struct urb *urb;
+};
+
+struct usb_ecm {
+	struct eth_device eth;
+	struct usb_cdc cdc;
+	rt_uint8_t mac[6];
+	atomic_t refcnt;		/* the binding, plus one per pbuf
+					 * lwIP holds */
+	struct usb_ecm_pbuf pbufs[USB_CDC_RX_URBS];
+	rt_uint8_t tx_buf[USB_CDC_ETH_FRAME];	/* for chained pbufs */
+};
+#endif
+
+int usb_cdc_init(void);
+void usb_cdc_cleanup(void);
+
+#endif /* __USB_CDC_H__ */
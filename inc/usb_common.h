@@ -1,9 +1,17 @@
 #ifndef __USB_COMMON_H__
 #define __USB_COMMON_H__
 
+#include <rtthread.h>
+#include <rthw.h>
 #include <rtdevice.h>
 
 #include <stdlib.h>
+#include <errno.h>
+
+/* types kept from the linux usb core this stack is derived from */
+typedef rt_atomic_t     atomic_t;       /* shared with interrupt context */
+typedef rt_ubase_t      dma_addr_t;     /* bus address seen by the HC    */
+typedef rt_uint32_t     u32;
 
 #define USB_DYNAMIC                     0x00
 
@@ -220,6 +228,18 @@ typedef struct __attribute__((__packed__)) usb_endpoint_descriptor   /*!< Endpoi
     uint8_t  bSynchAddress;             /*!< Sync address                           */
 };                                      /*!< Endpoint descriptor structure          */
 
+/*
+ *  SETUP data for a USB device control request
+ */
+struct __attribute__((__packed__)) usb_ctrlrequest
+{
+    uint8_t  bRequestType;
+    uint8_t  bRequest;
+    uint16_t wValue;
+    uint16_t wIndex;
+    uint16_t wLength;
+};
+
 enum usb_device_speed {
 	USB_SPEED_UNKNOWN = 0,			/* enumerating */
 	USB_SPEED_LOW, USB_SPEED_FULL,		/* usb 1.1 */
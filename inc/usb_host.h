@@ -1,14 +1,149 @@
 #ifndef __USB_HOST_H__
 #define __USB_HOST_H__
 
-#include "usb_common.h"
+#include "urb.h"
+#include "usb_trace.h"
+#include "usb_quirks.h"
+#include "usb_pm.h"
 
 struct usb_device;
 struct usb_bus;
+struct usb_driver;
+
+#define USB_MAXCONFIG		8	/* Arbitrary limit */
+#define USB_MAXINTERFACES	32
+#define USB_MAXALTSETTING	128	/* Hard limit */
+#define USB_MAXENDPOINTS	30	/* Hard limit */
+#define USB_MAXCHILDREN		31	/* bounded by a hub's status bitmap */
+
+#define USB_CTRL_GET_TIMEOUT	5000	/* ms */
+#define USB_CTRL_SET_TIMEOUT	5000	/* ms */
+
+/* protocol words go out little endian */
+#ifdef ARCH_CPU_BIG_ENDIAN
+#define cpu_to_le16(x)		__builtin_bswap16(x)
+#define cpu_to_le32(x)		__builtin_bswap32(x)
+#else
+#define cpu_to_le16(x)		((uint16_t)(x))
+#define cpu_to_le32(x)		((uint32_t)(x))
+#endif
+#define le16_to_cpu(x)		cpu_to_le16(x)
+#define le32_to_cpu(x)		cpu_to_le32(x)
+
+/* USB device number allocation bitmap, updated with atomic CAS */
+#define USB_DEVMAP_BITS		(8 * sizeof(atomic_t))
 
-/* USB device number allocation bitmap */
 struct usb_devmap {
-	unsigned long devicemap[128 / (8*sizeof(unsigned long))];
+	atomic_t devicemap[128 / USB_DEVMAP_BITS];
+};
+
+/*
+ * Periodic schedule budget.
+ *
+ * One slot per frame on a full/low speed bus and one per microframe on
+ * a high speed bus, covering USB_BW_FRAMES frames; every interrupt and
+ * isochronous endpoint is placed at a phase within its period and
+ * charged to each slot it occupies.  See bandwidth.c.
+ */
+#define USB_BW_FRAMES		32	/* longest period that is scheduled */
+#define USB_BW_SLOTS		(USB_BW_FRAMES * 8)
+
+struct usb_bandwidth_stats {
+	int slots;			/* slots in use on this bus */
+	int budget;			/* usecs per slot for periodic use */
+	int max_load;			/* busiest slot, usecs */
+	int min_load;			/* idlest slot, usecs */
+	int avg_load;			/* mean over all slots, usecs */
+	int fragmentation;		/* per mille of the free time that a
+					 * period 1 endpoint can't use */
+	int int_reqs;
+	int isoc_reqs;
+	int lost;			/* altsettings left unscheduled */
+};
+
+/*
+ * Endpoint state the transfer paths use, one entry per usb_pipe_epidx()
+ * slot of a device.  It repeats what they would otherwise dig out of
+ * the descriptors, and an entry never straddles a cache line, so
+ * submitting or completing an urb touches one line of device state.
+ */
+#ifndef USB_CACHE_LINE
+#define USB_CACHE_LINE		32	/* of the target cpu */
+#endif
+
+#define USB_EP_ENABLED		0x01
+#define USB_EP_HALTED		0x02	/* stalled, see usb_clear_halt() */
+#define USB_EP_TOGGLE		0x04	/* next packet is DATA1 */
+
+struct usb_ep_state {
+	void *hcpriv;			/* for the hcd */
+	rt_uint16_t maxpacket;		/* bytes, without the mult bits */
+	rt_uint16_t interval;		/* frames, periodic endpoints */
+	rt_uint8_t type;		/* PIPE_* */
+	rt_uint8_t mult;		/* packets per (micro)frame */
+	rt_uint8_t flags;		/* USB_EP_* */
+} __attribute__ ((aligned(16)));
+
+/*
+ * Per-device control transfer, see message.c.  The urb, the setup packet
+ * and a bounce buffer are allocated with the device and reused by every
+ * control request to it, so requests of up to USB_CTRL_BUF_SIZE bytes
+ * allocate nothing.
+ */
+#ifndef USB_CTRL_BUF_SIZE
+#define USB_CTRL_BUF_SIZE	64
+#endif
+
+typedef void (*usb_ctrl_complete_t)(struct usb_device *dev, void *context,
+		int status, int actual_length);
+
+struct usb_ctrl_xfer {
+	struct rt_semaphore lock;	/* held while a request is in flight */
+	struct urb *urb;		/* RT_NULL if the device has none */
+	struct usb_ctrlrequest *setup;	/* start of the dma block */
+	dma_addr_t dma;
+	void *buf;			/* bounce buffer, after the setup */
+	void *data;			/* IN data goes here on completion */
+	usb_ctrl_complete_t complete;	/* usb_control_msg_async() only */
+	void *context;
+};
+
+/*
+ * Error recovery, see recovery.c.  Each level is tried only when the
+ * one below it failed, or didn't help for long: an error within
+ * USB_RECOVER_WINDOW of the last recovery starts one level higher.
+ */
+#define USB_RECOVER_ENDPOINT	1	/* clear halt, reset the toggles */
+#define USB_RECOVER_RESET	2	/* port reset, state restored */
+#define USB_RECOVER_REENUMERATE	3	/* disconnect, enumerate again */
+#define USB_RECOVER_LEVELS	3
+
+#ifndef USB_RECOVER_WINDOW
+#define USB_RECOVER_WINDOW	1000	/* ms */
+#endif
+#ifndef USB_RECOVER_TIMEOUT
+#define USB_RECOVER_TIMEOUT	10000	/* ms usb_recover() waits */
+#endif
+
+struct usb_recovery {
+	rt_list_t node;			/* queued for the hub thread */
+	rt_list_t parked;		/* urbs to queue afterwards */
+	volatile int active;		/* queued, running or requeueing */
+	int again;			/* asked for while requeueing */
+	int level;			/* asked for, 0 to escalate */
+	unsigned int pipe;		/* endpoint to clear, or 0 */
+	int last_level;			/* of the last recovery */
+	rt_tick_t last;			/* when it finished */
+	rt_list_t waiters;		/* in usb_recover() */
+};
+
+struct usb_recover_stats {
+	rt_uint32_t count[USB_RECOVER_LEVELS];	/* succeeded at level n+1 */
+	rt_uint32_t failed[USB_RECOVER_LEVELS];
+	rt_uint32_t time_last[USB_RECOVER_LEVELS];	/* usecs */
+	rt_uint32_t time_max[USB_RECOVER_LEVELS];
+	rt_uint64_t time_sum[USB_RECOVER_LEVELS];
+	rt_uint32_t requeued;		/* urbs redone instead of failed */
 };
 
 /*
@@ -19,10 +154,11 @@ struct usb_bus {
 	int busnum;			/* Bus number (in order of reg) */
 	uint8_t otg_port;			/* 0, or number of OTG/HNP port */
 	unsigned is_b_host:1;		/* true during some HNP roleswitches */
+	unsigned no_sg_constraint:1;	/* no sg constraint */
+	unsigned sg_tablesize;		/* 0 or largest number of sg list entries */
 
-	int devnum_next;		/* Next open device number in
+	atomic_t devnum_next;		/* Next open device number in
 					 * round-robin allocation */
-	struct rt_mutex devnum_next_mutex; /* devnum_next mutex */
 
 	struct usb_devmap devmap;	/* device address allocation map */
 	struct usb_device *root_hub;	/* Root hub */
@@ -37,11 +173,162 @@ struct usb_bus {
 					 */
 	int bandwidth_int_reqs;		/* number of Interrupt requests */
 	int bandwidth_isoc_reqs;	/* number of Isoc. requests */
+	atomic_t bandwidth_lost;	/* altsettings whose bandwidth could
+					 * not be restored after a failed
+					 * SET_INTERFACE */
+
+	int bw_slots;			/* USB_BW_FRAMES, times 8 if HS */
+	int bw_budget;			/* usecs per slot: 90% FS, 80% HS */
+	rt_uint16_t bw_load[USB_BW_SLOTS]; /* usecs reserved per slot */
 
 	unsigned resuming_ports;	/* bit array: resuming root-hub ports */
 
 };
 
+struct usb_host_endpoint {
+	struct usb_endpoint_descriptor		desc;
+	/* This is for Super Speed USB */
+	/* reserved
+	struct usb_ss_ep_comp_descriptor	ss_ep_comp;
+	struct usb_ssp_isoc_ep_comp_descriptor	ssp_isoc_ep_comp;
+	*/
+	/* urbs handed to the hcd, owned by the hcd */
+	rt_list_t							urb_list;
+	/* urbs submitted but not yet taken by the hcd */
+	struct usb_urb_ring					ring;
+
+	struct usb_device 					*udev;
+
+	/* hcd drivers */
+	void								*hcpriv;
+
+	/* for uvc devices */
+	unsigned char 						*extra;   /* Extra descriptors */
+	int 								extralen;
+	
+	int 								enabled;
+
+	/* bulk stream IDs 1..streams, see usb_alloc_streams() */
+	int 								streams;
+
+	/* isochronous schedule, see usb_hcd_iso_schedule().  iso_next is
+	 * the frame after the last packet queued and, like the ring head,
+	 * belongs to the submitter.  iso_underruns counts frames the stream
+	 * had no data for, iso_overruns urbs queued too far ahead and
+	 * babbling packets. */
+	rt_uint16_t							iso_next;
+	rt_uint16_t							iso_active;
+	rt_uint32_t							iso_underruns;
+	rt_uint32_t							iso_overruns;
+
+	/* periodic schedule placement, period 0 if not scheduled */
+	rt_uint16_t							bw_period;	/* in slots */
+	rt_uint16_t							bw_phase;	/* first slot */
+	rt_uint16_t							bw_usecs;	/* per slot */
+
+#ifdef CONFIG_USB_TRACE
+	struct usb_ep_stats					stats;
+#endif
+};
+
+/* host-side wrapper for one interface setting's parsed descriptors */
+struct usb_host_interface {
+	struct usb_interface_descriptor	desc;
+
+	int extralen;
+	unsigned char *extra;   /* Extra descriptors */
+
+	/* array of desc.bNumEndpoints endpoints associated with this
+	 * interface setting.  these will be in no particular order.
+	 */
+	struct usb_host_endpoint *endpoint;
+};
+
+struct usb_interface {
+	/* array of alternate settings for this interface,
+	 * stored in no particular order */
+	struct usb_host_interface *altsetting;
+
+	struct usb_host_interface *cur_altsetting;	/* the currently
+					 * active alternate setting */
+	unsigned num_altsetting;	/* number of alternate settings */
+
+	struct usb_device *udev;	/* device the interface belongs to */
+	struct usb_driver *driver;	/* bound driver, or NULL */
+	void *driver_data;
+};
+
+struct usb_host_config {
+	struct usb_config_descriptor	desc;
+
+	/* the interfaces associated with this configuration,
+	 * stored in no particular order */
+	struct usb_interface *interface[USB_MAXINTERFACES];
+
+	/* interface[intf_index[n] - 1] has bInterfaceNumber n, 0 if none */
+	uint8_t intf_index[USB_MAXINTERFACES];
+
+	unsigned char *extra;   /* Extra descriptors */
+	int extralen;
+};
+
+/*
+ * Everything parsed from a device's descriptors lives in one block
+ * behind this header: the usb_host_config array, interfaces,
+ * altsettings (sorted by bAlternateSetting), endpoints, the raw
+ * configuration descriptors the extra pointers refer to (unless they
+ * are shared through desc_cache), and the cached strings.  See config.c.
+ */
+struct usb_desc_arena {
+	rt_size_t size;			/* bytes after the header */
+	rt_size_t used;
+};
+
+struct usb_desc_cache;
+
+#define interface_to_usbdev(intf)	((intf)->udev)
+
+/*
+ * Interface drivers are matched on usb_device_id tables, as in linux.
+ */
+#define USB_DEVICE_ID_MATCH_VENDOR		0x0001
+#define USB_DEVICE_ID_MATCH_PRODUCT		0x0002
+#define USB_DEVICE_ID_MATCH_INT_CLASS		0x0080
+#define USB_DEVICE_ID_MATCH_INT_SUBCLASS	0x0100
+#define USB_DEVICE_ID_MATCH_INT_PROTOCOL	0x0200
+
+struct usb_device_id {
+	uint16_t match_flags;
+	uint16_t idVendor;
+	uint16_t idProduct;
+	uint8_t bInterfaceClass;
+	uint8_t bInterfaceSubClass;
+	uint8_t bInterfaceProtocol;
+};
+
+#define USB_INTERFACE_INFO(cl, sc, pr) \
+	.match_flags = USB_DEVICE_ID_MATCH_INT_CLASS | \
+		USB_DEVICE_ID_MATCH_INT_SUBCLASS | \
+		USB_DEVICE_ID_MATCH_INT_PROTOCOL, \
+	.bInterfaceClass = (cl), \
+	.bInterfaceSubClass = (sc), \
+	.bInterfaceProtocol = (pr)
+
+#define USB_INTERFACE_CLASS(cl) \
+	.match_flags = USB_DEVICE_ID_MATCH_INT_CLASS, \
+	.bInterfaceClass = (cl)
+
+struct usb_driver {
+	const char *name;
+
+	int (*probe) (struct usb_interface *intf,
+		      const struct usb_device_id *id);
+	void (*disconnect) (struct usb_interface *intf);
+
+	const struct usb_device_id *id_table;	/* ends with match_flags 0 */
+	rt_list_t list;
+};
+
 struct usb_device {
 	struct rt_device dev;
 	int		devnum;
@@ -52,15 +339,26 @@ struct usb_device {
 	enum usb_device_state	state;
 	enum usb_device_speed	speed;
 
+	/* transfer path state, indexed by usb_pipe_epidx(), ahead of the
+	 * cold enumeration data below */
+	struct usb_ep_state	ep_state[32]
+			__attribute__ ((aligned(USB_CACHE_LINE)));
+	/* enabled endpoints; ep_table[usb_pipe_epidx(pipe)] finds a pipe's
+	 * endpoint with one load, ep_out[n] and ep_in[n] by number */
+	union {
+		struct {
+			struct usb_host_endpoint *ep_out[16];
+			struct usb_host_endpoint *ep_in[16];
+		};
+		struct usb_host_endpoint *ep_table[32];
+	};
+
 	/* for ohci ehci */
 	/* reserved 
 	struct usb_tt	*tt;
 	int		ttport;
 	*/
 
-	/* toggle D0/D1 bit */
-	unsigned int toggle[2];
-
 	struct usb_device *parent;
 	struct usb_bus *bus;
 	struct usb_host_endpoint ep0;
@@ -70,10 +368,14 @@ struct usb_device {
 	struct usb_host_config *config;
 
 	struct usb_host_config *actconfig;
-	struct usb_host_endpoint *ep_in[16];
-	struct usb_host_endpoint *ep_out[16];
 
-	char **rawdescriptors;
+	char **rawdescriptors;		/* raw config descriptors */
+	struct usb_desc_arena *descs;	/* holds config, rawdescriptors
+					 * and the strings below */
+	struct usb_desc_cache *desc_cache; /* shared rawdescriptors, if
+					 * CONFIG_USB_DESC_CACHE */
+	struct usb_ctrl_xfer ctrl;	/* for usb_control_msg() */
+	struct usb_recovery recover;	/* see recovery.c */
 
 	unsigned short bus_mA;
 	/* for hub */
@@ -83,7 +385,7 @@ struct usb_device {
 	uint8_t devaddr;
 
 	unsigned can_submit:1;
-	unsigned persist_enabled:1;
+	unsigned persist_enabled:1;	/* may be reset in place */
 	unsigned have_langid:1;
 	/* not support authorized usb */
 	/* reserved
@@ -106,17 +408,21 @@ struct usb_device {
 	*/
 	int string_langid;
 
-	/* static strings from the device */
+	/* static strings from the device, in descs */
 	char *product;
 	char *manufacturer;
 	char *serial;
 
 	rt_list_t children;
+	rt_list_t sibling;		/* node in parent->children */
 
 	int maxchild;
 
-	uint32_t quirks;//?
-	int urbnum;//需要原子操作
+	uint32_t quirks;		/* USB_QUIRK_* */
+	atomic_t urbnum;		/* number of URBs submitted */
+#ifdef CONFIG_USB_PM
+	struct usb_dev_pm pm;		/* runtime suspend, see pm.c */
+#endif
 	/* not support lpm
 	unsigned long active_duration;
 
@@ -138,31 +444,96 @@ struct usb_device {
 	unsigned use_generic_driver:1;
 };
 
-struct usb_host_endpoint {
-	struct usb_endpoint_descriptor		desc;
-	/* This is for Super Speed USB */
-	/* reserved
-	struct usb_ss_ep_comp_descriptor	ss_ep_comp;
-	struct usb_ssp_isoc_ep_comp_descriptor	ssp_isoc_ep_comp;
-	*/
-	rt_list_t							urb_list;
-
-	struct usb_device 					*udev;
-
-	/* hcd drivers */
-	void								*hcpriv;
-
-	/* for uvc devices */
-	unsigned char 						*extra;   /* Extra descriptors */
-	int 								extralen;
-	
-	int 								enabled;
-
-	/* reserved */
-	int 								streams;
-};
-
 
 
+/* usb_host.c */
+struct usb_device *usb_alloc_dev(struct usb_device *parent,
+		struct usb_bus *bus, unsigned port1);
+void usb_put_dev(struct usb_device *udev);
+int usb_alloc_devnum(struct usb_bus *bus);
+void usb_free_devnum(struct usb_bus *bus, int devnum);
+int usb_register_driver(struct usb_driver *driver);
+void usb_deregister(struct usb_driver *driver);
+void usb_probe_interfaces(struct usb_device *udev);
+void usb_unbind_interfaces(struct usb_device *udev);
+void usb_enable_interface(struct usb_device *dev,
+		struct usb_host_interface *alt);
+void usb_disable_interface(struct usb_device *dev,
+		struct usb_host_interface *alt);
+void usb_disable_endpoint(struct usb_device *dev, unsigned int epaddr);
+void usb_ep0_reinit(struct usb_device *udev);
+
+/* hcd.c */
+int usb_get_current_frame_number(struct usb_device *dev);
+int usb_alloc_streams(struct usb_interface *interface,
+		struct usb_host_endpoint **eps, unsigned int num_eps,
+		unsigned int num_streams);
+int usb_free_streams(struct usb_interface *interface,
+		struct usb_host_endpoint **eps, unsigned int num_eps);
+
+/* config.c */
+int usb_get_configuration(struct usb_device *dev);
+void usb_destroy_configuration(struct usb_device *dev);
+struct usb_interface *usb_ifnum_to_if(const struct usb_device *dev,
+		unsigned ifnum);
+struct usb_host_interface *usb_altnum_to_altsetting(
+		const struct usb_interface *intf, unsigned int altnum);
+
+/* recovery.c */
+void usb_recover_init(struct usb_device *udev);
+void usb_recover_cancel(struct usb_device *udev);
+void usb_queue_recovery(struct usb_device *udev, unsigned int pipe,
+		int level);
+int usb_recover(struct usb_device *udev, unsigned int pipe, int level);
+void usb_recover_work(void);
+int usb_recover_submit(struct urb *urb);
+int usb_recover_park(struct urb *urb);
+void usb_recover_account(int level, int status, rt_uint32_t usecs);
+void usb_recover_get_stats(struct usb_recover_stats *stats);
+
+/* message.c */
+int usb_ctrl_init(struct usb_device *dev);
+void usb_ctrl_release(struct usb_device *dev);
+int usb_control_msg(struct usb_device *dev, unsigned int pipe,
+		uint8_t request, uint8_t requesttype, uint16_t value,
+		uint16_t index, void *data, uint16_t size, int timeout);
+int usb_control_msg_async(struct usb_device *dev, unsigned int pipe,
+		uint8_t request, uint8_t requesttype, uint16_t value,
+		uint16_t index, void *data, uint16_t size,
+		usb_ctrl_complete_t complete, void *context);
+int usb_bulk_msg(struct usb_device *usb_dev, unsigned int pipe,
+		void *data, int len, int *actual_length, int timeout);
+int usb_get_descriptor(struct usb_device *dev, unsigned char desctype,
+		unsigned char descindex, void *buf, int size);
+int usb_get_device_descriptor(struct usb_device *dev, unsigned int size);
+int usb_string(struct usb_device *dev, int index, char *buf, rt_size_t size);
+char *usb_cache_string(struct usb_device *udev, int index);
+void usb_disable_device(struct usb_device *dev);
+int usb_clear_halt(struct usb_device *dev, unsigned int pipe);
+int usb_set_configuration(struct usb_device *dev, int configuration);
+int usb_set_interface(struct usb_device *dev, int ifnum, int alternate);
+
+rt_inline struct usb_host_endpoint *
+usb_pipe_endpoint(struct usb_device *dev, unsigned int pipe)
+{
+	return dev->ep_table[usb_pipe_epidx(pipe)];
+}
+
+rt_inline struct usb_ep_state *
+usb_pipe_ep_state(struct usb_device *dev, unsigned int pipe)
+{
+	return &dev->ep_state[usb_pipe_epidx(pipe)];
+}
+
+/* data toggle of a pipe's endpoint, kept by hcds without their own */
+#define usb_gettoggle(dev, pipe) \
+	((usb_pipe_ep_state(dev, pipe)->flags & USB_EP_TOGGLE) != 0)
+#define usb_dotoggle(dev, pipe) \
+	(usb_pipe_ep_state(dev, pipe)->flags ^= USB_EP_TOGGLE)
+#define usb_settoggle(dev, pipe, bit) do { \
+	struct usb_ep_state *__st = usb_pipe_ep_state(dev, pipe); \
+	__st->flags = (__st->flags & ~USB_EP_TOGGLE) | \
+			((bit) ? USB_EP_TOGGLE : 0); \
+} while (0)
 
 #endif /* __USB_HOST_H__ */
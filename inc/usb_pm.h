@@ -0,0 +1,70 @@
+#ifndef __USB_PM_H__
+#define __USB_PM_H__
+
+#include "usb_common.h"
+
+/*
+ * Runtime power management, see pm.c.
+ *
+ * With CONFIG_USB_PM set, a device that had no urb in flight and none
+ * submitted for its autosuspend delay is suspended through the port of
+ * its parent hub.  The next urb submitted to it resumes it first, and a
+ * device that is allowed to wake the host resumes itself.  Hubs, root
+ * hubs and devices with USB_QUIRK_RESET_RESUME are never suspended.
+ */
+#ifndef USB_AUTOSUSPEND_DELAY
+#define USB_AUTOSUSPEND_DELAY	2000	/* ms, negative to stay awake */
+#endif
+#define USB_SUSPEND_TIME	10	/* ms for the device to suspend */
+#define USB_RESUME_TIME		20	/* ms of resume signalling, TDRSMDN */
+#define USB_RESUME_RECOVERY	10	/* ms, TRSMRCY */
+
+/* resume latency as seen by the first urb after a suspend, in usecs */
+struct usb_pm_stats {
+	rt_uint32_t suspends;
+	rt_uint32_t resumes;		/* started by an urb or the driver */
+	rt_uint32_t wakeups;		/* started by the device */
+	rt_uint32_t lat_last;
+	rt_uint32_t lat_max;
+	rt_uint64_t lat_sum;		/* over resumes */
+};
+
+#ifdef CONFIG_USB_PM
+struct usb_dev_pm {
+	rt_list_t node;			/* in the list of pm.c */
+	struct rt_mutex lock;		/* serializes suspend and resume */
+	struct rt_timer timer;		/* idle check, every delay ms */
+	int delay;			/* autosuspend delay, ms */
+	rt_uint32_t last_urbnum;	/* urbnum at the last idle check */
+	atomic_t active;		/* urbs in flight */
+	atomic_t usage;			/* usb_autopm_get() references */
+	atomic_t request;		/* for the hub thread, see pm.c */
+	unsigned allowed:1;		/* set by usb_pm_start() */
+	unsigned remote_wakeup:1;	/* the device may wake us */
+	struct usb_pm_stats stats;
+};
+#endif
+
+struct usb_device;
+
+#ifdef CONFIG_USB_PM
+void usb_pm_init_dev(struct usb_device *udev);
+void usb_pm_release_dev(struct usb_device *udev);
+void usb_pm_start(struct usb_device *udev);
+void usb_pm_work(void);
+int usb_autoresume_device(struct usb_device *udev);
+void usb_pm_remote_wakeup(struct usb_device *udev);
+int usb_autopm_get(struct usb_device *udev);
+void usb_autopm_put(struct usb_device *udev);
+void usb_pm_set_autosuspend(struct usb_device *udev, int delay);
+void usb_pm_get_stats(struct usb_device *udev, struct usb_pm_stats *stats);
+#else
+#define usb_pm_init_dev(udev)		do { } while (0)
+#define usb_pm_release_dev(udev)	do { } while (0)
+#define usb_pm_start(udev)		do { } while (0)
+#define usb_autoresume_device(udev)	(-EHOSTUNREACH)
+#define usb_autopm_get(udev)		0
+#define usb_autopm_put(udev)		do { } while (0)
+#endif
+
+#endif /* __USB_PM_H__ */
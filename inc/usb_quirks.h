@@ -0,0 +1,48 @@
+#ifndef __USB_QUIRKS_H__
+#define __USB_QUIRKS_H__
+
+#include "usb_common.h"
+
+/*
+ * Device quirks, usb_device->quirks, see quirks.c.  They are looked up
+ * by vendor, product and bcdDevice as soon as the device descriptor is
+ * known, and applied by the core from then on.
+ */
+#define USB_QUIRK_NO_STRINGS		0x0001	/* don't read product,
+						 * manufacturer, serial */
+#define USB_QUIRK_RESET_RESUME		0x0002	/* reset instead of resume */
+#define USB_QUIRK_NO_SET_INTF		0x0004	/* never SET_INTERFACE */
+#define USB_QUIRK_DELAY_SET_ADDRESS	0x0008	/* slow SET_ADDRESS
+						 * recovery */
+#define USB_QUIRK_EP0_MAXP_8		0x0010	/* use 8 byte control
+						 * packets whatever the
+						 * descriptor says */
+
+#ifndef USB_QUIRK_ADDRESS_DELAY
+#define USB_QUIRK_ADDRESS_DELAY		100	/* ms, with
+						 * USB_QUIRK_DELAY_SET_ADDRESS */
+#endif
+
+struct usb_quirk_entry {
+	rt_uint32_t id;			/* idVendor << 16 | idProduct */
+	rt_uint16_t bcd_lo;		/* bcdDevice range, inclusive */
+	rt_uint16_t bcd_hi;
+	rt_uint32_t quirks;
+};
+
+#define USB_QUIRK_DEVICE_VER(vend, prod, lo, hi, q) \
+	{ .id = (vend) << 16 | (prod), .bcd_lo = (lo), .bcd_hi = (hi), \
+	  .quirks = (q) }
+#define USB_QUIRK_DEVICE(vend, prod, q) \
+	USB_QUIRK_DEVICE_VER(vend, prod, 0x0000, 0xffff, q)
+
+struct usb_device;
+struct usb_device_descriptor;
+
+rt_uint32_t usb_quirks_lookup(rt_uint16_t vendor, rt_uint16_t product,
+		rt_uint16_t bcd);
+void usb_detect_quirks(struct usb_device *udev,
+		const struct usb_device_descriptor *desc);
+int usb_quirks_set_table(const struct usb_quirk_entry *table, int count);
+
+#endif /* __USB_QUIRKS_H__ */
@@ -0,0 +1,119 @@
+#ifndef __USB_STORAGE_H__
+#define __USB_STORAGE_H__
+
+#include "usb_host.h"
+
+/*
+ * Mass storage, Bulk-Only Transport with the SCSI command set, see
+ * storage.c.  Each logical unit with media becomes a block rt_device
+ * named "ud<n>-<lun>" in front of a write-back sector cache.
+ */
+#define US_SC_SCSI		0x06	/* bInterfaceSubClass */
+#define US_PR_BULK		0x50	/* bInterfaceProtocol */
+
+#define US_BULK_RESET_REQUEST	0xff
+#define US_BULK_GET_MAX_LUN	0xfe
+
+#define US_BULK_CB_SIGN		0x43425355	/* "USBC" */
+#define US_BULK_CB_WRAP_LEN	31
+#define US_BULK_FLAG_IN		0x80
+
+struct __attribute__((__packed__)) bulk_cb_wrap {
+	uint32_t Signature;
+	uint32_t Tag;
+	uint32_t DataTransferLength;
+	uint8_t  Flags;
+	uint8_t  Lun;
+	uint8_t  Length;		/* of CDB, 1 to 16 */
+	uint8_t  CDB[16];
+};
+
+#define US_BULK_CS_SIGN		0x53425355	/* "USBS" */
+#define US_BULK_CS_WRAP_LEN	13
+#define US_BULK_STAT_OK		0
+#define US_BULK_STAT_FAIL	1
+#define US_BULK_STAT_PHASE	2
+
+struct __attribute__((__packed__)) bulk_cs_wrap {
+	uint32_t Signature;
+	uint32_t Tag;
+	uint32_t Residue;
+	uint8_t  Status;
+};
+
+/*
+ * The cache of a unit is one buffer of US_CACHE_LINES lines, each
+ * US_CACHE_LINE_SIZE bytes of consecutive sectors.  Line n of the disk
+ * can only live in slot n % US_CACHE_LINES, so neighbouring lines are
+ * neighbours in memory too, and one READ(10) or WRITE(10) moves as many
+ * of them as are due.  US_CACHE_READAHEAD lines are fetched at once
+ * when reads are sequential.
+ */
+#ifndef US_CACHE_LINES
+#define US_CACHE_LINES		8
+#endif
+#ifndef US_CACHE_LINE_SIZE
+#define US_CACHE_LINE_SIZE	4096	/* up to 32 sectors */
+#endif
+#ifndef US_CACHE_READAHEAD
+#define US_CACHE_READAHEAD	4
+#endif
+#ifndef US_MAX_LUNS
+#define US_MAX_LUNS		4
+#endif
+#ifndef US_TIMEOUT
+#define US_TIMEOUT		10000	/* ms, for a whole command */
+#endif
+
+struct us_cache_line {
+	rt_uint32_t line;		/* disk line held, if valid != 0 */
+	rt_uint32_t valid;		/* bit per sector */
+	rt_uint32_t dirty;		/* subset of valid */
+};
+
+struct us_data;
+
+struct us_lun {
+	struct rt_device parent;	/* block device */
+	struct us_data *us;
+	int lun;
+	rt_uint32_t capacity;		/* in sectors */
+	rt_uint32_t sector_size;
+	rt_uint32_t line_sectors;	/* sectors per cache line */
+	rt_uint32_t next_sector;	/* end of the last read */
+	int sequential;			/* reads in a row at next_sector */
+	uint8_t *cache;			/* US_CACHE_LINES lines */
+	dma_addr_t cache_dma;
+	struct us_cache_line lines[US_CACHE_LINES];
+};
+
+struct us_data {
+	struct usb_device *udev;
+	struct usb_interface *intf;
+	unsigned int send_pipe;
+	unsigned int recv_pipe;
+	int index;			/* the <n> in the device names, or
+					 * -1 */
+	int nluns;
+
+	/* one command at a time, all three phases queued at once */
+	struct rt_mutex lock;
+	struct urb *cbw_urb;
+	struct urb *data_urb;
+	struct urb *csw_urb;
+	atomic_t pending;		/* urbs not given back yet */
+	volatile int aborted;		/* a phase failed */
+	struct rt_completion done;
+	rt_uint32_t tag;
+
+	uint8_t *iobuf;			/* cbw, csw and small replies */
+	dma_addr_t iobuf_dma;
+	volatile int gone;		/* disconnected */
+
+	struct us_lun *luns[US_MAX_LUNS];
+};
+
+int usb_storage_init(void);
+void usb_storage_cleanup(void);
+
+#endif /* __USB_STORAGE_H__ */
@@ -0,0 +1,104 @@
+#ifndef __USB_TRACE_H__
+#define __USB_TRACE_H__
+
+#include "usb_common.h"
+
+/*
+ * Hot path instrumentation, see trace.c.
+ *
+ * With CONFIG_USB_TRACE set, every urb given back is accounted to its
+ * endpoint in struct usb_ep_stats, and submissions and givebacks are
+ * logged to a trace ring per cpu.  Without it the hooks in hcd.h are
+ * empty and neither the counters nor the urb timestamp exist.
+ */
+#ifndef USB_TRACE_RING_SIZE
+#define USB_TRACE_RING_SIZE	256	/* records per cpu, a power of two */
+#endif
+#ifndef USB_TRACE_BUSES
+#define USB_TRACE_BUSES		4
+#endif
+
+/*
+ * Microsecond timestamps; 32 bits wrap after about 71 minutes, which
+ * only the absolute record times notice.
+ */
+#ifndef usb_trace_clock
+#ifdef RT_USING_CPUTIME
+#define usb_trace_clock() \
+	((rt_uint32_t)clock_cpu_microsecond(clock_cpu_gettime()))
+#else
+#define usb_trace_clock() \
+	((rt_uint32_t)rt_tick_get() * (1000000 / RT_TICK_PER_SECOND))
+#endif
+#endif
+
+#ifdef RT_USING_SMP
+#define USB_TRACE_CPUS		RT_CPUS_NR
+#define usb_trace_cpu()		rt_hw_cpu_id()
+#else
+#define USB_TRACE_CPUS		1
+#define usb_trace_cpu()		0
+#endif
+
+/* per endpoint, updated on giveback by the hcd that owns the endpoint */
+struct usb_ep_stats {
+	rt_uint32_t urbs;		/* given back */
+	rt_uint32_t bytes;		/* actual_length of those */
+	rt_uint32_t naks;		/* reported by the hcd */
+	rt_uint32_t short_xfers;	/* ended by a short packet */
+	rt_uint32_t errors;		/* failed urbs and iso packets */
+	rt_uint32_t lat_min;		/* submit to giveback, usecs */
+	rt_uint32_t lat_max;
+	rt_uint64_t lat_sum;		/* lat_sum / urbs is the average */
+};
+
+#define USB_TRACE_SUBMIT	1	/* status is the submit result */
+#define USB_TRACE_GIVEBACK	2
+
+struct usb_trace_record {
+	rt_uint32_t seq;		/* 1 + ring position, 0 if unused */
+	rt_uint32_t time;		/* usecs, usb_trace_clock() */
+	rt_uint32_t pipe;
+	rt_int32_t status;
+	rt_uint32_t length;		/* requested on submit, actual on
+					 * giveback */
+	rt_uint32_t latency;		/* usecs, giveback only */
+	rt_uint32_t urb;		/* low bits of the urb's address */
+	rt_uint8_t event;		/* USB_TRACE_* */
+	rt_uint8_t cpu;
+	rt_uint16_t busnum;
+};
+
+/*
+ * usb_trace_dump() output: this header, then count records, each ring
+ * oldest first.  All fields are in the cpu's byte order, which the
+ * magic tells.
+ */
+#define USB_TRACE_MAGIC		0x54425355	/* "USBT" little endian */
+#define USB_TRACE_VERSION	1
+
+struct usb_trace_dump_header {
+	rt_uint32_t magic;
+	rt_uint16_t version;
+	rt_uint16_t record_size;
+	rt_uint32_t count;
+	rt_uint32_t time;		/* usb_trace_clock() at the dump */
+};
+
+struct usb_bus;
+struct usb_host_endpoint;
+
+#ifdef CONFIG_USB_TRACE
+void usb_trace_add_bus(struct usb_bus *bus);
+void usb_trace_remove_bus(struct usb_bus *bus);
+void usb_trace_get_stats(struct usb_host_endpoint *ep,
+		struct usb_ep_stats *stats);
+void usb_trace_clear(void);
+int usb_trace_dump(rt_size_t (*write)(void *ctx, const void *buf,
+		rt_size_t len), void *ctx);
+#else
+#define usb_trace_add_bus(bus)		do { } while (0)
+#define usb_trace_remove_bus(bus)	do { } while (0)
+#endif
+
+#endif /* __USB_TRACE_H__ */
@@ -0,0 +1,366 @@
+#include "hcd.h"
+
+/*
+ * Periodic bandwidth scheduling.
+ *
+ * The bus keeps a budget table of USB_BW_FRAMES frames, one slot per
+ * frame at full/low speed and one per microframe at high speed.  An
+ * interrupt or isochronous endpoint with a period of P slots occupies
+ * every P-th slot starting at its phase; the phase is chosen so that the
+ * busiest slot it lands on is as idle as possible.  A request that would
+ * push any slot past 90% (FS) or 80% (HS) of its time is refused, which
+ * is what turns a silent frame overrun into an error at
+ * SET_CONFIGURATION or SET_INTERFACE time.
+ *
+ * Transaction translators are not modelled: a full or low speed
+ * endpoint behind a high speed hub is charged its full speed time in
+ * the microframe it starts in, which overstates its cost on the high
+ * speed bus and never checks the TT's own 1 ms frame budget.
+ */
+
+#define BW_HOST_DELAY	1000L		/* nanoseconds */
+#define BW_HUB_LS_SETUP	333L		/* nanoseconds */
+
+#define BitTime(bytecount)	(7 * 8 * (bytecount) / 6)
+#define NS_TO_US(ns)		(((ns) + 999L) / 1000L)
+
+#define HS_HOST_DELAY	5		/* nanoseconds */
+#define HS_NSECS(bytes)	(((55 * 8 * 2083) \
+	+ (2083UL * (3 + BitTime(bytes))))/1000 \
+	+ HS_HOST_DELAY)
+#define HS_NSECS_ISO(bytes) (((38 * 8 * 2 * 2083) \
+	+ (2083UL * (3 + BitTime(bytes))))/1000 \
+	+ HS_HOST_DELAY)
+
+#define FRAME_TIME_USECS	1000L
+#define UFRAME_TIME_USECS	125L
+
+/**
+ * usb_calc_bus_time - approximate periodic transaction time in nanoseconds
+ * @speed: from dev->speed; USB_SPEED_{LOW,FULL,HIGH}
+ * @is_input: true iff the transaction sends data to the host
+ * @isoc: true for isochronous transactions, false for interrupt ones
+ * @bytecount: how many bytes in the transaction.
+ *
+ * Return: Approximate bus time in nanoseconds for a periodic transaction.
+ *
+ * Note:
+ * See USB 2.0 spec section 5.11.3; only periodic transfers need to be
+ * scheduled in software, this function is only used for such scheduling.
+ */
+int usb_calc_bus_time(int speed, int is_input, int isoc, int bytecount)
+{
+	unsigned long tmp;
+
+	switch (speed) {
+	case USB_SPEED_LOW:	/* INTR only */
+		if (is_input) {
+			tmp = (67667L * (31L + 10L * BitTime(bytecount))) / 1000L;
+			return 64060L + (2 * BW_HUB_LS_SETUP) + BW_HOST_DELAY + tmp;
+		} else {
+			tmp = (66700L * (31L + 10L * BitTime(bytecount))) / 1000L;
+			return 64107L + (2 * BW_HUB_LS_SETUP) + BW_HOST_DELAY + tmp;
+		}
+	case USB_SPEED_FULL:	/* ISOC or INTR */
+		if (isoc) {
+			tmp = (8354L * (31L + 10L * BitTime(bytecount))) / 1000L;
+			return ((is_input) ? 7268L : 6265L) + BW_HOST_DELAY + tmp;
+		} else {
+			tmp = (8354L * (31L + 10L * BitTime(bytecount))) / 1000L;
+			return 9107L + BW_HOST_DELAY + tmp;
+		}
+	case USB_SPEED_HIGH:	/* ISOC or INTR */
+		if (isoc)
+			tmp = HS_NSECS_ISO(bytecount);
+		else
+			tmp = HS_NSECS(bytecount);
+		return tmp;
+	default:
+		return -1;
+	}
+}
+
+void usb_bandwidth_init(struct usb_hcd *hcd)
+{
+	struct usb_bus *bus = hcd_to_bus(hcd);
+
+	if ((hcd->driver->flags & HCD_MASK) == HCD_USB2) {
+		bus->bw_slots = USB_BW_FRAMES * 8;
+		bus->bw_budget = UFRAME_TIME_USECS * 80 / 100;
+	} else {
+		bus->bw_slots = USB_BW_FRAMES;
+		bus->bw_budget = FRAME_TIME_USECS * 90 / 100;
+	}
+	rt_memset(bus->bw_load, 0, sizeof(bus->bw_load));
+}
+
+/* period in slots of the bus table, a power of two */
+static int bw_period(struct usb_bus *bus, struct usb_host_endpoint *ep)
+{
+	int speed = ep->udev->speed;
+	int interval = ep->desc.bInterval;
+	int isoc = (ep->desc.bmAttributes & USB_EP_ATTR_TYPE_MASK) ==
+			USB_EP_ATTR_ISOC;
+	int period;
+
+	if (interval < 1)
+		interval = 1;
+
+	if (speed == USB_SPEED_HIGH || isoc) {
+		/* 2^(bInterval-1) (micro)frames */
+		if (interval > 16)
+			interval = 16;
+		period = 1 << (interval - 1);
+	} else {
+		/* full/low speed interrupt: bInterval frames, rounded down */
+		period = 1;
+		while (period * 2 <= interval)
+			period *= 2;
+	}
+
+	/* full/low speed periods count frames, the HS table microframes */
+	if (speed != USB_SPEED_HIGH && bus->bw_slots != USB_BW_FRAMES)
+		period *= 8;
+
+	if (period > bus->bw_slots)
+		period = bus->bw_slots;
+	return period;
+}
+
+static int bw_usecs(struct usb_host_endpoint *ep)
+{
+	int maxp = ep->desc.wMaxPacketSize & 0x7ff;
+	int mult = ((ep->desc.wMaxPacketSize >> 11) & 3) + 1;
+	int isoc = (ep->desc.bmAttributes & USB_EP_ATTR_TYPE_MASK) ==
+			USB_EP_ATTR_ISOC;
+	int is_in = ep->desc.bEndpointAddress & USB_DIR_IN;
+	long ns;
+
+	ns = usb_calc_bus_time(ep->udev->speed, is_in, isoc, maxp);
+	if (ns < 0)
+		return -1;
+	if (ep->udev->speed != USB_SPEED_HIGH)
+		mult = 1;
+	return NS_TO_US(ns) * mult;
+}
+
+rt_inline int bw_is_periodic(struct usb_host_endpoint *ep)
+{
+	int type = ep->desc.bmAttributes & USB_EP_ATTR_TYPE_MASK;
+
+	return type == USB_EP_ATTR_ISOC || type == USB_EP_ATTR_INT;
+}
+
+/* least loaded phase that still fits @usecs, or -1 */
+static int bw_find_phase(struct usb_bus *bus, int period, int usecs)
+{
+	int phase, slot, worst;
+	int best = -1, best_worst = bus->bw_budget + 1;
+
+	for (phase = 0; phase < period; phase++) {
+		worst = 0;
+		for (slot = phase; slot < bus->bw_slots; slot += period)
+			if (bus->bw_load[slot] > worst)
+				worst = bus->bw_load[slot];
+		if (worst + usecs <= bus->bw_budget && worst < best_worst) {
+			best = phase;
+			best_worst = worst;
+		}
+	}
+	return best;
+}
+
+/* average usecs per frame an endpoint costs, for bandwidth_allocated */
+rt_inline int bw_per_frame(struct usb_bus *bus, struct usb_host_endpoint *ep)
+{
+	return ep->bw_usecs * (bus->bw_slots / USB_BW_FRAMES) / ep->bw_period;
+}
+
+static void bw_charge(struct usb_bus *bus, struct usb_host_endpoint *ep,
+		int sign)
+{
+	int slot;
+
+	for (slot = ep->bw_phase; slot < bus->bw_slots; slot += ep->bw_period)
+		bus->bw_load[slot] += sign * ep->bw_usecs;
+
+	bus->bandwidth_allocated += sign * bw_per_frame(bus, ep);
+	if ((ep->desc.bmAttributes & USB_EP_ATTR_TYPE_MASK) == USB_EP_ATTR_ISOC)
+		bus->bandwidth_isoc_reqs += sign;
+	else
+		bus->bandwidth_int_reqs += sign;
+}
+
+/**
+ * usb_bandwidth_release - give back the periodic time of endpoints
+ * @bus: bus the endpoints are scheduled on
+ * @eps: endpoints, non-periodic and unscheduled ones are skipped
+ * @count: number of entries in @eps
+ *
+ * Caller holds the hcd's bandwidth_mutex.
+ */
+void usb_bandwidth_release(struct usb_bus *bus,
+		struct usb_host_endpoint **eps, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (!eps[i] || !eps[i]->bw_period)
+			continue;
+		bw_charge(bus, eps[i], -1);
+		eps[i]->bw_period = 0;
+	}
+}
+
+/**
+ * usb_bandwidth_reserve - place endpoints in the periodic schedule
+ * @bus: bus to schedule on
+ * @eps: endpoints, non-periodic ones are skipped
+ * @count: number of entries in @eps
+ *
+ * All or nothing: if one endpoint does not fit, the ones placed so far
+ * are released again.  Caller holds the hcd's bandwidth_mutex.
+ *
+ * Return: 0 on success, -ENOSPC if the schedule would be oversubscribed.
+ */
+int usb_bandwidth_reserve(struct usb_bus *bus,
+		struct usb_host_endpoint **eps, int count)
+{
+	struct usb_host_endpoint *ep;
+	int i, period, usecs, phase;
+
+	for (i = 0; i < count; i++) {
+		ep = eps[i];
+		if (!ep || !bw_is_periodic(ep) || ep->bw_period)
+			continue;
+
+		period = bw_period(bus, ep);
+		usecs = bw_usecs(ep);
+		phase = usecs < 0 ? -1 : bw_find_phase(bus, period, usecs);
+		if (phase < 0) {
+			usb_bandwidth_release(bus, eps, i);
+			return -ENOSPC;
+		}
+
+		ep->bw_period = period;
+		ep->bw_phase = phase;
+		ep->bw_usecs = usecs;
+		bw_charge(bus, ep, 1);
+	}
+	return 0;
+}
+
+/* usb_hcd_check_bandwidth() keeps one bit per old endpoint */
+#if USB_MAXENDPOINTS > 32
+#error "USB_MAXENDPOINTS does not fit the placed mask"
+#endif
+
+/*
+ * Put endpoints back at the phases they had before a failed swap.  The
+ * phases are saved by the caller, since an endpoint in both sets was
+ * moved by the attempt.
+ */
+static void bw_restore(struct usb_bus *bus, struct usb_host_endpoint **eps,
+		int count, rt_uint32_t placed, const rt_uint16_t *phases)
+{
+	struct usb_host_endpoint *ep;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (!(placed & (1UL << i)))
+			continue;
+		ep = eps[i];
+		ep->bw_period = bw_period(bus, ep);
+		ep->bw_phase = phases[i];
+		ep->bw_usecs = bw_usecs(ep);
+		bw_charge(bus, ep, 1);
+	}
+}
+
+/**
+ * usb_hcd_check_bandwidth - swap one set of periodic endpoints for another
+ * @udev: device being configured
+ * @old_eps: endpoints of the configuration or altsetting being left
+ * @old_count: number of entries in @old_eps
+ * @new_eps: endpoints of the configuration or altsetting being selected
+ * @new_count: number of entries in @new_eps
+ *
+ * Called before SET_CONFIGURATION or SET_INTERFACE goes out.  On failure
+ * the old endpoints are back in the very slots they had, and the
+ * request must not be sent.  Either set holds at most USB_MAXENDPOINTS
+ * entries, the most one configuration can have.
+ *
+ * Return: 0 on success, -EINVAL if a set is too large, -ENOSPC if the
+ * new set does not fit.
+ */
+int usb_hcd_check_bandwidth(struct usb_device *udev,
+		struct usb_host_endpoint **old_eps, int old_count,
+		struct usb_host_endpoint **new_eps, int new_count)
+{
+	struct usb_hcd *hcd = bus_to_hcd(udev->bus);
+	struct usb_bus *bus = udev->bus;
+	rt_uint16_t phases[USB_MAXENDPOINTS];
+	rt_uint32_t placed = 0;
+	int i, ret;
+
+	/* the root hub's status endpoint never goes out on the wire */
+	if (!udev->parent)
+		return 0;
+
+	if (old_count > USB_MAXENDPOINTS || new_count > USB_MAXENDPOINTS)
+		return -EINVAL;
+	rt_mutex_take(hcd->primary_hcd->bandwidth_mutex, RT_WAITING_FOREVER);
+	for (i = 0; i < old_count; i++) {
+		if (old_eps[i] && old_eps[i]->bw_period) {
+			placed |= 1UL << i;
+			phases[i] = old_eps[i]->bw_phase;
+		}
+	}
+	usb_bandwidth_release(bus, old_eps, old_count);
+	ret = usb_bandwidth_reserve(bus, new_eps, new_count);
+	if (ret)
+		bw_restore(bus, old_eps, old_count, placed, phases);
+	rt_mutex_release(hcd->primary_hcd->bandwidth_mutex);
+	return ret;
+}
+
+/**
+ * usb_bandwidth_get_stats - summarize the periodic schedule of a bus
+ * @bus: bus to report on
+ * @stats: filled in
+ *
+ * Fragmentation is the share of the free time that is stranded: free in
+ * some slots but unusable by an endpoint polling every slot, because
+ * the busiest slot caps what such an endpoint may take.
+ */
+void usb_bandwidth_get_stats(struct usb_bus *bus,
+		struct usb_bandwidth_stats *stats)
+{
+	struct usb_hcd *hcd = bus_to_hcd(bus);
+	long total = 0, free_time, usable;
+	int slot, load;
+
+	rt_mutex_take(hcd->primary_hcd->bandwidth_mutex, RT_WAITING_FOREVER);
+	stats->slots = bus->bw_slots;
+	stats->budget = bus->bw_budget;
+	stats->max_load = 0;
+	stats->min_load = bus->bw_budget;
+	for (slot = 0; slot < bus->bw_slots; slot++) {
+		load = bus->bw_load[slot];
+		total += load;
+		if (load > stats->max_load)
+			stats->max_load = load;
+		if (load < stats->min_load)
+			stats->min_load = load;
+	}
+	stats->int_reqs = bus->bandwidth_int_reqs;
+	stats->isoc_reqs = bus->bandwidth_isoc_reqs;
+	stats->lost = rt_atomic_load(&bus->bandwidth_lost);
+	rt_mutex_release(hcd->primary_hcd->bandwidth_mutex);
+
+	stats->avg_load = bus->bw_slots ? total / bus->bw_slots : 0;
+	free_time = (long)bus->bw_slots * bus->bw_budget - total;
+	usable = (long)bus->bw_slots * (bus->bw_budget - stats->max_load);
+	stats->fragmentation = free_time > 0 ?
+			(int)((free_time - usable) * 1000 / free_time) : 0;
+}
@@ -0,0 +1,241 @@
+#include "hcd.h"
+
+/*
+ * DMA memory management for framework level HCD code (hc_driver)
+ *
+ * This implementation plugs in through generic "usb_bus" level methods,
+ * and should work with all USB controllers.
+ */
+
+/* buffer sizes of the four size classes, must stay in ascending order */
+static const rt_size_t pool_max[HCD_BUFFER_POOLS] = {
+	32, 128, 512, 2048,
+};
+
+static const rt_size_t pool_blocks[HCD_BUFFER_POOLS] = HCD_POOL_BLOCKS;
+
+static struct dma_pool *dma_pool_create(rt_size_t size, rt_size_t blocks)
+{
+	struct dma_pool *pool;
+	char *block;
+	rt_size_t i;
+
+	pool = rt_calloc(1, sizeof(*pool));
+	if (!pool)
+		return RT_NULL;
+
+	pool->size = RT_ALIGN(size, USB_DMA_ALIGN);
+	pool->blocks = blocks;
+	pool->vaddr = rt_malloc_align(pool->size * blocks, USB_DMA_ALIGN);
+	if (!pool->vaddr) {
+		rt_free(pool);
+		return RT_NULL;
+	}
+
+	/* thread the free list back to front so blocks go out in order */
+	for (i = blocks; i > 0; i--) {
+		block = pool->vaddr + (i - 1) * pool->size;
+		*(void **)block = pool->free_list;
+		pool->free_list = block;
+	}
+	return pool;
+}
+
+static void dma_pool_destroy(struct dma_pool *pool)
+{
+	if (!pool)
+		return;
+	if (pool->in_use)
+		usb_dbg("usb: dma_pool %d destroyed with %d busy blocks\n",
+				(int)pool->size, (int)pool->in_use);
+	rt_free_align(pool->vaddr);
+	rt_free(pool);
+}
+
+rt_inline rt_bool_t dma_pool_owns(struct dma_pool *pool, void *addr)
+{
+	char *p = addr;
+
+	return p >= pool->vaddr && p < pool->vaddr + pool->size * pool->blocks;
+}
+
+/**
+ * hcd_buffer_create - initialize buffer pools
+ * @hcd: the bus whose buffer pools are to be initialized
+ *
+ * Controllers with local memory allocate straight from
+ * hcd->localmem_pool and get no slabs.  An HCD_LOCAL_MEM controller
+ * must set the pool up before this: system memory is out of its reach,
+ * so there is nothing to fall back to.
+ *
+ * Return: 0 if successful, -ENOMEM otherwise.
+ */
+int hcd_buffer_create(struct usb_hcd *hcd)
+{
+	int i;
+
+	if (hcd->localmem_pool)
+		return 0;
+	if (hcd->driver->flags & HCD_LOCAL_MEM)
+		return -ENOMEM;
+
+	for (i = 0; i < HCD_BUFFER_POOLS; i++) {
+		hcd->pool[i] = dma_pool_create(pool_max[i], pool_blocks[i]);
+		if (!hcd->pool[i]) {
+			hcd_buffer_destroy(hcd);
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
+/**
+ * hcd_buffer_destroy - deallocate buffer pools
+ * @hcd: the bus whose buffer pools are to be destroyed
+ */
+void hcd_buffer_destroy(struct usb_hcd *hcd)
+{
+	int i;
+
+	for (i = 0; i < HCD_BUFFER_POOLS; i++) {
+		dma_pool_destroy(hcd->pool[i]);
+		hcd->pool[i] = RT_NULL;
+	}
+}
+
+/**
+ * hcd_buffer_alloc - allocate a transfer buffer
+ * @bus: bus the buffer is used on
+ * @size: bytes needed
+ * @dma: returns the bus address of the buffer
+ *
+ * Sizes up to 2048 bytes come from the smallest fitting slab and are
+ * safe in interrupt context.  A slab with no free block fails the
+ * request and counts it in its failures, it never falls back to the
+ * heap.  Only larger requests go to the heap, and only from thread
+ * context; in interrupt context they fail.  Controllers with local
+ * memory only ever get hcd->localmem_pool.
+ *
+ * Return: the buffer, aligned to USB_DMA_ALIGN, or %RT_NULL.
+ */
+void *hcd_buffer_alloc(struct usb_bus *bus, rt_size_t size, dma_addr_t *dma)
+{
+	struct usb_hcd *hcd = bus_to_hcd(bus);
+	struct dma_pool *pool;
+	rt_base_t level;
+	void *addr = RT_NULL;
+	int i;
+
+	if (size == 0)
+		return RT_NULL;
+
+	if (hcd->localmem_pool) {
+		addr = rt_memheap_alloc(hcd->localmem_pool, size);
+		goto done;
+	}
+	if (hcd->driver->flags & HCD_LOCAL_MEM)
+		goto done;
+
+	for (i = 0; i < HCD_BUFFER_POOLS; i++) {
+		if (size > pool_max[i])
+			continue;
+		pool = hcd->pool[i];
+		if (!pool)
+			break;
+
+		level = rt_hw_interrupt_disable();
+		addr = pool->free_list;
+		if (addr) {
+			pool->free_list = *(void **)addr;
+			if (++pool->in_use > pool->high_water)
+				pool->high_water = pool->in_use;
+		} else {
+			pool->failures++;
+		}
+		rt_hw_interrupt_enable(level);
+		goto done;
+	}
+
+	/* too big for any slab, or the hcd has none */
+	if (!rt_interrupt_get_nest())
+		addr = rt_malloc_align(RT_ALIGN(size, USB_DMA_ALIGN),
+				USB_DMA_ALIGN);
+done:
+	if (dma)
+		*dma = (dma_addr_t)addr;
+	return addr;
+}
+
+/**
+ * hcd_buffer_free - release a buffer from hcd_buffer_alloc()
+ * @bus: bus the buffer was allocated for
+ * @size: the size passed to hcd_buffer_alloc()
+ * @addr: the buffer, may be %RT_NULL
+ * @dma: its bus address
+ */
+void hcd_buffer_free(struct usb_bus *bus, rt_size_t size,
+		void *addr, dma_addr_t dma)
+{
+	struct usb_hcd *hcd = bus_to_hcd(bus);
+	struct dma_pool *pool;
+	rt_base_t level;
+	int i;
+
+	RT_UNUSED(dma);
+	if (!addr)
+		return;
+
+	if (hcd->localmem_pool) {
+		rt_memheap_free(addr);
+		return;
+	}
+
+	for (i = 0; i < HCD_BUFFER_POOLS; i++) {
+		if (size > pool_max[i])
+			continue;
+		pool = hcd->pool[i];
+		if (!pool || !dma_pool_owns(pool, addr))
+			break;
+
+		level = rt_hw_interrupt_disable();
+		*(void **)addr = pool->free_list;
+		pool->free_list = addr;
+		pool->in_use--;
+		rt_hw_interrupt_enable(level);
+		return;
+	}
+	rt_free_align(addr);
+}
+
+/**
+ * hcd_buffer_get_stats - report per size class pool usage
+ * @bus: bus to report on
+ * @stats: array filled with one entry per size class
+ * @count: number of entries in @stats
+ *
+ * Return: number of entries filled in.
+ */
+int hcd_buffer_get_stats(struct usb_bus *bus,
+		struct hcd_buffer_stats *stats, int count)
+{
+	struct usb_hcd *hcd = bus_to_hcd(bus);
+	struct dma_pool *pool;
+	rt_base_t level;
+	int i, n = 0;
+
+	for (i = 0; i < HCD_BUFFER_POOLS && n < count; i++) {
+		pool = hcd->pool[i];
+		if (!pool)
+			continue;
+
+		level = rt_hw_interrupt_disable();
+		stats[n].size = pool->size;
+		stats[n].blocks = pool->blocks;
+		stats[n].in_use = pool->in_use;
+		stats[n].high_water = pool->high_water;
+		stats[n].failures = pool->failures;
+		rt_hw_interrupt_enable(level);
+		n++;
+	}
+	return n;
+}
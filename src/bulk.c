@@ -0,0 +1,630 @@
+#include "hcd.h"
+
+/*
+ * Bulk FIFOs.
+ *
+ * A fifo owns its urbs and their buffers from usb_bulk_fifo_init()
+ * to usb_bulk_fifo_release().  Urbs the caller may use next, IN urbs
+ * the device has filled and OUT urbs the controller is done with, wait
+ * in ready_q in the order they were given back; the ready semaphore
+ * counts them.
+ *
+ * Every write is one bulk transfer, split into urbs of buf_size bytes.
+ * buf_size is a multiple of wMaxPacketSize, so only the last urb can
+ * end short, and URB_ZERO_PACKET is set on that one alone.  A read
+ * returns at the end of a transfer, that is after a short packet.
+ *
+ * Instead of reading, an IN fifo's urbs can be borrowed with
+ * usb_bulk_fifo_get() and handed back with usb_bulk_fifo_put(),
+ * in any order.  Their data is never copied, and a borrower that falls
+ * behind stops the endpoint: the device is NAKed while no urb is queued.
+ */
+
+rt_inline rt_int32_t usb_bulk_fifo_ticks(int timeout)
+{
+	if (timeout < 0)
+		return RT_WAITING_NO;
+	return timeout ? (rt_int32_t)rt_tick_from_millisecond(timeout) :
+			RT_WAITING_FOREVER;
+}
+
+/* may run in interrupt context, and for several urbs at once */
+static void usb_bulk_fifo_push(struct usb_bulk_fifo *fifo,
+		struct urb *urb)
+{
+	rt_base_t level;
+
+	level = rt_hw_interrupt_disable();
+	fifo->ready_q[fifo->ready_tail++ % USB_BULK_FIFO_URBS] = urb;
+	rt_hw_interrupt_enable(level);
+	rt_sem_release(&fifo->ready);
+	if (fifo->notify)
+		fifo->notify(fifo, urb);
+}
+
+/*
+ * Take one count of the ready semaphore.  A stop resets it and leaves
+ * one count behind, so a waiter that went to sleep after the reset
+ * wakes up as well; whoever gets that count hands it on.
+ */
+static int usb_bulk_fifo_take(struct usb_bulk_fifo *fifo, rt_int32_t ticks)
+{
+	if (rt_sem_take(&fifo->ready, ticks) != RT_EOK)
+		return rt_atomic_load(&fifo->running) ? -ETIMEDOUT :
+				-ESHUTDOWN;
+	if (!rt_atomic_load(&fifo->running)) {
+		rt_sem_release(&fifo->ready);
+		return -ESHUTDOWN;
+	}
+	return 0;
+}
+
+/* after usb_bulk_fifo_take() */
+static struct urb *usb_bulk_fifo_pop(struct usb_bulk_fifo *fifo)
+{
+	struct urb *urb;
+	rt_base_t level;
+
+	level = rt_hw_interrupt_disable();
+	urb = fifo->ready_q[fifo->ready_head++ % USB_BULK_FIFO_URBS];
+	rt_hw_interrupt_enable(level);
+	return urb;
+}
+
+/* the first OUT error since the last call, which clears it */
+static int usb_bulk_fifo_error(struct usb_bulk_fifo *fifo)
+{
+	rt_base_t level;
+	int error;
+
+	level = rt_hw_interrupt_disable();
+	error = fifo->error;
+	fifo->error = 0;
+	rt_hw_interrupt_enable(level);
+	return error;
+}
+
+static void usb_bulk_fifo_complete(struct urb *urb)
+{
+	struct usb_bulk_fifo *fifo = urb->context;
+	rt_base_t level;
+
+	switch (urb->status) {
+	case -EPIPE:
+	case -EPROTO:
+	case -EILSEQ:
+	case -ETIMEDOUT:
+		/* the urbs still in flight wait for it, see recovery.c */
+		usb_queue_recovery(fifo->dev, fifo->pipe, 0);
+		break;
+	}
+
+	if (usb_pipeout(fifo->pipe) && urb->status) {
+		level = rt_hw_interrupt_disable();
+		if (!fifo->error)
+			fifo->error = urb->status;
+		rt_hw_interrupt_enable(level);
+	}
+	usb_bulk_fifo_push(fifo, urb);
+}
+
+static int usb_bulk_fifo_submit(struct usb_bulk_fifo *fifo,
+		struct urb *urb, int length, unsigned int flags)
+{
+	urb->transfer_buffer_length = length;
+	urb->transfer_flags = flags | URB_NO_TRANSFER_DMA_MAP;
+	urb->actual_length = 0;
+	return usb_submit_urb(urb);
+}
+
+/* hand an IN urb back to the device */
+static void usb_bulk_fifo_requeue(struct usb_bulk_fifo *fifo,
+		struct urb *urb)
+{
+	int ret;
+
+	if (!rt_atomic_load(&fifo->running))
+		return;
+
+	ret = usb_bulk_fifo_submit(fifo, urb, fifo->buf_size,
+			fifo->flags);
+	if (ret) {
+		/* the reader finds the error when it gets to this urb */
+		urb->status = ret;
+		usb_bulk_fifo_push(fifo, urb);
+	}
+}
+
+/**
+ * usb_bulk_fifo_init - set up a bulk fifo
+ * @fifo: fifo to initialize
+ * @dev: device the endpoint belongs to
+ * @pipe: bulk pipe, usb_rcvbulkpipe() or usb_sndbulkpipe()
+ * @nurbs: urbs kept in flight, up to USB_BULK_FIFO_URBS
+ * @buf_size: bytes per urb, rounded down to whole packets
+ * @flags: URB_SHORT_NOT_OK to fail reads on short packets, and
+ *	URB_ZERO_PACKET to end writes of whole packets with a zero length
+ *	packet
+ *
+ * Everything the fifo needs while running is allocated here.
+ *
+ * Return: 0 on success, -EINVAL or -ENOMEM.
+ */
+int usb_bulk_fifo_init(struct usb_bulk_fifo *fifo,
+		struct usb_device *dev, unsigned int pipe, int nurbs,
+		int buf_size, unsigned int flags)
+{
+	struct usb_ep_state *st = usb_pipe_ep_state(dev, pipe);
+	struct urb *urb;
+	dma_addr_t dma;
+	int i;
+
+	rt_memset(fifo, 0, sizeof(*fifo));
+	if (!usb_pipebulk(pipe) || !(st->flags & USB_EP_ENABLED) ||
+			!st->maxpacket || nurbs < 1 ||
+			nurbs > USB_BULK_FIFO_URBS ||
+			buf_size < st->maxpacket)
+		return -EINVAL;
+
+	fifo->dev = dev;
+	fifo->bus = dev->bus;
+	fifo->pipe = pipe;
+	fifo->nurbs = nurbs;
+	fifo->buf_size = buf_size - buf_size % st->maxpacket;
+	fifo->flags = flags & (usb_pipein(pipe) ? URB_SHORT_NOT_OK :
+			URB_ZERO_PACKET);
+	rt_sem_init(&fifo->ready, "usbblk", 0, RT_IPC_FLAG_FIFO);
+	rt_mutex_init(&fifo->lock, "usbblk", RT_IPC_FLAG_PRIO);
+
+	for (i = 0; i < nurbs; i++) {
+		urb = usb_alloc_urb(0);
+		if (!urb)
+			goto fail;
+		fifo->urbs[i] = urb;
+
+		urb->transfer_buffer = hcd_buffer_alloc(dev->bus,
+				fifo->buf_size, &dma);
+		if (!urb->transfer_buffer)
+			goto fail;
+		usb_fill_bulk_urb(urb, dev, pipe, urb->transfer_buffer,
+				fifo->buf_size, usb_bulk_fifo_complete,
+				fifo);
+		urb->transfer_dma = dma;
+	}
+	return 0;
+
+fail:
+	usb_bulk_fifo_release(fifo);
+	return -ENOMEM;
+}
+
+/**
+ * usb_bulk_fifo_start - get a fifo going
+ * @fifo: fifo from usb_bulk_fifo_init()
+ *
+ * Submits all urbs of an IN fifo; an OUT fifo just becomes writable.
+ * Urbs borrowed from an earlier run must all have been put back.
+ *
+ * Return: 0 on success, or the error from usb_submit_urb(); the fifo
+ * is stopped again then.
+ */
+int usb_bulk_fifo_start(struct usb_bulk_fifo *fifo)
+{
+	int i, ret;
+
+	fifo->ready_head = fifo->ready_tail = 0;
+	fifo->cur = RT_NULL;
+	fifo->offset = 0;
+	fifo->error = 0;
+	rt_sem_control(&fifo->ready, RT_IPC_CMD_RESET, (void *)0);
+	rt_atomic_store(&fifo->running, 1);
+
+	if (usb_pipeout(fifo->pipe)) {
+		for (i = 0; i < fifo->nurbs; i++)
+			usb_bulk_fifo_push(fifo, fifo->urbs[i]);
+		return 0;
+	}
+
+	for (i = 0; i < fifo->nurbs; i++) {
+		ret = usb_bulk_fifo_submit(fifo, fifo->urbs[i],
+				fifo->buf_size, fifo->flags);
+		if (ret) {
+			usb_bulk_fifo_stop(fifo);
+			return ret;
+		}
+	}
+	return 0;
+}
+
+/**
+ * usb_bulk_fifo_stop - stop a fifo and wait for its urbs
+ * @fifo: fifo to stop
+ *
+ * Data still queued in either direction is dropped; use
+ * usb_bulk_fifo_flush() first to send it.  Readers and writers waiting
+ * on the fifo return -ESHUTDOWN.
+ */
+void usb_bulk_fifo_stop(struct usb_bulk_fifo *fifo)
+{
+	int i;
+
+	rt_atomic_store(&fifo->running, 0);
+	for (i = 0; i < fifo->nurbs; i++)
+		usb_kill_urb(fifo->urbs[i]);
+	rt_sem_control(&fifo->ready, RT_IPC_CMD_RESET, (void *)0);
+	rt_sem_release(&fifo->ready);	/* see usb_bulk_fifo_take() */
+}
+
+/**
+ * usb_bulk_fifo_disconnect - stop a fifo whose device is going away
+ * @fifo: fifo to stop
+ *
+ * Also waits for readers and writers to leave, and forgets the device,
+ * so that usb_bulk_fifo_release() may come after the device was freed,
+ * e.g. once the last urb lent out with usb_bulk_fifo_get() came back.
+ *
+ * Context: thread context, sleeps.
+ */
+void usb_bulk_fifo_disconnect(struct usb_bulk_fifo *fifo)
+{
+	int i;
+
+	if (!fifo->bus)
+		return;
+	usb_bulk_fifo_stop(fifo);
+	rt_mutex_take(&fifo->lock, RT_WAITING_FOREVER);
+	rt_mutex_release(&fifo->lock);
+	for (i = 0; i < fifo->nurbs; i++)
+		if (fifo->urbs[i])
+			fifo->urbs[i]->dev = RT_NULL;
+	fifo->dev = RT_NULL;
+}
+
+/**
+ * usb_bulk_fifo_release - stop a fifo and free its urbs and buffers
+ * @fifo: fifo from usb_bulk_fifo_init(), even a failed one
+ *
+ * No urb may be lent out any more.
+ */
+void usb_bulk_fifo_release(struct usb_bulk_fifo *fifo)
+{
+	struct urb *urb;
+	int i;
+
+	if (!fifo->bus)
+		return;
+	usb_bulk_fifo_stop(fifo);
+	for (i = 0; i < fifo->nurbs; i++) {
+		urb = fifo->urbs[i];
+		if (!urb)
+			continue;
+		if (urb->transfer_buffer)
+			hcd_buffer_free(fifo->bus, fifo->buf_size,
+					urb->transfer_buffer,
+					urb->transfer_dma);
+		usb_free_urb(urb);
+		fifo->urbs[i] = RT_NULL;
+	}
+	rt_sem_detach(&fifo->ready);
+	rt_mutex_detach(&fifo->lock);
+	fifo->dev = RT_NULL;
+	fifo->bus = RT_NULL;
+}
+
+/**
+ * usb_bulk_fifo_read - read from an IN fifo
+ * @fifo: running IN fifo
+ * @buf: where the data goes
+ * @size: bytes wanted
+ * @timeout: msecs to wait for the first byte, 0 waits forever
+ *
+ * Waits for data, then takes what has arrived up to @size bytes or the
+ * end of the transfer, whichever comes first.
+ *
+ * Context: thread context, sleeps.
+ *
+ * Return: the bytes read, or a negative error number: -ETIMEDOUT,
+ * -ESHUTDOWN if the fifo is stopped, -EREMOTEIO for a short packet
+ * with URB_SHORT_NOT_OK, or the status of the failed urb.
+ */
+rt_ssize_t usb_bulk_fifo_read(struct usb_bulk_fifo *fifo, void *buf,
+		rt_size_t size, int timeout)
+{
+	rt_int32_t ticks = usb_bulk_fifo_ticks(timeout);
+	rt_size_t done = 0, n;
+	struct urb *urb;
+	int ret = 0, shrt;
+
+	if (!usb_pipein(fifo->pipe))
+		return -EINVAL;
+	rt_mutex_take(&fifo->lock, RT_WAITING_FOREVER);
+	while (done < size) {
+		if (!rt_atomic_load(&fifo->running)) {
+			ret = -ESHUTDOWN;
+			break;
+		}
+		if (!fifo->cur) {
+			ret = usb_bulk_fifo_take(fifo,
+					done ? RT_WAITING_NO : ticks);
+			if (ret)
+				break;
+			fifo->cur = usb_bulk_fifo_pop(fifo);
+			fifo->offset = 0;
+		}
+		urb = fifo->cur;
+
+		if (urb->status) {
+			/* return the data so far, the error next time */
+			if (done)
+				break;
+			ret = urb->status;
+			fifo->cur = RT_NULL;
+			usb_bulk_fifo_requeue(fifo, urb);
+			break;
+		}
+
+		n = urb->actual_length - fifo->offset;
+		if (n > size - done)
+			n = size - done;
+		rt_memcpy((uint8_t *)buf + done,
+				(uint8_t *)urb->transfer_buffer + fifo->offset, n);
+		fifo->offset += n;
+		done += n;
+		if (fifo->offset < (int)urb->actual_length)
+			break;
+
+		/* a short packet ends the transfer; a lone zero length
+		 * packet has nothing to return, so keep waiting */
+		shrt = (int)urb->actual_length < fifo->buf_size;
+		fifo->cur = RT_NULL;
+		usb_bulk_fifo_requeue(fifo, urb);
+		if (shrt && done)
+			break;
+	}
+	rt_mutex_release(&fifo->lock);
+	return done ? (rt_ssize_t)done : ret;
+}
+
+/**
+ * usb_bulk_fifo_get - borrow the next filled urb of an IN fifo
+ * @fifo: running IN fifo, not read with usb_bulk_fifo_read()
+ * @timeout: msecs to wait, 0 waits forever, < 0 doesn't wait
+ *
+ * The data is urb->actual_length bytes at urb->transfer_buffer, unless
+ * urb->status tells otherwise.  The urb stays with the caller until
+ * usb_bulk_fifo_put().
+ *
+ * Context: thread context; interrupt context if @timeout < 0.
+ *
+ * Return: the urb, or %RT_NULL if none came or the fifo is stopped.
+ */
+struct urb *usb_bulk_fifo_get(struct usb_bulk_fifo *fifo, int timeout)
+{
+	if (!usb_pipein(fifo->pipe) || !rt_atomic_load(&fifo->running))
+		return RT_NULL;
+	if (usb_bulk_fifo_take(fifo, usb_bulk_fifo_ticks(timeout)))
+		return RT_NULL;
+	return usb_bulk_fifo_pop(fifo);
+}
+
+/**
+ * usb_bulk_fifo_put - give a borrowed urb back to its fifo
+ * @fifo: fifo the urb came from
+ * @urb: urb from usb_bulk_fifo_get()
+ *
+ * Queues the urb for the device again, unless the fifo was stopped.
+ *
+ * Context: any.
+ */
+void usb_bulk_fifo_put(struct usb_bulk_fifo *fifo, struct urb *urb)
+{
+	usb_bulk_fifo_requeue(fifo, urb);
+}
+
+/**
+ * usb_bulk_fifo_write - write one transfer to an OUT fifo
+ * @fifo: running OUT fifo
+ * @buf: the data
+ * @size: bytes to send
+ * @timeout: msecs to wait for each free urb, 0 waits forever
+ *
+ * Returns as soon as the last piece is queued.  An urb that fails later
+ * is reported by the next write or usb_bulk_fifo_flush().
+ *
+ * Context: thread context, sleeps.
+ *
+ * Return: the bytes queued, which is less than @size only if something
+ * failed on the way, or a negative error number if nothing was queued.
+ */
+rt_ssize_t usb_bulk_fifo_write(struct usb_bulk_fifo *fifo,
+		const void *buf, rt_size_t size, int timeout)
+{
+	rt_int32_t ticks = usb_bulk_fifo_ticks(timeout);
+	rt_size_t done = 0, n;
+	unsigned int flags;
+	struct urb *urb;
+	int ret = 0;
+
+	if (!usb_pipeout(fifo->pipe))
+		return -EINVAL;
+	rt_mutex_take(&fifo->lock, RT_WAITING_FOREVER);
+	while (done < size) {
+		if (!rt_atomic_load(&fifo->running)) {
+			ret = -ESHUTDOWN;
+			break;
+		}
+		ret = usb_bulk_fifo_take(fifo, ticks);
+		if (ret)
+			break;
+		urb = usb_bulk_fifo_pop(fifo);
+		ret = usb_bulk_fifo_error(fifo);
+		if (ret) {
+			usb_bulk_fifo_push(fifo, urb);
+			break;
+		}
+
+		n = size - done;
+		if (n > (rt_size_t)fifo->buf_size)
+			n = fifo->buf_size;
+		rt_memcpy(urb->transfer_buffer, (const uint8_t *)buf + done, n);
+		flags = done + n == size ? fifo->flags : 0;
+		ret = usb_bulk_fifo_submit(fifo, urb, n, flags);
+		if (ret) {
+			usb_bulk_fifo_push(fifo, urb);
+			break;
+		}
+		done += n;
+	}
+	rt_mutex_release(&fifo->lock);
+	return done ? (rt_ssize_t)done : ret;
+}
+
+/**
+ * usb_bulk_fifo_flush - wait until an OUT fifo has sent everything
+ * @fifo: OUT fifo
+ * @timeout: msecs to wait, 0 waits forever
+ *
+ * Context: thread context, sleeps.
+ *
+ * Return: 0, -ETIMEDOUT, -ESHUTDOWN if the fifo is or gets stopped,
+ * or the status of the first urb that failed since the last report.
+ */
+int usb_bulk_fifo_flush(struct usb_bulk_fifo *fifo, int timeout)
+{
+	rt_int32_t ticks = usb_bulk_fifo_ticks(timeout);
+	int i, ret = 0;
+
+	if (!usb_pipeout(fifo->pipe))
+		return -EINVAL;
+	rt_mutex_take(&fifo->lock, RT_WAITING_FOREVER);
+	for (i = 0; i < fifo->nurbs; i++) {
+		/* a stopped fifo never gets its urbs back */
+		if (!rt_atomic_load(&fifo->running)) {
+			ret = -ESHUTDOWN;
+			break;
+		}
+		ret = usb_bulk_fifo_take(fifo, ticks);
+		if (ret)
+			break;
+	}
+	while (i-- > 0)
+		rt_sem_release(&fifo->ready);
+	if (!ret)
+		ret = usb_bulk_fifo_error(fifo);
+	rt_mutex_release(&fifo->lock);
+	return ret;
+}
+
+/*-------------------------------------------------------------------------*/
+
+/*
+ * The rt_device face of a fifo: open starts it, close flushes and
+ * stops it, read and write use fifo->timeout.
+ */
+
+#define dev_to_fifo(d)	rt_container_of(d, struct usb_bulk_fifo, parent)
+
+static rt_err_t usb_bulk_fifo_dev_open(rt_device_t dev, rt_uint16_t oflag)
+{
+	return usb_bulk_fifo_start(dev_to_fifo(dev)) ? -RT_EIO : RT_EOK;
+}
+
+static rt_err_t usb_bulk_fifo_dev_close(rt_device_t dev)
+{
+	struct usb_bulk_fifo *fifo = dev_to_fifo(dev);
+
+	if (usb_pipeout(fifo->pipe))
+		usb_bulk_fifo_flush(fifo, fifo->timeout);
+	usb_bulk_fifo_stop(fifo);
+	return RT_EOK;
+}
+
+static rt_ssize_t usb_bulk_fifo_dev_read(rt_device_t dev, rt_off_t pos,
+		void *buffer, rt_size_t size)
+{
+	struct usb_bulk_fifo *fifo = dev_to_fifo(dev);
+
+	return usb_bulk_fifo_read(fifo, buffer, size, fifo->timeout);
+}
+
+static rt_ssize_t usb_bulk_fifo_dev_write(rt_device_t dev, rt_off_t pos,
+		const void *buffer, rt_size_t size)
+{
+	struct usb_bulk_fifo *fifo = dev_to_fifo(dev);
+
+	return usb_bulk_fifo_write(fifo, buffer, size, fifo->timeout);
+}
+
+static rt_err_t usb_bulk_fifo_dev_control(rt_device_t dev, int cmd,
+		void *args)
+{
+	struct usb_bulk_fifo *fifo = dev_to_fifo(dev);
+
+	switch (cmd) {
+	case USB_BULK_FIFO_CTRL_TIMEOUT:
+		if (!args)
+			return -RT_EINVAL;
+		fifo->timeout = *(int *)args;
+		return RT_EOK;
+	case USB_BULK_FIFO_CTRL_FLUSH:
+		return usb_bulk_fifo_flush(fifo, fifo->timeout) ?
+				-RT_EIO : RT_EOK;
+	}
+	return -RT_ENOSYS;
+}
+
+#ifdef RT_USING_DEVICE_OPS
+static const struct rt_device_ops usb_bulk_fifo_ops = {
+	.open		= usb_bulk_fifo_dev_open,
+	.close		= usb_bulk_fifo_dev_close,
+	.read		= usb_bulk_fifo_dev_read,
+	.write		= usb_bulk_fifo_dev_write,
+	.control	= usb_bulk_fifo_dev_control,
+};
+#endif
+
+/**
+ * usb_bulk_fifo_register - make a fifo an rt_device
+ * @fifo: fifo from usb_bulk_fifo_init(), not running
+ * @name: device name
+ *
+ * The device reads an IN fifo or writes an OUT fifo.
+ *
+ * Return: 0 on success, or -EEXIST if the name is taken.
+ */
+int usb_bulk_fifo_register(struct usb_bulk_fifo *fifo,
+		const char *name)
+{
+	struct rt_device *dev = &fifo->parent;
+
+	dev->type = RT_Device_Class_Char;
+#ifdef RT_USING_DEVICE_OPS
+	dev->ops = &usb_bulk_fifo_ops;
+#else
+	dev->init = RT_NULL;
+	dev->open = usb_bulk_fifo_dev_open;
+	dev->close = usb_bulk_fifo_dev_close;
+	dev->read = usb_bulk_fifo_dev_read;
+	dev->write = usb_bulk_fifo_dev_write;
+	dev->control = usb_bulk_fifo_dev_control;
+#endif
+	dev->user_data = fifo;
+
+	if (rt_device_register(dev, name, RT_DEVICE_FLAG_STANDALONE |
+			(usb_pipein(fifo->pipe) ? RT_DEVICE_FLAG_RDONLY :
+			RT_DEVICE_FLAG_WRONLY)) != RT_EOK)
+		return -EEXIST;
+	return 0;
+}
+
+/**
+ * usb_bulk_fifo_unregister - remove a fifo's rt_device
+ * @fifo: registered fifo
+ *
+ * Stops the fifo too; it can be released afterwards.
+ */
+void usb_bulk_fifo_unregister(struct usb_bulk_fifo *fifo)
+{
+	usb_bulk_fifo_stop(fifo);
+	rt_device_unregister(&fifo->parent);
+}
@@ -0,0 +1,623 @@
+#include "hcd.h"
+#include "usb_cdc.h"
+
+/*
+ * CDC ACM and ECM host driver.
+ *
+ * Both functions are a control interface, bound to this driver, and a
+ * data interface with a bulk pair, claimed along with it.  The bulk
+ * endpoints are bulk fifos: tx with URB_ZERO_PACKET, so that a write
+ * or frame ending on a packet boundary is still terminated, and rx with
+ * USB_CDC_RX_URBS buffers that are lent to the consumer instead of
+ * copied.  The interrupt endpoint for notifications is not used.
+ */
+
+#ifdef CONFIG_USB_CDC
+
+static rt_uint32_t cdc_index_map[2];	/* device name numbers, ACM and ECM */
+
+static int cdc_index_get(int ecm)
+{
+	rt_base_t level;
+	int i;
+
+	level = rt_hw_interrupt_disable();
+	for (i = 0; i < 32; i++) {
+		if (!(cdc_index_map[ecm] & (1u << i))) {
+			cdc_index_map[ecm] |= 1u << i;
+			break;
+		}
+	}
+	rt_hw_interrupt_enable(level);
+	return i < 32 ? i : -1;
+}
+
+static void cdc_index_put(int ecm, int index)
+{
+	rt_base_t level;
+
+	if (index < 0)
+		return;
+	level = rt_hw_interrupt_disable();
+	cdc_index_map[ecm] &= ~(1u << index);
+	rt_hw_interrupt_enable(level);
+}
+
+/* the union and, for ECM, the MAC address string from the functional
+ * descriptors of the control interface */
+static void cdc_parse_extra(struct usb_host_interface *alt, int *data_ifnum,
+		int *mac_index)
+{
+	unsigned char *p = alt->extra;
+	int left = alt->extralen;
+
+	*data_ifnum = alt->desc.bInterfaceNumber + 1;
+	*mac_index = 0;
+	while (left >= 3 && p[0] >= 3 && p[0] <= left) {
+		if (p[1] == USB_DT_CS_INTERFACE) {
+			if (p[2] == USB_CDC_UNION_TYPE &&
+					p[0] >= sizeof(struct usb_cdc_union_desc))
+				*data_ifnum = ((struct usb_cdc_union_desc *)p)->
+						bSlaveInterface0;
+			else if (p[2] == USB_CDC_ETHERNET_TYPE &&
+					p[0] >= sizeof(struct usb_cdc_ether_desc))
+				*mac_index = ((struct usb_cdc_ether_desc *)p)->
+						iMACAddress;
+		}
+		left -= p[0];
+		p += p[0];
+	}
+}
+
+/* give the claimed data interface up, it goes away with the device */
+static void cdc_unclaim(struct usb_cdc *cdc)
+{
+	if (cdc->data) {
+		cdc->data->driver = RT_NULL;
+		cdc->data->driver_data = RT_NULL;
+		cdc->data = RT_NULL;
+	}
+}
+
+static void cdc_release(struct usb_cdc *cdc)
+{
+	usb_bulk_fifo_release(&cdc->rx);
+	usb_bulk_fifo_release(&cdc->tx);
+	cdc_unclaim(cdc);
+}
+
+/*
+ * Claims the data interface, switched to @data_alt, and sets up both
+ * fifos on its bulk endpoints.
+ */
+static int cdc_setup(struct usb_cdc *cdc, struct usb_interface *intf,
+		int data_ifnum, int data_alt)
+{
+	struct usb_device *udev = intf->udev;
+	struct usb_endpoint_descriptor *ep;
+	struct usb_host_interface *alt;
+	struct usb_interface *data;
+	int in = 0, out = 0, i, ret;
+
+	data = usb_ifnum_to_if(udev, data_ifnum);
+	if (!data || (data != intf && data->driver))
+		return -ENODEV;
+	if (data_alt) {
+		ret = usb_set_interface(udev, data_ifnum, data_alt);
+		if (ret)
+			return ret;
+	}
+
+	alt = data->cur_altsetting;
+	for (i = 0; i < alt->desc.bNumEndpoints; i++) {
+		ep = &alt->endpoint[i].desc;
+		if ((ep->bmAttributes & USB_EP_ATTR_TYPE_MASK) !=
+				USB_EP_ATTR_BULK)
+			continue;
+		if (ep->bEndpointAddress & USB_DIR_IN)
+			in = in ? in : ep->bEndpointAddress;
+		else
+			out = out ? out : ep->bEndpointAddress;
+	}
+	if (!in || !out)
+		return -ENODEV;
+
+	cdc->udev = udev;
+	cdc->control = intf;
+	ret = usb_bulk_fifo_init(&cdc->rx, udev,
+			usb_rcvbulkpipe(udev, in & 0x0f), USB_CDC_RX_URBS,
+			USB_CDC_RX_SIZE, 0);
+	if (ret)
+		return ret;
+	ret = usb_bulk_fifo_init(&cdc->tx, udev,
+			usb_sndbulkpipe(udev, out & 0x0f), USB_CDC_TX_URBS,
+			USB_CDC_TX_SIZE, URB_ZERO_PACKET);
+	if (ret) {
+		usb_bulk_fifo_release(&cdc->rx);
+		return ret;
+	}
+
+	/* keep other drivers off it; unbinding it is left to intf */
+	if (data != intf) {
+		data->driver = intf->driver;
+		data->driver_data = RT_NULL;
+		cdc->data = data;
+	}
+	return 0;
+}
+
+static int cdc_request(struct usb_cdc *cdc, uint8_t request, uint16_t value,
+		void *data, uint16_t size)
+{
+	return usb_control_msg(cdc->udev, usb_sndctrlpipe(cdc->udev, 0),
+			request, USB_REQ_TYPE_CLASS | USB_REQ_TYPE_INTERFACE,
+			value, cdc->control->cur_altsetting->desc.bInterfaceNumber,
+			data, size, USB_CTRL_SET_TIMEOUT);
+}
+
+/*-------------------------------------------------------------------------*/
+
+/*
+ * ACM: read() copies and doesn't wait, like an RT-Thread serial device;
+ * rx_indicate tells when there is something.  USB_CDC_CTRL_RX_GET lends
+ * the next buffer instead.
+ */
+
+#define dev_to_acm(d)	rt_container_of(d, struct usb_acm, parent)
+
+static void acm_rx_notify(struct usb_bulk_fifo *fifo, struct urb *urb)
+{
+	struct usb_acm *acm = fifo->context;
+
+	if (acm->parent.rx_indicate)
+		acm->parent.rx_indicate(&acm->parent, urb->actual_length);
+}
+
+static rt_err_t acm_open(rt_device_t dev, rt_uint16_t oflag)
+{
+	struct usb_acm *acm = dev_to_acm(dev);
+	struct usb_cdc_line_coding line = acm->line;
+
+	if (cdc_request(&acm->cdc, USB_CDC_REQ_SET_LINE_CODING, 0, &line,
+			sizeof(line)) < 0 ||
+			cdc_request(&acm->cdc, USB_CDC_REQ_SET_CONTROL_LINE_STATE,
+			USB_CDC_CTRL_DTR | USB_CDC_CTRL_RTS, RT_NULL, 0) < 0)
+		return -RT_EIO;
+	if (usb_bulk_fifo_start(&acm->cdc.tx) ||
+			usb_bulk_fifo_start(&acm->cdc.rx)) {
+		usb_bulk_fifo_stop(&acm->cdc.tx);
+		return -RT_EIO;
+	}
+	return RT_EOK;
+}
+
+static rt_err_t acm_close(rt_device_t dev)
+{
+	struct usb_acm *acm = dev_to_acm(dev);
+	int timeout = acm->timeout;
+
+	/* a device that stopped reading must not hang the close */
+	if (!timeout || timeout > USB_CDC_CLOSE_TIMEOUT)
+		timeout = USB_CDC_CLOSE_TIMEOUT;
+	usb_bulk_fifo_flush(&acm->cdc.tx, timeout);
+	usb_bulk_fifo_stop(&acm->cdc.tx);
+	usb_bulk_fifo_stop(&acm->cdc.rx);
+	cdc_request(&acm->cdc, USB_CDC_REQ_SET_CONTROL_LINE_STATE, 0,
+			RT_NULL, 0);
+	return RT_EOK;
+}
+
+static rt_ssize_t acm_read(rt_device_t dev, rt_off_t pos, void *buffer,
+		rt_size_t size)
+{
+	rt_ssize_t ret;
+
+	ret = usb_bulk_fifo_read(&dev_to_acm(dev)->cdc.rx, buffer, size, -1);
+	return ret == -ETIMEDOUT ? 0 : ret;
+}
+
+static rt_ssize_t acm_write(rt_device_t dev, rt_off_t pos,
+		const void *buffer, rt_size_t size)
+{
+	struct usb_acm *acm = dev_to_acm(dev);
+
+	return usb_bulk_fifo_write(&acm->cdc.tx, buffer, size,
+			acm->timeout);
+}
+
+static rt_err_t acm_control(rt_device_t dev, int cmd, void *args)
+{
+	struct usb_acm *acm = dev_to_acm(dev);
+	struct usb_cdc_line_coding line;
+	struct usb_cdc_rx_buf *buf = args;
+	struct urb *urb;
+
+	if (!args)
+		return -RT_EINVAL;
+
+	switch (cmd) {
+	case USB_CDC_CTRL_LINE_CODING:
+		line = *(struct usb_cdc_line_coding *)args;
+		if (cdc_request(&acm->cdc, USB_CDC_REQ_SET_LINE_CODING, 0,
+				&line, sizeof(line)) < 0)
+			return -RT_EIO;
+		acm->line = line;
+		return RT_EOK;
+	case USB_CDC_CTRL_RX_GET:
+		urb = usb_bulk_fifo_get(&acm->cdc.rx, -1);
+		if (!urb)
+			return -RT_EEMPTY;
+		buf->data = urb->transfer_buffer;
+		buf->len = urb->status ? 0 : urb->actual_length;
+		buf->cookie = urb;
+		return RT_EOK;
+	case USB_CDC_CTRL_RX_PUT:
+		usb_bulk_fifo_put(&acm->cdc.rx, buf->cookie);
+		return RT_EOK;
+	case USB_CDC_CTRL_TIMEOUT:
+		acm->timeout = *(int *)args;
+		return RT_EOK;
+	}
+	return -RT_ENOSYS;
+}
+
+#ifdef RT_USING_DEVICE_OPS
+static const struct rt_device_ops acm_ops = {
+	.open		= acm_open,
+	.close		= acm_close,
+	.read		= acm_read,
+	.write		= acm_write,
+	.control	= acm_control,
+};
+#endif
+
+static int acm_probe(struct usb_interface *intf)
+{
+	struct usb_acm *acm;
+	char name[RT_NAME_MAX];
+	int data_ifnum, mac_index, ret;
+
+	acm = rt_calloc(1, sizeof(*acm));
+	if (!acm)
+		return -ENOMEM;
+	cdc_parse_extra(intf->cur_altsetting, &data_ifnum, &mac_index);
+	ret = cdc_setup(&acm->cdc, intf, data_ifnum, 0);
+	if (ret) {
+		rt_free(acm);
+		return ret;
+	}
+	acm->cdc.rx.notify = acm_rx_notify;
+	acm->cdc.rx.context = acm;
+	acm->line.dwDTERate = 115200;
+	acm->line.bDataBits = 8;
+
+	acm->cdc.index = cdc_index_get(0);
+	if (acm->cdc.index < 0) {
+		ret = -EBUSY;
+		goto fail;
+	}
+	acm->parent.type = RT_Device_Class_Char;
+#ifdef RT_USING_DEVICE_OPS
+	acm->parent.ops = &acm_ops;
+#else
+	acm->parent.open = acm_open;
+	acm->parent.close = acm_close;
+	acm->parent.read = acm_read;
+	acm->parent.write = acm_write;
+	acm->parent.control = acm_control;
+#endif
+	rt_snprintf(name, sizeof(name), "ttyACM%d", acm->cdc.index);
+	if (rt_device_register(&acm->parent, name, RT_DEVICE_FLAG_RDWR |
+			RT_DEVICE_FLAG_INT_RX | RT_DEVICE_FLAG_REMOVABLE |
+			RT_DEVICE_FLAG_STANDALONE) != RT_EOK) {
+		ret = -EEXIST;
+		goto fail;
+	}
+	intf->driver_data = &acm->cdc;
+	return 0;
+
+fail:
+	cdc_index_put(0, acm->cdc.index);
+	cdc_release(&acm->cdc);
+	rt_free(acm);
+	return ret;
+}
+
+static void acm_disconnect(struct usb_cdc *cdc)
+{
+	struct usb_acm *acm = rt_container_of(cdc, struct usb_acm, cdc);
+
+	rt_device_unregister(&acm->parent);
+	/* blocked readers and writers return -ESHUTDOWN, then we wait for
+	 * them to leave */
+	usb_bulk_fifo_disconnect(&cdc->tx);
+	usb_bulk_fifo_disconnect(&cdc->rx);
+	cdc_index_put(0, cdc->index);
+	cdc_release(cdc);
+	rt_free(acm);
+}
+
+/*-------------------------------------------------------------------------*/
+
+#ifdef RT_USING_LWIP
+
+/*
+ * ECM: every received frame is one urb, handed to lwIP as a custom pbuf
+ * around the urb's buffer.  lwIP freeing the pbuf queues the urb again.
+ *
+ * Each pbuf holds a reference to the ecm, as does the binding, so a
+ * pbuf lwIP frees after the unplug finds its buffer still there; the
+ * last one frees the ecm.
+ */
+
+#define eth_to_ecm(d)	rt_container_of(d, struct usb_ecm, eth.parent)
+
+static void ecm_put(struct usb_ecm *ecm)
+{
+	if (rt_atomic_sub(&ecm->refcnt, 1) != 1)
+		return;
+	cdc_release(&ecm->cdc);
+	rt_free(ecm);
+}
+
+static void ecm_pbuf_free(struct pbuf *p)
+{
+	struct usb_ecm_pbuf *ep = (struct usb_ecm_pbuf *)p;
+	struct usb_ecm *ecm = ep->ecm;
+
+	usb_bulk_fifo_put(&ecm->cdc.rx, ep->urb);
+	ecm_put(ecm);
+}
+
+static void ecm_rx_notify(struct usb_bulk_fifo *fifo, struct urb *urb)
+{
+	struct usb_ecm *ecm = fifo->context;
+
+	eth_device_ready(&ecm->eth);
+}
+
+static struct pbuf *ecm_rx(rt_device_t dev)
+{
+	struct usb_ecm *ecm = eth_to_ecm(dev);
+	struct usb_ecm_pbuf *ep;
+	struct urb *urb;
+	struct pbuf *p;
+	int i;
+
+	while ((urb = usb_bulk_fifo_get(&ecm->cdc.rx, -1)) != RT_NULL) {
+		if (urb->status || !urb->actual_length) {
+			usb_bulk_fifo_put(&ecm->cdc.rx, urb);
+			continue;
+		}
+		for (i = 0; ecm->cdc.rx.urbs[i] != urb; i++)
+			;
+		ep = &ecm->pbufs[i];
+		ep->urb = urb;
+		rt_atomic_add(&ecm->refcnt, 1);
+		p = pbuf_alloced_custom(PBUF_RAW, urb->actual_length, PBUF_REF,
+				&ep->pc, urb->transfer_buffer,
+				ecm->cdc.rx.buf_size);
+		if (p)
+			return p;
+		rt_atomic_sub(&ecm->refcnt, 1);
+		usb_bulk_fifo_put(&ecm->cdc.rx, urb);
+	}
+	return RT_NULL;
+}
+
+static rt_err_t ecm_tx(rt_device_t dev, struct pbuf *p)
+{
+	struct usb_ecm *ecm = eth_to_ecm(dev);
+	const void *data = p->payload;
+	rt_ssize_t ret;
+
+	if (p->tot_len > USB_CDC_ETH_FRAME)
+		return -RT_EINVAL;
+	if (p->next) {
+		pbuf_copy_partial(p, ecm->tx_buf, p->tot_len, 0);
+		data = ecm->tx_buf;
+	}
+	/* the tx thread is the only writer */
+	ret = usb_bulk_fifo_write(&ecm->cdc.tx, data, p->tot_len, 100);
+	return ret == p->tot_len ? RT_EOK : -RT_EIO;
+}
+
+static rt_err_t ecm_control(rt_device_t dev, int cmd, void *args)
+{
+	struct usb_ecm *ecm = eth_to_ecm(dev);
+
+	if (cmd != NIOCTL_GADDR)
+		return -RT_ENOSYS;
+	if (!args)
+		return -RT_EINVAL;
+	rt_memcpy(args, ecm->mac, sizeof(ecm->mac));
+	return RT_EOK;
+}
+
+#ifdef RT_USING_DEVICE_OPS
+static const struct rt_device_ops ecm_ops = {
+	.control	= ecm_control,
+};
+#endif
+
+static int ecm_hex(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+static int ecm_get_mac(struct usb_ecm *ecm, int index)
+{
+	char str[13];
+	int i, hi, lo;
+
+	if (!index || usb_string(ecm->cdc.udev, index, str, sizeof(str)) != 12)
+		return -EINVAL;
+	for (i = 0; i < 6; i++) {
+		hi = ecm_hex(str[2 * i]);
+		lo = ecm_hex(str[2 * i + 1]);
+		if (hi < 0 || lo < 0)
+			return -EINVAL;
+		ecm->mac[i] = hi << 4 | lo;
+	}
+	return 0;
+}
+
+static int ecm_probe(struct usb_interface *intf)
+{
+	struct usb_ecm *ecm;
+	char name[RT_NAME_MAX];
+	int data_ifnum, mac_index, i, ret;
+
+	ecm = rt_calloc(1, sizeof(*ecm));
+	if (!ecm)
+		return -ENOMEM;
+	cdc_parse_extra(intf->cur_altsetting, &data_ifnum, &mac_index);
+	/* the data interface has its endpoints in altsetting 1 */
+	ret = cdc_setup(&ecm->cdc, intf, data_ifnum, 1);
+	if (ret) {
+		rt_free(ecm);
+		return ret;
+	}
+	ecm->cdc.rx.notify = ecm_rx_notify;
+	ecm->cdc.rx.context = ecm;
+	rt_atomic_store(&ecm->refcnt, 1);
+	for (i = 0; i < USB_CDC_RX_URBS; i++) {
+		ecm->pbufs[i].pc.custom_free_function = ecm_pbuf_free;
+		ecm->pbufs[i].ecm = ecm;
+	}
+
+	ecm->cdc.index = cdc_index_get(1);
+	if (ecm->cdc.index < 0) {
+		ret = -EBUSY;
+		goto fail;
+	}
+	ret = ecm_get_mac(ecm, mac_index);
+	if (ret)
+		goto fail;
+	ret = cdc_request(&ecm->cdc, USB_CDC_SET_ETHERNET_PACKET_FILTER,
+			USB_CDC_PACKET_TYPE_DIRECTED |
+			USB_CDC_PACKET_TYPE_BROADCAST |
+			USB_CDC_PACKET_TYPE_ALL_MULTICAST, RT_NULL, 0);
+	if (ret < 0)
+		goto fail;
+	ret = usb_bulk_fifo_start(&ecm->cdc.tx);
+	if (!ret)
+		ret = usb_bulk_fifo_start(&ecm->cdc.rx);
+	if (ret)
+		goto fail;
+
+#ifdef RT_USING_DEVICE_OPS
+	ecm->eth.parent.ops = &ecm_ops;
+#else
+	ecm->eth.parent.control = ecm_control;
+#endif
+	ecm->eth.eth_rx = ecm_rx;
+	ecm->eth.eth_tx = ecm_tx;
+	rt_snprintf(name, sizeof(name), "ue%d", ecm->cdc.index);
+	if (eth_device_init(&ecm->eth, name) != RT_EOK) {
+		ret = -EEXIST;
+		goto fail;
+	}
+	/* the connection notification is not read: assume a link */
+	eth_device_linkchange(&ecm->eth, RT_TRUE);
+	intf->driver_data = &ecm->cdc;
+	return 0;
+
+fail:
+	cdc_index_put(1, ecm->cdc.index);
+	cdc_release(&ecm->cdc);
+	rt_free(ecm);
+	return ret;
+}
+
+static void ecm_disconnect(struct usb_cdc *cdc)
+{
+	struct usb_ecm *ecm = rt_container_of(cdc, struct usb_ecm, cdc);
+
+	eth_device_linkchange(&ecm->eth, RT_FALSE);
+	eth_device_deinit(&ecm->eth);
+	usb_bulk_fifo_disconnect(&cdc->tx);
+	usb_bulk_fifo_disconnect(&cdc->rx);
+	cdc_index_put(1, cdc->index);
+	cdc_unclaim(cdc);
+	/* the buffers lwIP still holds stay until it frees them */
+	ecm_put(ecm);
+}
+
+#endif /* RT_USING_LWIP */
+
+/*-------------------------------------------------------------------------*/
+
+static int cdc_probe(struct usb_interface *intf,
+		const struct usb_device_id *id)
+{
+	switch (intf->cur_altsetting->desc.bInterfaceSubClass) {
+	case USB_CDC_SUBCLASS_ACM:
+		return acm_probe(intf);
+#ifdef RT_USING_LWIP
+	case USB_CDC_SUBCLASS_ETHERNET:
+		return ecm_probe(intf);
+#endif
+	}
+	return -ENODEV;
+}
+
+static void cdc_disconnect(struct usb_interface *intf)
+{
+	struct usb_cdc *cdc = intf->driver_data;
+
+	/* the claimed data interface has no driver_data */
+	if (!cdc)
+		return;
+#ifdef RT_USING_LWIP
+	if (intf->cur_altsetting->desc.bInterfaceSubClass ==
+			USB_CDC_SUBCLASS_ETHERNET) {
+		ecm_disconnect(cdc);
+		return;
+	}
+#endif
+	acm_disconnect(cdc);
+}
+
+static const struct usb_device_id cdc_id_table[] = {
+	{ USB_INTERFACE_INFO(USB_CLASS_CDC, USB_CDC_SUBCLASS_ACM, 1) },
+	{ USB_INTERFACE_INFO(USB_CLASS_CDC, USB_CDC_SUBCLASS_ACM, 0) },
+#ifdef RT_USING_LWIP
+	{ USB_INTERFACE_INFO(USB_CLASS_CDC, USB_CDC_SUBCLASS_ETHERNET, 0) },
+#endif
+	{ }
+};
+
+static struct usb_driver cdc_driver = {
+	.name =		"cdc",
+	.probe =	cdc_probe,
+	.disconnect =	cdc_disconnect,
+	.id_table =	cdc_id_table,
+};
+
+/**
+ * usb_cdc_init - register the CDC ACM and ECM driver
+ *
+ * Return: 0.
+ */
+int usb_cdc_init(void)
+{
+	return usb_register_driver(&cdc_driver);
+}
+INIT_PREV_EXPORT(usb_cdc_init);
+
+/**
+ * usb_cdc_cleanup - unregister the CDC ACM and ECM driver
+ */
+void usb_cdc_cleanup(void)
+{
+	usb_deregister(&cdc_driver);
+}
+
+#endif /* CONFIG_USB_CDC */
@@ -0,0 +1,835 @@
+#include "hcd.h"
+
+/*
+ * config.c - configuration descriptor parsing
+ *
+ * A device's configurations are fetched, measured and then parsed into
+ * one allocation, dev->descs.  The raw configuration descriptors are
+ * copied in as well, or shared with identical devices when
+ * CONFIG_USB_DESC_CACHE is set, and extra (class specific) descriptors
+ * point into them instead of being copied again.  Nothing in the block is freed on
+ * its own; usb_destroy_configuration() frees it whole.
+ */
+
+#define ARENA_ALIGN		8
+#define arena_size(x)		RT_ALIGN((rt_size_t)(x), ARENA_ALIGN)
+
+/* carve @size zeroed bytes off the device's descriptor block */
+static void *arena_alloc(struct usb_desc_arena *arena, rt_size_t size)
+{
+	rt_size_t off = arena_size(arena->used);
+
+	if (off + size > arena->size)
+		return RT_NULL;
+	arena->used = off + size;
+	return (char *)(arena + 1) + off;
+}
+
+static char *arena_strdup(struct usb_desc_arena *arena, const char *str)
+{
+	rt_size_t len;
+	char *p;
+
+	if (!str)
+		return RT_NULL;
+	len = rt_strlen(str) + 1;
+	p = arena_alloc(arena, len);
+	if (p)
+		rt_memcpy(p, str, len);
+	return p;
+}
+
+/* skip to the next descriptor of type @dt1 or @dt2, return bytes skipped */
+static int find_next_descriptor(unsigned char *buffer, int size,
+		int dt1, int dt2, int *num_skipped)
+{
+	struct usb_descriptor_header *h;
+	int n = 0;
+	unsigned char *buffer0 = buffer;
+
+	while (size > 0) {
+		h = (struct usb_descriptor_header *)buffer;
+		if (h->bLength < 2 || h->bLength > size)
+			break;
+		if (h->bDescriptorType == dt1 || h->bDescriptorType == dt2)
+			break;
+		buffer += h->bLength;
+		size -= h->bLength;
+		++n;
+	}
+
+	if (num_skipped)
+		*num_skipped = n;
+	return buffer - buffer0;
+}
+
+static int usb_parse_endpoint(struct usb_device *udev,
+		struct usb_host_interface *ifp, int num_ep,
+		unsigned char *buffer, int size)
+{
+	struct usb_endpoint_descriptor *d;
+	struct usb_host_endpoint *endpoint;
+	unsigned char *buffer0 = buffer;
+	int n, len;
+
+	d = (struct usb_endpoint_descriptor *)buffer;
+	buffer += d->bLength;
+	size -= d->bLength;
+
+	if (d->bLength < USB_DESC_LENGTH_ENDPOINT ||
+			(d->bEndpointAddress & USB_EP_DESC_NUM_MASK) == 0 ||
+			ifp->desc.bNumEndpoints >= num_ep)
+		goto skip;
+
+	endpoint = &ifp->endpoint[ifp->desc.bNumEndpoints];
+	++ifp->desc.bNumEndpoints;
+
+	len = d->bLength < sizeof(endpoint->desc) ?
+			d->bLength : sizeof(endpoint->desc);
+	rt_memcpy(&endpoint->desc, d, len);
+	endpoint->udev = udev;
+	rt_list_init(&endpoint->urb_list);
+
+	/* Skip over any Class Specific or Vendor Specific descriptors;
+	 * find the next endpoint or interface descriptor */
+	endpoint->extra = buffer;
+	len = find_next_descriptor(buffer, size, USB_DESC_TYPE_ENDPOINT,
+			USB_DESC_TYPE_INTERFACE, &n);
+	endpoint->extralen = len;
+	if (!len)
+		endpoint->extra = RT_NULL;
+	return buffer - buffer0 + len;
+
+skip:
+	len = find_next_descriptor(buffer, size, USB_DESC_TYPE_ENDPOINT,
+			USB_DESC_TYPE_INTERFACE, RT_NULL);
+	return buffer - buffer0 + len;
+}
+
+static int usb_parse_interface(struct usb_device *udev,
+		struct usb_desc_arena *arena, struct usb_host_config *config,
+		unsigned char *buffer, int size)
+{
+	unsigned char *buffer0 = buffer;
+	struct usb_interface_descriptor *d;
+	struct usb_interface *intf;
+	struct usb_host_interface *alt;
+	int i, n, len, num_ep;
+
+	d = (struct usb_interface_descriptor *)buffer;
+	buffer += d->bLength;
+	size -= d->bLength;
+
+	if (d->bLength < USB_DESC_LENGTH_INTERFACE)
+		goto skip_to_next_interface_descriptor;
+
+	/* Which interface entry is this? */
+	intf = RT_NULL;
+	if (d->bInterfaceNumber < USB_MAXINTERFACES) {
+		i = config->intf_index[d->bInterfaceNumber];
+		if (i)
+			intf = config->interface[i - 1];
+	} else for (i = 0; i < config->desc.bNumInterfaces; ++i) {
+		if (config->interface[i] &&
+		    config->interface[i]->altsetting[0].desc.bInterfaceNumber ==
+				d->bInterfaceNumber) {
+			intf = config->interface[i];
+			break;
+		}
+	}
+	if (!intf)
+		goto skip_to_next_interface_descriptor;
+
+	/* Check for duplicate altsetting entries */
+	for (i = 0, alt = intf->altsetting; i < (int)intf->num_altsetting;
+			++i, ++alt) {
+		if (alt->desc.bAlternateSetting == d->bAlternateSetting &&
+				alt->desc.bLength)
+			goto skip_to_next_interface_descriptor;
+	}
+	for (i = 0, alt = intf->altsetting; i < (int)intf->num_altsetting;
+			++i, ++alt)
+		if (!alt->desc.bLength)
+			break;
+	if (i == (int)intf->num_altsetting)
+		goto skip_to_next_interface_descriptor;
+
+	rt_memcpy(&alt->desc, d, USB_DESC_LENGTH_INTERFACE);
+
+	/* Skip over any Class Specific or Vendor Specific descriptors;
+	 * find the first endpoint or interface descriptor */
+	alt->extra = buffer;
+	i = find_next_descriptor(buffer, size, USB_DESC_TYPE_ENDPOINT,
+			USB_DESC_TYPE_INTERFACE, &n);
+	alt->extralen = i;
+	if (!i)
+		alt->extra = RT_NULL;
+	buffer += i;
+	size -= i;
+
+	/* Allocate space for the right(?) number of endpoints */
+	num_ep = alt->desc.bNumEndpoints;
+	alt->desc.bNumEndpoints = 0;	/* Use as a counter */
+	if (num_ep > USB_MAXENDPOINTS)
+		num_ep = USB_MAXENDPOINTS;
+
+	if (num_ep > 0) {
+		alt->endpoint = arena_alloc(arena,
+				num_ep * sizeof(struct usb_host_endpoint));
+		if (!alt->endpoint)
+			return -ENOMEM;
+	}
+
+	/* Parse all the endpoint descriptors */
+	n = 0;
+	while (size > 0) {
+		if (((struct usb_descriptor_header *)buffer)->bDescriptorType
+				== USB_DESC_TYPE_INTERFACE)
+			break;
+		len = usb_parse_endpoint(udev, alt, num_ep, buffer, size);
+		if (len <= 0)
+			break;
+		buffer += len;
+		size -= len;
+		++n;
+	}
+	return buffer - buffer0;
+
+skip_to_next_interface_descriptor:
+	i = find_next_descriptor(buffer, size, USB_DESC_TYPE_INTERFACE,
+			USB_DESC_TYPE_INTERFACE, RT_NULL);
+	return buffer - buffer0 + i;
+}
+
+/*
+ * First pass over the descriptors following a configuration descriptor:
+ * interface numbers, altsettings per interface and the bytes of endpoint
+ * arrays usb_parse_interface() will take.  *sizep is cut short at the
+ * first malformed descriptor or at the next device/config descriptor.
+ */
+static int usb_scan_configuration(unsigned char *buffer, int *sizep,
+		unsigned char *inums, unsigned char *nalts, rt_size_t *ep_bytes)
+{
+	struct usb_descriptor_header *header;
+	struct usb_interface_descriptor *d;
+	unsigned char *buffer2;
+	int size2, i, n = 0, num_ep;
+
+	*ep_bytes = 0;
+	for ((buffer2 = buffer, size2 = *sizep);
+			size2 > 0;
+			(buffer2 += header->bLength, size2 -= header->bLength)) {
+
+		header = (struct usb_descriptor_header *)buffer2;
+		if (header->bLength > size2 || header->bLength < 2)
+			break;
+
+		if (header->bDescriptorType == USB_DESC_TYPE_INTERFACE) {
+			int inum;
+
+			d = (struct usb_interface_descriptor *)header;
+			if (d->bLength < USB_DESC_LENGTH_INTERFACE)
+				continue;
+
+			num_ep = d->bNumEndpoints;
+			if (num_ep > USB_MAXENDPOINTS)
+				num_ep = USB_MAXENDPOINTS;
+			if (num_ep)
+				*ep_bytes += arena_size(num_ep *
+					sizeof(struct usb_host_endpoint));
+
+			inum = d->bInterfaceNumber;
+			for (i = 0; i < n; ++i) {
+				if (inums[i] == inum)
+					break;
+			}
+			if (i < n) {
+				if (nalts[i] < 255)
+					++nalts[i];
+			} else if (n < USB_MAXINTERFACES) {
+				inums[n] = inum;
+				nalts[n] = 1;
+				++n;
+			}
+		} else if (header->bDescriptorType == USB_DESC_TYPE_DEVICE ||
+			   header->bDescriptorType == USB_DESC_TYPE_CONFIGURATION) {
+			break;
+		}
+	}
+	*sizep = buffer2 - buffer;
+	return n;
+}
+
+/* arena bytes usb_parse_configuration() needs for @buffer */
+static rt_size_t usb_config_bytes(unsigned char *buffer, int size)
+{
+	struct usb_config_descriptor *desc =
+			(struct usb_config_descriptor *)buffer;
+	unsigned char inums[USB_MAXINTERFACES], nalts[USB_MAXINTERFACES];
+	rt_size_t bytes;
+	int i, j, nintf;
+
+	if (size < USB_DESC_LENGTH_CONFIG ||
+			desc->bLength < USB_DESC_LENGTH_CONFIG ||
+			desc->bLength > size)
+		return 0;
+	size -= desc->bLength;
+	nintf = usb_scan_configuration(buffer + desc->bLength, &size,
+			inums, nalts, &bytes);
+	if (nintf > desc->bNumInterfaces)
+		nintf = desc->bNumInterfaces;
+
+	for (i = 0; i < nintf; i++) {
+		j = nalts[i] < USB_MAXALTSETTING ? nalts[i] : USB_MAXALTSETTING;
+		bytes += arena_size(sizeof(struct usb_interface));
+		bytes += arena_size(j * sizeof(struct usb_host_interface));
+	}
+	return bytes;
+}
+
+/* order altsettings by number so they can be indexed directly */
+static void usb_sort_altsettings(struct usb_interface *intf)
+{
+	struct usb_host_interface tmp;
+	int i, j;
+
+	for (i = 1; i < (int)intf->num_altsetting; i++) {
+		tmp = intf->altsetting[i];
+		for (j = i; j > 0 &&
+				intf->altsetting[j - 1].desc.bAlternateSetting >
+				tmp.desc.bAlternateSetting; j--)
+			intf->altsetting[j] = intf->altsetting[j - 1];
+		intf->altsetting[j] = tmp;
+	}
+}
+
+static int usb_parse_configuration(struct usb_device *dev,
+		struct usb_desc_arena *arena, struct usb_host_config *config,
+		unsigned char *buffer, int size)
+{
+	struct usb_interface *intf;
+	unsigned char inums[USB_MAXINTERFACES], nalts[USB_MAXINTERFACES];
+	rt_size_t ep_bytes;
+	int nintf, i, j, n, retval, scanned;
+
+	rt_memcpy(&config->desc, buffer, USB_DESC_LENGTH_CONFIG);
+	if (config->desc.bDescriptorType != USB_DESC_TYPE_CONFIGURATION ||
+			config->desc.bLength < USB_DESC_LENGTH_CONFIG ||
+			config->desc.bLength > size)
+		return -EINVAL;
+
+	buffer += config->desc.bLength;
+	size -= config->desc.bLength;
+
+	nintf = config->desc.bNumInterfaces;
+	if (nintf > USB_MAXINTERFACES)
+		nintf = USB_MAXINTERFACES;
+
+	/* Go through the descriptors, checking their length and counting
+	 * the number of altsettings for each interface */
+	scanned = size;
+	n = usb_scan_configuration(buffer, &scanned, inums, nalts, &ep_bytes);
+	if (scanned < size)
+		config->desc.wTotalLength = scanned + config->desc.bLength;
+	size = scanned;
+	config->desc.bNumInterfaces = nintf = n < nintf ? n : nintf;
+
+	/* Carve the usb_interfaces and altsetting arrays */
+	for (i = 0; i < nintf; ++i) {
+		j = nalts[i];
+		if (j > USB_MAXALTSETTING)
+			j = USB_MAXALTSETTING;
+
+		intf = arena_alloc(arena, sizeof(struct usb_interface));
+		if (!intf)
+			return -ENOMEM;
+		intf->altsetting = arena_alloc(arena,
+				j * sizeof(struct usb_host_interface));
+		if (!intf->altsetting)
+			return -ENOMEM;
+		intf->num_altsetting = j;
+		intf->udev = dev;
+		/* usb_parse_interface() looks interfaces up by number; the
+		 * first altsetting it parses overwrites this */
+		intf->altsetting[0].desc.bInterfaceNumber = inums[i];
+		config->interface[i] = intf;
+		if (inums[i] < USB_MAXINTERFACES)
+			config->intf_index[inums[i]] = i + 1;
+	}
+
+	/* Skip over any Class Specific or Vendor Specific descriptors;
+	 * find the first interface descriptor */
+	config->extra = buffer;
+	i = find_next_descriptor(buffer, size, USB_DESC_TYPE_INTERFACE,
+			USB_DESC_TYPE_INTERFACE, &n);
+	config->extralen = i;
+	if (!i)
+		config->extra = RT_NULL;
+	buffer += i;
+	size -= i;
+
+	/* Parse all the interface/altsetting descriptors */
+	while (size > 0) {
+		retval = usb_parse_interface(dev, arena, config, buffer, size);
+		if (retval < 0)
+			return retval;
+		if (retval == 0)
+			break;
+		buffer += retval;
+		size -= retval;
+	}
+
+	for (i = 0; i < nintf; ++i) {
+		intf = config->interface[i];
+		usb_sort_altsettings(intf);
+		intf->cur_altsetting = &intf->altsetting[0];
+	}
+	return 0;
+}
+
+/*
+ * Raw configuration descriptors shared between devices of one model.
+ *
+ * An entry is found by idVendor/idProduct/bcdDevice plus a hash of the
+ * device descriptor.  A hit is only trusted once every configuration
+ * the device returns matches the entry byte for byte, read with the
+ * cached wTotalLength; that is one read per configuration instead of
+ * the header read plus the full read of a miss.  An entry that no
+ * longer matches is dropped and the descriptors are fetched again.
+ *
+ * The bytes are never written after the entry is made.  Each device
+ * parses them into its own arena, since interfaces and endpoints carry
+ * per-device state.
+ */
+struct usb_desc_cache {
+	rt_list_t	list;		/* desc_cache_list, most recent first */
+	atomic_t	refcnt;		/* users, plus one while listed */
+	uint16_t	idVendor;
+	uint16_t	idProduct;
+	uint16_t	bcdDevice;
+	uint8_t		ncfg;
+	uint32_t	hash;
+	unsigned int	length[USB_MAXCONFIG];
+	unsigned char	*raw[USB_MAXCONFIG];	/* follow the entry */
+};
+
+#ifdef CONFIG_USB_DESC_CACHE
+#ifndef USB_DESC_CACHE_ENTRIES
+#define USB_DESC_CACHE_ENTRIES	8
+#endif
+
+static rt_list_t desc_cache_list = RT_LIST_OBJECT_INIT(desc_cache_list);
+static int desc_cache_count;
+static struct rt_mutex desc_cache_lock;
+static rt_bool_t desc_cache_lock_ready;
+
+static void desc_cache_lock_take(void)
+{
+	rt_enter_critical();
+	if (!desc_cache_lock_ready) {
+		rt_mutex_init(&desc_cache_lock, "usbdesc", RT_IPC_FLAG_PRIO);
+		desc_cache_lock_ready = RT_TRUE;
+	}
+	rt_exit_critical();
+	rt_mutex_take(&desc_cache_lock, RT_WAITING_FOREVER);
+}
+
+/* FNV-1a */
+static uint32_t desc_hash(uint32_t h, const void *data, rt_size_t len)
+{
+	const unsigned char *p = data;
+
+	while (len--)
+		h = (h ^ *p++) * 16777619u;
+	return h;
+}
+
+static uint32_t usb_desc_cache_hash(struct usb_device *dev)
+{
+	return desc_hash(2166136261u, &dev->descriptor,
+			sizeof(dev->descriptor));
+}
+
+static void usb_desc_cache_put(struct usb_desc_cache *entry)
+{
+	if (entry && rt_atomic_sub(&entry->refcnt, 1) == 1)
+		rt_free(entry);
+}
+
+/* caller holds desc_cache_lock */
+static void usb_desc_cache_unlist(struct usb_desc_cache *entry)
+{
+	rt_list_remove(&entry->list);
+	desc_cache_count--;
+	usb_desc_cache_put(entry);
+}
+
+/*
+ * Look @dev up by its device descriptor.
+ * Return: a referenced entry, still to be checked, or %RT_NULL.
+ */
+static struct usb_desc_cache *usb_desc_cache_get(struct usb_device *dev,
+		int ncfg)
+{
+	struct usb_desc_cache *entry, *found = RT_NULL;
+	uint32_t hash = usb_desc_cache_hash(dev);
+	rt_list_t *pos;
+
+	desc_cache_lock_take();
+	rt_list_for_each(pos, &desc_cache_list) {
+		entry = rt_list_entry(pos, struct usb_desc_cache, list);
+		if (entry->idVendor != dev->descriptor.idVendor ||
+				entry->idProduct != dev->descriptor.idProduct ||
+				entry->bcdDevice != dev->descriptor.bcdDevice)
+			continue;
+
+		if (entry->hash != hash || entry->ncfg != ncfg) {
+			/* same model, different descriptors: firmware
+			 * changed or a bad entry; fetch them again */
+			usb_desc_cache_unlist(entry);
+			break;
+		}
+
+		rt_atomic_add(&entry->refcnt, 1);
+		rt_list_remove(&entry->list);
+		rt_list_insert_after(&desc_cache_list, &entry->list);
+		found = entry;
+		break;
+	}
+	rt_mutex_release(&desc_cache_lock);
+	return found;
+}
+
+/* forget an entry @dev's descriptors did not match, and put it */
+static void usb_desc_cache_drop(struct usb_desc_cache *entry)
+{
+	desc_cache_lock_take();
+	if (!rt_list_isempty(&entry->list))
+		usb_desc_cache_unlist(entry);
+	rt_mutex_release(&desc_cache_lock);
+	usb_desc_cache_put(entry);
+}
+
+/*
+ * Read every configuration of @dev with the length @entry has for it.
+ * A longer or shorter one shows up in wTotalLength, which is compared
+ * along with the rest.
+ * Return: 0 if all match, 1 if one does not, or a negative error.
+ */
+static int usb_desc_cache_check(struct usb_device *dev,
+		struct usb_desc_cache *entry)
+{
+	unsigned int max = 0;
+	unsigned char *buf;
+	int i, result = 0;
+
+	for (i = 0; i < entry->ncfg; i++)
+		if (entry->length[i] > max)
+			max = entry->length[i];
+	buf = rt_malloc(max);
+	if (!buf)
+		return -ENOMEM;
+
+	for (i = 0; i < entry->ncfg && !result; i++) {
+		result = usb_get_descriptor(dev, USB_DESC_TYPE_CONFIGURATION,
+				i, buf, entry->length[i]);
+		if (result >= 0)
+			result = (unsigned int)result != entry->length[i] ||
+					rt_memcmp(buf, entry->raw[i],
+						entry->length[i]);
+	}
+	rt_free(buf);
+	return result;
+}
+
+/*
+ * Remember the descriptors just fetched from @dev.
+ * Return: a referenced entry holding a copy of @raw, or %RT_NULL.
+ */
+static struct usb_desc_cache *usb_desc_cache_add(struct usb_device *dev,
+		const unsigned char *hdrs, unsigned char **raw,
+		const unsigned int *length, int ncfg)
+{
+	struct usb_desc_cache *entry;
+	unsigned char *p;
+	rt_size_t bytes = 0;
+	int i;
+
+	for (i = 0; i < ncfg; i++) {
+		/* a short read; don't hand it to the next device too */
+		if (length[i] < USB_DESC_LENGTH_CONFIG ||
+				rt_memcmp(raw[i], hdrs + i * USB_DESC_LENGTH_CONFIG,
+					USB_DESC_LENGTH_CONFIG))
+			return RT_NULL;
+		bytes += length[i];
+	}
+
+	entry = rt_malloc(sizeof(*entry) + bytes);
+	if (!entry)
+		return RT_NULL;
+	rt_memset(entry, 0, sizeof(*entry));
+	entry->idVendor = dev->descriptor.idVendor;
+	entry->idProduct = dev->descriptor.idProduct;
+	entry->bcdDevice = dev->descriptor.bcdDevice;
+	entry->ncfg = ncfg;
+	entry->hash = usb_desc_cache_hash(dev);
+	rt_atomic_store(&entry->refcnt, 2);
+
+	p = (unsigned char *)(entry + 1);
+	for (i = 0; i < ncfg; i++) {
+		entry->length[i] = length[i];
+		entry->raw[i] = p;
+		rt_memcpy(p, raw[i], length[i]);
+		p += length[i];
+	}
+
+	desc_cache_lock_take();
+	if (desc_cache_count == USB_DESC_CACHE_ENTRIES)
+		usb_desc_cache_unlist(rt_list_entry(desc_cache_list.prev,
+				struct usb_desc_cache, list));
+	rt_list_insert_after(&desc_cache_list, &entry->list);
+	desc_cache_count++;
+	rt_mutex_release(&desc_cache_lock);
+	return entry;
+}
+#else
+#define usb_desc_cache_get(dev, ncfg)				RT_NULL
+#define usb_desc_cache_check(dev, entry)			0
+#define usb_desc_cache_drop(entry)				do { } while (0)
+#define usb_desc_cache_add(dev, hdrs, raw, length, ncfg)	RT_NULL
+#define usb_desc_cache_put(entry)				do { } while (0)
+#endif /* CONFIG_USB_DESC_CACHE */
+
+void usb_destroy_configuration(struct usb_device *dev)
+{
+	rt_free(dev->descs);
+	dev->descs = RT_NULL;
+	usb_desc_cache_put(dev->desc_cache);
+	dev->desc_cache = RT_NULL;
+	dev->config = RT_NULL;
+	dev->actconfig = RT_NULL;
+	dev->rawdescriptors = RT_NULL;
+	dev->product = RT_NULL;
+	dev->manufacturer = RT_NULL;
+	dev->serial = RT_NULL;
+}
+
+/*
+ * Get the USB config descriptors and strings, cache and parse'em
+ *
+ * hub-only!! ... and only in reset path, or usb_new_device()
+ * (used by real hubs and virtual root hubs)
+ *
+ * Everything is read into temporary buffers first so the size of the
+ * device's descriptor block is known before it is allocated.  With
+ * CONFIG_USB_DESC_CACHE the raw descriptors of a known model are only
+ * read to check them against the cache; the block then only holds what
+ * was parsed from them.
+ */
+int usb_get_configuration(struct usb_device *dev)
+{
+	int ncfg = dev->descriptor.bNumConfigurations;
+	unsigned char *raw[USB_MAXCONFIG] = { RT_NULL };
+	unsigned int length[USB_MAXCONFIG];
+	char *strings[3] = { RT_NULL };
+	struct usb_config_descriptor *desc;
+	struct usb_desc_cache *cache;
+	struct usb_desc_arena *arena;
+	unsigned char *hdrs = RT_NULL;
+	unsigned int cfgno = 0;
+	rt_size_t bytes;
+	int i, result;
+
+	if (ncfg > USB_MAXCONFIG)
+		dev->descriptor.bNumConfigurations = ncfg = USB_MAXCONFIG;
+	if (ncfg < 1)
+		return -EINVAL;
+
+	cache = usb_desc_cache_get(dev, ncfg);
+	if (cache) {
+		result = usb_desc_cache_check(dev, cache);
+		if (result < 0) {
+			usb_desc_cache_put(cache);
+			goto out;
+		}
+		if (result) {
+			usb_desc_cache_drop(cache);
+			cache = RT_NULL;
+		}
+	}
+	for (cfgno = 0; cache && cfgno < (unsigned)ncfg; cfgno++) {
+		raw[cfgno] = cache->raw[cfgno];
+		length[cfgno] = cache->length[cfgno];
+	}
+	if (cache)
+		goto parse;
+
+	hdrs = rt_malloc(ncfg * USB_DESC_LENGTH_CONFIG);
+	if (!hdrs)
+		return -ENOMEM;
+
+	/* We grab just the first descriptor of each configuration so we
+	 * know how long the whole thing is */
+	for (cfgno = 0; cfgno < (unsigned)ncfg; cfgno++) {
+		desc = (struct usb_config_descriptor *)
+				(hdrs + cfgno * USB_DESC_LENGTH_CONFIG);
+		result = usb_get_descriptor(dev, USB_DESC_TYPE_CONFIGURATION,
+				cfgno, desc, USB_DESC_LENGTH_CONFIG);
+		if (result < 0)
+			goto out;
+		if (result < USB_DESC_LENGTH_CONFIG) {
+			result = -EINVAL;
+			goto out;
+		}
+		length[cfgno] = desc->wTotalLength > USB_DESC_LENGTH_CONFIG ?
+				desc->wTotalLength : USB_DESC_LENGTH_CONFIG;
+	}
+
+	for (cfgno = 0; cfgno < (unsigned)ncfg; cfgno++) {
+		/* Now that we know the length, get the whole thing */
+		raw[cfgno] = rt_malloc(length[cfgno]);
+		if (!raw[cfgno]) {
+			result = -ENOMEM;
+			goto out;
+		}
+
+		result = usb_get_descriptor(dev, USB_DESC_TYPE_CONFIGURATION,
+				cfgno, raw[cfgno], length[cfgno]);
+		if (result < 0)
+			goto out;
+		if ((unsigned)result < length[cfgno])
+			length[cfgno] = result;
+	}
+	cache = usb_desc_cache_add(dev, hdrs, raw, length, ncfg);
+	for (i = 0; cache && i < ncfg; i++) {
+		rt_free(raw[i]);
+		raw[i] = cache->raw[i];
+	}
+parse:
+	dev->desc_cache = cache;
+
+	if (!(dev->quirks & USB_QUIRK_NO_STRINGS)) {
+		strings[0] = usb_cache_string(dev, dev->descriptor.iProduct);
+		strings[1] = usb_cache_string(dev,
+				dev->descriptor.iManufacturer);
+		strings[2] = usb_cache_string(dev,
+				dev->descriptor.iSerialNumber);
+	}
+
+	/* measure */
+	bytes = arena_size(ncfg * sizeof(struct usb_host_config)) +
+		arena_size(ncfg * sizeof(char *));
+	for (i = 0; i < ncfg; i++) {
+		if (!cache)
+			bytes += arena_size(length[i]);
+		bytes += usb_config_bytes(raw[i], length[i]);
+	}
+	for (i = 0; i < 3; i++)
+		if (strings[i])
+			bytes += arena_size(rt_strlen(strings[i]) + 1);
+
+	arena = rt_malloc(sizeof(*arena) + bytes);
+	if (!arena) {
+		result = -ENOMEM;
+		goto out;
+	}
+	rt_memset(arena, 0, sizeof(*arena) + bytes);
+	arena->size = bytes;
+	dev->descs = arena;
+
+	/* none of these can fail, the block was sized for them */
+	dev->config = arena_alloc(arena, ncfg * sizeof(struct usb_host_config));
+	dev->rawdescriptors = arena_alloc(arena, ncfg * sizeof(char *));
+	dev->product = arena_strdup(arena, strings[0]);
+	dev->manufacturer = arena_strdup(arena, strings[1]);
+	dev->serial = arena_strdup(arena, strings[2]);
+
+	for (cfgno = 0; cfgno < (unsigned)ncfg; cfgno++) {
+		if (cache) {
+			dev->rawdescriptors[cfgno] = (char *)raw[cfgno];
+		} else {
+			dev->rawdescriptors[cfgno] = arena_alloc(arena,
+					length[cfgno]);
+			rt_memcpy(dev->rawdescriptors[cfgno], raw[cfgno],
+					length[cfgno]);
+		}
+
+		result = usb_parse_configuration(dev, arena,
+				&dev->config[cfgno],
+				(unsigned char *)dev->rawdescriptors[cfgno],
+				length[cfgno]);
+		if (result < 0) {
+			++cfgno;
+			goto out;
+		}
+	}
+	result = 0;
+
+out:
+	for (i = 0; !dev->desc_cache && i < ncfg; i++)
+		rt_free(raw[i]);
+	for (i = 0; i < 3; i++)
+		rt_free(strings[i]);
+	rt_free(hdrs);
+	dev->descriptor.bNumConfigurations = cfgno;
+	return result;
+}
+
+/**
+ * usb_ifnum_to_if - get the interface object with a given interface number
+ * @dev: the device whose current configuration is considered
+ * @ifnum: the desired interface
+ *
+ * Return: A pointer to the interface that has @ifnum as interface number,
+ * if found. %RT_NULL otherwise.
+ */
+struct usb_interface *usb_ifnum_to_if(const struct usb_device *dev,
+		unsigned ifnum)
+{
+	struct usb_host_config *config = dev->actconfig;
+	int i;
+
+	if (!config)
+		return RT_NULL;
+	if (ifnum < USB_MAXINTERFACES) {
+		i = config->intf_index[ifnum];
+		return i ? config->interface[i - 1] : RT_NULL;
+	}
+	for (i = 0; i < config->desc.bNumInterfaces; i++)
+		if (config->interface[i] &&
+		    config->interface[i]->altsetting[0].desc.bInterfaceNumber
+				== ifnum)
+			return config->interface[i];
+
+	return RT_NULL;
+}
+
+/**
+ * usb_altnum_to_altsetting - get the altsetting structure with a given alternate setting number.
+ * @intf: the interface containing the altsetting in question
+ * @altnum: the desired alternate setting number
+ *
+ * Return: A pointer to the entry of the altsetting array of @intf that
+ * has @altnum as the alternate setting number. %RT_NULL if not found.
+ */
+struct usb_host_interface *usb_altnum_to_altsetting(
+		const struct usb_interface *intf, unsigned int altnum)
+{
+	int lo = 0, hi = (int)intf->num_altsetting - 1, mid;
+
+	/* altsettings are sorted and nearly always numbered 0..n-1 */
+	if (altnum < intf->num_altsetting &&
+			intf->altsetting[altnum].desc.bAlternateSetting == altnum)
+		return &intf->altsetting[altnum];
+
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if (intf->altsetting[mid].desc.bAlternateSetting == altnum)
+			return &intf->altsetting[mid];
+		if (intf->altsetting[mid].desc.bAlternateSetting < altnum)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return RT_NULL;
+}
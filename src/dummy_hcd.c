@@ -0,0 +1,1531 @@
+/*
+ * dummy_hcd.c - software host controller
+ *
+ * Runs the stack without hardware: virtual devices (struct dummy_device)
+ * sit behind the root hub's ports, or behind virtual hubs on them, and a
+ * 1 ms frame timer moves data between their callbacks and the endpoints'
+ * urbs.  Every packet costs
+ * bus time at the device's speed plus the injected latency; a frame has
+ * DUMMY_FRAME_NS of it, and a packet that overdraws the budget delays
+ * the following frames.  Periodic endpoints are served once per
+ * interval, at most once per frame.
+ */
+
+#include "hcd.h"
+#include "hub.h"
+#include "dummy_hcd.h"
+
+#ifdef CONFIG_USB_DUMMY_HCD
+
+#define DUMMY_FRAME_NS		900000	/* 90% of a frame for transfers */
+#define DUMMY_PACKET_OVERHEAD	16	/* token, sync, crc, handshake */
+
+#define DUMMY_EPS		32	/* see dummy_ep_index() */
+#define DUMMY_MAX_STREAMS	64	/* per bulk endpoint */
+#define DUMMY_SG_TABLESIZE	128	/* segments per urb */
+
+struct dummy_ep {
+	rt_list_t		active;		/* on dummy_hcd.active */
+	struct usb_host_endpoint *ep;
+	struct urb		*cur;		/* urb in progress */
+	int			iso_next;	/* its next iso packet */
+	rt_uint32_t		next_frame;	/* interrupt: next service */
+	unsigned		toggle:1;
+	unsigned		halted:1;
+	unsigned		zlp_sent:1;
+	unsigned		cerr:2;		/* transaction errors in a row */
+
+	rt_list_t		*stream_q;	/* [1..nstreams], see
+						 * dummy_next_stream_urb() */
+	unsigned int		nstreams;
+	unsigned int		stream_urbs;	/* on stream_q */
+	unsigned int		stream_next;	/* round robin position */
+};
+
+struct dummy_hub;
+
+struct dummy_port {
+	uint16_t		status;
+	uint16_t		change;
+	struct dummy_device	*vdev;
+	struct dummy_hub	*owner;		/* RT_NULL on the root hub */
+	struct dummy_hub	*hub;		/* the last hub plugged in, it
+						 * routes its devices' urbs */
+	struct dummy_ep		eps[DUMMY_EPS];
+};
+
+/*
+ * A high speed hub without a TT.  Its class requests work on its own
+ * ports the way dummy_hub_control() does on the root hub's, and its
+ * status change endpoint NAKs until a port has a change to report.
+ */
+struct dummy_hub {
+	struct dummy_device	vdev;
+	struct dummy_hcd	*dum;		/* once plugged in somewhere */
+	struct dummy_port	*up;		/* the port it was plugged into */
+	int			nports;
+	struct dummy_port	ports[DUMMY_HUB_PORTS];
+};
+
+struct dummy_hcd {
+	struct usb_hcd		*hcd;
+	struct rt_timer		frame_timer;
+	struct rt_mutex		lock;		/* everything but active */
+	rt_list_t		active;		/* endpoints with work, irq off */
+	rt_uint32_t		frame;
+	rt_int32_t		budget;		/* bus time left, ns */
+	unsigned		rh_pending:1;	/* connect change to report */
+	struct dummy_port	ports[DUMMY_HCD_PORTS];
+	struct dummy_hcd_stats	stats;
+	uint8_t			packet[DUMMY_MAX_PACKET];	/* sg bounce */
+};
+
+rt_inline struct dummy_hcd *hcd_to_dummy(struct usb_hcd *hcd)
+{
+	return (struct dummy_hcd *)hcd->hcd_priv;
+}
+
+/* ep0 and other control endpoints at their number, OUT at 1..15 and
+ * IN at 17..31 */
+rt_inline int dummy_ep_index(uint8_t epaddr, int is_control)
+{
+	int idx = epaddr & USB_EP_DESC_NUM_MASK;
+
+	if (!is_control && (epaddr & USB_DIR_IN))
+		idx += 16;
+	return idx;
+}
+
+static const struct dummy_device_ops dummy_hub_ops;
+
+rt_inline int dummy_is_hub(struct dummy_device *vdev)
+{
+	return vdev->ops == &dummy_hub_ops;
+}
+
+rt_inline struct dummy_hub *vdev_to_hub(struct dummy_device *vdev)
+{
+	return rt_container_of(vdev, struct dummy_hub, vdev);
+}
+
+/*
+ * Devices behind a virtual hub keep their port until the hub is
+ * destroyed, so that urbs still coming for them after it was unplugged
+ * find it and are given back.
+ */
+static struct dummy_port *dummy_udev_port(struct dummy_hcd *dum,
+		struct usb_device *udev)
+{
+	struct dummy_port *up;
+
+	if (!udev->parent || udev->portnum < 1)
+		return RT_NULL;
+	if (udev->parent == dum->hcd->self.root_hub) {
+		if (udev->portnum > DUMMY_HCD_PORTS)
+			return RT_NULL;
+		return &dum->ports[udev->portnum - 1];
+	}
+
+	up = dummy_udev_port(dum, udev->parent);
+	if (!up || !up->hub || udev->portnum > up->hub->nports)
+		return RT_NULL;
+	return &up->hub->ports[udev->portnum - 1];
+}
+
+/* enabled and awake all the way up to the root hub */
+static int dummy_port_reachable(struct dummy_port *port)
+{
+	struct dummy_hub *hub;
+
+	for (;;) {
+		if (!port->vdev || !(port->status & USB_PORT_STAT_ENABLE) ||
+				(port->status & USB_PORT_STAT_SUSPEND))
+			return 0;
+		hub = port->owner;
+		if (!hub)
+			return 1;
+		port = hub->up;
+		if (!port || port->vdev != &hub->vdev)
+			return 0;
+	}
+}
+
+static struct dummy_ep *dummy_get_ep(struct dummy_hcd *dum,
+		struct usb_host_endpoint *ep)
+{
+	struct dummy_port *port = dummy_udev_port(dum, ep->udev);
+	int is_control = (ep->desc.bmAttributes & USB_EP_ATTR_TYPE_MASK) ==
+			USB_EP_ATTR_CONTROL;
+
+	if (!port)
+		return RT_NULL;
+	return &port->eps[dummy_ep_index(ep->desc.bEndpointAddress,
+			is_control)];
+}
+
+static void dummy_reset_ep(struct dummy_ep *dep)
+{
+	dep->toggle = 0;
+	dep->halted = 0;
+	dep->cerr = 0;
+}
+
+/* a port reset or SET_CONFIGURATION: every endpoint back to DATA0 */
+static void dummy_reset_eps(struct dummy_port *port, int keep_ep0)
+{
+	int i;
+
+	for (i = keep_ep0 ? 1 : 0; i < DUMMY_EPS; i++)
+		dummy_reset_ep(&port->eps[i]);
+}
+
+/*-------------------------------------------------------------------------*/
+
+/* bus time of one packet of @len bytes */
+static rt_int32_t dummy_packet_ns(struct dummy_device *vdev, int len)
+{
+	rt_int32_t byte_ns;
+
+	switch (vdev->speed) {
+	case USB_SPEED_HIGH:
+		byte_ns = 17;
+		break;
+	case USB_SPEED_LOW:
+		byte_ns = 5333;
+		break;
+	default:
+		byte_ns = 667;
+		break;
+	}
+	return (len + DUMMY_PACKET_OVERHEAD) * byte_ns +
+			vdev->faults.latency_us * 1000;
+}
+
+/* copy between a flat packet and an sg urb's data stage at @offset */
+static void dummy_sg_copy(struct urb *urb, u32 offset, uint8_t *buf,
+		int len, int to_urb)
+{
+	struct usb_sg_iter iter;
+	unsigned int n;
+	void *p;
+
+	usb_sg_iter_init(&iter, urb);
+	while (offset && (n = usb_sg_iter_next(&iter, offset, &p)))
+		offset -= n;
+	while (len > 0 && (n = usb_sg_iter_next(&iter, len, &p))) {
+		if (to_urb)
+			rt_memcpy(p, buf, n);
+		else
+			rt_memcpy(buf, p, n);
+		buf += n;
+		len -= n;
+	}
+}
+
+/*
+ * One data packet between the host and @vdev, faults first.
+ * Return: bytes moved, -EAGAIN for a NAK, -EILSEQ for a toggle error,
+ * -EPIPE for a STALL, -EPROTO while the device is hung.
+ */
+static int dummy_packet(struct dummy_hcd *dum, struct dummy_device *vdev,
+		uint8_t epaddr, void *buf, int len)
+{
+	struct dummy_faults *f = &vdev->faults;
+	int ret;
+
+	vdev->packets++;
+	dum->stats.packets++;
+
+	if (f->hang_after && vdev->packets >= f->hang_after) {
+		f->hang_after = 0;
+		vdev->hung = 1;
+	}
+
+	if (vdev->hung) {
+		ret = -EPROTO;
+	} else if (f->stall_after && vdev->packets >= f->stall_after &&
+			epaddr == f->stall_ep) {
+		f->stall_after = 0;
+		ret = -EPIPE;
+	} else if (f->nak_every && vdev->packets % f->nak_every == 0) {
+		ret = -EAGAIN;
+	} else if (f->toggle_every && vdev->packets % f->toggle_every == 0) {
+		ret = -EILSEQ;
+	} else if (!vdev->ops || !vdev->ops->transfer) {
+		ret = -EPIPE;
+	} else {
+		ret = vdev->ops->transfer(vdev, epaddr, buf, len);
+	}
+
+	if (ret >= 0)
+		dum->stats.bytes += ret;
+	else if (ret == -EAGAIN)
+		dum->stats.naks++;
+	else if (ret == -EILSEQ)
+		dum->stats.toggle_errors++;
+	else if (ret == -EPIPE)
+		dum->stats.stalls++;
+	else if (ret == -EPROTO)
+		dum->stats.hangs++;
+	return ret;
+}
+
+/*-------------------------------------------------------------------------*/
+
+static int dummy_string(struct dummy_device *vdev, int index,
+		uint8_t *buf, int len)
+{
+	const char *s;
+	int n, total;
+
+	if (index == 0) {
+		uint8_t langids[4] = { 4, USB_DESC_TYPE_STRING, 0x09, 0x04 };
+
+		n = len < 4 ? len : 4;
+		rt_memcpy(buf, langids, n);
+		return n;
+	}
+	if (!vdev->strings || index > vdev->nstrings ||
+			!vdev->strings[index - 1])
+		return -EPIPE;
+
+	s = vdev->strings[index - 1];
+	total = 2 + 2 * rt_strlen(s);
+	if (total > 254)
+		total = 254;
+	if (len > total)
+		len = total;
+	for (n = 0; n < len; n++) {
+		if (n == 0)
+			buf[n] = total;
+		else if (n == 1)
+			buf[n] = USB_DESC_TYPE_STRING;
+		else
+			buf[n] = (n & 1) ? 0 : s[n / 2 - 1];
+	}
+	return len;
+}
+
+static int dummy_get_descriptor(struct dummy_device *vdev,
+		uint16_t wValue, uint8_t *buf, int len)
+{
+	const uint8_t *desc;
+	int index = wValue & 0xff, n;
+
+	switch (wValue >> 8) {
+	case USB_DESC_TYPE_DEVICE:
+		desc = (const uint8_t *)vdev->device;
+		n = USB_DESC_LENGTH_DEVICE;
+		break;
+	case USB_DESC_TYPE_CONFIGURATION:
+		if (index >= vdev->device->bNumConfigurations)
+			return -EPIPE;
+		desc = vdev->configs[index];
+		n = desc[2] | (desc[3] << 8);
+		break;
+	case USB_DESC_TYPE_STRING:
+		return dummy_string(vdev, index, buf, len);
+	default:
+		return -ENOSYS;
+	}
+	if (n > len)
+		n = len;
+	rt_memcpy(buf, desc, n);
+	return n;
+}
+
+static int dummy_notify(struct dummy_device *vdev,
+		const struct usb_ctrlrequest *req, void *buf)
+{
+	int ret;
+
+	if (!vdev->ops || !vdev->ops->setup)
+		return 0;
+	ret = vdev->ops->setup(vdev, req, buf);
+	return ret < 0 ? ret : 0;
+}
+
+/*
+ * The standard requests every device answers the same way.
+ * Return: data length, a negative error, or -ENOSYS if @vdev's own
+ * setup() has to answer.
+ */
+static int dummy_std_request(struct dummy_port *port,
+		const struct usb_ctrlrequest *req, uint8_t *buf, int len)
+{
+	struct dummy_device *vdev = port->vdev;
+	uint16_t typeReq = (req->bRequestType << 8) | req->bRequest;
+	struct dummy_ep *dep;
+	int i;
+
+	switch (typeReq) {
+	case DeviceOutRequest | USB_REQ_SET_ADDRESS:
+		if (req->wValue > 127)
+			return -EPIPE;
+		vdev->address = req->wValue;
+		return 0;
+	case DeviceRequest | USB_REQ_GET_DESCRIPTOR:
+		return dummy_get_descriptor(vdev, req->wValue, buf, len);
+	case DeviceRequest | USB_REQ_GET_CONFIGURATION:
+		if (len < 1)
+			return 0;
+		buf[0] = vdev->config;
+		return 1;
+	case DeviceOutRequest | USB_REQ_SET_CONFIGURATION:
+		for (i = 0; req->wValue &&
+				i < vdev->device->bNumConfigurations; i++) {
+			if (vdev->configs[i][5] == req->wValue)
+				break;
+		}
+		if (req->wValue && i == vdev->device->bNumConfigurations)
+			return -EPIPE;
+		vdev->config = req->wValue;
+		dummy_reset_eps(port, 1);
+		return dummy_notify(vdev, req, buf);
+	case InterfaceOutRequest | USB_REQ_SET_INTERFACE:
+		dummy_reset_eps(port, 1);
+		return dummy_notify(vdev, req, buf);
+	case DeviceRequest | USB_REQ_GET_STATUS:
+	case InterfaceRequest | USB_REQ_GET_STATUS:
+	case EndpointRequest | USB_REQ_GET_STATUS:
+		if (len < 2)
+			return 0;
+		buf[0] = 0;
+		buf[1] = 0;
+		if ((req->bRequestType & USB_REQ_TYPE_RECIPIENT_MASK) ==
+				USB_REQ_TYPE_ENDPOINT)
+			buf[0] = port->eps[dummy_ep_index(req->wIndex,
+					!(req->wIndex & 0x0f))].halted;
+		return 2;
+	case EndpointOutRequest | USB_REQ_CLEAR_FEATURE:
+	case EndpointOutRequest | USB_REQ_SET_FEATURE:
+		if (req->wValue != USB_FEATURE_ENDPOINT_HALT)
+			return -EPIPE;
+		dep = &port->eps[dummy_ep_index(req->wIndex,
+				!(req->wIndex & 0x0f))];
+		dummy_reset_ep(dep);
+		dep->halted = req->bRequest == USB_REQ_SET_FEATURE;
+		return 0;
+	}
+	return -ENOSYS;
+}
+
+/* setup, data and status stage in one go, there is no error between */
+static int dummy_control(struct dummy_hcd *dum, struct dummy_port *port,
+		struct urb *urb)
+{
+	struct usb_ctrlrequest *req = (void *)urb->setup_packet;
+	struct dummy_device *vdev = port->vdev;
+	uint8_t *buf = urb->transfer_buffer;
+	int len = req->wLength, ret;
+
+	if (dum->budget <= 0)
+		return -EINPROGRESS;
+	dum->budget -= dummy_packet_ns(vdev, 8) +
+			dummy_packet_ns(vdev, len) + dummy_packet_ns(vdev, 0);
+
+	if (vdev->hung) {
+		dum->stats.hangs++;
+		return -EPROTO;
+	}
+
+	if ((u32)len > urb->transfer_buffer_length)
+		len = urb->transfer_buffer_length;
+	if (urb->num_sgs) {
+		if (len > DUMMY_MAX_PACKET)
+			len = DUMMY_MAX_PACKET;
+		buf = dum->packet;
+		if (!(req->bRequestType & USB_DIR_IN))
+			dummy_sg_copy(urb, 0, buf, len, 0);
+	}
+
+	ret = dummy_std_request(port, req, buf, len);
+	if (ret == -ENOSYS)
+		ret = vdev->ops && vdev->ops->setup ?
+				vdev->ops->setup(vdev, req, buf) : -EPIPE;
+	if (ret == -EAGAIN)
+		return -EINPROGRESS;
+	if (ret < 0)
+		return ret;
+
+	if (!(req->bRequestType & USB_DIR_IN))
+		ret = len;
+	else if (ret > len)
+		ret = len;
+	if (urb->num_sgs && (req->bRequestType & USB_DIR_IN))
+		dummy_sg_copy(urb, 0, buf, ret, 1);
+	urb->actual_length = ret;
+	return 0;
+}
+
+/* bulk and interrupt; -EINPROGRESS while @urb isn't done */
+static int dummy_data(struct dummy_hcd *dum, struct dummy_port *port,
+		struct dummy_ep *dep, struct urb *urb)
+{
+	struct dummy_device *vdev = port->vdev;
+	struct usb_host_endpoint *ep = dep->ep;
+	struct usb_ep_state *st = usb_pipe_ep_state(urb->dev, urb->pipe);
+	uint8_t epaddr = ep->desc.bEndpointAddress;
+	int maxp = st->maxpacket;
+	int is_in = usb_pipein(urb->pipe) != 0;
+	int is_int = usb_pipeint(urb->pipe);
+	u32 left;
+	uint8_t *buf;
+	int len, ret;
+
+	if (dep->halted)
+		return -EPIPE;
+	if (maxp == 0 || maxp > DUMMY_MAX_PACKET)
+		return -EMSGSIZE;
+
+	while (dum->budget > 0) {
+		if (is_int && (rt_int32_t)(dum->frame - dep->next_frame) < 0)
+			return -EINPROGRESS;
+
+		left = urb->transfer_buffer_length - urb->actual_length;
+		if (left == 0 && urb->transfer_buffer_length &&
+				(is_in || dep->zlp_sent ||
+				 !(urb->transfer_flags & URB_ZERO_PACKET) ||
+				 urb->transfer_buffer_length % maxp))
+			return 0;
+
+		len = left < (u32)maxp ? (int)left : maxp;
+		if (urb->num_sgs) {
+			buf = dum->packet;
+			if (!is_in)
+				dummy_sg_copy(urb, urb->actual_length, buf,
+						len, 0);
+		} else {
+			buf = (uint8_t *)urb->transfer_buffer +
+					urb->actual_length;
+		}
+
+		dum->budget -= dummy_packet_ns(vdev, len);
+		if (is_int)
+			dep->next_frame = dum->frame + st->interval;
+
+		ret = dummy_packet(dum, vdev, epaddr, buf, len);
+		if (ret == -EAGAIN) {
+			usb_hcd_trace_nak(ep);
+			return -EINPROGRESS;
+		}
+		if (ret == -EILSEQ) {
+			if (++dep->cerr == 3)
+				return -EPROTO;
+			continue;
+		}
+		if (ret == -EPIPE)
+			dep->halted = 1;
+		if (ret < 0)
+			return ret;
+
+		dep->cerr = 0;
+		dep->toggle ^= 1;
+		if (ret > len)
+			ret = len;
+		if (urb->num_sgs && is_in)
+			dummy_sg_copy(urb, urb->actual_length, buf, ret, 1);
+		urb->actual_length += ret;
+		if (len == 0) {
+			dep->zlp_sent = 1;
+			return 0;
+		}
+		if (ret < len)
+			return 0;	/* short packet */
+	}
+	return -EINPROGRESS;
+}
+
+/*
+ * Each packet goes out in its own frame, start_frame + n * interval.
+ * A packet whose frame went by without bus time for it is lost and
+ * counted as an underrun.
+ */
+static int dummy_iso(struct dummy_hcd *dum, struct dummy_port *port,
+		struct dummy_ep *dep, struct urb *urb)
+{
+	struct usb_host_endpoint *ep = dep->ep;
+	struct usb_iso_packet_descriptor *d;
+	int interval = usb_pipe_ep_state(urb->dev, urb->pipe)->interval;
+	int now = dum->frame & USB_FRAME_MASK;
+	int diff, ret;
+	uint8_t *buf;
+
+	while (dep->iso_next < urb->number_of_packets) {
+		diff = usb_frame_diff(urb->start_frame +
+				dep->iso_next * interval, now);
+		if (diff > 0 || (diff == 0 && dum->budget <= 0))
+			return -EINPROGRESS;
+
+		d = &urb->iso_frame_desc[dep->iso_next++];
+		d->actual_length = 0;
+		if (diff < 0) {
+			d->status = -EXDEV;
+			urb->error_count++;
+			ep->iso_underruns++;
+			continue;
+		}
+		if (d->length > DUMMY_MAX_PACKET) {
+			d->status = -EMSGSIZE;
+			urb->error_count++;
+			continue;
+		}
+
+		if (urb->num_sgs) {
+			buf = dum->packet;
+			if (usb_pipeout(urb->pipe))
+				dummy_sg_copy(urb, d->offset, buf, d->length, 0);
+		} else {
+			buf = (uint8_t *)urb->transfer_buffer + d->offset;
+		}
+
+		dum->budget -= dummy_packet_ns(port->vdev, d->length);
+		ret = dummy_packet(dum, port->vdev,
+				ep->desc.bEndpointAddress, buf, d->length);
+		if (ret > (int)d->length) {
+			d->status = -EOVERFLOW;
+			urb->error_count++;
+			ep->iso_overruns++;
+		} else if (ret < 0) {
+			d->status = ret == -EAGAIN ? -EXDEV : -EPROTO;
+			urb->error_count++;
+		} else {
+			d->status = 0;
+			d->actual_length = ret;
+			urb->actual_length += ret;
+			if (urb->num_sgs && usb_pipein(urb->pipe))
+				dummy_sg_copy(urb, d->offset, buf, ret, 1);
+		}
+		return dep->iso_next < urb->number_of_packets ?
+				-EINPROGRESS : 0;
+	}
+	return 0;
+}
+
+static void dummy_giveback(struct dummy_hcd *dum, struct dummy_ep *dep,
+		struct urb *urb, int status)
+{
+	if (dep->cur == urb)
+		dep->cur = RT_NULL;
+	usb_hcd_giveback_urb(dum->hcd, urb, status);
+}
+
+/* 0 if @urb can go on the wire, else the status to give it back with */
+static int dummy_urb_check(struct dummy_port *port, struct urb *urb)
+{
+	if (urb->unlinked)
+		return urb->unlinked;
+	if (!dummy_port_reachable(port))
+		return -ENODEV;
+	/* nobody answers at that address */
+	if (usb_pipedevice(urb->pipe) != port->vdev->address)
+		return -EPROTO;
+	return 0;
+}
+
+static void dummy_urb_start(struct dummy_ep *dep, struct urb *urb)
+{
+	if (dep->cur == urb)
+		return;
+	dep->cur = urb;
+	dep->iso_next = 0;
+	dep->zlp_sent = 0;
+	dep->cerr = 0;
+	urb->actual_length = 0;
+	urb->error_count = 0;
+}
+
+/*
+ * The urb to work on next: the one in progress, or the next off the
+ * ring.  Unlinked urbs and urbs for a device that went away are given
+ * back on the way.
+ */
+static struct urb *dummy_next_urb(struct dummy_hcd *dum,
+		struct dummy_port *port, struct dummy_ep *dep)
+{
+	struct usb_host_endpoint *ep = dep->ep;
+	struct urb *urb;
+	int status;
+
+	for (;;) {
+		if (!rt_list_isempty(&ep->urb_list))
+			urb = rt_list_first_entry(&ep->urb_list, struct urb,
+					urb_list);
+		else
+			urb = usb_hcd_ep_next_urb(dum->hcd, ep);
+		if (!urb)
+			return RT_NULL;
+
+		status = dummy_urb_check(port, urb);
+		if (status) {
+			dummy_giveback(dum, dep, urb, status);
+			continue;
+		}
+		dummy_urb_start(dep, urb);
+		return urb;
+	}
+}
+
+/*
+ * Streams: urbs taken off the ring are sorted onto one queue per
+ * stream, and the device picks which stream moves next, so urbs on
+ * different streams complete in whatever order it likes.  Once picked,
+ * an urb keeps the endpoint until it is done.
+ */
+static struct urb *dummy_next_stream_urb(struct dummy_hcd *dum,
+		struct dummy_port *port, struct dummy_ep *dep)
+{
+	struct usb_host_endpoint *ep = dep->ep;
+	struct dummy_device *vdev = port->vdev;
+	struct urb *urb, *next;
+	unsigned int i, sid = 0;
+	int status;
+
+	while ((urb = usb_hcd_ep_next_urb(dum->hcd, ep)) != RT_NULL) {
+		if (urb->stream_id < 1 || urb->stream_id > dep->nstreams) {
+			dummy_giveback(dum, dep, urb, -EINVAL);
+			continue;
+		}
+		rt_list_remove(&urb->urb_list);
+		rt_list_insert_before(&dep->stream_q[urb->stream_id],
+				&urb->urb_list);
+		dep->stream_urbs++;
+	}
+
+	/* unlinks don't wait for the device to pick their stream */
+	for (i = 1; i <= dep->nstreams; i++) {
+		rt_list_for_each_entry_safe(urb, next, &dep->stream_q[i],
+				urb_list) {
+			status = dummy_urb_check(port, urb);
+			if (status) {
+				dep->stream_urbs--;
+				dummy_giveback(dum, dep, urb, status);
+			}
+		}
+	}
+
+	if (dep->cur)
+		return dep->cur;
+	if (!dep->stream_urbs)
+		return RT_NULL;
+
+	if (vdev->ops && vdev->ops->next_stream) {
+		sid = vdev->ops->next_stream(vdev, ep->desc.bEndpointAddress);
+	} else {
+		for (i = 0; i < dep->nstreams; i++) {
+			sid = (dep->stream_next + i) % dep->nstreams + 1;
+			if (!rt_list_isempty(&dep->stream_q[sid]))
+				break;
+		}
+		dep->stream_next = sid % dep->nstreams;
+	}
+	if (sid < 1 || sid > dep->nstreams ||
+			rt_list_isempty(&dep->stream_q[sid]))
+		return RT_NULL;		/* nothing the device wants yet */
+
+	urb = rt_list_first_entry(&dep->stream_q[sid], struct urb, urb_list);
+	dummy_urb_start(dep, urb);
+	return urb;
+}
+
+static void dummy_service_ep(struct dummy_hcd *dum, struct dummy_ep *dep)
+{
+	struct dummy_port *port = dummy_udev_port(dum, dep->ep->udev);
+	struct urb *urb;
+	int status;
+
+	if (!port)
+		return;
+	while (dum->budget > 0) {
+		if (dep->nstreams)
+			urb = dummy_next_stream_urb(dum, port, dep);
+		else
+			urb = dummy_next_urb(dum, port, dep);
+		if (!urb)
+			return;
+
+		switch (usb_pipetype(urb->pipe)) {
+		case PIPE_CONTROL:
+			status = dummy_control(dum, port, urb);
+			break;
+		case PIPE_ISOCHRONOUS:
+			status = dummy_iso(dum, port, dep, urb);
+			break;
+		default:
+			status = dummy_data(dum, port, dep, urb);
+			break;
+		}
+		if (status == -EINPROGRESS)
+			return;
+
+		if (dep->nstreams)
+			dep->stream_urbs--;
+		dummy_giveback(dum, dep, urb, status);
+	}
+}
+
+rt_inline int dummy_ep_busy(struct dummy_ep *dep)
+{
+	struct usb_host_endpoint *ep = dep->ep;
+
+	return !rt_list_isempty(&ep->urb_list) || dep->stream_urbs ||
+		rt_atomic_load(&ep->ring.head) != rt_atomic_load(&ep->ring.tail);
+}
+
+static void dummy_frame(void *parameter)
+{
+	struct dummy_hcd *dum = parameter;
+	struct dummy_ep *dep;
+	rt_list_t pending;
+	rt_base_t level;
+	int rh_pending;
+
+	rt_mutex_take(&dum->lock, RT_WAITING_FOREVER);
+	dum->frame++;
+	dum->stats.frames++;
+	dum->budget += DUMMY_FRAME_NS;
+	if (dum->budget > DUMMY_FRAME_NS)
+		dum->budget = DUMMY_FRAME_NS;
+
+	/* Endpoints stay linked while they are served, so a kick meanwhile
+	 * doesn't link them twice; whether they go back on the list is
+	 * decided with interrupts off, where no kick can slip in between. */
+	rt_list_init(&pending);
+	level = rt_hw_interrupt_disable();
+	if (!rt_list_isempty(&dum->active)) {
+		pending.next = dum->active.next;
+		pending.prev = dum->active.prev;
+		pending.next->prev = &pending;
+		pending.prev->next = &pending;
+		rt_list_init(&dum->active);
+	}
+	rt_hw_interrupt_enable(level);
+
+	while (!rt_list_isempty(&pending)) {
+		dep = rt_list_first_entry(&pending, struct dummy_ep, active);
+		if (dum->budget > 0)
+			dummy_service_ep(dum, dep);
+
+		level = rt_hw_interrupt_disable();
+		rt_list_remove(&dep->active);
+		if (dep->ep && dummy_ep_busy(dep))
+			rt_list_insert_before(&dum->active, &dep->active);
+		rt_hw_interrupt_enable(level);
+	}
+
+	rh_pending = dum->rh_pending;
+	dum->rh_pending = 0;
+	rt_mutex_release(&dum->lock);
+
+	usb_hcd_giveback_flush(dum->hcd);
+
+	if (rh_pending)
+		usb_hcd_poll_rh_status(dum->hcd);
+}
+
+/*-------------------------------------------------------------------------*/
+
+static void dummy_endpoint_kick(struct usb_hcd *hcd,
+		struct usb_host_endpoint *ep)
+{
+	struct dummy_hcd *dum = hcd_to_dummy(hcd);
+	struct dummy_ep *dep = dummy_get_ep(dum, ep);
+	rt_base_t level;
+
+	if (!dep)
+		return;
+
+	level = rt_hw_interrupt_disable();
+	dep->ep = ep;
+	if (rt_list_isempty(&dep->active))
+		rt_list_insert_before(&dum->active, &dep->active);
+	rt_hw_interrupt_enable(level);
+}
+
+/* the frame timer gives the urb back the next time it looks at the
+ * endpoint */
+static int dummy_urb_dequeue(struct usb_hcd *hcd, struct urb *urb,
+		int status)
+{
+	dummy_endpoint_kick(hcd, urb->ep);
+	return 0;
+}
+
+/* gives back what is still queued on the streams; caller holds the lock */
+static void dummy_drop_streams(struct dummy_hcd *dum, struct dummy_ep *dep)
+{
+	struct urb *urb;
+	unsigned int i;
+
+	for (i = 1; i <= dep->nstreams; i++) {
+		while (!rt_list_isempty(&dep->stream_q[i])) {
+			urb = rt_list_first_entry(&dep->stream_q[i],
+					struct urb, urb_list);
+			dummy_giveback(dum, dep, urb, -ESHUTDOWN);
+		}
+	}
+	rt_free(dep->stream_q);
+	dep->stream_q = RT_NULL;
+	dep->nstreams = 0;
+	dep->stream_urbs = 0;
+	dep->stream_next = 0;
+}
+
+static int dummy_alloc_streams(struct usb_hcd *hcd, struct usb_device *udev,
+		struct usb_host_endpoint **eps, unsigned int num_eps,
+		unsigned int num_streams)
+{
+	struct dummy_hcd *dum = hcd_to_dummy(hcd);
+	struct dummy_ep *dep;
+	unsigned int i, j;
+	int retval = num_streams;
+
+	if (num_streams > DUMMY_MAX_STREAMS)
+		num_streams = retval = DUMMY_MAX_STREAMS;
+
+	rt_mutex_take(&dum->lock, RT_WAITING_FOREVER);
+	for (i = 0; i < num_eps; i++) {
+		dep = dummy_get_ep(dum, eps[i]);
+		if (!dep) {
+			retval = -EINVAL;
+			break;
+		}
+		dep->stream_q = rt_malloc((num_streams + 1) *
+				sizeof(rt_list_t));
+		if (!dep->stream_q) {
+			retval = -ENOMEM;
+			break;
+		}
+		for (j = 0; j <= num_streams; j++)
+			rt_list_init(&dep->stream_q[j]);
+		dep->ep = eps[i];
+		dep->nstreams = num_streams;
+	}
+	while (retval < 0 && i--)
+		dummy_drop_streams(dum, dummy_get_ep(dum, eps[i]));
+	rt_mutex_release(&dum->lock);
+	return retval;
+}
+
+static int dummy_free_streams(struct usb_hcd *hcd, struct usb_device *udev,
+		struct usb_host_endpoint **eps, unsigned int num_eps)
+{
+	struct dummy_hcd *dum = hcd_to_dummy(hcd);
+	struct dummy_ep *dep;
+	unsigned int i;
+
+	rt_mutex_take(&dum->lock, RT_WAITING_FOREVER);
+	for (i = 0; i < num_eps; i++) {
+		dep = dummy_get_ep(dum, eps[i]);
+		if (dep)
+			dummy_drop_streams(dum, dep);
+	}
+	rt_mutex_release(&dum->lock);
+	return 0;
+}
+
+static void dummy_endpoint_disable(struct usb_hcd *hcd,
+		struct usb_host_endpoint *ep)
+{
+	struct dummy_hcd *dum = hcd_to_dummy(hcd);
+	struct dummy_ep *dep = dummy_get_ep(dum, ep);
+	struct urb *urb;
+	rt_base_t level;
+
+	rt_mutex_take(&dum->lock, RT_WAITING_FOREVER);
+	while (!rt_list_isempty(&ep->urb_list)) {
+		urb = rt_list_first_entry(&ep->urb_list, struct urb,
+				urb_list);
+		usb_hcd_giveback_urb(hcd, urb, -ESHUTDOWN);
+	}
+	while ((urb = usb_hcd_ep_next_urb(hcd, ep)) != RT_NULL)
+		usb_hcd_giveback_urb(hcd, urb, -ESHUTDOWN);
+
+	if (dep && dep->ep == ep) {
+		dummy_drop_streams(dum, dep);
+		level = rt_hw_interrupt_disable();
+		rt_list_remove(&dep->active);
+		rt_list_init(&dep->active);
+		dep->ep = RT_NULL;
+		rt_hw_interrupt_enable(level);
+		dep->cur = RT_NULL;
+		dummy_reset_ep(dep);
+	}
+	rt_mutex_release(&dum->lock);
+}
+
+static void dummy_endpoint_reset(struct usb_hcd *hcd,
+		struct usb_host_endpoint *ep)
+{
+	struct dummy_hcd *dum = hcd_to_dummy(hcd);
+	struct dummy_ep *dep = dummy_get_ep(dum, ep);
+
+	if (!dep)
+		return;
+	rt_mutex_take(&dum->lock, RT_WAITING_FOREVER);
+	dummy_reset_ep(dep);
+	rt_mutex_release(&dum->lock);
+}
+
+static int dummy_get_frame_number(struct usb_hcd *hcd)
+{
+	return hcd_to_dummy(hcd)->frame & 0x7ff;
+}
+
+/*-------------------------------------------------------------------------*/
+
+/* connect state follows power and the attached device; caller holds
+ * the lock */
+static void dummy_port_update(struct dummy_hcd *dum, struct dummy_port *port)
+{
+	uint16_t old = port->status;
+
+	port->status &= ~(USB_PORT_STAT_CONNECTION | USB_PORT_STAT_ENABLE |
+			USB_PORT_STAT_SUSPEND | USB_PORT_STAT_LOW_SPEED |
+			USB_PORT_STAT_HIGH_SPEED);
+	if ((port->status & USB_PORT_STAT_POWER) && port->vdev) {
+		port->status |= USB_PORT_STAT_CONNECTION;
+		if (port->vdev->speed == USB_SPEED_LOW)
+			port->status |= USB_PORT_STAT_LOW_SPEED;
+		else if (port->vdev->speed == USB_SPEED_HIGH)
+			port->status |= USB_PORT_STAT_HIGH_SPEED;
+		/* still the same device, it stays enabled */
+		port->status |= old & (USB_PORT_STAT_ENABLE |
+				USB_PORT_STAT_SUSPEND);
+	}
+
+	if ((old ^ port->status) & USB_PORT_STAT_CONNECTION) {
+		port->change |= USB_PORT_STAT_C_CONNECTION;
+		/* a virtual hub reports it on its status endpoint */
+		if (!port->owner)
+			dum->rh_pending = 1;
+	}
+	if ((old & ~port->status) & USB_PORT_STAT_ENABLE)
+		port->change |= USB_PORT_STAT_C_ENABLE;
+}
+
+static int dummy_hub_status_data(struct usb_hcd *hcd, char *buf)
+{
+	struct dummy_hcd *dum = hcd_to_dummy(hcd);
+	uint8_t bits = 0;
+	int i;
+
+	for (i = 0; i < DUMMY_HCD_PORTS; i++) {
+		if (dum->ports[i].change)
+			bits |= 1 << (i + 1);
+	}
+	buf[0] = bits;
+	return bits ? 1 : 0;
+}
+
+/* a hub powers up with its ports off and nothing to report */
+static void dummy_hub_reset(struct dummy_hub *hub)
+{
+	int i;
+
+	for (i = 0; i < hub->nports; i++) {
+		hub->ports[i].status = 0;
+		hub->ports[i].change = 0;
+	}
+}
+
+/*
+ * Hub class requests on @ports, the root hub's or a virtual hub's;
+ * caller holds the lock.
+ */
+static int dummy_port_control(struct dummy_hcd *dum, struct dummy_port *ports,
+		int nports, uint16_t typeReq, uint16_t wValue, uint16_t wIndex,
+		char *buf)
+{
+	struct dummy_port *port = RT_NULL;
+	struct usb_port_status *ps;
+	uint8_t *desc;
+	int retval = 0;
+
+	if (typeReq == GetPortStatus || typeReq == SetPortFeature ||
+			typeReq == ClearPortFeature) {
+		if (wIndex < 1 || wIndex > nports)
+			return -EPIPE;
+		port = &ports[wIndex - 1];
+	}
+
+	switch (typeReq) {
+	case ClearHubFeature:
+	case SetHubFeature:
+		break;
+	case GetHubDescriptor:
+		desc = (uint8_t *)buf;
+		rt_memset(desc, 0, USB_DT_HUB_NONVAR_SIZE + 2);
+		desc[0] = USB_DT_HUB_NONVAR_SIZE + 2;
+		desc[1] = USB_DESC_TYPE_HUB;
+		desc[2] = nports;
+		desc[3] = 0x01;		/* per-port power switching */
+		desc[5] = 1;		/* bPwrOn2PwrGood, 2 ms */
+		desc[USB_DT_HUB_NONVAR_SIZE + 1] = 0xff;	/* PortPwrCtrlMask */
+		break;
+	case GetHubStatus:
+		rt_memset(buf, 0, sizeof(struct usb_hub_status));
+		break;
+	case GetPortStatus:
+		ps = (struct usb_port_status *)buf;
+		ps->wPortStatus = port->status;
+		ps->wPortChange = port->change;
+		break;
+	case SetPortFeature:
+		switch (wValue) {
+		case USB_PORT_FEAT_POWER:
+			port->status |= USB_PORT_STAT_POWER;
+			dummy_port_update(dum, port);
+			break;
+		case USB_PORT_FEAT_RESET:
+			if (!(port->status & USB_PORT_STAT_CONNECTION))
+				break;
+			/* the reset is over by the time anyone looks */
+			port->status |= USB_PORT_STAT_ENABLE;
+			port->status &= ~USB_PORT_STAT_SUSPEND;
+			port->change |= USB_PORT_STAT_C_RESET;
+			port->vdev->address = 0;
+			port->vdev->config = 0;
+			dummy_reset_eps(port, 0);
+			if (port->vdev->hung && port->vdev->faults.hang_resets)
+				port->vdev->faults.hang_resets--;
+			else
+				port->vdev->hung = 0;
+			if (dummy_is_hub(port->vdev))
+				dummy_hub_reset(vdev_to_hub(port->vdev));
+			break;
+		case USB_PORT_FEAT_SUSPEND:
+			if (port->status & USB_PORT_STAT_ENABLE)
+				port->status |= USB_PORT_STAT_SUSPEND;
+			break;
+		default:
+			retval = -EPIPE;
+			break;
+		}
+		break;
+	case ClearPortFeature:
+		switch (wValue) {
+		case USB_PORT_FEAT_ENABLE:
+			port->status &= ~(USB_PORT_STAT_ENABLE |
+					USB_PORT_STAT_SUSPEND);
+			break;
+		case USB_PORT_FEAT_SUSPEND:
+			port->status &= ~USB_PORT_STAT_SUSPEND;
+			break;
+		case USB_PORT_FEAT_POWER:
+			port->status &= ~USB_PORT_STAT_POWER;
+			dummy_port_update(dum, port);
+			break;
+		case USB_PORT_FEAT_C_CONNECTION:
+		case USB_PORT_FEAT_C_ENABLE:
+		case USB_PORT_FEAT_C_SUSPEND:
+		case USB_PORT_FEAT_C_OVER_CURRENT:
+		case USB_PORT_FEAT_C_RESET:
+			port->change &= ~(1 << (wValue -
+					USB_PORT_FEAT_C_CONNECTION));
+			break;
+		default:
+			retval = -EPIPE;
+			break;
+		}
+		break;
+	default:
+		retval = -EPIPE;
+		break;
+	}
+	return retval;
+}
+
+static int dummy_hub_control(struct usb_hcd *hcd, uint16_t typeReq,
+		uint16_t wValue, uint16_t wIndex, char *buf, uint16_t wLength)
+{
+	struct dummy_hcd *dum = hcd_to_dummy(hcd);
+	int retval;
+
+	rt_mutex_take(&dum->lock, RT_WAITING_FOREVER);
+	retval = dummy_port_control(dum, dum->ports, DUMMY_HCD_PORTS, typeReq,
+			wValue, wIndex, buf);
+	rt_mutex_release(&dum->lock);
+	return retval;
+}
+
+/*-------------------------------------------------------------------------*/
+
+static const struct usb_device_descriptor dummy_hub_device = {
+	.bLength =		USB_DESC_LENGTH_DEVICE,
+	.bDescriptorType =	USB_DESC_TYPE_DEVICE,
+	.bcdUSB =		0x0200,
+	.bDeviceClass =		USB_CLASS_HUB,
+	.bMaxPacketSize0 =	64,
+	.idVendor =		0x1d6b,
+	.idProduct =		0x0100,
+	.bcdDevice =		0x0100,
+	.bNumConfigurations =	1,
+};
+
+static const uint8_t dummy_hub_config[] = {
+	USB_DESC_LENGTH_CONFIG, USB_DESC_TYPE_CONFIGURATION,
+	USB_DESC_LENGTH_CONFIG + USB_DESC_LENGTH_INTERFACE +
+		USB_DESC_LENGTH_ENDPOINT, 0,
+	1,		/* bNumInterfaces */
+	1,		/* bConfigurationValue */
+	0,
+	0xe0,		/* self powered, remote wakeup */
+	0,
+
+	USB_DESC_LENGTH_INTERFACE, USB_DESC_TYPE_INTERFACE,
+	0, 0, 1, USB_CLASS_HUB, 0, 0, 0,
+
+	/* status change endpoint, every frame rather than every 256 */
+	USB_DESC_LENGTH_ENDPOINT, USB_DESC_TYPE_ENDPOINT,
+	USB_DIR_IN | 1, USB_EP_ATTR_INT, 1, 0, 4,
+};
+
+static const uint8_t * const dummy_hub_configs[] = { dummy_hub_config };
+
+/* called from the frame timer with the lock held */
+static int dummy_hub_setup(struct dummy_device *vdev,
+		const struct usb_ctrlrequest *req, void *buf)
+{
+	struct dummy_hub *hub = vdev_to_hub(vdev);
+	uint16_t typeReq = (req->bRequestType << 8) | req->bRequest;
+	char data[USB_DT_HUB_NONVAR_SIZE + 2];
+	int ret;
+
+	/* SET_CONFIGURATION and SET_INTERFACE, nothing to do */
+	if ((req->bRequestType & USB_REQ_TYPE_MASK) != USB_REQ_TYPE_CLASS)
+		return 0;
+
+	ret = dummy_port_control(hub->dum, hub->ports, hub->nports, typeReq,
+			req->wValue, req->wIndex, data);
+	if (ret < 0)
+		return ret;
+	switch (typeReq) {
+	case GetHubDescriptor:
+		ret = data[0];
+		break;
+	case GetHubStatus:
+	case GetPortStatus:
+		ret = 4;
+		break;
+	}
+	if (ret > req->wLength)
+		ret = req->wLength;
+	rt_memcpy(buf, data, ret);
+	return ret;
+}
+
+/* the status change bitmap, a NAK while there is none */
+static int dummy_hub_transfer(struct dummy_device *vdev, uint8_t epaddr,
+		void *buf, int len)
+{
+	struct dummy_hub *hub = vdev_to_hub(vdev);
+	uint8_t bits = 0;
+	int i;
+
+	for (i = 0; i < hub->nports; i++) {
+		if (hub->ports[i].change)
+			bits |= 1 << (i + 1);
+	}
+	if (!bits)
+		return -EAGAIN;
+	*(uint8_t *)buf = bits;
+	return 1;
+}
+
+static const struct dummy_device_ops dummy_hub_ops = {
+	.setup =	dummy_hub_setup,
+	.transfer =	dummy_hub_transfer,
+};
+
+/* the devices already behind @hub come along to @dum */
+static void dummy_hub_adopt(struct dummy_hub *hub, struct dummy_hcd *dum)
+{
+	struct dummy_device *vdev;
+	int i;
+
+	hub->dum = dum;
+	for (i = 0; i < hub->nports; i++) {
+		vdev = hub->ports[i].vdev;
+		if (vdev && dummy_is_hub(vdev))
+			dummy_hub_adopt(vdev_to_hub(vdev), dum);
+	}
+}
+
+/* caller holds @dum's lock, if there is one yet */
+static int dummy_port_attach(struct dummy_hcd *dum, struct dummy_port *port,
+		struct dummy_device *vdev)
+{
+	struct dummy_port *p;
+	struct dummy_hub *hub;
+
+	if (!vdev->device ||
+			(vdev->device->bNumConfigurations && !vdev->configs))
+		return -EINVAL;
+	if (port->vdev)
+		return -EBUSY;
+
+	if (dummy_is_hub(vdev)) {
+		hub = vdev_to_hub(vdev);
+		if (hub->up && hub->up->vdev == vdev)
+			return -EBUSY;		/* plugged in elsewhere */
+		/* not behind itself */
+		for (p = port; p && p->owner; p = p->owner->up) {
+			if (p->owner == hub)
+				return -ELOOP;
+		}
+		hub->up = port;
+		port->hub = hub;
+		dummy_hub_reset(hub);
+		dummy_hub_adopt(hub, dum);
+	}
+
+	vdev->address = 0;
+	vdev->config = 0;
+	vdev->packets = 0;
+	port->vdev = vdev;
+	dummy_port_update(dum, port);
+	return 0;
+}
+
+static void dummy_port_detach(struct dummy_hcd *dum, struct dummy_port *port)
+{
+	port->vdev = RT_NULL;
+	dummy_port_update(dum, port);
+}
+
+/*-------------------------------------------------------------------------*/
+
+static int dummy_start(struct usb_hcd *hcd)
+{
+	struct dummy_hcd *dum = hcd_to_dummy(hcd);
+	int i, j;
+
+	dum->hcd = hcd;
+	hcd->can_do_streams = 1;
+	/* packets are assembled across segments, see dummy_sg_copy() */
+	hcd->self.sg_tablesize = DUMMY_SG_TABLESIZE;
+	hcd->self.no_sg_constraint = 1;
+	rt_list_init(&dum->active);
+	for (i = 0; i < DUMMY_HCD_PORTS; i++)
+		for (j = 0; j < DUMMY_EPS; j++)
+			rt_list_init(&dum->ports[i].eps[j].active);
+	rt_mutex_init(&dum->lock, "dummyhc", RT_IPC_FLAG_PRIO);
+	rt_timer_init(&dum->frame_timer, "dummyfr", dummy_frame, dum,
+			rt_tick_from_millisecond(1),
+			RT_TIMER_FLAG_PERIODIC | RT_TIMER_FLAG_SOFT_TIMER);
+	rt_timer_start(&dum->frame_timer);
+	return 0;
+}
+
+/* the root hub and with it every device is gone already */
+static void dummy_stop(struct usb_hcd *hcd)
+{
+	struct dummy_hcd *dum = hcd_to_dummy(hcd);
+
+	rt_timer_stop(&dum->frame_timer);
+	/* let a frame that is running finish */
+	rt_mutex_take(&dum->lock, RT_WAITING_FOREVER);
+	rt_timer_detach(&dum->frame_timer);
+	rt_mutex_release(&dum->lock);
+	rt_mutex_detach(&dum->lock);
+}
+
+static const struct hc_driver dummy_hc_driver = {
+	.description =		"dummy_hcd",
+	.product_desc =		"Dummy host controller",
+	.hcd_priv_size =	sizeof(struct dummy_hcd),
+	.flags =		HCD_USB2 | HCD_BH | HCD_BH_BATCH,
+
+	.start =		dummy_start,
+	.stop =			dummy_stop,
+	.get_frame_number =	dummy_get_frame_number,
+
+	.endpoint_kick =	dummy_endpoint_kick,
+	.urb_dequeue =		dummy_urb_dequeue,
+	.endpoint_disable =	dummy_endpoint_disable,
+	.endpoint_reset =	dummy_endpoint_reset,
+	.alloc_streams =	dummy_alloc_streams,
+	.free_streams =		dummy_free_streams,
+
+	.hub_status_data =	dummy_hub_status_data,
+	.hub_control =		dummy_hub_control,
+};
+
+/**
+ * dummy_hcd_create - create and start a software host controller
+ * @name: bus name
+ *
+ * Return: the running hcd, its ports still empty, or %RT_NULL.
+ */
+struct usb_hcd *dummy_hcd_create(const char *name)
+{
+	struct usb_hcd *hcd;
+
+	hcd = usb_create_hcd(&dummy_hc_driver, name);
+	if (!hcd)
+		return RT_NULL;
+	if (usb_add_hcd(hcd)) {
+		usb_put_hcd(hcd);
+		return RT_NULL;
+	}
+	return hcd;
+}
+
+void dummy_hcd_destroy(struct usb_hcd *hcd)
+{
+	usb_remove_hcd(hcd);
+	usb_put_hcd(hcd);
+}
+
+/**
+ * dummy_hcd_connect - plug a virtual device into a root hub port
+ * @hcd: a dummy_hcd_create() controller
+ * @port1: port number, from 1
+ * @vdev: the device, which must stay around until it's disconnected
+ *
+ * The hub driver sees the connect change on the next frame and
+ * enumerates @vdev like a real device.  A dummy_hub_create() hub brings
+ * along whatever is plugged into it already.
+ *
+ * Return: 0, -EINVAL for a bad port or device, -EBUSY if the port is
+ * taken or @vdev is plugged in elsewhere.
+ */
+int dummy_hcd_connect(struct usb_hcd *hcd, int port1,
+		struct dummy_device *vdev)
+{
+	struct dummy_hcd *dum = hcd_to_dummy(hcd);
+	int retval;
+
+	if (port1 < 1 || port1 > DUMMY_HCD_PORTS)
+		return -EINVAL;
+
+	rt_mutex_take(&dum->lock, RT_WAITING_FOREVER);
+	retval = dummy_port_attach(dum, &dum->ports[port1 - 1], vdev);
+	rt_mutex_release(&dum->lock);
+	return retval;
+}
+
+void dummy_hcd_disconnect(struct usb_hcd *hcd, int port1)
+{
+	struct dummy_hcd *dum = hcd_to_dummy(hcd);
+
+	if (port1 < 1 || port1 > DUMMY_HCD_PORTS)
+		return;
+	rt_mutex_take(&dum->lock, RT_WAITING_FOREVER);
+	dummy_port_detach(dum, &dum->ports[port1 - 1]);
+	rt_mutex_release(&dum->lock);
+}
+
+/**
+ * dummy_hub_create - a virtual high speed hub
+ * @nports: downstream ports, 1 to DUMMY_HUB_PORTS
+ *
+ * Plug it in like any other device, with dummy_hcd_connect() or into
+ * another hub, and devices into it with dummy_hub_connect().
+ *
+ * Return: the hub's device, or %RT_NULL.
+ */
+struct dummy_device *dummy_hub_create(int nports)
+{
+	struct dummy_hub *hub;
+	int i, j;
+
+	if (nports < 1 || nports > DUMMY_HUB_PORTS)
+		return RT_NULL;
+	hub = rt_calloc(1, sizeof(*hub));
+	if (!hub)
+		return RT_NULL;
+
+	hub->vdev.speed = USB_SPEED_HIGH;
+	hub->vdev.device = &dummy_hub_device;
+	hub->vdev.configs = dummy_hub_configs;
+	hub->vdev.ops = &dummy_hub_ops;
+	hub->nports = nports;
+	for (i = 0; i < nports; i++) {
+		hub->ports[i].owner = hub;
+		for (j = 0; j < DUMMY_EPS; j++)
+			rt_list_init(&hub->ports[i].eps[j].active);
+	}
+	return &hub->vdev;
+}
+
+/**
+ * dummy_hub_destroy - free a virtual hub
+ * @vdev: a dummy_hub_create() hub
+ *
+ * Only once it is unplugged and the stack is done with the devices that
+ * were behind it, their urbs still find their way through it until then.
+ */
+void dummy_hub_destroy(struct dummy_device *vdev)
+{
+	struct dummy_hub *hub = vdev_to_hub(vdev);
+	struct dummy_hcd *dum = hub->dum;
+
+	if (dum)
+		rt_mutex_take(&dum->lock, RT_WAITING_FOREVER);
+	if (hub->up && hub->up->hub == hub)
+		hub->up->hub = RT_NULL;
+	if (dum)
+		rt_mutex_release(&dum->lock);
+	rt_free(hub);
+}
+
+/**
+ * dummy_hub_connect - plug a virtual device into a virtual hub's port
+ * @vdev: a dummy_hub_create() hub
+ * @port1: port number, from 1
+ * @child: the device, which must stay around until it's disconnected
+ *
+ * Like dummy_hcd_connect(), the hub reports the change once it is
+ * enumerated and has powered its ports.
+ *
+ * Return: 0, -EINVAL for a bad hub, port or device, -EBUSY if the port
+ * is taken or @child is plugged in elsewhere, -ELOOP if @child is a hub
+ * @vdev is behind.
+ */
+int dummy_hub_connect(struct dummy_device *vdev, int port1,
+		struct dummy_device *child)
+{
+	struct dummy_hub *hub = vdev_to_hub(vdev);
+	struct dummy_hcd *dum;
+	int retval;
+
+	if (!dummy_is_hub(vdev) || port1 < 1 || port1 > hub->nports)
+		return -EINVAL;
+
+	dum = hub->dum;
+	if (dum)
+		rt_mutex_take(&dum->lock, RT_WAITING_FOREVER);
+	retval = dummy_port_attach(dum, &hub->ports[port1 - 1], child);
+	if (dum)
+		rt_mutex_release(&dum->lock);
+	return retval;
+}
+
+void dummy_hub_disconnect(struct dummy_device *vdev, int port1)
+{
+	struct dummy_hub *hub = vdev_to_hub(vdev);
+	struct dummy_hcd *dum;
+
+	if (!dummy_is_hub(vdev) || port1 < 1 || port1 > hub->nports)
+		return;
+
+	dum = hub->dum;
+	if (dum)
+		rt_mutex_take(&dum->lock, RT_WAITING_FOREVER);
+	dummy_port_detach(dum, &hub->ports[port1 - 1]);
+	if (dum)
+		rt_mutex_release(&dum->lock);
+}
+
+void dummy_hcd_get_stats(struct usb_hcd *hcd, struct dummy_hcd_stats *stats)
+{
+	struct dummy_hcd *dum = hcd_to_dummy(hcd);
+
+	rt_mutex_take(&dum->lock, RT_WAITING_FOREVER);
+	*stats = dum->stats;
+	rt_mutex_release(&dum->lock);
+}
+
+#endif /* CONFIG_USB_DUMMY_HCD */
@@ -0,0 +1,1211 @@
+#include "hcd.h"
+#include "hub.h"
+
+/*-------------------------------------------------------------------------*/
+
+/*
+ * URB submission ring, see struct usb_urb_ring.
+ *
+ * Multi-producer, single-consumer, after Vyukov's bounded queue: the
+ * slot for position p is free for a producer when its sequence is p,
+ * filled for the consumer when it is p + 1, and becomes free for
+ * position p + USB_URB_RING_SIZE once drained.  head, tail and the
+ * sequences only ever grow; arithmetic is done unsigned so they may
+ * wrap.
+ */
+
+#define URB_RING_MASK	(USB_URB_RING_SIZE - 1)
+
+rt_inline rt_ubase_t urb_ring_seq(struct usb_urb_ring *ring, rt_ubase_t idx)
+{
+	return (rt_ubase_t)rt_atomic_load(&ring->seq[idx]) + idx;
+}
+
+rt_inline void urb_ring_set_seq(struct usb_urb_ring *ring, rt_ubase_t idx,
+		rt_ubase_t seq)
+{
+	rt_atomic_store(&ring->seq[idx], (atomic_t)(seq - idx));
+}
+
+/**
+ * usb_hcd_link_urb_to_ep - publish an URB on its endpoint's ring
+ * @hcd: host controller the URB was submitted to
+ * @urb: URB being submitted
+ *
+ * Producer side of the ring, called from usb_hcd_submit_urb() by any
+ * number of submitters at once.  A position is claimed with one
+ * compare-and-swap on head, which is retried only if another submitter
+ * claimed it first; the slot is written before its sequence publishes
+ * it, so the hcd never sees a slot it could read half-written.
+ *
+ * Return: 0 on success, -ESHUTDOWN if the controller is not running,
+ * -ENOENT if the endpoint is disabled, -ENOSPC if the ring is full.
+ */
+int usb_hcd_link_urb_to_ep(struct usb_hcd *hcd, struct urb *urb)
+{
+	struct usb_urb_ring *ring = &urb->ep->ring;
+	atomic_t head;
+	rt_ubase_t pos, idx;
+	rt_base_t diff;
+
+	if (!HCD_RH_RUNNING(hcd) || !HCD_HW_ACCESSIBLE(hcd))
+		return -ESHUTDOWN;
+	if (!urb->ep->enabled)
+		return -ENOENT;
+
+	head = rt_atomic_load(&ring->head);
+	for (;;) {
+		pos = (rt_ubase_t)head;
+		idx = pos & URB_RING_MASK;
+		diff = (rt_base_t)(urb_ring_seq(ring, idx) - pos);
+		if (diff < 0)
+			return -ENOSPC;	/* not drained since the last lap */
+		if (diff > 0) {
+			/* claimed by another submitter meanwhile */
+			head = rt_atomic_load(&ring->head);
+			continue;
+		}
+		/* on failure head is reloaded */
+		if (rt_atomic_compare_exchange_strong(&ring->head, &head,
+				(atomic_t)(pos + 1)))
+			break;
+	}
+
+	ring->slot[idx] = urb;
+	urb_ring_set_seq(ring, idx, pos + 1);
+	return 0;
+}
+
+/**
+ * usb_hcd_ep_next_urb - take the next URB off an endpoint's ring
+ * @hcd: host controller owning the endpoint
+ * @ep: endpoint to drain
+ *
+ * Consumer side of the ring, for hcd use only.  The returned URB is
+ * moved onto @ep->urb_list, which belongs to the hcd from then on.
+ * URBs that were unlinked while still on the ring are given back here
+ * and skipped.  A slot that is claimed but not yet filled ends the
+ * search; its submitter kicks the endpoint once it is.
+ *
+ * Return: the next URB to start, or %RT_NULL if the ring is empty.
+ */
+struct urb *usb_hcd_ep_next_urb(struct usb_hcd *hcd,
+		struct usb_host_endpoint *ep)
+{
+	struct usb_urb_ring *ring = &ep->ring;
+	struct urb *urb;
+	rt_ubase_t tail, idx;
+
+	for (;;) {
+		tail = (rt_ubase_t)rt_atomic_load(&ring->tail);
+		idx = tail & URB_RING_MASK;
+		if (urb_ring_seq(ring, idx) != tail + 1)
+			return RT_NULL;
+		urb = ring->slot[idx];
+		urb_ring_set_seq(ring, idx, tail + USB_URB_RING_SIZE);
+		rt_atomic_store(&ring->tail, (atomic_t)(tail + 1));
+
+		rt_list_insert_before(&ep->urb_list, &urb->urb_list);
+		if (!urb->unlinked)
+			return urb;
+		usb_hcd_giveback_urb(hcd, urb, urb->unlinked);
+	}
+}
+
+/*-------------------------------------------------------------------------*/
+
+/*
+ * Root hub emulation.
+ *
+ * The root hub is a usb_device like any other, but its urbs never reach
+ * the ring.  Standard control requests are answered here from static
+ * descriptors, hub class requests go to hc_driver->hub_control(), and
+ * the one status change urb is parked in hcd->status_urb until the hcd
+ * reports a port change through usb_hcd_poll_rh_status().
+ */
+
+#define RH_POLL_INTERVAL	250	/* msec, HCD_FLAG_POLL_RH only */
+
+/* usb 2.0 root hub device descriptor */
+static const struct usb_device_descriptor usb2_rh_dev_descriptor = {
+	.bLength =		USB_DESC_LENGTH_DEVICE,
+	.bDescriptorType =	USB_DESC_TYPE_DEVICE,
+	.bcdUSB =		0x0200,
+	.bDeviceClass =		USB_CLASS_HUB,
+	.bDeviceSubClass =	0,
+	.bDeviceProtocol =	1,	/* [ usb 2.0 single TT ] */
+	.bMaxPacketSize0 =	64,
+	.idVendor =		0x1d6b,	/* Linux Foundation */
+	.idProduct =		0x0002,	/* 2.0 root hub */
+	.bcdDevice =		0x0100,
+	.iManufacturer =	3,
+	.iProduct =		2,
+	.iSerialNumber =	1,
+	.bNumConfigurations =	1,
+};
+
+/* usb 1.1 root hub device descriptor */
+static const struct usb_device_descriptor usb11_rh_dev_descriptor = {
+	.bLength =		USB_DESC_LENGTH_DEVICE,
+	.bDescriptorType =	USB_DESC_TYPE_DEVICE,
+	.bcdUSB =		0x0110,
+	.bDeviceClass =		USB_CLASS_HUB,
+	.bDeviceSubClass =	0,
+	.bDeviceProtocol =	0,	/* [ low/full speeds only ] */
+	.bMaxPacketSize0 =	64,
+	.idVendor =		0x1d6b,	/* Linux Foundation */
+	.idProduct =		0x0001,	/* 1.1 root hub */
+	.bcdDevice =		0x0100,
+	.iManufacturer =	3,
+	.iProduct =		2,
+	.iSerialNumber =	1,
+	.bNumConfigurations =	1,
+};
+
+static const uint8_t fs_rh_config_descriptor[] = {
+	/* one configuration */
+	0x09,       /*  __u8  bLength; */
+	0x02,       /*  __u8  bDescriptorType; Configuration */
+	0x19, 0x00, /*  __le16 wTotalLength; */
+	0x01,       /*  __u8  bNumInterfaces; (1) */
+	0x01,       /*  __u8  bConfigurationValue; */
+	0x00,       /*  __u8  iConfiguration; */
+	0xc0,       /*  __u8  bmAttributes; Self-powered */
+	0x00,       /*  __u8  MaxPower; */
+
+	/* one interface */
+	0x09,       /*  __u8  if_bLength; */
+	0x04,       /*  __u8  if_bDescriptorType; Interface */
+	0x00,       /*  __u8  if_bInterfaceNumber; */
+	0x00,       /*  __u8  if_bAlternateSetting; */
+	0x01,       /*  __u8  if_bNumEndpoints; */
+	0x09,       /*  __u8  if_bInterfaceClass; HUB_CLASSCODE */
+	0x00,       /*  __u8  if_bInterfaceSubClass; */
+	0x00,       /*  __u8  if_bInterfaceProtocol; [usb1.1 or single tt] */
+	0x00,       /*  __u8  if_iInterface; */
+
+	/* one endpoint (status change endpoint) */
+	0x07,       /*  __u8  ep_bLength; */
+	0x05,       /*  __u8  ep_bDescriptorType; Endpoint */
+	0x81,       /*  __u8  ep_bEndpointAddress; IN Endpoint 1 */
+	0x03,       /*  __u8  ep_bmAttributes; Interrupt */
+	0x04, 0x00, /*  __le16 ep_wMaxPacketSize; 1 + (MAX_ROOT_PORTS / 8) */
+	0xff        /*  __u8  ep_bInterval; (255ms -- usb 2.0 spec) */
+};
+
+static const uint8_t hs_rh_config_descriptor[] = {
+	/* one configuration */
+	0x09,       /*  __u8  bLength; */
+	0x02,       /*  __u8  bDescriptorType; Configuration */
+	0x19, 0x00, /*  __le16 wTotalLength; */
+	0x01,       /*  __u8  bNumInterfaces; (1) */
+	0x01,       /*  __u8  bConfigurationValue; */
+	0x00,       /*  __u8  iConfiguration; */
+	0xc0,       /*  __u8  bmAttributes; Self-powered */
+	0x00,       /*  __u8  MaxPower; */
+
+	/* one interface */
+	0x09,       /*  __u8  if_bLength; */
+	0x04,       /*  __u8  if_bDescriptorType; Interface */
+	0x00,       /*  __u8  if_bInterfaceNumber; */
+	0x00,       /*  __u8  if_bAlternateSetting; */
+	0x01,       /*  __u8  if_bNumEndpoints; */
+	0x09,       /*  __u8  if_bInterfaceClass; HUB_CLASSCODE */
+	0x00,       /*  __u8  if_bInterfaceSubClass; */
+	0x00,       /*  __u8  if_bInterfaceProtocol; [usb1.1 or single tt] */
+	0x00,       /*  __u8  if_iInterface; */
+
+	/* one endpoint (status change endpoint) */
+	0x07,       /*  __u8  ep_bLength; */
+	0x05,       /*  __u8  ep_bDescriptorType; Endpoint */
+	0x81,       /*  __u8  ep_bEndpointAddress; IN Endpoint 1 */
+	0x03,       /*  __u8  ep_bmAttributes; Interrupt */
+	0x04, 0x00, /*  __le16 ep_wMaxPacketSize; 1 + (MAX_ROOT_PORTS / 8) */
+	0x0c        /*  __u8  ep_bInterval; (256ms -- usb 2.0 spec) */
+};
+
+/**
+ * ascii2desc() - Helper routine for producing UTF-16LE string descriptors
+ * @s: Null-terminated ASCII (actually ISO-8859-1) string
+ * @buf: Buffer for USB string descriptor (header + UTF-16LE)
+ * @len: Length (in bytes; may be odd) of descriptor buffer.
+ *
+ * Return: The number of bytes filled in: 2 + 2*strlen(s) or @len,
+ * whichever is less.
+ */
+static unsigned ascii2desc(const char *s, uint8_t *buf, unsigned len)
+{
+	unsigned n, t = 2 + 2 * rt_strlen(s);
+
+	if (t > 254)
+		t = 254;	/* Longest possible UTF string descriptor */
+	if (len > t)
+		len = t;
+
+	t += USB_DESC_TYPE_STRING << 8;	/* Now t is first 16-bit word */
+
+	n = len;
+	while (n--) {
+		*buf++ = t;
+		if (!n--)
+			break;
+		*buf++ = t >> 8;
+		t = (unsigned char)*s++;
+	}
+	return len;
+}
+
+/*
+ * rh_string() - provides string descriptors for root hub
+ * @id: the string ID number (0: langids, 1: serial #, 2: product, 3: vendor)
+ *
+ * Return: The number of bytes filled in, or -EPIPE for unknown ids.
+ */
+static int rh_string(int id, const struct usb_hcd *hcd, uint8_t *data,
+		unsigned len)
+{
+	static const uint8_t langids[4] = { 4, USB_DESC_TYPE_STRING,
+			0x09, 0x04 };	/* US English */
+	char buf[64];
+	const char *s;
+
+	switch (id) {
+	case 0:
+		if (len > sizeof(langids))
+			len = sizeof(langids);
+		rt_memcpy(data, langids, len);
+		return len;
+	case 1:
+		s = hcd->self.parent.parent.name;
+		break;
+	case 2:
+		s = hcd->product_desc;
+		break;
+	case 3:
+		rt_snprintf(buf, sizeof(buf), "RT-Thread %s",
+				hcd->driver->description ?
+				hcd->driver->description : "hcd");
+		s = buf;
+		break;
+	default:
+		return -EPIPE;
+	}
+	return ascii2desc(s, data, len);
+}
+
+/* Root hub control transfers execute synchronously */
+static int rh_call_control(struct usb_hcd *hcd, struct urb *urb)
+{
+	struct usb_ctrlrequest *cmd = (void *)urb->setup_packet;
+	uint16_t typeReq, wValue, wIndex, wLength;
+	const uint8_t *bufp = RT_NULL;
+	uint8_t *tbuf = hcd->rh_buf;
+	unsigned len = 0, tlen;
+	int status = 0;
+
+	typeReq = (cmd->bRequestType << 8) | cmd->bRequest;
+	wValue = cmd->wValue;
+	wIndex = cmd->wIndex;
+	wLength = cmd->wLength;
+
+	if (wLength > urb->transfer_buffer_length)
+		return -EINVAL;
+
+	tlen = wLength < USB_RH_BUF_SIZE ? wLength : USB_RH_BUF_SIZE;
+	rt_mutex_take(hcd->rh_mutex, RT_WAITING_FOREVER);
+	rt_memset(tbuf, 0, USB_RH_BUF_SIZE);
+
+	switch (typeReq) {
+
+	/* DEVICE REQUESTS */
+
+	case DeviceRequest | USB_REQ_GET_STATUS:
+		tbuf[0] = 1;	/* self powered */
+		tbuf[1] = 0;
+		len = 2;
+		break;
+	case DeviceOutRequest | USB_REQ_CLEAR_FEATURE:
+	case DeviceOutRequest | USB_REQ_SET_FEATURE:
+		break;
+	case DeviceRequest | USB_REQ_GET_CONFIGURATION:
+		tbuf[0] = 1;
+		len = 1;
+		break;
+	case DeviceOutRequest | USB_REQ_SET_CONFIGURATION:
+		break;
+	case DeviceRequest | USB_REQ_GET_DESCRIPTOR:
+		switch (wValue & 0xff00) {
+		case USB_DESC_TYPE_DEVICE << 8:
+			if (hcd->speed == HCD_USB2)
+				bufp = (const uint8_t *)&usb2_rh_dev_descriptor;
+			else
+				bufp = (const uint8_t *)&usb11_rh_dev_descriptor;
+			len = USB_DESC_LENGTH_DEVICE;
+			break;
+		case USB_DESC_TYPE_CONFIGURATION << 8:
+			if (hcd->speed == HCD_USB2) {
+				bufp = hs_rh_config_descriptor;
+				len = sizeof(hs_rh_config_descriptor);
+			} else {
+				bufp = fs_rh_config_descriptor;
+				len = sizeof(fs_rh_config_descriptor);
+			}
+			break;
+		case USB_DESC_TYPE_STRING << 8:
+			status = rh_string(wValue & 0xff, hcd, tbuf, tlen);
+			if (status >= 0) {
+				len = status;
+				status = 0;
+			}
+			break;
+		default:
+			status = -EPIPE;
+			break;
+		}
+		break;
+	case DeviceRequest | USB_REQ_GET_INTERFACE:
+		tbuf[0] = 0;
+		len = 1;
+		break;
+	case InterfaceOutRequest | USB_REQ_SET_INTERFACE:
+		break;
+	case DeviceOutRequest | USB_REQ_SET_ADDRESS:
+		/* the root hub is addressed when it is registered */
+		break;
+
+	/* ENDPOINT REQUESTS */
+
+	case EndpointRequest | USB_REQ_GET_STATUS:
+		/* ENDPOINT_HALT flag */
+		tbuf[0] = 0;
+		tbuf[1] = 0;
+		len = 2;
+		break;
+	case EndpointOutRequest | USB_REQ_CLEAR_FEATURE:
+	case EndpointOutRequest | USB_REQ_SET_FEATURE:
+		break;
+
+	/* CLASS REQUESTS (and errors) */
+
+	default:
+		status = hcd->driver->hub_control(hcd, typeReq, wValue,
+				wIndex, (char *)tbuf, tlen);
+		switch (typeReq) {
+		case GetHubDescriptor:
+			len = tbuf[0];
+			break;
+		case GetHubStatus:
+		case GetPortStatus:
+			len = 4;
+			break;
+		}
+		break;
+	}
+
+	if (status) {
+		len = 0;
+		if (status != -EPIPE)
+			status = -EPIPE;	/* "protocol stall" on error */
+	}
+	if (len) {
+		if (urb->transfer_buffer_length < len)
+			len = urb->transfer_buffer_length;
+		if (len > wLength)
+			len = wLength;
+		rt_memcpy(urb->transfer_buffer, bufp ? bufp : tbuf, len);
+	}
+	urb->actual_length = len;
+	rt_mutex_release(hcd->rh_mutex);
+
+	usb_hcd_giveback_urb(hcd, urb, status);
+	return 0;
+}
+
+/**
+ * usb_hcd_poll_rh_status - report root hub port changes
+ * @hcd: host controller whose root hub may have changed
+ *
+ * HCDs call this from their port change interrupt; the status urb, if
+ * one is queued, completes with the bitmap from hub_status_data(), and
+ * otherwise the change is remembered until the hub driver asks again.
+ * Controllers without such an interrupt set HCD_FLAG_POLL_RH and are
+ * polled from hcd->rh_timer instead.
+ */
+void usb_hcd_poll_rh_status(struct usb_hcd *hcd)
+{
+	struct urb *urb;
+	char buffer[6];	/* Any root hubs with > 31 ports? */
+	rt_base_t level;
+	int length;
+
+	if (!HCD_RH_RUNNING(hcd))
+		return;
+
+	length = hcd->driver->hub_status_data(hcd, buffer);
+	if (length <= 0)
+		return;
+
+	level = rt_hw_interrupt_disable();
+	urb = hcd->status_urb;
+	if (!urb) {
+		hcd->flags |= 1U << HCD_FLAG_POLL_PENDING;
+		rt_hw_interrupt_enable(level);
+		return;
+	}
+	hcd->flags &= ~(1U << HCD_FLAG_POLL_PENDING);
+	hcd->status_urb = RT_NULL;
+	rt_hw_interrupt_enable(level);
+
+	if ((unsigned)length > urb->transfer_buffer_length)
+		length = urb->transfer_buffer_length;
+	rt_memcpy(urb->transfer_buffer, buffer, length);
+	urb->actual_length = length;
+	usb_hcd_giveback_urb(hcd, urb, 0);
+}
+
+/**
+ * usb_hcd_resume_root_hub - a root port saw resume signalling
+ * @hcd: host controller whose port a suspended device woke up on
+ *
+ * For HCDs that get an interrupt when a device signals remote wakeup:
+ * the port change is reported right away instead of at the next poll,
+ * and HCD_FLAG_WAKEUP_PENDING stays set until the hub thread finished
+ * the resume.  Safe from interrupt context.
+ */
+void usb_hcd_resume_root_hub(struct usb_hcd *hcd)
+{
+	rt_base_t level;
+
+	level = rt_hw_interrupt_disable();
+	hcd->flags |= 1U << HCD_FLAG_WAKEUP_PENDING;
+	rt_hw_interrupt_enable(level);
+	usb_hcd_poll_rh_status(hcd);
+}
+
+static void rh_timer_func(void *parameter)
+{
+	usb_hcd_poll_rh_status(parameter);
+}
+
+static int rh_queue_status(struct usb_hcd *hcd, struct urb *urb)
+{
+	rt_base_t level;
+	int pending;
+
+	level = rt_hw_interrupt_disable();
+	if (hcd->status_urb || urb->transfer_buffer_length < 1) {
+		rt_hw_interrupt_enable(level);
+		return -EINVAL;
+	}
+	hcd->status_urb = urb;
+	pending = HCD_POLL_PENDING(hcd) != 0;
+	rt_hw_interrupt_enable(level);
+
+	/* a change reported while no urb was queued */
+	if (pending)
+		usb_hcd_poll_rh_status(hcd);
+	return 0;
+}
+
+static int rh_urb_enqueue(struct usb_hcd *hcd, struct urb *urb)
+{
+	if (!HCD_RH_RUNNING(hcd))
+		return -ESHUTDOWN;
+	if (usb_pipeint(urb->pipe))
+		return rh_queue_status(hcd, urb);
+	if (usb_pipecontrol(urb->pipe))
+		return rh_call_control(hcd, urb);
+	return -EINVAL;
+}
+
+/* control urbs complete before submit returns, only the status urb
+ * can still be pending */
+static int usb_rh_urb_dequeue(struct usb_hcd *hcd, struct urb *urb,
+		int status)
+{
+	rt_base_t level;
+
+	level = rt_hw_interrupt_disable();
+	if (hcd->status_urb != urb) {
+		rt_hw_interrupt_enable(level);
+		return 0;
+	}
+	hcd->status_urb = RT_NULL;
+	rt_hw_interrupt_enable(level);
+
+	usb_hcd_giveback_urb(hcd, urb, status);
+	return 0;
+}
+
+/* the root hub takes address 1 and is enumerated like any device */
+static int register_root_hub(struct usb_hcd *hcd)
+{
+	struct usb_device *rhdev;
+	int retval;
+
+	rhdev = usb_alloc_dev(RT_NULL, &hcd->self, 0);
+	if (!rhdev)
+		return -ENOMEM;
+	rhdev->speed = hcd->speed == HCD_USB2 ? USB_SPEED_HIGH :
+			USB_SPEED_FULL;
+	rhdev->ep0.desc.wMaxPacketSize = 64;
+	usb_ep0_reinit(rhdev);
+	rhdev->devnum = usb_alloc_devnum(&hcd->self);	/* 1 on a new bus */
+	rhdev->state = USB_STATE_ADDRESS;
+	hcd->self.root_hub = rhdev;
+
+	retval = usb_get_device_descriptor(rhdev, USB_DESC_LENGTH_DEVICE);
+	if (retval == USB_DESC_LENGTH_DEVICE)
+		retval = usb_new_device(rhdev);
+	else if (retval >= 0)
+		retval = -EMSGSIZE;
+	if (retval) {
+		usb_disconnect(&hcd->self.root_hub);
+		return retval;
+	}
+
+	hcd->rh_registered = 1;
+	if (HCD_POLL_RH(hcd))
+		rt_timer_start(&hcd->rh_timer);
+	return 0;
+}
+
+/*-------------------------------------------------------------------------*/
+
+/*
+ * usb_hcd_iso_schedule - place an isochronous urb in the frame schedule
+ *
+ * With URB_ISO_ASAP the urb follows the packets already queued on its
+ * endpoint, or starts USB_ISO_SLOP frames from now if the stream fell
+ * behind; the frames it missed count as underruns.  Otherwise
+ * urb->start_frame is taken as given.  Either way the hcd sends packet
+ * n in frame start_frame + n * interval.  The urb is then published on
+ * the ring like any other.
+ *
+ * Return: 0, -EXDEV if an explicit start frame is already past, -EFBIG
+ * if the urb would end more than USB_ISO_HORIZON frames ahead, or an
+ * error from usb_hcd_link_urb_to_ep().
+ */
+static int usb_hcd_iso_schedule(struct usb_hcd *hcd, struct urb *urb)
+{
+	struct usb_host_endpoint *ep = urb->ep;
+	int now, start, end, late = 0, ret;
+
+	if (!hcd->driver->get_frame_number)
+		return -EINVAL;
+	now = hcd->driver->get_frame_number(hcd);
+
+	if (urb->transfer_flags & URB_ISO_ASAP) {
+		start = now + USB_ISO_SLOP;
+		if (ep->iso_active) {
+			late = usb_frame_diff(start, ep->iso_next);
+			if (late <= 0) {
+				start = ep->iso_next;
+				late = 0;
+			}
+		}
+	} else {
+		start = urb->start_frame;
+		if (usb_frame_diff(start, now) <= 0)
+			return -EXDEV;
+	}
+
+	end = start + urb->number_of_packets *
+			usb_ep_frame_interval(urb->dev, ep);
+	if (usb_frame_diff(end, now) > USB_ISO_HORIZON ||
+			usb_frame_diff(end, now) < 0) {
+		ep->iso_overruns++;
+		return -EFBIG;
+	}
+
+	urb->start_frame = start & USB_FRAME_MASK;
+	ret = usb_hcd_link_urb_to_ep(hcd, urb);
+	if (ret)
+		return ret;
+	ep->iso_underruns += late;
+	ep->iso_next = end & USB_FRAME_MASK;
+	ep->iso_active = 1;
+	return 0;
+}
+
+/**
+ * usb_get_current_frame_number - return current bus frame number
+ * @dev: the device whose bus is being queried
+ *
+ * Return: the frame number, 0 to USB_FRAME_MASK, or a negative error.
+ */
+int usb_get_current_frame_number(struct usb_device *dev)
+{
+	struct usb_hcd *hcd = bus_to_hcd(dev->bus);
+
+	if (!HCD_RH_RUNNING(hcd) || !hcd->driver->get_frame_number)
+		return -ESHUTDOWN;
+	return hcd->driver->get_frame_number(hcd) & USB_FRAME_MASK;
+}
+
+/*
+ * usb_hcd_submit_urb - hand an URB to its host controller
+ *
+ * Caller is usb_submit_urb(), which already validated the URB.  The
+ * whole path is lock free: the counters, the ring store and the kick.
+ * An urb for a suspended device resumes it first, see pm.c, and one for
+ * a device being recovered waits for it, see recovery.c.
+ */
+int usb_hcd_submit_urb(struct urb *urb)
+{
+	struct usb_hcd *hcd = bus_to_hcd(urb->dev->bus);
+	int status;
+
+	/* the hcd replaces this once it starts the urb; until giveback a
+	 * non-NULL hcpriv marks the urb as busy */
+	urb->hcpriv = urb->ep;
+	usb_trace_start(urb);
+	usb_get_urb(urb);
+	rt_atomic_add(&urb->use_count, 1);
+	rt_atomic_add(&urb->dev->urbnum, 1);
+	if (usb_pm_counts(urb))
+		usb_pm_busy(urb->dev);
+
+	/* the state is looked at after urbnum grew, see pm.c */
+	if (rt_atomic_load(&urb->reject))
+		status = -EPERM;
+	else if (urb->dev->state == USB_STATE_SUSPENDED &&
+			(status = usb_autoresume_device(urb->dev)) < 0)
+		;	/* still asleep */
+	else if (urb->dev->recover.active && usb_recover_submit(urb))
+		return 0;	/* queued once the device recovered */
+	else if (!urb->dev->parent)
+		status = rh_urb_enqueue(hcd, urb);
+	else if (usb_pipeisoc(urb->pipe))
+		status = usb_hcd_iso_schedule(hcd, urb);
+	else
+		status = usb_hcd_link_urb_to_ep(hcd, urb);
+	usb_trace_submit(urb, status);
+
+	if (status) {
+		if (usb_pm_counts(urb))
+			usb_pm_idle(urb->dev);
+		rt_atomic_sub(&urb->use_count, 1);
+		if (rt_atomic_load(&urb->reject))
+			usb_kill_urb_wakeup(urb);
+		urb->hcpriv = RT_NULL;
+		usb_free_urb(urb);
+		return status;
+	}
+
+	if (urb->dev->parent)
+		hcd->driver->endpoint_kick(hcd, urb->ep);
+	return 0;
+}
+
+/*
+ * usb_hcd_unlink_urb - ask the hcd to stop an URB
+ *
+ * The unlinked code is claimed with interrupts off so that exactly one
+ * unlinker wins; the per-URB submit path never takes that section.
+ */
+int usb_hcd_unlink_urb(struct urb *urb, int status)
+{
+	struct usb_hcd *hcd;
+	rt_base_t level;
+
+	if (!urb->dev || !urb->ep)
+		return -ENODEV;
+	hcd = bus_to_hcd(urb->dev->bus);
+
+	level = rt_hw_interrupt_disable();
+	if (rt_atomic_load(&urb->use_count) == 0) {
+		rt_hw_interrupt_enable(level);
+		return -EIDRM;
+	}
+	if (urb->unlinked) {
+		rt_hw_interrupt_enable(level);
+		return -EBUSY;
+	}
+	urb->unlinked = status;
+	rt_hw_interrupt_enable(level);
+
+	if (!urb->dev->parent)
+		return usb_rh_urb_dequeue(hcd, urb, status);
+	return hcd->driver->urb_dequeue(hcd, urb, status);
+}
+
+/**
+ * usb_alloc_streams - allocate bulk endpoint stream IDs
+ * @interface: interface the endpoints belong to
+ * @eps: bulk endpoints that need streams
+ * @num_eps: number of endpoints in @eps
+ * @num_streams: stream IDs wanted per endpoint
+ *
+ * Afterwards urbs on @eps must carry an urb->stream_id from 1 to the
+ * returned count, and the hcd may complete urbs on different streams
+ * out of order.  Stream 0 is reserved.
+ *
+ * Return: the number of stream IDs each endpoint got, which may be
+ * fewer than asked for, or a negative error number.
+ */
+int usb_alloc_streams(struct usb_interface *interface,
+		struct usb_host_endpoint **eps, unsigned int num_eps,
+		unsigned int num_streams)
+{
+	struct usb_device *dev = interface_to_usbdev(interface);
+	struct usb_hcd *hcd = bus_to_hcd(dev->bus);
+	unsigned int i;
+	int ret;
+
+	if (!hcd->driver->alloc_streams || !hcd->driver->free_streams ||
+			!hcd->can_do_streams)
+		return -EINVAL;
+	if (num_eps < 1 || num_streams < 1)
+		return -EINVAL;
+	for (i = 0; i < num_eps; i++) {
+		if (!eps[i] || eps[i]->streams ||
+				(eps[i]->desc.bmAttributes &
+				 USB_EP_ATTR_TYPE_MASK) != USB_EP_ATTR_BULK)
+			return -EINVAL;
+	}
+
+	rt_mutex_take(hcd->bandwidth_mutex, RT_WAITING_FOREVER);
+	ret = hcd->driver->alloc_streams(hcd, dev, eps, num_eps, num_streams);
+	for (i = 0; ret > 0 && i < num_eps; i++)
+		eps[i]->streams = ret;
+	rt_mutex_release(hcd->bandwidth_mutex);
+	return ret;
+}
+
+/**
+ * usb_free_streams - free bulk endpoint stream IDs
+ * @interface: interface the endpoints belong to
+ * @eps: endpoints from an earlier usb_alloc_streams()
+ * @num_eps: number of endpoints in @eps
+ *
+ * Urbs still queued on a stream are given back with -ESHUTDOWN.
+ *
+ * Return: 0 on success, or a negative error number.
+ */
+int usb_free_streams(struct usb_interface *interface,
+		struct usb_host_endpoint **eps, unsigned int num_eps)
+{
+	struct usb_device *dev = interface_to_usbdev(interface);
+	struct usb_hcd *hcd = bus_to_hcd(dev->bus);
+	unsigned int i;
+	int ret;
+
+	if (!hcd->driver->free_streams)
+		return -EINVAL;
+	for (i = 0; i < num_eps; i++) {
+		if (!eps[i] || !eps[i]->streams)
+			return -EINVAL;
+	}
+
+	rt_mutex_take(hcd->bandwidth_mutex, RT_WAITING_FOREVER);
+	ret = hcd->driver->free_streams(hcd, dev, eps, num_eps);
+	for (i = 0; ret == 0 && i < num_eps; i++)
+		eps[i]->streams = 0;
+	rt_mutex_release(hcd->bandwidth_mutex);
+	return ret;
+}
+
+static void __usb_hcd_giveback_urb(struct urb *urb)
+{
+	struct usb_anchor *anchor = urb->anchor;
+	struct usb_device *udev = urb->dev;
+	rt_bool_t counted = usb_pm_counts(urb);
+
+	/* a failed urb may wait out its device's recovery instead */
+	if (urb->status && usb_recover_park(urb))
+		return;
+
+	/* keep usb_kill_anchored_urbs() waiting until the handler returned */
+	if (anchor)
+		rt_atomic_add(&anchor->suspend_wakeups, 1);
+	usb_unanchor_urb(urb);
+
+	urb->complete(urb);
+
+	if (anchor && rt_atomic_sub(&anchor->suspend_wakeups, 1) == 1)
+		usb_anchor_wakeup(anchor);
+
+	/* only now, so a resubmitting handler never looks idle */
+	if (counted)
+		usb_pm_idle(udev);
+	rt_atomic_sub(&urb->use_count, 1);
+	if (rt_atomic_load(&urb->reject))
+		usb_kill_urb_wakeup(urb);
+	usb_free_urb(urb);
+}
+
+/* move every entry of @from to the empty list @to */
+rt_inline void urb_list_splice_init(rt_list_t *from, rt_list_t *to)
+{
+	if (rt_list_isempty(from))
+		return;
+	to->next = from->next;
+	to->prev = from->prev;
+	to->next->prev = to;
+	to->prev->next = to;
+	rt_list_init(from);
+}
+
+static void usb_giveback_urb_bh(void *parameter)
+{
+	struct giveback_urb_bh *bh = parameter;
+	rt_list_t local_list;
+	struct urb *urb;
+	rt_base_t level;
+
+	rt_list_init(&local_list);
+	for (;;) {
+		rt_sem_take(&bh->wakeup, RT_WAITING_FOREVER);
+
+		/* grab the whole batch, the isr keeps appending to bh->head */
+		level = rt_hw_interrupt_disable();
+		urb_list_splice_init(&bh->head, &local_list);
+		bh->deferred = RT_FALSE;
+		rt_hw_interrupt_enable(level);
+
+		while (!rt_list_isempty(&local_list)) {
+			urb = rt_list_first_entry(&local_list, struct urb,
+					urb_list);
+			rt_list_remove(&urb->urb_list);
+			__usb_hcd_giveback_urb(urb);
+		}
+
+		level = rt_hw_interrupt_disable();
+		if (bh->stopping && rt_list_isempty(&bh->head)) {
+			rt_hw_interrupt_enable(level);
+			rt_completion_done(&bh->exited);
+			return;
+		}
+		rt_hw_interrupt_enable(level);
+	}
+}
+
+static int init_giveback_urb_bh(struct giveback_urb_bh *bh,
+		const char *name, rt_uint8_t priority)
+{
+	bh->stopping = RT_FALSE;
+	bh->deferred = RT_FALSE;
+	rt_list_init(&bh->head);
+	rt_sem_init(&bh->wakeup, name, 0, RT_IPC_FLAG_FIFO);
+	rt_completion_init(&bh->exited);
+
+	bh->thread = rt_thread_create(name, usb_giveback_urb_bh, bh,
+			USB_BH_STACK_SIZE, priority, 10);
+	if (!bh->thread) {
+		rt_sem_detach(&bh->wakeup);
+		return -ENOMEM;
+	}
+	rt_thread_startup(bh->thread);
+	return 0;
+}
+
+/* lets the worker finish what is queued, then waits for it to exit */
+static void exit_giveback_urb_bh(struct giveback_urb_bh *bh)
+{
+	rt_base_t level;
+
+	if (!bh->thread)
+		return;
+	level = rt_hw_interrupt_disable();
+	bh->stopping = RT_TRUE;
+	rt_hw_interrupt_enable(level);
+	rt_sem_release(&bh->wakeup);
+	rt_completion_wait(&bh->exited, RT_WAITING_FOREVER);
+	bh->thread = RT_NULL;
+	rt_sem_detach(&bh->wakeup);
+}
+
+/**
+ * usb_hcd_requeue_urb - put a failed urb back on its ring
+ * @urb: urb parked by usb_recover_park(), not given back yet
+ *
+ * Submits @urb again once its device recovered.  It still holds the
+ * reference and the counts usb_hcd_submit_urb() took, so only the
+ * transfer state starts over.
+ *
+ * Return: 0, or the error that kept @urb off the ring; the caller gives
+ * it back then.
+ */
+int usb_hcd_requeue_urb(struct urb *urb)
+{
+	struct usb_hcd *hcd = bus_to_hcd(urb->dev->bus);
+	int status;
+
+	if (rt_atomic_load(&urb->reject) || urb->unlinked)
+		return -EPERM;
+
+	urb->status = -EINPROGRESS;
+	urb->actual_length = 0;
+	urb->hcpriv = urb->ep;
+	usb_trace_start(urb);
+	status = usb_hcd_link_urb_to_ep(hcd, urb);
+	usb_trace_submit(urb, status);
+	if (status) {
+		urb->hcpriv = RT_NULL;
+		return status;
+	}
+	hcd->driver->endpoint_kick(hcd, urb->ep);
+	return 0;
+}
+
+/**
+ * usb_hcd_can_sleep - whether the caller may wait for @hcd's urbs
+ * @hcd: host controller
+ *
+ * Not in interrupt context and not in a completion handler, which runs
+ * on the giveback worker that would have to deliver them.
+ */
+rt_bool_t usb_hcd_can_sleep(struct usb_hcd *hcd)
+{
+	rt_thread_t self;
+
+	if (rt_interrupt_get_nest())
+		return RT_FALSE;
+	self = rt_thread_self();
+	return self != hcd->high_prio_bh.thread &&
+			self != hcd->low_prio_bh.thread;
+}
+
+/**
+ * usb_hcd_giveback_urb - return URB from HCD to device driver
+ * @hcd: host controller returning the URB
+ * @urb: urb being returned to the USB device driver.
+ * @status: completion status code for the URB.
+ *
+ * The hcd is done with @urb and it is taken off @urb->ep->urb_list.
+ * For an HCD_BH controller this only queues the urb for its bottom
+ * half, which is a handful of pointer stores and safe from the hcd's
+ * interrupt handler; otherwise the completion handler runs right here.
+ * The handler may resubmit the URB or drop the last reference to it.
+ */
+void usb_hcd_giveback_urb(struct usb_hcd *hcd, struct urb *urb, int status)
+{
+	struct giveback_urb_bh *bh;
+	rt_bool_t was_empty, defer, wake;
+	rt_base_t level;
+
+	rt_list_remove(&urb->urb_list);
+	urb->hcpriv = RT_NULL;
+
+	if (urb->unlinked)
+		status = urb->unlinked;
+	else if ((urb->transfer_flags & URB_SHORT_NOT_OK) &&
+			urb->actual_length < urb->transfer_buffer_length &&
+			!status)
+		status = -EREMOTEIO;
+	urb->status = status;
+	if (status == -EPIPE && !usb_pipecontrol(urb->pipe))
+		usb_pipe_ep_state(urb->dev, urb->pipe)->flags |= USB_EP_HALTED;
+	usb_trace_giveback(urb);
+
+	if (!(hcd->driver->flags & HCD_BH)) {
+		__usb_hcd_giveback_urb(urb);
+		return;
+	}
+
+	if (usb_pipeisoc(urb->pipe) || usb_pipeint(urb->pipe))
+		bh = &hcd->high_prio_bh;
+	else
+		bh = &hcd->low_prio_bh;
+
+	/* a successful urb that asked for no interrupt waits for the
+	 * hcd's flush at the end of the frame */
+	defer = (hcd->driver->flags & HCD_BH_BATCH) && !status &&
+			(urb->transfer_flags & URB_NO_INTERRUPT);
+
+	/* one wakeup per batch; a running worker picks the rest up */
+	level = rt_hw_interrupt_disable();
+	was_empty = rt_list_isempty(&bh->head);
+	rt_list_insert_before(&bh->head, &urb->urb_list);
+	if (defer) {
+		wake = RT_FALSE;
+		if (was_empty)
+			bh->deferred = RT_TRUE;
+	} else {
+		wake = was_empty || bh->deferred;
+		bh->deferred = RT_FALSE;
+	}
+	rt_hw_interrupt_enable(level);
+
+	if (wake)
+		rt_sem_release(&bh->wakeup);
+}
+
+static void usb_giveback_bh_flush(struct giveback_urb_bh *bh)
+{
+	rt_bool_t wake;
+	rt_base_t level;
+
+	level = rt_hw_interrupt_disable();
+	wake = bh->deferred;
+	bh->deferred = RT_FALSE;
+	rt_hw_interrupt_enable(level);
+
+	if (wake)
+		rt_sem_release(&bh->wakeup);
+}
+
+/**
+ * usb_hcd_giveback_flush - run the completions a frame deferred
+ * @hcd: host controller at the end of a frame or interrupt
+ *
+ * For HCD_BH_BATCH controllers: wakes the giveback workers for the
+ * URB_NO_INTERRUPT urbs given back since the last flush, so their
+ * handlers run as one batch.  Safe from the hcd's interrupt handler.
+ */
+void usb_hcd_giveback_flush(struct usb_hcd *hcd)
+{
+	usb_giveback_bh_flush(&hcd->high_prio_bh);
+	usb_giveback_bh_flush(&hcd->low_prio_bh);
+}
+
+/*-------------------------------------------------------------------------*/
+
+static atomic_t usb_busnum_next;
+
+/**
+ * usb_create_hcd - create and initialize an HCD structure
+ * @driver: HC driver that will use this hcd
+ * @bus_name: value to stash in hcd->self.parent's name
+ *
+ * Return: the hcd with its private area zeroed, or %RT_NULL.
+ */
+struct usb_hcd *usb_create_hcd(const struct hc_driver *driver,
+		const char *bus_name)
+{
+	struct usb_hcd *hcd;
+
+	hcd = rt_calloc(1, sizeof(*hcd) + driver->hcd_priv_size);
+	if (!hcd)
+		return RT_NULL;
+
+	rt_strncpy(hcd->self.parent.parent.name, bus_name,
+			sizeof(hcd->self.parent.parent.name));
+	rt_atomic_store(&hcd->self.devnum_next, 1);
+	hcd->self.busnum = rt_atomic_add(&usb_busnum_next, 1) + 1;
+	hcd->driver = driver;
+	hcd->speed = driver->flags & HCD_MASK;
+	hcd->product_desc = driver->product_desc ? driver->product_desc :
+			"USB Host Controller";
+	hcd->primary_hcd = hcd;
+
+	hcd->address0_mutex = rt_mutex_create("addr0", RT_IPC_FLAG_PRIO);
+	hcd->bandwidth_mutex = rt_mutex_create("usbbw", RT_IPC_FLAG_PRIO);
+	hcd->rh_mutex = rt_mutex_create("usbrh", RT_IPC_FLAG_PRIO);
+	if (!hcd->address0_mutex || !hcd->bandwidth_mutex ||
+			!hcd->rh_mutex) {
+		usb_put_hcd(hcd);
+		return RT_NULL;
+	}
+	usb_bandwidth_init(hcd);
+	return hcd;
+}
+
+void usb_put_hcd(struct usb_hcd *hcd)
+{
+	if (!hcd)
+		return;
+	if (hcd->address0_mutex)
+		rt_mutex_delete(hcd->address0_mutex);
+	if (hcd->bandwidth_mutex)
+		rt_mutex_delete(hcd->bandwidth_mutex);
+	if (hcd->rh_mutex)
+		rt_mutex_delete(hcd->rh_mutex);
+	rt_free(hcd);
+}
+
+/**
+ * usb_add_hcd - finish generic HCD structure initialization and register
+ * @hcd: the usb_hcd structure to initialize
+ *
+ * Sets up the buffer pools and giveback workers, resets and starts the
+ * controller, then registers its root hub; devices already connected
+ * are enumerated by the hub thread from there.
+ *
+ * Return: 0 on success, or a negative error number.
+ */
+int usb_add_hcd(struct usb_hcd *hcd)
+{
+	int retval;
+
+	retval = hcd_buffer_create(hcd);
+	if (retval)
+		return retval;
+	hcd->flags |= 1U << HCD_FLAG_HW_ACCESSIBLE;
+
+	if (hcd->driver->flags & HCD_BH) {
+		retval = init_giveback_urb_bh(&hcd->high_prio_bh, "usbbh_hi",
+				USB_BH_HIGH_PRIORITY);
+		if (retval)
+			goto err_bh;
+		retval = init_giveback_urb_bh(&hcd->low_prio_bh, "usbbh_lo",
+				USB_BH_LOW_PRIORITY);
+		if (retval)
+			goto err_low_bh;
+	}
+
+	if (hcd->driver->reset) {
+		retval = hcd->driver->reset(hcd);
+		if (retval)
+			goto err_start;
+	}
+
+	retval = hcd->driver->start(hcd);
+	if (retval)
+		goto err_start;
+	hcd->state = HC_STATE_RUNNING;
+	hcd->flags |= 1U << HCD_FLAG_RH_RUNNING;
+
+	rt_timer_init(&hcd->rh_timer, "usbrh", rh_timer_func, hcd,
+			rt_tick_from_millisecond(RH_POLL_INTERVAL),
+			RT_TIMER_FLAG_PERIODIC | RT_TIMER_FLAG_SOFT_TIMER);
+	retval = register_root_hub(hcd);
+	if (retval)
+		goto err_register_root_hub;
+	usb_trace_add_bus(&hcd->self);
+	return 0;
+
+err_register_root_hub:
+	rt_timer_detach(&hcd->rh_timer);
+	hcd->flags &= ~(1U << HCD_FLAG_RH_RUNNING);
+	hcd->driver->stop(hcd);
+	hcd->state = HC_STATE_HALT;
+err_start:
+	exit_giveback_urb_bh(&hcd->low_prio_bh);
+err_low_bh:
+	exit_giveback_urb_bh(&hcd->high_prio_bh);
+err_bh:
+	hcd->flags &= ~(1U << HCD_FLAG_HW_ACCESSIBLE);
+	hcd_buffer_destroy(hcd);
+	return retval;
+}
+
+/**
+ * usb_remove_hcd - shutdown processing for generic HCDs
+ * @hcd: the usb_hcd structure to remove
+ *
+ * The root hub, and with it every device on the bus, is disconnected
+ * first.  New submissions fail once the flags are cleared; completions the
+ * controller gives back while stopping still reach their handlers
+ * before the workers exit.
+ */
+void usb_remove_hcd(struct usb_hcd *hcd)
+{
+	usb_trace_remove_bus(&hcd->self);
+	rt_timer_stop(&hcd->rh_timer);
+	usb_disconnect(&hcd->self.root_hub);
+	hcd->rh_registered = 0;
+	rt_timer_detach(&hcd->rh_timer);
+
+	hcd->flags &= ~(1U << HCD_FLAG_RH_RUNNING);
+	hcd->state = HC_STATE_QUIESCING;
+
+	hcd->driver->stop(hcd);
+	hcd->state = HC_STATE_HALT;
+	hcd->flags &= ~(1U << HCD_FLAG_HW_ACCESSIBLE);
+
+	exit_giveback_urb_bh(&hcd->high_prio_bh);
+	exit_giveback_urb_bh(&hcd->low_prio_bh);
+	hcd_buffer_destroy(hcd);
+}
@@ -0,0 +1,1251 @@
+#include "hcd.h"
+#include "hub.h"
+
+/*
+ * hub.c - USB hub driver
+ *
+ * Every hub, the root hub included, keeps one interrupt urb queued on
+ * its status change endpoint.  Its completion only records which ports
+ * changed and queues the hub for the hub thread, which does all of the
+ * (sleeping) port work.  Connect debouncing does not sleep: a port whose
+ * connect state changed is looked at again from the hub's debounce timer
+ * until it has been stable long enough, and other ports and hubs are
+ * handled meanwhile.
+ *
+ * The hub thread only takes a new device as far as SET_ADDRESS, the one
+ * step that must be serialized per bus.  Reading its descriptors and
+ * configuring it is queued to the enumeration workers, and the result is
+ * picked up again by port_event().
+ */
+
+#define SET_CONFIG_TRIES	2
+#define GET_DESCRIPTOR_TRIES	2
+
+static rt_list_t hub_event_list = RT_LIST_OBJECT_INIT(hub_event_list);
+static struct rt_semaphore hub_event_sem;
+static struct rt_mutex hub_lock;	/* serializes topology changes */
+static rt_thread_t hub_thread;
+
+/* queue @hub for the hub thread; safe from interrupt context */
+static void kick_hub_wq(struct usb_hub *hub)
+{
+	rt_base_t level;
+
+	level = rt_hw_interrupt_disable();
+	if (hub->disconnected || !rt_list_isempty(&hub->event_list)) {
+		rt_hw_interrupt_enable(level);
+		return;
+	}
+	rt_list_insert_before(&hub_event_list, &hub->event_list);
+	rt_hw_interrupt_enable(level);
+
+	rt_sem_release(&hub_event_sem);
+}
+
+/* wake the hub thread for work other than hub events */
+void usb_hub_kick(void)
+{
+	rt_sem_release(&hub_event_sem);
+}
+
+/* whether the caller is the hub thread, which must not wait for itself */
+rt_bool_t usb_hub_thread_self(void)
+{
+	return rt_thread_self() == hub_thread;
+}
+
+static void hub_debounce_timeout(void *parameter)
+{
+	kick_hub_wq(parameter);
+}
+
+/*-------------------------------------------------------------------------*/
+
+/* USB 2.0 spec Section 11.24.4.5 */
+static int get_hub_descriptor(struct usb_device *hdev,
+		struct usb_hub_descriptor *desc)
+{
+	int i, ret = -EINVAL;
+
+	for (i = 0; i < 3; i++) {
+		ret = usb_control_msg(hdev, usb_rcvctrlpipe(hdev, 0),
+				USB_REQ_GET_DESCRIPTOR, USB_DIR_IN | USB_RT_HUB,
+				USB_DESC_TYPE_HUB << 8, 0, desc, sizeof(*desc),
+				USB_CTRL_GET_TIMEOUT);
+		if (ret >= USB_DT_HUB_NONVAR_SIZE)
+			return ret;
+	}
+	return ret < 0 ? ret : -EINVAL;
+}
+
+/*
+ * USB 2.0 spec Section 11.24.2.1
+ */
+static int clear_hub_feature(struct usb_device *hdev, int feature)
+{
+	return usb_control_msg(hdev, usb_sndctrlpipe(hdev, 0),
+			USB_REQ_CLEAR_FEATURE, USB_RT_HUB, feature, 0,
+			RT_NULL, 0, 1000);
+}
+
+/*
+ * USB 2.0 spec Section 11.24.2.2
+ */
+int usb_hub_clear_port_feature(struct usb_device *hdev, int port1,
+		int feature)
+{
+	return usb_control_msg(hdev, usb_sndctrlpipe(hdev, 0),
+			USB_REQ_CLEAR_FEATURE, USB_RT_PORT, feature, port1,
+			RT_NULL, 0, 1000);
+}
+
+/*
+ * USB 2.0 spec Section 11.24.2.13
+ */
+int usb_hub_set_port_feature(struct usb_device *hdev, int port1,
+		int feature)
+{
+	return usb_control_msg(hdev, usb_sndctrlpipe(hdev, 0),
+			USB_REQ_SET_FEATURE, USB_RT_PORT, feature, port1,
+			RT_NULL, 0, 1000);
+}
+
+static int hub_hub_status(struct usb_hub *hub, uint16_t *status,
+		uint16_t *change)
+{
+	int ret;
+
+	ret = usb_control_msg(hub->hdev, usb_rcvctrlpipe(hub->hdev, 0),
+			USB_REQ_GET_STATUS, USB_DIR_IN | USB_RT_HUB, 0, 0,
+			&hub->status->hub, sizeof(hub->status->hub),
+			USB_CTRL_GET_TIMEOUT);
+	if (ret < (int)sizeof(hub->status->hub))
+		return ret < 0 ? ret : -EIO;
+
+	*status = hub->status->hub.wHubStatus;
+	*change = hub->status->hub.wHubChange;
+	return 0;
+}
+
+static int hub_port_status(struct usb_hub *hub, int port1,
+		uint16_t *status, uint16_t *change)
+{
+	int ret;
+
+	ret = usb_control_msg(hub->hdev, usb_rcvctrlpipe(hub->hdev, 0),
+			USB_REQ_GET_STATUS, USB_DIR_IN | USB_RT_PORT, 0, port1,
+			&hub->status->port, sizeof(hub->status->port),
+			USB_CTRL_GET_TIMEOUT);
+	if (ret < (int)sizeof(hub->status->port))
+		return ret < 0 ? ret : -EIO;
+
+	*status = hub->status->port.wPortStatus;
+	*change = hub->status->port.wPortChange;
+	return 0;
+}
+
+/*-------------------------------------------------------------------------*/
+
+/*-------------------------------------------------------------------------*/
+
+static int hub_port_reset(struct usb_hub *hub, int port1,
+		struct usb_device *udev)
+{
+	uint16_t portstatus, portchange;
+	int delay, ret;
+
+	ret = usb_hub_set_port_feature(hub->hdev, port1, USB_PORT_FEAT_RESET);
+	if (ret < 0)
+		return ret;
+
+	for (delay = 0; delay < HUB_RESET_TIMEOUT;
+			delay += HUB_SHORT_RESET_TIME) {
+		rt_thread_mdelay(HUB_SHORT_RESET_TIME);
+		ret = hub_port_status(hub, port1, &portstatus, &portchange);
+		if (ret < 0)
+			return ret;
+		if (!(portstatus & USB_PORT_STAT_CONNECTION))
+			return -ENOTCONN;
+		if (!(portstatus & USB_PORT_STAT_RESET) &&
+				(portchange & USB_PORT_STAT_C_RESET))
+			break;
+	}
+	if (delay >= HUB_RESET_TIMEOUT)
+		return -ETIMEDOUT;
+
+	usb_hub_clear_port_feature(hub->hdev, port1,
+			USB_PORT_FEAT_C_RESET);
+	if (!(portstatus & USB_PORT_STAT_ENABLE))
+		return -EBUSY;
+
+	if (portstatus & USB_PORT_STAT_HIGH_SPEED)
+		udev->speed = USB_SPEED_HIGH;
+	else if (portstatus & USB_PORT_STAT_LOW_SPEED)
+		udev->speed = USB_SPEED_LOW;
+	else
+		udev->speed = USB_SPEED_FULL;
+	udev->state = USB_STATE_DEFAULT;
+
+	/* TRSTRCY, reset recovery */
+	rt_thread_mdelay(HUB_SHORT_RESET_TIME);
+	return 0;
+}
+
+#ifdef CONFIG_USB_PM
+/**
+ * usb_hub_port_suspend - selectively suspend a device's port
+ * @udev: the device, not a hub, with nothing in flight
+ *
+ * Context: thread context, sleeps.
+ *
+ * Return: 0 once the device is suspended, or a negative error number.
+ */
+int usb_hub_port_suspend(struct usb_device *udev)
+{
+	int ret;
+
+	ret = usb_hub_set_port_feature(udev->parent, udev->portnum,
+			USB_PORT_FEAT_SUSPEND);
+	if (ret < 0)
+		return ret;
+	rt_thread_mdelay(USB_SUSPEND_TIME);
+	return 0;
+}
+
+/**
+ * usb_hub_port_resume - resume a device's suspended port
+ * @udev: the device
+ *
+ * Drives resume signalling and checks that the port came back.  Unlike
+ * the hub thread, this uses its own status buffer, so any thread may
+ * call it.
+ *
+ * Context: thread context, sleeps.
+ *
+ * Return: 0 once the port is enabled again, or a negative error number.
+ */
+int usb_hub_port_resume(struct usb_device *udev)
+{
+	struct usb_device *hdev = udev->parent;
+	struct usb_port_status st;
+	int ret;
+
+	ret = usb_hub_clear_port_feature(hdev, udev->portnum,
+			USB_PORT_FEAT_SUSPEND);
+	if (ret < 0)
+		return ret;
+	rt_thread_mdelay(USB_RESUME_TIME);
+
+	ret = usb_control_msg(hdev, usb_rcvctrlpipe(hdev, 0),
+			USB_REQ_GET_STATUS, USB_DIR_IN | USB_RT_PORT, 0,
+			udev->portnum, &st, sizeof(st), USB_CTRL_GET_TIMEOUT);
+	if (ret < (int)sizeof(st))
+		return ret < 0 ? ret : -EIO;
+	if (!(st.wPortStatus & USB_PORT_STAT_CONNECTION))
+		return -ENOTCONN;
+	if ((st.wPortStatus & (USB_PORT_STAT_ENABLE |
+			USB_PORT_STAT_SUSPEND)) != USB_PORT_STAT_ENABLE)
+		return -EIO;
+	if (st.wPortChange & USB_PORT_STAT_C_SUSPEND)
+		usb_hub_clear_port_feature(hdev, udev->portnum,
+				USB_PORT_FEAT_C_SUSPEND);
+	return 0;
+}
+#endif /* CONFIG_USB_PM */
+
+/*
+ * Reset the port, learn ep0's maxpacket at address 0 and move the device
+ * to its own address.  Only one device per bus may answer at address 0,
+ * so this runs under address0_mutex; everything after SET_ADDRESS is
+ * left to hub_enumerate().
+ */
+static int hub_port_init(struct usb_hub *hub, struct usb_device *udev,
+		int port1, int devnum)
+{
+	struct usb_hcd *hcd = bus_to_hcd(udev->bus);
+	union {
+		struct usb_device_descriptor desc;
+		uint8_t raw[64];
+	} u;
+	struct usb_device_descriptor *buf = &u.desc;
+	int i, maxp0, retval;
+
+	rt_mutex_take(hcd->address0_mutex, RT_WAITING_FOREVER);
+	retval = hub_port_reset(hub, port1, udev);
+	if (retval < 0)
+		goto fail;
+
+	udev->devnum = 0;
+	udev->ep0.desc.wMaxPacketSize = udev->speed == USB_SPEED_LOW ? 8 : 64;
+	usb_ep0_reinit(udev);
+
+	/* ask for 64 bytes and take whatever fits in one packet */
+	for (i = 0; i < GET_DESCRIPTOR_TRIES; i++) {
+		retval = usb_control_msg(udev, usb_rcvctrlpipe(udev, 0),
+				USB_REQ_GET_DESCRIPTOR, USB_DIR_IN,
+				USB_DESC_TYPE_DEVICE << 8, 0, u.raw, sizeof(u),
+				USB_CTRL_GET_TIMEOUT);
+		if (retval >= 8 &&
+				buf->bDescriptorType == USB_DESC_TYPE_DEVICE)
+			break;
+		if (retval >= 0)
+			retval = -EPROTO;
+	}
+	if (retval < 0)
+		goto fail;
+	/* a whole descriptor in the first packet tells the quirks early */
+	if (retval >= (int)sizeof(*buf))
+		usb_detect_quirks(udev, buf);
+
+	maxp0 = buf->bMaxPacketSize0;
+	if ((maxp0 != 8 && maxp0 != 16 && maxp0 != 32 && maxp0 != 64) ||
+			(udev->speed == USB_SPEED_LOW && maxp0 != 8) ||
+			(udev->speed == USB_SPEED_HIGH && maxp0 != 64)) {
+		retval = -EMSGSIZE;
+		goto fail;
+	}
+	if (udev->quirks & USB_QUIRK_EP0_MAXP_8)
+		maxp0 = 8;
+	udev->ep0.desc.wMaxPacketSize = maxp0;
+	usb_ep0_reinit(udev);
+
+	retval = usb_control_msg(udev, usb_sndctrlpipe(udev, 0),
+			USB_REQ_SET_ADDRESS, 0, devnum, 0, RT_NULL, 0,
+			USB_CTRL_SET_TIMEOUT);
+	if (retval < 0)
+		goto fail;
+	udev->devnum = devnum;
+	udev->state = USB_STATE_ADDRESS;
+	if (hcd->driver->endpoint_reset)
+		hcd->driver->endpoint_reset(hcd, &udev->ep0);
+	rt_mutex_release(hcd->address0_mutex);
+	return 0;
+
+fail:
+	udev->devnum = 0;
+	rt_mutex_release(hcd->address0_mutex);
+	return retval;
+}
+
+/* SET_CONFIGURATION and SET_INTERFACE without touching the drivers */
+static int usb_restore_config(struct usb_device *udev)
+{
+	struct usb_host_config *c = udev->actconfig;
+	struct usb_host_interface *alt;
+	int i, ret;
+
+	ret = usb_control_msg(udev, usb_sndctrlpipe(udev, 0),
+			USB_REQ_SET_CONFIGURATION, 0,
+			c->desc.bConfigurationValue, 0, RT_NULL, 0,
+			USB_CTRL_SET_TIMEOUT);
+	if (ret < 0)
+		return ret;
+	udev->state = USB_STATE_CONFIGURED;
+
+	if (udev->quirks & USB_QUIRK_NO_SET_INTF)
+		return 0;
+	for (i = 0; i < c->desc.bNumInterfaces; i++) {
+		if (!c->interface[i])
+			continue;
+		alt = c->interface[i]->cur_altsetting;
+		if (!alt->desc.bAlternateSetting)
+			continue;
+		ret = usb_control_msg(udev, usb_sndctrlpipe(udev, 0),
+				USB_REQ_SET_INTERFACE, USB_REQ_TYPE_INTERFACE,
+				alt->desc.bAlternateSetting,
+				alt->desc.bInterfaceNumber, RT_NULL, 0,
+				USB_CTRL_SET_TIMEOUT);
+		if (ret < 0)
+			return ret;
+	}
+	return 0;
+}
+
+/**
+ * usb_reset_device - reset a device's port and restore its state
+ * @udev: a configured device, not a hub
+ *
+ * The device gets its address, configuration and altsettings back, and
+ * its drivers stay bound.  Its descriptors are read again and must be
+ * the ones it had.  Every endpoint starts over with DATA0 and without a
+ * halt; whatever was in flight is lost to the reset.
+ *
+ * Context: the hub thread.
+ *
+ * Return: 0, -ENODEV if the device no longer looks the same, or another
+ * negative error number; it should be enumerated again then.
+ */
+int usb_reset_device(struct usb_device *udev)
+{
+	struct usb_hub *hub = usb_hub_to_struct_hub(udev->parent);
+	struct usb_hcd *hcd = bus_to_hcd(udev->bus);
+	struct usb_host_config *c = udev->actconfig;
+	struct usb_device_descriptor desc;
+	enum usb_device_speed speed = udev->speed;
+	int devnum = udev->devnum;
+	int i, len, ret;
+	uint8_t *buf;
+
+	if (!hub || !c || udev->maxchild)
+		return -EINVAL;
+	if (hub->ports[udev->portnum - 1].enum_job ||
+			udev->state == USB_STATE_NOTATTACHED)
+		return -EBUSY;
+
+	rt_mutex_take(hcd->address0_mutex, RT_WAITING_FOREVER);
+	ret = hub_port_reset(hub, udev->portnum, udev);
+	if (ret == 0 && udev->speed != speed)
+		ret = -ENODEV;
+	if (ret == 0) {
+		udev->devnum = 0;
+		if (hcd->driver->endpoint_reset)
+			hcd->driver->endpoint_reset(hcd, &udev->ep0);
+		ret = usb_control_msg(udev, usb_sndctrlpipe(udev, 0),
+				USB_REQ_SET_ADDRESS, 0, devnum, 0, RT_NULL, 0,
+				USB_CTRL_SET_TIMEOUT);
+		udev->devnum = devnum;
+	}
+	rt_mutex_release(hcd->address0_mutex);
+	udev->speed = speed;
+	if (ret < 0)
+		return ret;
+	udev->state = USB_STATE_ADDRESS;
+
+	/* SET_ADDRESS recovery, USB 2.0 spec 9.2.6.3 */
+	rt_thread_mdelay(udev->quirks & USB_QUIRK_DELAY_SET_ADDRESS ?
+			USB_QUIRK_ADDRESS_DELAY : 10);
+
+	ret = usb_get_descriptor(udev, USB_DESC_TYPE_DEVICE, 0, &desc,
+			sizeof(desc));
+	if (ret < (int)sizeof(desc))
+		return ret < 0 ? ret : -ENODEV;
+	if (rt_memcmp(&desc, &udev->descriptor, sizeof(desc)))
+		return -ENODEV;
+
+	i = c - udev->config;
+	len = c->desc.wTotalLength;
+	buf = rt_malloc(len);
+	if (!buf)
+		return -ENOMEM;
+	ret = usb_get_descriptor(udev, USB_DESC_TYPE_CONFIGURATION, i, buf,
+			len);
+	if (ret == len)
+		ret = rt_memcmp(buf, udev->rawdescriptors[i], len) ?
+				-ENODEV : 0;
+	else if (ret >= 0)
+		ret = -ENODEV;
+	rt_free(buf);
+	if (ret < 0)
+		return ret;
+
+	ret = usb_restore_config(udev);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < 32; i++) {
+		if (!udev->ep_table[i])
+			continue;
+		udev->ep_state[i].flags &= ~(USB_EP_HALTED | USB_EP_TOGGLE);
+		if (hcd->driver->endpoint_reset)
+			hcd->driver->endpoint_reset(hcd, udev->ep_table[i]);
+	}
+
+	/* the reset cleared its remote wakeup feature */
+	usb_pm_start(udev);
+	return 0;
+}
+
+/* prefer the first configuration that is not vendor specific */
+static int usb_choose_configuration(struct usb_device *udev)
+{
+	struct usb_host_config *c;
+	int i;
+
+	for (i = 0; i < udev->descriptor.bNumConfigurations; i++) {
+		c = &udev->config[i];
+		if (c->desc.bNumInterfaces > 0 && c->interface[0] &&
+				c->interface[0]->altsetting[0].desc.bInterfaceClass
+				== 0xff)
+			continue;
+		return c->desc.bConfigurationValue;
+	}
+	if (udev->descriptor.bNumConfigurations)
+		return udev->config[0].desc.bConfigurationValue;
+	return -1;
+}
+
+/**
+ * usb_new_device - perform initial device setup (usbcore-internal)
+ * @udev: newly addressed device (in ADDRESS state)
+ *
+ * Reads the configurations and strings (usb_get_configuration() keeps
+ * them in one block), selects a configuration and binds interface
+ * drivers to it.
+ *
+ * Return: 0 on success, a negative error number otherwise; the caller
+ * then disconnects the device.
+ */
+int usb_new_device(struct usb_device *udev)
+{
+	int err, c;
+
+	err = usb_get_configuration(udev);
+	if (err < 0)
+		return err;
+
+	c = usb_choose_configuration(udev);
+	if (c <= 0)
+		return 0;
+	err = usb_set_configuration(udev, c);
+	if (err)
+		return err;
+
+	usb_probe_interfaces(udev);
+	usb_pm_start(udev);
+	return 0;
+}
+
+/**
+ * usb_disconnect - disconnect a device (usbcore-internal)
+ * @pdev: pointer to device being disconnected
+ *
+ * Unbinds the drivers (a hub takes its children down first), releases
+ * the device's bandwidth and address and frees it.  *@pdev is cleared.
+ *
+ * Context: thread context, sleeps.
+ */
+void usb_disconnect(struct usb_device **pdev)
+{
+	struct usb_device *udev = *pdev;
+
+	if (!udev)
+		return;
+
+	rt_mutex_take(&hub_lock, RT_WAITING_FOREVER);
+	udev->state = USB_STATE_NOTATTACHED;
+	/* parked urbs first, disabling the endpoints waits for them */
+	usb_recover_cancel(udev);
+	usb_disable_device(udev);
+	usb_free_devnum(udev->bus, udev->devnum);
+	*pdev = RT_NULL;
+	/* freed under the lock, so usb_hub_for_each_device() never
+	 * sees it half gone */
+	usb_put_dev(udev);
+	rt_mutex_release(&hub_lock);
+}
+
+static void usb_walk_device(struct usb_device *udev,
+		void (*fn)(struct usb_device *udev, void *arg), void *arg)
+{
+	struct usb_device *child;
+
+	fn(udev, arg);
+	rt_list_for_each_entry(child, &udev->children, sibling)
+		usb_walk_device(child, fn, arg);
+}
+
+/**
+ * usb_hub_for_each_device - call a function for every device of a bus
+ * @bus: the bus to walk, from its root hub down
+ * @fn: called for each device, parents before their children
+ * @arg: passed on to @fn
+ *
+ * Runs under the hub lock, so no device is added or freed meanwhile;
+ * @fn must not wait for the hub thread.
+ */
+void usb_hub_for_each_device(struct usb_bus *bus,
+		void (*fn)(struct usb_device *udev, void *arg), void *arg)
+{
+	rt_mutex_take(&hub_lock, RT_WAITING_FOREVER);
+	if (bus->root_hub)
+		usb_walk_device(bus->root_hub, fn, arg);
+	rt_mutex_release(&hub_lock);
+}
+
+/*-------------------------------------------------------------------------*/
+
+struct hub_enum_job {
+	rt_list_t		list;
+	struct usb_hub		*hub;
+	struct usb_device	*udev;
+	int			port1;
+	atomic_t		status;		/* -EINPROGRESS until done */
+	struct rt_completion	done;
+};
+
+static rt_list_t hub_enum_list = RT_LIST_OBJECT_INIT(hub_enum_list);
+static struct rt_semaphore hub_enum_sem;
+static rt_thread_t hub_enum_threads[USB_HUB_ENUM_THREADS];
+
+/* the addressed half of enumeration, on an enumeration worker */
+static int hub_enumerate(struct usb_device *udev)
+{
+	rt_uint32_t early = udev->quirks;
+	int retval;
+
+	/* SET_ADDRESS recovery, USB 2.0 spec 9.2.6.3 */
+	rt_thread_mdelay(early & USB_QUIRK_DELAY_SET_ADDRESS ?
+			USB_QUIRK_ADDRESS_DELAY : 10);
+
+	retval = usb_get_device_descriptor(udev, sizeof(udev->descriptor));
+	if (retval < (int)sizeof(udev->descriptor))
+		return retval < 0 ? retval : -ENOMSG;
+
+	usb_detect_quirks(udev, &udev->descriptor);
+	if (udev->quirks)
+		usb_dbg("usb %d-%d: %04x:%04x quirks 0x%04x\n",
+				udev->bus->busnum, udev->devnum,
+				udev->descriptor.idVendor,
+				udev->descriptor.idProduct, udev->quirks);
+	/* quirks found only now, after 8 byte packets at address 0 */
+	if (udev->quirks & ~early & USB_QUIRK_DELAY_SET_ADDRESS)
+		rt_thread_mdelay(USB_QUIRK_ADDRESS_DELAY);
+	if ((udev->quirks & USB_QUIRK_EP0_MAXP_8) &&
+			udev->ep0.desc.wMaxPacketSize != 8) {
+		udev->ep0.desc.wMaxPacketSize = 8;
+		usb_ep0_reinit(udev);
+	}
+	return usb_new_device(udev);
+}
+
+static void hub_enum_thread_entry(void *parameter)
+{
+	struct hub_enum_job *job;
+	rt_base_t level;
+
+	for (;;) {
+		rt_sem_take(&hub_enum_sem, RT_WAITING_FOREVER);
+
+		level = rt_hw_interrupt_disable();
+		if (rt_list_isempty(&hub_enum_list)) {
+			rt_hw_interrupt_enable(level);
+			continue;
+		}
+		job = rt_list_first_entry(&hub_enum_list,
+				struct hub_enum_job, list);
+		rt_list_remove(&job->list);
+		rt_hw_interrupt_enable(level);
+
+		rt_atomic_store(&job->status,
+				(atomic_t)hub_enumerate(job->udev));
+
+		/* the hub thread collects the result from port_event();
+		 * the hub stays around until done is signalled */
+		rt_atomic_or(&job->hub->event_bits,
+				(atomic_t)(1U << job->port1));
+		kick_hub_wq(job->hub);
+		rt_completion_done(&job->done);
+	}
+}
+
+static void hub_queue_enum_job(struct hub_enum_job *job)
+{
+	rt_base_t level;
+
+	level = rt_hw_interrupt_disable();
+	rt_list_insert_before(&hub_enum_list, &job->list);
+	rt_hw_interrupt_enable(level);
+	rt_sem_release(&hub_enum_sem);
+}
+
+/* wait for a job that may still be running, then free it */
+static void hub_port_reap_enum_job(struct usb_port *port)
+{
+	struct hub_enum_job *job = port->enum_job;
+
+	rt_completion_wait(&job->done, RT_WAITING_FOREVER);
+	port->enum_job = RT_NULL;
+	rt_free(job);
+}
+
+static void hub_port_connect(struct usb_hub *hub, int port1)
+{
+	struct usb_port *port = &hub->ports[port1 - 1];
+	struct usb_device *hdev = hub->hdev;
+	struct hub_enum_job *job;
+	struct usb_device *udev;
+	int i, devnum, status = -ENOMEM;
+
+	for (i = 0; i < SET_CONFIG_TRIES; i++) {
+		job = rt_malloc(sizeof(*job));
+		udev = usb_alloc_dev(hdev, hdev->bus, port1);
+		if (!job || !udev) {
+			rt_free(job);
+			usb_put_dev(udev);
+			break;
+		}
+
+		devnum = usb_alloc_devnum(hdev->bus);
+		if (devnum < 0) {
+			rt_free(job);
+			usb_put_dev(udev);
+			status = devnum;
+			break;
+		}
+
+		status = hub_port_init(hub, udev, port1, devnum);
+		if (!status) {
+			job->hub = hub;
+			job->udev = udev;
+			job->port1 = port1;
+			rt_atomic_store(&job->status, (atomic_t)-EINPROGRESS);
+			rt_completion_init(&job->done);
+			port->child = udev;
+			port->enum_job = job;
+			hub_queue_enum_job(job);
+			return;
+		}
+
+		rt_free(job);
+		usb_free_devnum(udev->bus, devnum);
+		usb_disconnect(&udev);
+		if (status == -ENOTCONN)
+			break;
+	}
+
+	rt_kprintf("usb: hub %d port %d: unable to enumerate, %d\n",
+			hdev->devnum, port1, status);
+	usb_hub_clear_port_feature(hdev, port1, USB_PORT_FEAT_ENABLE);
+}
+
+static void hub_port_connect_change(struct usb_hub *hub, int port1)
+{
+	struct usb_port *port = &hub->ports[port1 - 1];
+
+	/* whatever was there before is gone */
+	usb_disconnect(&port->child);
+	if (port->connected)
+		hub_port_connect(hub, port1);
+}
+
+static void hub_port_debounce_start(struct usb_hub *hub, int port1,
+		uint16_t portstatus)
+{
+	struct usb_port *port = &hub->ports[port1 - 1];
+
+	port->debouncing = 1;
+	port->connected = !!(portstatus & USB_PORT_STAT_CONNECTION);
+	port->debounce_start = rt_tick_get();
+	hub->debounce_bits |= 1U << port1;
+}
+
+/* collect a finished enumeration; a failed one starts over */
+static void hub_port_enum_done(struct usb_hub *hub, int port1)
+{
+	struct usb_port *port = &hub->ports[port1 - 1];
+	int status;
+
+	status = (int)rt_atomic_load(&port->enum_job->status);
+	if (status == -EINPROGRESS)
+		return;
+	hub_port_reap_enum_job(port);
+
+	if (!status) {
+		port->enum_tries = 0;
+		if (port->reenum)
+			usb_recover_account(USB_RECOVER_REENUMERATE, 0,
+					usb_trace_clock() - port->reenum_start);
+		port->reenum = 0;
+		return;
+	}
+
+	usb_disconnect(&port->child);
+	if (++port->enum_tries < SET_CONFIG_TRIES) {
+		hub_port_debounce_start(hub, port1, USB_PORT_STAT_CONNECTION);
+		return;
+	}
+	rt_kprintf("usb: hub %d port %d: unable to enumerate, %d\n",
+			hub->hdev->devnum, port1, status);
+	if (port->reenum)
+		usb_recover_account(USB_RECOVER_REENUMERATE, status, 0);
+	port->reenum = 0;
+	port->enum_tries = 0;
+	usb_hub_clear_port_feature(hub->hdev, port1, USB_PORT_FEAT_ENABLE);
+}
+
+/**
+ * usb_hub_reenumerate - replace a device by enumerating its port again
+ * @udev: the device; it is disconnected and freed
+ *
+ * The last resort of recovery.c.  The new device's enumeration runs as
+ * after a connect, without waiting for the connection to settle, and
+ * hub_port_enum_done() accounts its time.
+ *
+ * Context: the hub thread.
+ *
+ * Return: 0 once the port is being enumerated, or a negative error
+ * number; @udev is still there then.
+ */
+int usb_hub_reenumerate(struct usb_device *udev)
+{
+	struct usb_hub *hub = usb_hub_to_struct_hub(udev->parent);
+	uint16_t portstatus, portchange;
+	struct usb_port *port;
+	int port1 = udev->portnum, ret;
+
+	if (!hub)
+		return -ENODEV;
+	port = &hub->ports[port1 - 1];
+	if (port->child != udev || port->enum_job)
+		return -EBUSY;
+
+	/* a device that went away is the connect change's business */
+	ret = hub_port_status(hub, port1, &portstatus, &portchange);
+	if (ret < 0)
+		return ret;
+	if (!(portstatus & USB_PORT_STAT_CONNECTION))
+		return -ENOTCONN;
+
+	port->reenum = 1;
+	port->reenum_start = usb_trace_clock();
+	port->debouncing = 0;
+	port->connected = 1;
+	port->enum_tries = 0;
+	hub_port_connect_change(hub, port1);
+	if (!port->enum_job) {
+		port->reenum = 0;
+		usb_recover_account(USB_RECOVER_REENUMERATE, -EIO, 0);
+	}
+	return 0;
+}
+
+static void port_event(struct usb_hub *hub, int port1)
+{
+	struct usb_device *hdev = hub->hdev;
+	struct usb_port *port = &hub->ports[port1 - 1];
+	uint16_t portstatus, portchange;
+	rt_base_t level;
+	int connected;
+
+	if (port->enum_job)
+		hub_port_enum_done(hub, port1);
+
+	if (hub_port_status(hub, port1, &portstatus, &portchange) < 0)
+		return;
+
+	if (portchange & USB_PORT_STAT_C_CONNECTION) {
+		usb_hub_clear_port_feature(hdev, port1,
+				USB_PORT_FEAT_C_CONNECTION);
+		port->enum_tries = 0;
+		port->reenum = 0;
+		hub_port_debounce_start(hub, port1, portstatus);
+		return;
+	}
+
+	if (portchange & USB_PORT_STAT_C_ENABLE) {
+		usb_hub_clear_port_feature(hdev, port1,
+				USB_PORT_FEAT_C_ENABLE);
+		/* disabled behind our back, e.g. by EMI: a reset in place
+		 * usually brings the device back, see recovery.c */
+		if (!(portstatus & USB_PORT_STAT_ENABLE) && port->child &&
+				(portstatus & USB_PORT_STAT_CONNECTION)) {
+			if (port->enum_job)
+				hub_port_debounce_start(hub, port1,
+						portstatus);
+			else
+				usb_queue_recovery(port->child, 0,
+						USB_RECOVER_RESET);
+		}
+	}
+
+	if (portchange & USB_PORT_STAT_C_SUSPEND) {
+		usb_hub_clear_port_feature(hdev, port1,
+				USB_PORT_FEAT_C_SUSPEND);
+		/* a resume finished; one nobody asked for is a remote
+		 * wakeup */
+		if (!hdev->parent) {
+			level = rt_hw_interrupt_disable();
+			bus_to_hcd(hdev->bus)->flags &=
+					~(1U << HCD_FLAG_WAKEUP_PENDING);
+			rt_hw_interrupt_enable(level);
+		}
+#ifdef CONFIG_USB_PM
+		if (port->child && !(portstatus & USB_PORT_STAT_SUSPEND))
+			usb_pm_remote_wakeup(port->child);
+#endif
+	}
+
+	if (portchange & USB_PORT_STAT_C_OVERCURRENT) {
+		usb_hub_clear_port_feature(hdev, port1,
+				USB_PORT_FEAT_C_OVER_CURRENT);
+		if (!(portstatus & USB_PORT_STAT_POWER))
+			usb_hub_set_port_feature(hdev, port1,
+					USB_PORT_FEAT_POWER);
+	}
+
+	if (portchange & USB_PORT_STAT_C_RESET)
+		usb_hub_clear_port_feature(hdev, port1,
+				USB_PORT_FEAT_C_RESET);
+
+	if (!port->debouncing)
+		return;
+
+	connected = !!(portstatus & USB_PORT_STAT_CONNECTION);
+	if (connected != port->connected) {
+		hub_port_debounce_start(hub, port1, portstatus);
+		return;
+	}
+	if (rt_tick_get() - port->debounce_start <
+			rt_tick_from_millisecond(HUB_DEBOUNCE_STABLE)) {
+		hub->debounce_bits |= 1U << port1;
+		return;
+	}
+	if (port->enum_job) {
+		/* let the enumeration finish before tearing it down */
+		hub->debounce_bits |= 1U << port1;
+		return;
+	}
+	port->debouncing = 0;
+	hub_port_connect_change(hub, port1);
+}
+
+static void hub_hub_status_change(struct usb_hub *hub)
+{
+	uint16_t hubstatus, hubchange;
+	int port1;
+
+	if (hub_hub_status(hub, &hubstatus, &hubchange) < 0)
+		return;
+
+	if (hubchange & HUB_CHANGE_LOCAL_POWER)
+		clear_hub_feature(hub->hdev, C_HUB_LOCAL_POWER);
+	if (hubchange & HUB_CHANGE_OVERCURRENT) {
+		clear_hub_feature(hub->hdev, C_HUB_OVER_CURRENT);
+		rt_thread_mdelay(500);	/* Cool down */
+		for (port1 = 1; port1 <= hub->nports; port1++)
+			usb_hub_set_port_feature(hub->hdev, port1,
+					USB_PORT_FEAT_POWER);
+	}
+}
+
+static void hub_event(struct usb_hub *hub)
+{
+	rt_uint32_t bits;
+	int port1;
+
+	bits = (rt_uint32_t)rt_atomic_exchange(&hub->event_bits, 0);
+	bits |= hub->debounce_bits;
+	hub->debounce_bits = 0;
+
+	if (bits & 1)
+		hub_hub_status_change(hub);
+	for (port1 = 1; port1 <= hub->nports; port1++)
+		if (bits & (1U << port1))
+			port_event(hub, port1);
+
+	/* the status urb gave up after too many errors, try again */
+	if (hub->nerrors >= 10 && !hub->quiescing) {
+		hub->nerrors = 0;
+		usb_submit_urb(hub->urb);
+	}
+
+	if (hub->debounce_bits)
+		rt_timer_start(&hub->debounce_timer);
+}
+
+static void hub_thread_entry(void *parameter)
+{
+	struct usb_hub *hub;
+	rt_base_t level;
+
+	for (;;) {
+		rt_sem_take(&hub_event_sem, RT_WAITING_FOREVER);
+
+		rt_mutex_take(&hub_lock, RT_WAITING_FOREVER);
+		for (;;) {
+			level = rt_hw_interrupt_disable();
+			if (rt_list_isempty(&hub_event_list)) {
+				rt_hw_interrupt_enable(level);
+				break;
+			}
+			hub = rt_list_first_entry(&hub_event_list,
+					struct usb_hub, event_list);
+			rt_list_remove(&hub->event_list);
+			rt_hw_interrupt_enable(level);
+
+			hub_event(hub);
+		}
+		usb_recover_work();
+#ifdef CONFIG_USB_PM
+		usb_pm_work();
+#endif
+		rt_mutex_release(&hub_lock);
+	}
+}
+
+/*-------------------------------------------------------------------------*/
+
+/* completion of the status change urb; may run in interrupt context */
+static void hub_irq(struct urb *urb)
+{
+	struct usb_hub *hub = urb->context;
+	rt_uint32_t bits = 0;
+	int i;
+
+	switch (urb->status) {
+	case -ENOENT:		/* synchronous unlink */
+	case -ECONNRESET:	/* async unlink */
+	case -ESHUTDOWN:	/* hardware going away */
+		return;
+
+	case 0:			/* we got data:  port status changed */
+		for (i = 0; (u32)i < urb->actual_length && i < 4; i++)
+			bits |= (rt_uint32_t)hub->buffer[i] << (8 * i);
+		hub->nerrors = 0;
+		rt_atomic_or(&hub->event_bits, (atomic_t)bits);
+		kick_hub_wq(hub);
+		break;
+
+	default:		/* presumably an error */
+		/* after 10 in a row the hub thread resubmits */
+		if (++hub->nerrors >= 10) {
+			kick_hub_wq(hub);
+			return;
+		}
+		break;
+	}
+
+	if (hub->quiescing)
+		return;
+	if (usb_submit_urb(urb) != 0) {
+		hub->nerrors = 10;
+		kick_hub_wq(hub);
+	}
+}
+
+/* power the ports and look at every one of them */
+static void hub_activate(struct usb_hub *hub)
+{
+	int port1, delay;
+
+	for (port1 = 1; port1 <= hub->nports; port1++)
+		usb_hub_set_port_feature(hub->hdev, port1,
+				USB_PORT_FEAT_POWER);
+	delay = hub->descriptor->bPwrOn2PwrGood * 2;
+	rt_thread_mdelay(delay > 100 ? delay : 100);
+
+	for (port1 = 1; port1 <= hub->nports; port1++)
+		hub_port_debounce_start(hub, port1, 0);
+
+	if (usb_submit_urb(hub->urb) != 0)
+		hub->nerrors = 10;
+	kick_hub_wq(hub);
+}
+
+static void hub_free(struct usb_hub *hub)
+{
+	usb_free_urb(hub->urb);
+	rt_free(hub->buffer);
+	rt_free(hub->ports);
+	rt_free(hub->status);
+	rt_free(hub->descriptor);
+	rt_free(hub);
+}
+
+static int hub_configure(struct usb_hub *hub,
+		struct usb_endpoint_descriptor *endpoint)
+{
+	struct usb_device *hdev = hub->hdev;
+	unsigned int pipe;
+	int ret, maxp;
+
+	hub->descriptor = rt_malloc(sizeof(*hub->descriptor));
+	hub->status = rt_malloc(sizeof(*hub->status));
+	if (!hub->descriptor || !hub->status)
+		return -ENOMEM;
+
+	ret = get_hub_descriptor(hdev, hub->descriptor);
+	if (ret < 0)
+		return ret;
+	hub->nports = hub->descriptor->bNbrPorts;
+	if (hub->nports > USB_MAXCHILDREN)
+		return -E2BIG;
+	if (hub->nports == 0)
+		return -ENODEV;
+
+	hub->ports = rt_calloc(hub->nports, sizeof(*hub->ports));
+	if (!hub->ports)
+		return -ENOMEM;
+
+	/* one bit for the hub and one per port */
+	hub->buffer_len = (hub->nports + 1 + 7) / 8;
+	maxp = endpoint->wMaxPacketSize & 0x7ff;
+	if (maxp && maxp < hub->buffer_len)
+		hub->buffer_len = maxp;
+	hub->buffer = rt_malloc(hub->buffer_len);
+	hub->urb = usb_alloc_urb(0);
+	if (!hub->buffer || !hub->urb)
+		return -ENOMEM;
+
+	pipe = usb_rcvintpipe(hdev, endpoint->bEndpointAddress &
+			USB_EP_DESC_NUM_MASK);
+	usb_fill_int_urb(hub->urb, hdev, pipe, hub->buffer, hub->buffer_len,
+			hub_irq, hub, endpoint->bInterval);
+
+	rt_timer_init(&hub->debounce_timer, "hubdb", hub_debounce_timeout,
+			hub, rt_tick_from_millisecond(HUB_DEBOUNCE_STEP),
+			RT_TIMER_FLAG_ONE_SHOT | RT_TIMER_FLAG_SOFT_TIMER);
+
+	hdev->maxchild = hub->nports;
+	hub_activate(hub);
+	return 0;
+}
+
+static int hub_probe(struct usb_interface *intf,
+		const struct usb_device_id *id)
+{
+	struct usb_host_interface *desc = intf->cur_altsetting;
+	struct usb_device *hdev = interface_to_usbdev(intf);
+	struct usb_endpoint_descriptor *endpoint;
+	struct usb_hub *hub;
+	int ret;
+
+	if (hdev->level > HUB_MAX_DEPTH)
+		return -E2BIG;
+
+	/* Multiple endpoints? What kind of mutant ninja-hub is this? */
+	if (desc->desc.bNumEndpoints != 1)
+		return -EIO;
+
+	/* Output endpoint? Curiouser and curiouser.. */
+	endpoint = &desc->endpoint[0].desc;
+	if (!(endpoint->bEndpointAddress & USB_DIR_IN) ||
+			(endpoint->bmAttributes & USB_EP_ATTR_TYPE_MASK) !=
+			USB_EP_ATTR_INT)
+		return -EIO;
+
+	hub = rt_calloc(1, sizeof(*hub));
+	if (!hub)
+		return -ENOMEM;
+	hub->hdev = hdev;
+	hub->intf = intf;
+	rt_list_init(&hub->event_list);
+	intf->driver_data = hub;
+
+	ret = hub_configure(hub, endpoint);
+	if (ret < 0) {
+		hdev->maxchild = 0;
+		intf->driver_data = RT_NULL;
+		hub_free(hub);
+	}
+	return ret;
+}
+
+static void hub_disconnect(struct usb_interface *intf)
+{
+	struct usb_hub *hub = intf->driver_data;
+	struct usb_port *port;
+	rt_base_t level;
+	int port1;
+
+	hub->quiescing = 1;
+	usb_kill_urb(hub->urb);
+	rt_timer_detach(&hub->debounce_timer);
+
+	level = rt_hw_interrupt_disable();
+	hub->disconnected = 1;
+	rt_list_remove(&hub->event_list);
+	rt_hw_interrupt_enable(level);
+
+	for (port1 = hub->nports; port1 > 0; port1--) {
+		port = &hub->ports[port1 - 1];
+		if (port->enum_job) {
+			/* make its remaining requests fail fast */
+			port->child->state = USB_STATE_NOTATTACHED;
+			hub_port_reap_enum_job(port);
+		}
+		usb_disconnect(&port->child);
+	}
+
+	hub->hdev->maxchild = 0;
+	hub_free(hub);
+}
+
+static const struct usb_device_id hub_id_table[] = {
+	{ USB_INTERFACE_CLASS(USB_CLASS_HUB) },
+	{ }
+};
+
+static struct usb_driver hub_driver = {
+	.name =		"hub",
+	.probe =	hub_probe,
+	.disconnect =	hub_disconnect,
+	.id_table =	hub_id_table,
+};
+
+/**
+ * usb_hub_init - start the hub thread and register the hub driver
+ *
+ * Runs before any host controller is added.
+ *
+ * Return: 0 on success, -ENOMEM if the thread can't be created.
+ */
+int usb_hub_init(void)
+{
+	int i;
+
+	if (hub_thread)
+		return 0;
+
+	rt_sem_init(&hub_event_sem, "hubev", 0, RT_IPC_FLAG_FIFO);
+	rt_sem_init(&hub_enum_sem, "hubenum", 0, RT_IPC_FLAG_FIFO);
+	rt_mutex_init(&hub_lock, "hub", RT_IPC_FLAG_PRIO);
+
+	for (i = 0; i < USB_HUB_ENUM_THREADS; i++) {
+		hub_enum_threads[i] = rt_thread_create("usbenum",
+				hub_enum_thread_entry, RT_NULL,
+				USB_HUB_THREAD_STACK_SIZE,
+				USB_HUB_THREAD_PRIORITY, 10);
+		if (!hub_enum_threads[i])
+			goto fail;
+	}
+	hub_thread = rt_thread_create("usbhub", hub_thread_entry, RT_NULL,
+			USB_HUB_THREAD_STACK_SIZE, USB_HUB_THREAD_PRIORITY, 10);
+	if (!hub_thread)
+		goto fail;
+
+	usb_register_driver(&hub_driver);
+	for (i = 0; i < USB_HUB_ENUM_THREADS; i++)
+		rt_thread_startup(hub_enum_threads[i]);
+	rt_thread_startup(hub_thread);
+	return 0;
+
+fail:
+	for (i = 0; i < USB_HUB_ENUM_THREADS; i++) {
+		if (hub_enum_threads[i])
+			rt_thread_delete(hub_enum_threads[i]);
+		hub_enum_threads[i] = RT_NULL;
+	}
+	rt_mutex_detach(&hub_lock);
+	rt_sem_detach(&hub_enum_sem);
+	rt_sem_detach(&hub_event_sem);
+	return -ENOMEM;
+}
+INIT_PREV_EXPORT(usb_hub_init);
+
+/*
+ * usb_hub_cleanup - stop the hub thread; every hcd has been removed
+ */
+void usb_hub_cleanup(void)
+{
+	int i;
+
+	if (!hub_thread)
+		return;
+
+	usb_deregister(&hub_driver);
+	rt_mutex_take(&hub_lock, RT_WAITING_FOREVER);
+	rt_thread_delete(hub_thread);
+	hub_thread = RT_NULL;
+	rt_mutex_release(&hub_lock);
+
+	/* no hub is left, so no enumeration is either */
+	for (i = 0; i < USB_HUB_ENUM_THREADS; i++) {
+		rt_thread_delete(hub_enum_threads[i]);
+		hub_enum_threads[i] = RT_NULL;
+	}
+
+	rt_mutex_detach(&hub_lock);
+	rt_sem_detach(&hub_enum_sem);
+	rt_sem_detach(&hub_event_sem);
+}
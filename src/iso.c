@@ -0,0 +1,186 @@
+#include "hcd.h"
+
+/*
+ * Isochronous streams.
+ *
+ * A stream owns its urbs and their buffers from usb_iso_stream_init()
+ * to usb_iso_stream_release().  Every urb is resubmitted with
+ * URB_ISO_ASAP from its own completion, so the core places it right
+ * behind the packets still queued and the steady state allocates
+ * nothing.  If the stream falls behind anyway, the frames it missed
+ * show up in ep->iso_underruns.
+ */
+
+static void usb_iso_stream_prep(struct usb_iso_stream *stream,
+		struct urb *urb)
+{
+	int i;
+
+	for (i = 0; i < stream->packets; i++) {
+		urb->iso_frame_desc[i].offset = i * stream->packet_size;
+		urb->iso_frame_desc[i].length = stream->packet_size;
+	}
+	urb->transfer_flags = URB_ISO_ASAP | URB_NO_TRANSFER_DMA_MAP;
+	if (stream->prepare && usb_pipeout(stream->pipe))
+		stream->prepare(stream, urb);
+}
+
+static void usb_iso_stream_complete(struct urb *urb)
+{
+	struct usb_iso_stream *stream = urb->context;
+	int ret;
+
+	stream->complete(stream, urb);
+
+	switch (urb->status) {
+	case -ENOENT:		/* killed */
+	case -ECONNRESET:	/* unlinked */
+	case -ESHUTDOWN:	/* endpoint or controller gone */
+	case -ENODEV:
+		goto out;
+	}
+	if (!rt_atomic_load(&stream->running))
+		goto out;
+
+	usb_iso_stream_prep(stream, urb);
+	ret = usb_submit_urb(urb);
+	if (ret == 0)
+		return;
+	stream->error = ret;
+out:
+	rt_atomic_sub(&stream->active, 1);
+}
+
+/**
+ * usb_iso_stream_init - set up an isochronous stream
+ * @stream: stream to initialize
+ * @dev: device the endpoint belongs to
+ * @pipe: isochronous pipe, usb_rcvisocpipe() or usb_sndisocpipe()
+ * @nurbs: urbs kept in flight, up to USB_ISO_STREAM_URBS
+ * @packets: packets per urb
+ * @packet_size: bytes per packet
+ * @complete: called for every urb given back, before it is resubmitted
+ * @context: for the caller, in stream->context
+ *
+ * Everything the stream needs while running is allocated here.
+ *
+ * Return: 0 on success, -EINVAL or -ENOMEM.
+ */
+int usb_iso_stream_init(struct usb_iso_stream *stream,
+		struct usb_device *dev, unsigned int pipe, int nurbs,
+		int packets, int packet_size,
+		void (*complete)(struct usb_iso_stream *, struct urb *),
+		void *context)
+{
+	struct usb_host_endpoint *ep = usb_pipe_endpoint(dev, pipe);
+	struct urb *urb;
+	dma_addr_t dma;
+	int i;
+
+	rt_memset(stream, 0, sizeof(*stream));
+	if (!ep || !usb_pipeisoc(pipe) || !complete ||
+			nurbs < 1 || nurbs > USB_ISO_STREAM_URBS ||
+			packets < 1 || packet_size < 1)
+		return -EINVAL;
+
+	stream->dev = dev;
+	stream->ep = ep;
+	stream->pipe = pipe;
+	stream->nurbs = nurbs;
+	stream->packets = packets;
+	stream->packet_size = packet_size;
+	stream->complete = complete;
+	stream->context = context;
+
+	for (i = 0; i < nurbs; i++) {
+		urb = usb_alloc_urb(packets);
+		if (!urb)
+			goto fail;
+		stream->urbs[i] = urb;
+
+		urb->transfer_buffer = hcd_buffer_alloc(dev->bus,
+				packets * packet_size, &dma);
+		if (!urb->transfer_buffer)
+			goto fail;
+		urb->transfer_dma = dma;
+		urb->transfer_buffer_length = packets * packet_size;
+		urb->number_of_packets = packets;
+		urb->dev = dev;
+		urb->pipe = pipe;
+		urb->interval = ep->desc.bInterval;
+		urb->complete = usb_iso_stream_complete;
+		urb->context = stream;
+	}
+	return 0;
+
+fail:
+	usb_iso_stream_release(stream);
+	return -ENOMEM;
+}
+
+/**
+ * usb_iso_stream_start - submit all of a stream's urbs
+ * @stream: stream from usb_iso_stream_init()
+ *
+ * Return: 0 on success, or the error from usb_submit_urb(); the stream
+ * is stopped again then.
+ */
+int usb_iso_stream_start(struct usb_iso_stream *stream)
+{
+	struct urb *urb;
+	int i, ret;
+
+	stream->error = 0;
+	rt_atomic_store(&stream->running, 1);
+	for (i = 0; i < stream->nurbs; i++) {
+		urb = stream->urbs[i];
+		usb_iso_stream_prep(stream, urb);
+		rt_atomic_add(&stream->active, 1);
+		ret = usb_submit_urb(urb);
+		if (ret) {
+			rt_atomic_sub(&stream->active, 1);
+			usb_iso_stream_stop(stream);
+			return ret;
+		}
+	}
+	return 0;
+}
+
+/**
+ * usb_iso_stream_stop - stop a stream and wait for its urbs
+ * @stream: stream to stop
+ *
+ * Must not be called from the stream's complete().  The next start
+ * begins a new schedule, so the gap doesn't count as underruns.
+ */
+void usb_iso_stream_stop(struct usb_iso_stream *stream)
+{
+	int i;
+
+	rt_atomic_store(&stream->running, 0);
+	for (i = 0; i < stream->nurbs; i++)
+		usb_kill_urb(stream->urbs[i]);
+	if (stream->ep)
+		stream->ep->iso_active = 0;
+}
+
+/**
+ * usb_iso_stream_release - stop a stream and free its urbs and buffers
+ * @stream: stream from usb_iso_stream_init(), even a failed one
+ */
+void usb_iso_stream_release(struct usb_iso_stream *stream)
+{
+	struct urb *urb;
+	int i;
+
+	usb_iso_stream_stop(stream);
+	for (i = 0; i < stream->nurbs; i++) {
+		urb = stream->urbs[i];
+		if (!urb)
+			continue;
+		hcd_buffer_free(stream->dev->bus, urb->transfer_buffer_length,
+				urb->transfer_buffer, urb->transfer_dma);
+		usb_free_urb(urb);
+		stream->urbs[i] = RT_NULL;
+	}
+}
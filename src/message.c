@@ -0,0 +1,767 @@
+#include "hcd.h"
+
+/*
+ * message.c - synchronous message handling
+ */
+
+struct api_context {
+	struct rt_completion	done;
+	int			status;
+};
+
+static void usb_api_blocking_completion(struct urb *urb)
+{
+	struct api_context *ctx = urb->context;
+
+	ctx->status = urb->status;
+	rt_completion_done(&ctx->done);
+}
+
+/*
+ * Starts urb and waits for completion or timeout.  Consumes the caller's
+ * reference to @urb.
+ */
+static int usb_start_wait_urb(struct urb *urb, int timeout, int *actual_length)
+{
+	struct api_context ctx;
+	rt_int32_t ticks;
+	int retval;
+
+	rt_completion_init(&ctx.done);
+	urb->context = &ctx;
+	urb->actual_length = 0;
+	retval = usb_submit_urb(urb);
+	if (retval)
+		goto out;
+
+	ticks = timeout ? (rt_int32_t)rt_tick_from_millisecond(timeout) :
+			RT_WAITING_FOREVER;
+	if (rt_completion_wait(&ctx.done, ticks) != RT_EOK) {
+		usb_kill_urb(urb);
+		retval = (ctx.status == -ENOENT ? -ETIMEDOUT : ctx.status);
+	} else {
+		retval = ctx.status;
+	}
+out:
+	if (actual_length)
+		*actual_length = urb->actual_length;
+	usb_free_urb(urb);
+	return retval;
+}
+
+/* the setup packet takes a whole dma alignment unit before the data */
+#define USB_CTRL_SETUP_SPACE \
+	RT_ALIGN(sizeof(struct usb_ctrlrequest), USB_DMA_ALIGN)
+
+/**
+ * usb_ctrl_init - set up a device's control transfer
+ * @dev: new device, its bus' buffer pools are up
+ *
+ * Without it, or when it fails, usb_control_msg() allocates per call
+ * and usb_control_msg_async() is not available.
+ *
+ * Return: 0 on success, -ENOMEM otherwise.
+ */
+int usb_ctrl_init(struct usb_device *dev)
+{
+	struct usb_ctrl_xfer *c = &dev->ctrl;
+
+	rt_sem_init(&c->lock, "usbctl", 1, RT_IPC_FLAG_PRIO);
+	c->urb = usb_alloc_urb(0);
+	if (!c->urb)
+		return -ENOMEM;
+	c->setup = hcd_buffer_alloc(dev->bus,
+			USB_CTRL_SETUP_SPACE + USB_CTRL_BUF_SIZE, &c->dma);
+	if (!c->setup) {
+		usb_free_urb(c->urb);
+		c->urb = RT_NULL;
+		return -ENOMEM;
+	}
+	c->buf = (uint8_t *)c->setup + USB_CTRL_SETUP_SPACE;
+	return 0;
+}
+
+/**
+ * usb_ctrl_release - free a device's control transfer
+ * @dev: device being freed
+ */
+void usb_ctrl_release(struct usb_device *dev)
+{
+	struct usb_ctrl_xfer *c = &dev->ctrl;
+
+	if (c->urb) {
+		usb_kill_urb(c->urb);
+		hcd_buffer_free(dev->bus,
+				USB_CTRL_SETUP_SPACE + USB_CTRL_BUF_SIZE,
+				c->setup, c->dma);
+		usb_free_urb(c->urb);
+		c->urb = RT_NULL;
+	}
+	rt_sem_detach(&c->lock);
+}
+
+/*
+ * Fills the device's control urb, which the caller has claimed.  Data
+ * that fits goes through the bounce buffer, so callers may pass stack
+ * buffers; IN data is copied back by usb_ctrl_finish().
+ */
+static void usb_ctrl_fill(struct usb_device *dev, unsigned int pipe,
+		uint8_t request, uint8_t requesttype, uint16_t value,
+		uint16_t index, void *data, uint16_t size,
+		usb_complete_t complete)
+{
+	struct usb_ctrl_xfer *c = &dev->ctrl;
+	struct usb_ctrlrequest *dr = c->setup;
+	struct urb *urb = c->urb;
+
+	dr->bRequestType = requesttype;
+	dr->bRequest = request;
+	dr->wValue = value;
+	dr->wIndex = index;
+	dr->wLength = size;
+
+	c->data = RT_NULL;
+	urb->transfer_flags = URB_NO_SETUP_DMA_MAP;
+	urb->setup_dma = c->dma;
+	if (size <= USB_CTRL_BUF_SIZE) {
+		if (requesttype & USB_DIR_IN)
+			c->data = data;
+		else if (size)
+			rt_memcpy(c->buf, data, size);
+		data = c->buf;
+		urb->transfer_dma = c->dma + USB_CTRL_SETUP_SPACE;
+		urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+	}
+	usb_fill_control_urb(urb, dev, pipe, (unsigned char *)dr, data,
+			size, complete, c);
+}
+
+static void usb_ctrl_finish(struct usb_ctrl_xfer *c, int length)
+{
+	if (c->data && length > 0)
+		rt_memcpy(c->data, c->buf, length);
+}
+
+/* the allocating path, for devices without a control transfer */
+static int usb_control_msg_alloc(struct usb_device *dev, unsigned int pipe,
+		uint8_t request, uint8_t requesttype, uint16_t value,
+		uint16_t index, void *data, uint16_t size, int timeout)
+{
+	struct usb_ctrlrequest *dr;
+	struct urb *urb;
+	int ret, length;
+
+	dr = rt_malloc(sizeof(*dr));
+	if (!dr)
+		return -ENOMEM;
+
+	dr->bRequestType = requesttype;
+	dr->bRequest = request;
+	dr->wValue = value;
+	dr->wIndex = index;
+	dr->wLength = size;
+
+	urb = usb_alloc_urb(0);
+	if (!urb) {
+		rt_free(dr);
+		return -ENOMEM;
+	}
+	usb_fill_control_urb(urb, dev, pipe, (unsigned char *)dr, data,
+			size, usb_api_blocking_completion, RT_NULL);
+
+	ret = usb_start_wait_urb(urb, timeout, &length);
+	rt_free(dr);
+	return ret < 0 ? ret : length;
+}
+
+/**
+ * usb_control_msg - Builds a control urb, sends it off and waits for completion
+ * @dev: pointer to the usb device to send the message to
+ * @pipe: endpoint "pipe" to send the message to
+ * @request: USB message request value
+ * @requesttype: USB message request type value
+ * @value: USB message value
+ * @index: USB message index value
+ * @data: pointer to the data to send
+ * @size: length in bytes of the data to send
+ * @timeout: time in msecs to wait for the message to complete before timing
+ *	out (if 0 the wait is forever)
+ *
+ * Requests to one device are serialized.  Up to USB_CTRL_BUF_SIZE bytes
+ * nothing is allocated and @data may be on the stack.
+ *
+ * Context: thread context, sleeps.
+ *
+ * Return: If successful, the number of bytes transferred. Otherwise, a
+ * negative error number.
+ */
+int usb_control_msg(struct usb_device *dev, unsigned int pipe,
+		uint8_t request, uint8_t requesttype, uint16_t value,
+		uint16_t index, void *data, uint16_t size, int timeout)
+{
+	struct usb_ctrl_xfer *c = &dev->ctrl;
+	int ret, length;
+
+	if (!c->urb)
+		return usb_control_msg_alloc(dev, pipe, request, requesttype,
+				value, index, data, size, timeout);
+
+	rt_sem_take(&c->lock, RT_WAITING_FOREVER);
+	usb_ctrl_fill(dev, pipe, request, requesttype, value, index, data,
+			size, usb_api_blocking_completion);
+	/* usb_start_wait_urb() consumes a reference, the device keeps its own */
+	usb_get_urb(c->urb);
+	ret = usb_start_wait_urb(c->urb, timeout, &length);
+	if (ret >= 0)
+		usb_ctrl_finish(c, length);
+	rt_sem_release(&c->lock);
+	return ret < 0 ? ret : length;
+}
+
+static void usb_ctrl_async_complete(struct urb *urb)
+{
+	struct usb_ctrl_xfer *c = urb->context;
+	usb_ctrl_complete_t complete = c->complete;
+	void *context = c->context;
+	int status = urb->status;
+	int length = urb->actual_length;
+
+	if (!status)
+		usb_ctrl_finish(c, length);
+	/* free for the next request before the handler, which may send it */
+	rt_sem_release(&c->lock);
+	complete(urb->dev, context, status, length);
+}
+
+/**
+ * usb_control_msg_async - send a control message without waiting for it
+ * @dev: pointer to the usb device to send the message to
+ * @pipe: endpoint "pipe" to send the message to
+ * @request: USB message request value
+ * @requesttype: USB message request type value
+ * @value: USB message value
+ * @index: USB message index value
+ * @data: the data to send, or where received data goes; must stay valid
+ *	until @complete runs
+ * @size: length in bytes of the data
+ * @complete: called with the status and the bytes transferred
+ * @context: passed on to @complete
+ *
+ * Uses the device's control transfer like usb_control_msg(), but does
+ * not wait for it to become free either.  Nothing on the way sleeps
+ * where the caller can't: a suspended device is left to the hub thread
+ * to resume, and a root hub, whose replies are built under a mutex,
+ * only takes requests from threads that may sleep.
+ *
+ * Context: any, also completion handlers.
+ *
+ * Return: 0 if @complete will be called, -EBUSY if a request to @dev is
+ * in flight, -EAGAIN for a root hub where usb_hcd_can_sleep() is false,
+ * -EHOSTUNREACH while @dev is being resumed, or another negative error
+ * number.
+ */
+int usb_control_msg_async(struct usb_device *dev, unsigned int pipe,
+		uint8_t request, uint8_t requesttype, uint16_t value,
+		uint16_t index, void *data, uint16_t size,
+		usb_ctrl_complete_t complete, void *context)
+{
+	struct usb_ctrl_xfer *c = &dev->ctrl;
+	int ret;
+
+	if (!c->urb || !complete)
+		return -EINVAL;
+	if (!dev->parent && !usb_hcd_can_sleep(bus_to_hcd(dev->bus)))
+		return -EAGAIN;
+	if (rt_sem_trytake(&c->lock) != RT_EOK)
+		return -EBUSY;
+
+	usb_ctrl_fill(dev, pipe, request, requesttype, value, index, data,
+			size, usb_ctrl_async_complete);
+	c->complete = complete;
+	c->context = context;
+	ret = usb_submit_urb(c->urb);
+	if (ret)
+		rt_sem_release(&c->lock);
+	return ret;
+}
+
+/**
+ * usb_bulk_msg - Builds a bulk urb, sends it off and waits for completion
+ * @usb_dev: pointer to the usb device to send the message to
+ * @pipe: endpoint "pipe" to send the message to
+ * @data: pointer to the data to send
+ * @len: length in bytes of the data to send
+ * @actual_length: pointer to a location to put the actual length transferred
+ *	in bytes
+ * @timeout: time in msecs to wait for the message to complete before
+ *	timing out (if 0 the wait is forever)
+ *
+ * Return: If successful, 0. Otherwise a negative error number.
+ */
+int usb_bulk_msg(struct usb_device *usb_dev, unsigned int pipe,
+		void *data, int len, int *actual_length, int timeout)
+{
+	struct urb *urb;
+	struct usb_host_endpoint *ep;
+
+	ep = usb_pipe_endpoint(usb_dev, pipe);
+	if (!ep || len < 0)
+		return -EINVAL;
+
+	urb = usb_alloc_urb(0);
+	if (!urb)
+		return -ENOMEM;
+
+	if (usb_pipe_ep_state(usb_dev, pipe)->type == PIPE_INTERRUPT) {
+		pipe = (pipe & ~(3 << 30)) | (PIPE_INTERRUPT << 30);
+		usb_fill_int_urb(urb, usb_dev, pipe, data, len,
+				usb_api_blocking_completion, RT_NULL,
+				ep->desc.bInterval);
+	} else {
+		usb_fill_bulk_urb(urb, usb_dev, pipe, data, len,
+				usb_api_blocking_completion, RT_NULL);
+	}
+
+	return usb_start_wait_urb(urb, timeout, actual_length);
+}
+
+/**
+ * usb_clear_halt - tells device to clear endpoint halt/stall condition
+ * @dev: device whose endpoint is halted
+ * @pipe: endpoint "pipe" being cleared
+ *
+ * For endpoints that stalled a transfer with -EPIPE.  The device and
+ * the host side both restart the endpoint with DATA0.
+ *
+ * Context: thread context, sleeps.
+ *
+ * Return: 0 on success, or a negative error number.
+ */
+int usb_clear_halt(struct usb_device *dev, unsigned int pipe)
+{
+	struct usb_ep_state *st = usb_pipe_ep_state(dev, pipe);
+	int endp = usb_pipeendpoint(pipe);
+	int ret;
+
+	if (usb_pipein(pipe))
+		endp |= USB_DIR_IN;
+
+	ret = usb_control_msg(dev, usb_sndctrlpipe(dev, 0),
+			USB_REQ_CLEAR_FEATURE, USB_REQ_TYPE_ENDPOINT,
+			USB_FEATURE_ENDPOINT_HALT, endp, RT_NULL, 0,
+			USB_CTRL_SET_TIMEOUT);
+	if (ret < 0)
+		return ret;
+
+	st->flags &= ~(USB_EP_HALTED | USB_EP_TOGGLE);
+	return 0;
+}
+
+/**
+ * usb_get_descriptor - issues a generic GET_DESCRIPTOR request
+ * @dev: the device whose descriptor is being retrieved
+ * @desctype: the descriptor type (USB_DESC_TYPE_*)
+ * @descindex: the number of the descriptor
+ * @buf: where to put the descriptor
+ * @size: how big is "buf"?
+ *
+ * Return: The number of bytes received on success, or else the status
+ * code returned by the underlying usb_control_msg() call.
+ */
+int usb_get_descriptor(struct usb_device *dev, unsigned char desctype,
+		unsigned char descindex, void *buf, int size)
+{
+	int i;
+	int result;
+
+	rt_memset(buf, 0, size);	/* Make sure we parse really received data */
+
+	for (i = 0; i < 3; ++i) {
+		/* retry on length 0 or error; some devices are flakey */
+		result = usb_control_msg(dev, usb_rcvctrlpipe(dev, 0),
+				USB_REQ_GET_DESCRIPTOR, USB_DIR_IN,
+				(desctype << 8) + descindex, 0, buf, size,
+				USB_CTRL_GET_TIMEOUT);
+		if (result <= 0 && result != -ETIMEDOUT)
+			continue;
+		if (result > 1 && ((uint8_t *)buf)[1] != desctype) {
+			result = -ENODATA;
+			continue;
+		}
+		break;
+	}
+	return result;
+}
+
+/*
+ * usb_get_device_descriptor - (re)reads the device descriptor (usbcore)
+ * @dev: the device whose device descriptor is being updated
+ * @size: how much of the descriptor to read
+ *
+ * Updates the copy of the device descriptor stored in the device structure.
+ *
+ * Return: The number of bytes received on success, or else the status code
+ * returned by the underlying usb_control_msg() call.
+ */
+int usb_get_device_descriptor(struct usb_device *dev, unsigned int size)
+{
+	struct usb_device_descriptor desc;
+	int ret;
+
+	if (size > sizeof(desc))
+		return -EINVAL;
+
+	ret = usb_get_descriptor(dev, USB_DESC_TYPE_DEVICE, 0, &desc, size);
+	if (ret >= 0)
+		rt_memcpy(&dev->descriptor, &desc, size);
+	return ret;
+}
+
+static int usb_get_string(struct usb_device *dev, unsigned short langid,
+		unsigned char index, void *buf, int size)
+{
+	int i;
+	int result;
+
+	for (i = 0; i < 3; ++i) {
+		/* retry on length 0 or stall; some devices are flakey */
+		result = usb_control_msg(dev, usb_rcvctrlpipe(dev, 0),
+				USB_REQ_GET_DESCRIPTOR, USB_DIR_IN,
+				(USB_DESC_TYPE_STRING << 8) + index, langid,
+				buf, size, USB_CTRL_GET_TIMEOUT);
+		if (result == 0 || result == -EPIPE)
+			continue;
+		if (result > 1 && ((uint8_t *)buf)[1] != USB_DESC_TYPE_STRING) {
+			result = -ENODATA;
+			continue;
+		}
+		break;
+	}
+	return result;
+}
+
+/**
+ * usb_string - returns ISO 8859-1 version of a string descriptor
+ * @dev: the device whose string descriptor is being retrieved
+ * @index: the number of the descriptor
+ * @buf: where to put the string
+ * @size: how big is "buf"?
+ *
+ * Characters outside ISO 8859-1 are replaced with '?'.
+ *
+ * Return: length of the string (>= 0) or a negative error number.
+ */
+int usb_string(struct usb_device *dev, int index, char *buf, rt_size_t size)
+{
+	unsigned char *tbuf;
+	int err, idx;
+
+	if (size <= 0 || !buf)
+		return -EINVAL;
+	buf[0] = 0;
+	if (index <= 0 || index >= 256)
+		return -EINVAL;
+	tbuf = rt_malloc(256);
+	if (!tbuf)
+		return -ENOMEM;
+
+	if (!dev->have_langid) {
+		err = usb_get_string(dev, 0, 0, tbuf, 4);
+		if (err < 4) {
+			err = err < 0 ? err : -EINVAL;
+			goto errout;
+		}
+		dev->have_langid = 1;
+		dev->string_langid = tbuf[2] | (tbuf[3] << 8);
+	}
+
+	err = usb_get_string(dev, dev->string_langid, index, tbuf, 255);
+	if (err < 0)
+		goto errout;
+
+	size--;		/* leave room for trailing NULL char in output buffer */
+	for (idx = 0, err = 2; err + 1 < tbuf[0] && (rt_size_t)idx < size;
+			err += 2) {
+		if (tbuf[err + 1])	/* high byte */
+			buf[idx++] = '?';
+		else
+			buf[idx++] = tbuf[err];
+	}
+	buf[idx] = 0;
+	err = idx;
+
+errout:
+	rt_free(tbuf);
+	return err;
+}
+
+/**
+ * usb_cache_string - read a string descriptor and cache it for later use
+ * @udev: the device whose string descriptor is being read
+ * @index: the descriptor index
+ *
+ * Return: A pointer to a rt_malloc'ed buffer containing the descriptor
+ * string, or %RT_NULL if the index is 0 or the string could not be read.
+ */
+char *usb_cache_string(struct usb_device *udev, int index)
+{
+	char *buf;
+	char *smallbuf = RT_NULL;
+	int len;
+
+	if (index <= 0)
+		return RT_NULL;
+
+	buf = rt_malloc(USB_STRING_MAX);
+	if (buf) {
+		len = usb_string(udev, index, buf, USB_STRING_MAX);
+		if (len > 0) {
+			smallbuf = rt_malloc(++len);
+			if (smallbuf)
+				rt_memcpy(smallbuf, buf, len);
+		}
+		rt_free(buf);
+	}
+	return smallbuf;
+}
+
+/*
+ * Append the periodic endpoints of an altsetting to @eps, which holds
+ * USB_MAXENDPOINTS, for the bandwidth checks.  Return the new count, or
+ * -EINVAL if they don't fit: no valid configuration has more.
+ */
+static int usb_alt_endpoints(struct usb_host_interface *alt,
+		struct usb_host_endpoint **eps, int n)
+{
+	struct usb_host_endpoint *ep;
+	int i;
+
+	if (!alt || n < 0)
+		return n;
+	for (i = 0; i < alt->desc.bNumEndpoints; i++) {
+		ep = &alt->endpoint[i];
+		if (usb_endpoint_pipetype(&ep->desc) != PIPE_ISOCHRONOUS &&
+				usb_endpoint_pipetype(&ep->desc) != PIPE_INTERRUPT)
+			continue;
+		if (n >= USB_MAXENDPOINTS)
+			return -EINVAL;
+		eps[n++] = ep;
+	}
+	return n;
+}
+
+/* altsetting 0, which every interface of a new configuration starts in */
+static struct usb_host_interface *usb_first_altsetting(
+		struct usb_interface *intf)
+{
+	struct usb_host_interface *alt = usb_altnum_to_altsetting(intf, 0);
+
+	return alt ? alt : &intf->altsetting[0];
+}
+
+/* the periodic endpoints of @config in the current altsettings, or in
+ * altsetting 0 if @initial; -EINVAL if there are too many */
+static int usb_config_endpoints(struct usb_host_config *config,
+		struct usb_host_endpoint **eps, int initial)
+{
+	struct usb_interface *intf;
+	int i, n = 0;
+
+	if (!config)
+		return 0;
+	for (i = 0; i < config->desc.bNumInterfaces; i++) {
+		intf = config->interface[i];
+		if (intf)
+			n = usb_alt_endpoints(initial ?
+					usb_first_altsetting(intf) :
+					intf->cur_altsetting, eps, n);
+	}
+	return n;
+}
+
+/**
+ * usb_disable_device - Disable all the endpoints for a USB device
+ * @dev: the device whose endpoints are being disabled
+ *
+ * Unbinds the interface drivers, gives the periodic bandwidth of the
+ * active configuration back to the bus and disables every endpoint,
+ * ep0 included.  Nothing is sent to the device, which may be gone.
+ */
+void usb_disable_device(struct usb_device *dev)
+{
+	struct usb_host_endpoint *eps[USB_MAXENDPOINTS];
+	struct usb_interface *intf;
+	int i, n;
+
+	usb_unbind_interfaces(dev);
+	if (dev->actconfig) {
+		for (i = 0; i < dev->actconfig->desc.bNumInterfaces; i++) {
+			intf = dev->actconfig->interface[i];
+			if (!intf)
+				continue;
+			n = usb_alt_endpoints(intf->cur_altsetting, eps, 0);
+			if (n > 0)
+				usb_hcd_check_bandwidth(dev, eps, n,
+						RT_NULL, 0);
+			usb_disable_interface(dev, intf->cur_altsetting);
+		}
+		dev->actconfig = RT_NULL;
+		if (dev->state == USB_STATE_CONFIGURED)
+			dev->state = USB_STATE_ADDRESS;
+	}
+	usb_disable_endpoint(dev, 0);
+}
+
+/**
+ * usb_set_configuration - Makes a particular device setting be current
+ * @dev: the device whose configuration is being updated
+ * @configuration: the configuration being chosen, 0 to unconfigure
+ *
+ * Interfaces of the old configuration are unbound and their endpoints
+ * disabled; the new configuration's periodic endpoints must fit the bus
+ * schedule before SET_CONFIGURATION is sent.  Interface drivers are not
+ * probed here, see usb_probe_interfaces().
+ *
+ * Return: Zero on success, or else the status code returned by the
+ * underlying call that failed.
+ */
+int usb_set_configuration(struct usb_device *dev, int configuration)
+{
+	struct usb_host_config *cp = RT_NULL;
+	struct usb_host_endpoint *old_eps[USB_MAXENDPOINTS];
+	struct usb_host_endpoint *new_eps[USB_MAXENDPOINTS];
+	struct usb_interface *intf;
+	int i, ret, old_n, new_n;
+
+	for (i = 0; i < dev->descriptor.bNumConfigurations; i++) {
+		if (dev->config[i].desc.bConfigurationValue == configuration) {
+			cp = &dev->config[i];
+			break;
+		}
+	}
+	if (!cp && configuration != 0)
+		return -EINVAL;
+
+	/* the old configuration as it is, which may be @cp in other
+	 * altsettings; the new one as it starts out */
+	old_n = usb_config_endpoints(dev->actconfig, old_eps, 0);
+	new_n = usb_config_endpoints(cp, new_eps, 1);
+	if (old_n < 0 || new_n < 0)
+		return -EINVAL;
+	ret = usb_hcd_check_bandwidth(dev, old_eps, old_n, new_eps, new_n);
+	if (ret)
+		return ret;
+
+	usb_unbind_interfaces(dev);
+	if (dev->actconfig) {
+		for (i = 0; i < dev->actconfig->desc.bNumInterfaces; i++) {
+			intf = dev->actconfig->interface[i];
+			if (intf)
+				usb_disable_interface(dev,
+						intf->cur_altsetting);
+		}
+	}
+	dev->actconfig = RT_NULL;
+
+	/* every interface starts out in altsetting 0 */
+	if (cp) {
+		for (i = 0; i < cp->desc.bNumInterfaces; i++) {
+			intf = cp->interface[i];
+			if (intf)
+				intf->cur_altsetting =
+					usb_first_altsetting(intf);
+		}
+	}
+
+	ret = usb_control_msg(dev, usb_sndctrlpipe(dev, 0),
+			USB_REQ_SET_CONFIGURATION, 0, configuration, 0,
+			RT_NULL, 0, USB_CTRL_SET_TIMEOUT);
+	if (ret < 0) {
+		usb_hcd_check_bandwidth(dev, new_eps, new_n, RT_NULL, 0);
+		dev->state = USB_STATE_ADDRESS;
+		return ret;
+	}
+
+	if (!cp) {
+		dev->state = USB_STATE_ADDRESS;
+		return 0;
+	}
+	dev->actconfig = cp;
+	dev->state = USB_STATE_CONFIGURED;
+	for (i = 0; i < cp->desc.bNumInterfaces; i++) {
+		intf = cp->interface[i];
+		if (intf)
+			usb_enable_interface(dev, intf->cur_altsetting);
+	}
+	return 0;
+}
+
+/**
+ * usb_set_interface - Makes a particular alternate setting be current
+ * @dev: the device whose interface is being updated
+ * @ifnum: the interface being updated
+ * @alternate: the setting being chosen.
+ *
+ * Return: Zero on success, or else the status code returned by the
+ * underlying usb_control_msg() call.
+ */
+int usb_set_interface(struct usb_device *dev, int ifnum, int alternate)
+{
+	struct usb_interface *iface;
+	struct usb_host_interface *alt;
+	struct usb_host_endpoint *old_eps[USB_MAXENDPOINTS];
+	struct usb_host_endpoint *new_eps[USB_MAXENDPOINTS];
+	int ret, old_n, new_n;
+
+	if (dev->state == USB_STATE_SUSPENDED) {
+		ret = usb_autoresume_device(dev);
+		if (ret < 0)
+			return ret;
+	}
+
+	iface = usb_ifnum_to_if(dev, ifnum);
+	if (!iface)
+		return -EINVAL;
+	alt = usb_altnum_to_altsetting(iface, alternate);
+	if (!alt)
+		return -EINVAL;
+
+	old_n = usb_alt_endpoints(iface->cur_altsetting, old_eps, 0);
+	new_n = usb_alt_endpoints(alt, new_eps, 0);
+	if (old_n < 0 || new_n < 0)
+		return -EINVAL;
+	ret = usb_hcd_check_bandwidth(dev, old_eps, old_n, new_eps, new_n);
+	if (ret < 0)
+		return ret;
+
+	if (dev->quirks & USB_QUIRK_NO_SET_INTF)
+		ret = 0;
+	else
+		ret = usb_control_msg(dev, usb_sndctrlpipe(dev, 0),
+				USB_REQ_SET_INTERFACE, USB_REQ_TYPE_INTERFACE,
+				alternate, ifnum, RT_NULL, 0,
+				USB_CTRL_SET_TIMEOUT);
+
+	/* 9.4.10 says devices don't need this and are free to STALL the
+	 * request if the interface only has one alternate setting.
+	 */
+	if (ret == -EPIPE && iface->num_altsetting == 1)
+		ret = 0;
+	if (ret < 0) {
+		/* the device stays in the old altsetting; if a reservation
+		 * since took its slots, it runs unscheduled */
+		if (usb_hcd_check_bandwidth(dev, new_eps, new_n,
+				old_eps, old_n)) {
+			rt_kprintf("usb %d-%d: interface %d lost its periodic "
+					"bandwidth\n", dev->bus->busnum,
+					dev->devnum, ifnum);
+			rt_atomic_add(&dev->bus->bandwidth_lost, 1);
+		}
+		return ret;
+	}
+
+	usb_disable_interface(dev, iface->cur_altsetting);
+	iface->cur_altsetting = alt;
+	usb_enable_interface(dev, alt);
+	return 0;
+}
@@ -0,0 +1,468 @@
+#include "hcd.h"
+#include "hub.h"
+
+/*
+ * Runtime power management.
+ *
+ * Activity is what the submit path counts anyway: udev->urbnum grows
+ * with every urb submitted, and pm.active counts the urbs in flight
+ * except the interrupt IN ones waiting for the device to speak.
+ * The idle timer of a device looks at both every autosuspend delay; if
+ * nothing was submitted since its last look and nothing is in flight,
+ * the device is queued for the hub thread, which suspends its port.
+ *
+ * Suspending sets the device state before it checks urbnum again, and
+ * usb_hcd_submit_urb() counts the urb before it looks at the state, so
+ * a racing submission either stops the suspend or resumes the device.
+ * Remote wakeup is enabled once, when the device is started, so
+ * suspending sends the device nothing.
+ *
+ * Resume latency is measured from the moment a submission found the
+ * device suspended until the device took urbs again.
+ */
+
+#ifdef CONFIG_USB_PM
+
+#ifdef RT_USING_FINSH
+#include <finsh.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define usb_pm_barrier()	__sync_synchronize()
+#else
+#define usb_pm_barrier()	rt_hw_dmb()
+#endif
+
+#define USB_CONFIG_ATT_WAKEUP	0x20	/* bmAttributes */
+
+#define USB_PM_REQ_SUSPEND	1
+#define USB_PM_REQ_RESUME	2
+
+static rt_list_t usb_pm_devices = RT_LIST_OBJECT_INIT(usb_pm_devices);
+static struct rt_mutex usb_pm_lock;	/* guards usb_pm_devices */
+static rt_bool_t usb_pm_lock_ready;
+static atomic_t usb_pm_pending;		/* some device has a request */
+
+/* for usb_pm_timer_sync(), under usb_pm_lock */
+static struct rt_timer usb_pm_sync_timer;
+static struct rt_completion usb_pm_sync_done;
+
+static void usb_pm_sync_timeout(void *parameter)
+{
+	rt_completion_done(&usb_pm_sync_done);
+}
+
+static void usb_pm_lock_take(void)
+{
+	rt_enter_critical();
+	if (!usb_pm_lock_ready) {
+		rt_mutex_init(&usb_pm_lock, "usbpm", RT_IPC_FLAG_PRIO);
+		rt_timer_init(&usb_pm_sync_timer, "usbpmsync",
+				usb_pm_sync_timeout, RT_NULL, 1,
+				RT_TIMER_FLAG_ONE_SHOT |
+				RT_TIMER_FLAG_SOFT_TIMER);
+		usb_pm_lock_ready = RT_TRUE;
+	}
+	rt_exit_critical();
+	rt_mutex_take(&usb_pm_lock, RT_WAITING_FOREVER);
+}
+
+/*
+ * Wait for the idle timer callback that may be running.  Soft timers
+ * run one after the other in the timer thread, so once a timer started
+ * now has run, so has every callback that was running before.  Called
+ * with usb_pm_lock held.
+ */
+static void usb_pm_timer_sync(void)
+{
+	rt_completion_init(&usb_pm_sync_done);
+	rt_timer_start(&usb_pm_sync_timer);
+	rt_completion_wait(&usb_pm_sync_done, RT_WAITING_FOREVER);
+}
+
+/* hand @req to the hub thread; safe from interrupt context */
+static void usb_pm_queue(struct usb_device *udev, int req)
+{
+	rt_atomic_store(&udev->pm.request, req);
+	rt_atomic_store(&usb_pm_pending, 1);
+	usb_hub_kick();
+}
+
+/* look again in one autosuspend delay */
+static void usb_pm_rearm(struct usb_device *udev)
+{
+	rt_tick_t ticks;
+
+	if (!udev->pm.allowed || udev->pm.delay < 0)
+		return;
+	ticks = rt_tick_from_millisecond(udev->pm.delay);
+	if (!ticks)
+		ticks = 1;
+	udev->pm.last_urbnum = (rt_uint32_t)rt_atomic_load(&udev->urbnum);
+	rt_timer_control(&udev->pm.timer, RT_TIMER_CTRL_SET_TIME, &ticks);
+	rt_timer_start(&udev->pm.timer);
+}
+
+static void usb_pm_timeout(void *parameter)
+{
+	struct usb_device *udev = parameter;
+	rt_uint32_t n = (rt_uint32_t)rt_atomic_load(&udev->urbnum);
+
+	if (!udev->pm.allowed)
+		return;		/* see usb_pm_release_dev() */
+	if (n == udev->pm.last_urbnum &&
+			!rt_atomic_load(&udev->pm.active) &&
+			!rt_atomic_load(&udev->pm.usage)) {
+		usb_pm_queue(udev, USB_PM_REQ_SUSPEND);
+		return;
+	}
+	udev->pm.last_urbnum = n;
+	rt_timer_start(&udev->pm.timer);
+}
+
+/* called with pm.lock held */
+static int usb_pm_suspend(struct usb_device *udev)
+{
+	int ret;
+
+	if (udev->state != USB_STATE_CONFIGURED || !udev->pm.allowed ||
+			udev->pm.delay < 0)
+		return -EBUSY;
+
+	udev->state = USB_STATE_SUSPENDED;
+	usb_pm_barrier();
+	if ((rt_uint32_t)rt_atomic_load(&udev->urbnum) !=
+				udev->pm.last_urbnum ||
+			rt_atomic_load(&udev->pm.active) ||
+			rt_atomic_load(&udev->pm.usage)) {
+		udev->state = USB_STATE_CONFIGURED;
+		return -EBUSY;
+	}
+
+	ret = usb_hub_port_suspend(udev);
+	if (ret < 0) {
+		udev->state = USB_STATE_CONFIGURED;
+		return ret;
+	}
+	udev->pm.stats.suspends++;
+	return 0;
+}
+
+/* called with pm.lock held; @remote if the port already resumed */
+static int usb_pm_resume(struct usb_device *udev, int remote)
+{
+	int ret;
+
+	if (!remote) {
+		ret = usb_hub_port_resume(udev);
+		if (ret < 0)
+			return ret;
+	}
+	rt_thread_mdelay(USB_RESUME_RECOVERY);
+
+	udev->state = USB_STATE_CONFIGURED;
+	usb_pm_rearm(udev);
+	return 0;
+}
+
+/**
+ * usb_pm_init_dev - set up runtime pm for a new device
+ * @udev: the device, just allocated
+ *
+ * The device is not suspended until usb_pm_start() allows it.
+ */
+void usb_pm_init_dev(struct usb_device *udev)
+{
+	struct usb_dev_pm *pm = &udev->pm;
+
+	rt_mutex_init(&pm->lock, "usbpm", RT_IPC_FLAG_PRIO);
+	rt_timer_init(&pm->timer, "usbpm", usb_pm_timeout, udev, 1,
+			RT_TIMER_FLAG_ONE_SHOT | RT_TIMER_FLAG_SOFT_TIMER);
+	pm->delay = USB_AUTOSUSPEND_DELAY;
+
+	usb_pm_lock_take();
+	rt_list_insert_before(&usb_pm_devices, &pm->node);
+	rt_mutex_release(&usb_pm_lock);
+}
+
+/**
+ * usb_pm_release_dev - undo usb_pm_init_dev()
+ * @udev: the device, about to be freed
+ *
+ * Stops the idle timer and waits for its callback, which may have
+ * started it again before it saw the device go.
+ *
+ * Context: thread context, sleeps.
+ */
+void usb_pm_release_dev(struct usb_device *udev)
+{
+	struct usb_dev_pm *pm = &udev->pm;
+
+	rt_mutex_take(&pm->lock, RT_WAITING_FOREVER);
+	pm->allowed = 0;
+	rt_mutex_release(&pm->lock);
+
+	usb_pm_lock_take();
+	rt_list_remove(&pm->node);
+	/* a callback that still saw it allowed may start the timer again,
+	 * one that fires after that sees it is not */
+	rt_timer_stop(&pm->timer);
+	usb_pm_timer_sync();
+	rt_timer_stop(&pm->timer);
+	usb_pm_timer_sync();
+	rt_mutex_release(&usb_pm_lock);
+	rt_timer_detach(&pm->timer);
+	rt_mutex_detach(&pm->lock);
+}
+
+/**
+ * usb_pm_start - let a configured device autosuspend
+ * @udev: the device, with its drivers bound
+ *
+ * Hubs stay awake for their children, and devices that lose their
+ * state over a suspend (USB_QUIRK_RESET_RESUME) are not suspended at
+ * all.  A device whose configuration can wake the host is allowed to.
+ *
+ * Context: thread context, sleeps.
+ */
+void usb_pm_start(struct usb_device *udev)
+{
+	struct usb_host_config *c = udev->actconfig;
+	int ret;
+
+	if (!udev->parent || udev->maxchild || !c ||
+			(udev->quirks & USB_QUIRK_RESET_RESUME))
+		return;
+
+	rt_mutex_take(&udev->pm.lock, RT_WAITING_FOREVER);
+	udev->pm.remote_wakeup = 0;
+	if (c->desc.bmAttributes & USB_CONFIG_ATT_WAKEUP) {
+		ret = usb_control_msg(udev, usb_sndctrlpipe(udev, 0),
+				USB_REQ_SET_FEATURE, USB_REQ_TYPE_DEVICE,
+				USB_FEATURE_DEV_REMOTE_WAKEUP, 0, RT_NULL, 0,
+				USB_CTRL_SET_TIMEOUT);
+		udev->pm.remote_wakeup = ret == 0;
+	}
+	udev->pm.allowed = 1;
+	usb_pm_rearm(udev);
+	rt_mutex_release(&udev->pm.lock);
+}
+
+/**
+ * usb_autoresume_device - wake up a suspended device
+ * @udev: the device
+ *
+ * Called by the submit path for an urb to a suspended device.  Where
+ * the caller can't wait for the hub, in interrupt context or in a
+ * completion handler, the resume is left to the hub thread.
+ *
+ * Return: 0 once the device takes urbs, -EHOSTUNREACH if it is still
+ * being resumed, or another negative error number.
+ */
+int usb_autoresume_device(struct usb_device *udev)
+{
+	struct usb_pm_stats *st = &udev->pm.stats;
+	rt_uint32_t start, lat;
+	int ret;
+
+	if (!usb_hcd_can_sleep(bus_to_hcd(udev->bus))) {
+		usb_pm_queue(udev, USB_PM_REQ_RESUME);
+		return -EHOSTUNREACH;
+	}
+
+	start = usb_trace_clock();
+	rt_mutex_take(&udev->pm.lock, RT_WAITING_FOREVER);
+	if (udev->state == USB_STATE_SUSPENDED) {
+		ret = usb_pm_resume(udev, 0);
+		if (!ret) {
+			lat = usb_trace_clock() - start;
+			st->resumes++;
+			st->lat_last = lat;
+			st->lat_sum += lat;
+			if (lat > st->lat_max)
+				st->lat_max = lat;
+		}
+	} else {
+		ret = udev->state == USB_STATE_NOTATTACHED ? -ENODEV : 0;
+	}
+	rt_mutex_release(&udev->pm.lock);
+	return ret;
+}
+
+/**
+ * usb_pm_remote_wakeup - a suspended device resumed itself
+ * @udev: the device, whose port is no longer suspended
+ *
+ * Context: the hub thread, which saw the port's suspend change.
+ */
+void usb_pm_remote_wakeup(struct usb_device *udev)
+{
+	rt_mutex_take(&udev->pm.lock, RT_WAITING_FOREVER);
+	if (udev->state == USB_STATE_SUSPENDED &&
+			!usb_pm_resume(udev, 1))
+		udev->pm.stats.wakeups++;
+	rt_mutex_release(&udev->pm.lock);
+}
+
+/**
+ * usb_pm_work - carry out the queued suspend and resume requests
+ *
+ * Context: the hub thread.
+ */
+void usb_pm_work(void)
+{
+	struct usb_device *udev;
+	int req;
+
+	if (!rt_atomic_exchange(&usb_pm_pending, 0))
+		return;
+
+	usb_pm_lock_take();
+	rt_list_for_each_entry(udev, &usb_pm_devices, pm.node) {
+		req = (int)rt_atomic_exchange(&udev->pm.request, 0);
+		if (req == USB_PM_REQ_SUSPEND) {
+			rt_mutex_take(&udev->pm.lock, RT_WAITING_FOREVER);
+			if (usb_pm_suspend(udev) < 0 &&
+					udev->state == USB_STATE_CONFIGURED)
+				usb_pm_rearm(udev);
+			rt_mutex_release(&udev->pm.lock);
+		} else if (req == USB_PM_REQ_RESUME) {
+			usb_autoresume_device(udev);
+		}
+	}
+	rt_mutex_release(&usb_pm_lock);
+}
+
+/**
+ * usb_autopm_get - keep a device awake
+ * @udev: the device
+ *
+ * Resumes @udev if it is suspended.  It is not suspended again before
+ * a matching usb_autopm_put().
+ *
+ * Context: thread context, sleeps.
+ *
+ * Return: 0, or the error of the resume; no reference is held then.
+ */
+int usb_autopm_get(struct usb_device *udev)
+{
+	int ret = 0;
+
+	rt_atomic_add(&udev->pm.usage, 1);
+	if (udev->state == USB_STATE_SUSPENDED)
+		ret = usb_autoresume_device(udev);
+	if (ret)
+		rt_atomic_sub(&udev->pm.usage, 1);
+	return ret;
+}
+
+/**
+ * usb_autopm_put - drop a usb_autopm_get() reference
+ * @udev: the device
+ */
+void usb_autopm_put(struct usb_device *udev)
+{
+	rt_atomic_sub(&udev->pm.usage, 1);
+}
+
+/**
+ * usb_pm_set_autosuspend - change a device's autosuspend delay
+ * @udev: the device
+ * @delay: idle time before it is suspended in ms, negative for never
+ *
+ * A suspended device is resumed if it may no longer be suspended.
+ *
+ * Context: thread context, sleeps.
+ */
+void usb_pm_set_autosuspend(struct usb_device *udev, int delay)
+{
+	rt_mutex_take(&udev->pm.lock, RT_WAITING_FOREVER);
+	udev->pm.delay = delay;
+	if (delay < 0) {
+		rt_timer_stop(&udev->pm.timer);
+		if (udev->state == USB_STATE_SUSPENDED)
+			usb_pm_resume(udev, 0);
+	} else if (udev->state != USB_STATE_SUSPENDED) {
+		usb_pm_rearm(udev);
+	}
+	rt_mutex_release(&udev->pm.lock);
+}
+
+/**
+ * usb_pm_get_stats - copy a device's suspend and resume counters
+ * @udev: the device
+ * @stats: filled in
+ */
+void usb_pm_get_stats(struct usb_device *udev, struct usb_pm_stats *stats)
+{
+	rt_mutex_take(&udev->pm.lock, RT_WAITING_FOREVER);
+	*stats = udev->pm.stats;
+	rt_mutex_release(&udev->pm.lock);
+}
+
+#ifdef RT_USING_FINSH
+
+static void usb_pm_show(void)
+{
+	struct usb_device *udev;
+	struct usb_pm_stats st;
+
+	rt_kprintf("bus dev  state  delay  susp resume  wake "
+			"lat last/avg/max us\n");
+	usb_pm_lock_take();
+	rt_list_for_each_entry(udev, &usb_pm_devices, pm.node) {
+		if (!udev->pm.allowed)
+			continue;
+		usb_pm_get_stats(udev, &st);
+		rt_kprintf("%3d %3d  %-6s %5d %5u %6u %5u %u/%u/%u\n",
+				udev->bus->busnum, udev->devnum,
+				udev->state == USB_STATE_SUSPENDED ?
+					"susp" : "active",
+				udev->pm.delay, st.suspends, st.resumes,
+				st.wakeups, st.lat_last,
+				st.resumes ? (rt_uint32_t)(st.lat_sum /
+						st.resumes) : 0,
+				st.lat_max);
+	}
+	rt_mutex_release(&usb_pm_lock);
+}
+
+static int usb_pm_set_delay(int busnum, int devnum, int delay)
+{
+	struct usb_device *udev;
+	int ret = -ENODEV;
+
+	usb_pm_lock_take();
+	rt_list_for_each_entry(udev, &usb_pm_devices, pm.node) {
+		if (udev->bus->busnum == busnum && udev->devnum == devnum) {
+			usb_pm_set_autosuspend(udev, delay);
+			ret = 0;
+			break;
+		}
+	}
+	rt_mutex_release(&usb_pm_lock);
+	return ret;
+}
+
+static int usb_pm(int argc, char **argv)
+{
+	if (argc < 2 || !rt_strcmp(argv[1], "stats")) {
+		usb_pm_show();
+	} else if (!rt_strcmp(argv[1], "delay") && argc > 4) {
+		if (usb_pm_set_delay(atoi(argv[2]), atoi(argv[3]),
+				atoi(argv[4]))) {
+			rt_kprintf("usb_pm: no device %s-%s\n",
+					argv[2], argv[3]);
+			return -ENODEV;
+		}
+	} else {
+		rt_kprintf("usage: usb_pm [stats|delay <bus> <dev> <ms>]\n");
+		return -EINVAL;
+	}
+	return 0;
+}
+MSH_CMD_EXPORT(usb_pm, usb runtime suspend state and resume latency);
+
+#endif /* RT_USING_FINSH */
+
+#endif /* CONFIG_USB_PM */
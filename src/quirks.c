@@ -0,0 +1,126 @@
+#include "hcd.h"
+
+/*
+ * Device quirks.
+ *
+ * Both tables are sorted by id, vendor and product packed in one word,
+ * so a lookup is a binary search of word compares followed by a look
+ * at the bcdDevice ranges of the entries with that id.  The built-in
+ * table is kept sorted by hand; one from the application is checked
+ * when it is set, and its quirks add to the built-in ones.
+ */
+
+static const struct usb_quirk_entry usb_quirk_table[] = {
+	/* HP 5300/5370C scanner */
+	USB_QUIRK_DEVICE(0x03f0, 0x0701, USB_QUIRK_NO_STRINGS),
+
+	/* Logitech HD Pro Webcams C920 and C930e */
+	USB_QUIRK_DEVICE(0x046d, 0x082d, USB_QUIRK_DELAY_SET_ADDRESS),
+	USB_QUIRK_DEVICE(0x046d, 0x0843, USB_QUIRK_DELAY_SET_ADDRESS),
+
+	/* Logitech Quickcam Pro 9000 */
+	USB_QUIRK_DEVICE(0x046d, 0x0990, USB_QUIRK_RESET_RESUME),
+
+	/* Samsung Android phone modem */
+	USB_QUIRK_DEVICE(0x04e8, 0x6601, USB_QUIRK_NO_STRINGS),
+
+	/* Action Semiconductor flash disk */
+	USB_QUIRK_DEVICE(0x10d6, 0x2200, USB_QUIRK_NO_SET_INTF),
+
+	/* Hauppauge HVR-950q */
+	USB_QUIRK_DEVICE(0x2040, 0x7200, USB_QUIRK_NO_STRINGS),
+};
+
+/* both under the interrupt lock, a lookup must not see half a change */
+static const struct usb_quirk_entry *usb_quirk_app_table;
+static int usb_quirk_app_count;
+
+static rt_uint32_t usb_quirks_search(const struct usb_quirk_entry *table,
+		int count, rt_uint32_t id, rt_uint16_t bcd)
+{
+	rt_uint32_t quirks = 0;
+	int lo = 0, hi = count, mid;
+
+	/* the first entry with an id >= @id */
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (table[mid].id < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (; lo < count && table[lo].id == id; lo++)
+		if (bcd >= table[lo].bcd_lo && bcd <= table[lo].bcd_hi)
+			quirks |= table[lo].quirks;
+	return quirks;
+}
+
+/**
+ * usb_quirks_lookup - find the quirks of a device model
+ * @vendor: idVendor
+ * @product: idProduct
+ * @bcd: bcdDevice
+ *
+ * Return: the USB_QUIRK_* flags of every matching entry of both tables.
+ */
+rt_uint32_t usb_quirks_lookup(rt_uint16_t vendor, rt_uint16_t product,
+		rt_uint16_t bcd)
+{
+	rt_uint32_t id = (rt_uint32_t)vendor << 16 | product;
+	const struct usb_quirk_entry *table;
+	rt_base_t level;
+	int count;
+
+	level = rt_hw_interrupt_disable();
+	table = usb_quirk_app_table;
+	count = usb_quirk_app_count;
+	rt_hw_interrupt_enable(level);
+
+	return usb_quirks_search(usb_quirk_table,
+			sizeof(usb_quirk_table) / sizeof(usb_quirk_table[0]),
+			id, bcd) |
+		usb_quirks_search(table, count, id, bcd);
+}
+
+/**
+ * usb_detect_quirks - set a new device's quirks
+ * @udev: device being enumerated
+ * @desc: its device descriptor, as far as idProduct at least
+ *
+ * The hub calls this as soon as it has seen the descriptor, which may
+ * be before SET_ADDRESS, and again once it has read all of it; what
+ * the quirks change happens from then on.
+ */
+void usb_detect_quirks(struct usb_device *udev,
+		const struct usb_device_descriptor *desc)
+{
+	udev->quirks = usb_quirks_lookup(desc->idVendor, desc->idProduct,
+			desc->bcdDevice);
+}
+
+/**
+ * usb_quirks_set_table - add the application's quirks
+ * @table: entries sorted by id, then anything; must stay valid
+ * @count: number of entries, 0 to drop the table again
+ *
+ * Devices enumerated from now on are looked up in @table as well.  A
+ * lookup already running may still search the previous table, so that
+ * one must stay valid too.
+ *
+ * Return: 0, or -EINVAL if @table is not sorted.
+ */
+int usb_quirks_set_table(const struct usb_quirk_entry *table, int count)
+{
+	rt_base_t level;
+	int i;
+
+	for (i = 1; i < count; i++)
+		if (table[i - 1].id > table[i].id)
+			return -EINVAL;
+
+	level = rt_hw_interrupt_disable();
+	usb_quirk_app_table = count ? table : RT_NULL;
+	usb_quirk_app_count = count;
+	rt_hw_interrupt_enable(level);
+	return 0;
+}
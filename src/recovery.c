@@ -0,0 +1,503 @@
+#include "hcd.h"
+#include "hub.h"
+
+/*
+ * Error recovery.
+ *
+ * A driver whose transfers fail with what looks like a line error asks
+ * for its device to be recovered, and the hub thread tries the cheapest
+ * cure first:
+ *
+ *  1. clear the endpoint's halt and reset both data toggles;
+ *  2. reset the port and put the device back as it was: same address,
+ *     configuration and altsettings, descriptors read again and
+ *     compared, drivers left bound (usb_reset_device());
+ *  3. disconnect the device and enumerate its port again.
+ *
+ * A recovery asked for without a level starts at 1, or one above the
+ * last one if that finished less than USB_RECOVER_WINDOW ago and so
+ * didn't help, and goes up a level whenever one fails.
+ *
+ * While a recovery is queued or running, bulk and interrupt urbs of the
+ * device that fail before moving any data are parked instead of given
+ * back, and new ones are parked instead of queued.  Once the recovery
+ * succeeded the hub thread puts them on their rings in order; the driver
+ * never sees them fail.  Meanwhile urbs are still held but failures are
+ * no longer parked, so a device that keeps failing can't keep the hub
+ * thread busy, and the hub thread is the only one to fill the rings.
+ * Control and isochronous urbs, and urbs that moved some data, are
+ * given back as usual.  An urb that is unlinked while parked is given
+ * back when the recovery ends.
+ */
+
+#ifdef RT_USING_FINSH
+#include <finsh.h>
+#endif
+
+/* recover.active */
+#define RECOVER_IDLE		0
+#define RECOVER_QUEUED		1	/* or running */
+#define RECOVER_REQUEUE		2	/* parked urbs going back */
+
+/* a usb_recover() caller, on its stack */
+struct usb_recover_waiter {
+	rt_list_t node;
+	struct rt_semaphore done;
+	int result;
+};
+
+static rt_list_t usb_recover_list = RT_LIST_OBJECT_INIT(usb_recover_list);
+static struct usb_recover_stats usb_recover_stats;
+
+/**
+ * usb_recover_init - set up a new device's recovery state
+ * @udev: the device, just allocated
+ */
+void usb_recover_init(struct usb_device *udev)
+{
+	struct usb_recovery *rec = &udev->recover;
+
+	rt_list_init(&rec->node);
+	rt_list_init(&rec->parked);
+	rt_list_init(&rec->waiters);
+}
+
+/* called with interrupts off; RT_TRUE if the hub thread needs a kick */
+static rt_bool_t usb_recover_queue_locked(struct usb_device *udev,
+		unsigned int pipe, int level)
+{
+	struct usb_recovery *rec = &udev->recover;
+
+	if (rec->active) {
+		/* one recovery for every error of a burst */
+		if (level > rec->level)
+			rec->level = level;
+		if (!rec->pipe)
+			rec->pipe = pipe;
+		/* too late for the one that is ending, do another */
+		if (rec->active == RECOVER_REQUEUE)
+			rec->again = 1;
+		return RT_FALSE;
+	}
+	rec->active = RECOVER_QUEUED;
+	rec->level = level;
+	rec->pipe = pipe;
+	rt_list_insert_before(&usb_recover_list, &rec->node);
+	return RT_TRUE;
+}
+
+/**
+ * usb_queue_recovery - have the hub thread recover a device
+ * @udev: the device
+ * @pipe: the endpoint that failed, or 0
+ * @level: USB_RECOVER_* to start at, or 0 to escalate
+ *
+ * Safe from interrupt context and completion handlers.  Requests made
+ * while one is queued are merged into it.
+ */
+void usb_queue_recovery(struct usb_device *udev, unsigned int pipe,
+		int level)
+{
+	rt_bool_t kick = RT_FALSE;
+	rt_base_t irq;
+
+	irq = rt_hw_interrupt_disable();
+	if (udev->state != USB_STATE_NOTATTACHED)
+		kick = usb_recover_queue_locked(udev, pipe, level);
+	rt_hw_interrupt_enable(irq);
+
+	if (kick)
+		usb_hub_kick();
+}
+
+/**
+ * usb_recover - recover a device and wait for the result
+ * @udev: the device
+ * @pipe: the endpoint that failed, or 0
+ * @level: USB_RECOVER_* to start at, or 0 to escalate
+ *
+ * Where the caller can't wait for the hub thread, in interrupt context,
+ * in a completion handler or on the hub thread itself, the recovery is
+ * only queued.
+ *
+ * Return: 0 once the device works again, -ENODEV if it was disconnected
+ * (a re-enumeration replaces it), -EINPROGRESS if the recovery was only
+ * queued, or another negative error number.
+ */
+int usb_recover(struct usb_device *udev, unsigned int pipe, int level)
+{
+	struct usb_recover_waiter w;
+	rt_bool_t kick;
+	rt_base_t irq;
+	rt_err_t err;
+
+	if (!usb_hcd_can_sleep(bus_to_hcd(udev->bus)) ||
+			usb_hub_thread_self()) {
+		usb_queue_recovery(udev, pipe, level);
+		return -EINPROGRESS;
+	}
+
+	rt_sem_init(&w.done, "usbrec", 0, RT_IPC_FLAG_FIFO);
+	w.result = -ETIMEDOUT;
+
+	/* the waiter list is for threads only; the scheduler lock keeps
+	 * the hub thread from releasing @w halfway */
+	rt_enter_critical();
+	irq = rt_hw_interrupt_disable();
+	if (udev->state == USB_STATE_NOTATTACHED) {
+		rt_hw_interrupt_enable(irq);
+		rt_exit_critical();
+		rt_sem_detach(&w.done);
+		return -ENODEV;
+	}
+	rt_list_insert_before(&udev->recover.waiters, &w.node);
+	kick = usb_recover_queue_locked(udev, pipe, level);
+	rt_hw_interrupt_enable(irq);
+	rt_exit_critical();
+
+	if (kick)
+		usb_hub_kick();
+
+	err = rt_sem_take(&w.done,
+			rt_tick_from_millisecond(USB_RECOVER_TIMEOUT));
+	if (err != RT_EOK) {
+		/* still linked means the device is still there */
+		rt_enter_critical();
+		if (!rt_list_isempty(&w.node))
+			rt_list_remove(&w.node);
+		rt_exit_critical();
+	}
+	rt_sem_detach(&w.done);
+	return w.result;
+}
+
+static void usb_recover_wake(struct usb_recovery *rec, int result)
+{
+	struct usb_recover_waiter *w;
+
+	rt_enter_critical();
+	while (!rt_list_isempty(&rec->waiters)) {
+		w = rt_list_first_entry(&rec->waiters,
+				struct usb_recover_waiter, node);
+		rt_list_remove(&w->node);
+		w->result = result;
+		rt_sem_release(&w->done);
+	}
+	rt_exit_critical();
+}
+
+/* park @urb, a new one or with @failed one that can be redone */
+static int usb_recover_hold(struct urb *urb, int failed)
+{
+	struct usb_device *udev = urb->dev;
+	struct usb_recovery *rec = &udev->recover;
+	rt_base_t irq;
+
+	if (!udev->parent || urb->unlinked || rt_atomic_load(&urb->reject) ||
+			usb_pipecontrol(urb->pipe) || usb_pipeisoc(urb->pipe))
+		return 0;
+
+	irq = rt_hw_interrupt_disable();
+	if ((failed ? rec->active != RECOVER_QUEUED : !rec->active) ||
+			udev->state == USB_STATE_NOTATTACHED) {
+		rt_hw_interrupt_enable(irq);
+		return 0;
+	}
+	rt_list_insert_before(&rec->parked, &urb->urb_list);
+	rt_hw_interrupt_enable(irq);
+	return 1;
+}
+
+/**
+ * usb_recover_submit - hold back an urb while its device is recovered
+ * @urb: urb being submitted, device->recover.active found set
+ *
+ * Return: 1 if @urb was parked and is submitted later, else 0.
+ */
+int usb_recover_submit(struct urb *urb)
+{
+	return usb_recover_hold(urb, 0);
+}
+
+/**
+ * usb_recover_park - hold back a failed urb for its device's recovery
+ * @urb: urb about to be given back with a non-zero status
+ *
+ * Called from the giveback path, possibly in interrupt context.
+ *
+ * Return: 1 if @urb was parked and must not be given back now, else 0.
+ */
+int usb_recover_park(struct urb *urb)
+{
+	if (urb->dev->recover.active != RECOVER_QUEUED || urb->actual_length)
+		return 0;
+
+	switch (urb->status) {
+	case -EPIPE:		/* stall */
+	case -EPROTO:		/* bitstuff, crc or no response */
+	case -EILSEQ:		/* toggle mismatch */
+	case -ETIMEDOUT:
+	case -ENODEV:		/* port disabled under us */
+		break;
+	default:
+		return 0;
+	}
+	return usb_recover_hold(urb, 1);
+}
+
+/*
+ * The recovery is over: requeue or give back the parked urbs, then tell
+ * the waiters.  Submissions are still held until the hub thread is
+ * through, so the rings keep their order.
+ */
+static void usb_recover_finish(struct usb_device *udev, int result)
+{
+	struct usb_recovery *rec = &udev->recover;
+	struct usb_hcd *hcd = bus_to_hcd(udev->bus);
+	rt_bool_t kick = RT_FALSE;
+	struct urb *urb;
+	rt_base_t irq;
+	int status, ret;
+
+	irq = rt_hw_interrupt_disable();
+	rt_list_remove(&rec->node);
+	rec->active = RECOVER_REQUEUE;
+	rt_hw_interrupt_enable(irq);
+
+	/* failures aren't parked any more, and a driver only has so many
+	 * urbs to submit, so the list runs empty */
+	for (;;) {
+		irq = rt_hw_interrupt_disable();
+		if (rt_list_isempty(&rec->parked)) {
+			if (rec->again && !result) {
+				rec->active = RECOVER_QUEUED;
+				rt_list_insert_before(&usb_recover_list,
+						&rec->node);
+				kick = RT_TRUE;
+			} else {
+				rec->active = RECOVER_IDLE;
+			}
+			rec->again = 0;
+			rt_hw_interrupt_enable(irq);
+			break;
+		}
+		urb = rt_list_first_entry(&rec->parked, struct urb, urb_list);
+		rt_list_remove(&urb->urb_list);
+		rt_hw_interrupt_enable(irq);
+
+		status = urb->status;
+		ret = result ? result : usb_hcd_requeue_urb(urb);
+		if (!ret) {
+			if (status != -EINPROGRESS) {
+				irq = rt_hw_interrupt_disable();
+				usb_recover_stats.requeued++;
+				rt_hw_interrupt_enable(irq);
+			}
+			continue;
+		}
+		/* one held before it ever ran fails with the recovery */
+		usb_hcd_giveback_urb(hcd, urb,
+				status == -EINPROGRESS ? ret : status);
+	}
+
+	usb_recover_wake(rec, result);
+	if (kick)
+		usb_hub_kick();
+}
+
+/**
+ * usb_recover_cancel - end a disconnected device's recovery
+ * @udev: the device, already USB_STATE_NOTATTACHED
+ *
+ * Gives back the parked urbs with the status they failed with, or
+ * -ENODEV if they never ran, and wakes the waiters with -ENODEV.
+ * Called by usb_disconnect() before the endpoints are disabled.
+ */
+void usb_recover_cancel(struct usb_device *udev)
+{
+	usb_recover_finish(udev, -ENODEV);
+}
+
+/* level 1: clear the halt, both toggles back to DATA0 */
+static int usb_recover_endpoint(struct usb_device *udev, unsigned int pipe)
+{
+	struct usb_hcd *hcd = bus_to_hcd(udev->bus);
+	struct usb_host_endpoint *ep = udev->ep_table[usb_pipe_epidx(pipe)];
+	int ret;
+
+	/* gone with its altsetting, nothing to clear */
+	if (!ep)
+		return 0;
+
+	ret = usb_clear_halt(udev, pipe);
+	if (ret < 0)
+		return ret;
+	if (hcd->driver->endpoint_reset)
+		hcd->driver->endpoint_reset(hcd, ep);
+	return 0;
+}
+
+static void usb_recover_run(struct usb_device *udev)
+{
+	struct usb_recovery *rec = &udev->recover;
+	unsigned int pipe;
+	rt_uint32_t start;
+	rt_base_t irq;
+	int level, ret;
+
+	irq = rt_hw_interrupt_disable();
+	level = rec->level;
+	pipe = rec->pipe;
+	rec->level = 0;
+	rec->pipe = 0;
+	if (!pipe && !rt_list_isempty(&rec->parked))
+		pipe = rt_list_first_entry(&rec->parked, struct urb,
+				urb_list)->pipe;
+	rt_hw_interrupt_enable(irq);
+
+	if (!level) {
+		level = USB_RECOVER_ENDPOINT;
+		if (rec->last_level && rt_tick_get() - rec->last <
+				rt_tick_from_millisecond(USB_RECOVER_WINDOW))
+			level = rec->last_level + 1;
+	}
+
+	for (; level < USB_RECOVER_REENUMERATE; level++) {
+		if (level == USB_RECOVER_ENDPOINT && !pipe)
+			continue;
+		if (level == USB_RECOVER_RESET && !udev->persist_enabled)
+			continue;
+
+		start = usb_trace_clock();
+		if (level == USB_RECOVER_ENDPOINT)
+			ret = usb_recover_endpoint(udev, pipe);
+		else
+			ret = usb_reset_device(udev);
+		usb_recover_account(level, ret, usb_trace_clock() - start);
+
+		if (!ret) {
+			rec->last_level = level;
+			rec->last = rt_tick_get();
+			usb_recover_finish(udev, 0);
+			return;
+		}
+	}
+
+	/* the last resort; on success @udev is gone, see
+	 * usb_recover_cancel(), and hub.c accounts the time */
+	usb_dbg("usb %d-%d: recovery failed, re-enumerating\n",
+			udev->bus->busnum, udev->devnum);
+	ret = usb_hub_reenumerate(udev);
+	if (ret) {
+		usb_recover_account(USB_RECOVER_REENUMERATE, ret, 0);
+		usb_recover_finish(udev, ret);
+	}
+}
+
+/**
+ * usb_recover_work - carry out the queued recoveries
+ *
+ * Context: the hub thread, with the hub lock held, so no device is
+ * disconnected under it.
+ */
+void usb_recover_work(void)
+{
+	struct usb_recovery *rec;
+	rt_base_t irq;
+
+	for (;;) {
+		irq = rt_hw_interrupt_disable();
+		if (rt_list_isempty(&usb_recover_list)) {
+			rt_hw_interrupt_enable(irq);
+			return;
+		}
+		rec = rt_list_first_entry(&usb_recover_list,
+				struct usb_recovery, node);
+		rt_list_remove(&rec->node);
+		rt_hw_interrupt_enable(irq);
+
+		usb_recover_run(rt_container_of(rec, struct usb_device,
+				recover));
+	}
+}
+
+/**
+ * usb_recover_account - count a recovery attempt
+ * @level: USB_RECOVER_*
+ * @status: 0 if the device works again
+ * @usecs: how long it took, successful attempts only
+ */
+void usb_recover_account(int level, int status, rt_uint32_t usecs)
+{
+	struct usb_recover_stats *st = &usb_recover_stats;
+	rt_base_t irq;
+	int i = level - 1;
+
+	irq = rt_hw_interrupt_disable();
+	if (status) {
+		st->failed[i]++;
+	} else {
+		st->count[i]++;
+		st->time_last[i] = usecs;
+		st->time_sum[i] += usecs;
+		if (usecs > st->time_max[i])
+			st->time_max[i] = usecs;
+	}
+	rt_hw_interrupt_enable(irq);
+}
+
+/**
+ * usb_recover_get_stats - copy the recovery counters of all devices
+ * @stats: filled in
+ */
+void usb_recover_get_stats(struct usb_recover_stats *stats)
+{
+	rt_base_t irq;
+
+	irq = rt_hw_interrupt_disable();
+	*stats = usb_recover_stats;
+	rt_hw_interrupt_enable(irq);
+}
+
+#ifdef RT_USING_FINSH
+
+static const char * const usb_recover_names[USB_RECOVER_LEVELS] = {
+	"endpoint", "reset", "reenum",
+};
+
+static void usb_recover_show(void)
+{
+	struct usb_recover_stats st;
+	int i;
+
+	usb_recover_get_stats(&st);
+	rt_kprintf("level     ok  failed  time last/avg/max us\n");
+	for (i = 0; i < USB_RECOVER_LEVELS; i++)
+		rt_kprintf("%-8s %4u %6u  %u/%u/%u\n", usb_recover_names[i],
+				st.count[i], st.failed[i], st.time_last[i],
+				st.count[i] ? (rt_uint32_t)(st.time_sum[i] /
+						st.count[i]) : 0,
+				st.time_max[i]);
+	rt_kprintf("urbs requeued: %u\n", st.requeued);
+}
+
+static int usb_recover_cmd(int argc, char **argv)
+{
+	rt_base_t irq;
+
+	if (argc < 2 || !rt_strcmp(argv[1], "stats")) {
+		usb_recover_show();
+	} else if (!rt_strcmp(argv[1], "clear")) {
+		irq = rt_hw_interrupt_disable();
+		rt_memset(&usb_recover_stats, 0, sizeof(usb_recover_stats));
+		rt_hw_interrupt_enable(irq);
+	} else {
+		rt_kprintf("usage: usb_recover [stats|clear]\n");
+		return -EINVAL;
+	}
+	return 0;
+}
+MSH_CMD_EXPORT_ALIAS(usb_recover_cmd, usb_recover,
+		usb error recovery counts and times);
+
+#endif /* RT_USING_FINSH */
@@ -0,0 +1,778 @@
+#include "hcd.h"
+#include "usb_storage.h"
+
+/*
+ * USB Mass Storage, Bulk-Only Transport.
+ *
+ * A command is three bulk transfers: the CBW out, the data either way,
+ * and the CSW in.  All three urbs are queued before the first one
+ * completes, so the device never waits for the host between phases.
+ * A phase that fails unlinks the ones behind it; recovery then follows
+ * the BOT spec: clear a stalled endpoint and read the CSW again, or
+ * reset the interface if that doesn't help either.
+ *
+ * Units are accessed through their cache (see usb_storage.h).  Dirty
+ * sectors are written back when their slot is needed, on sync and on
+ * close, always all of them at once, so adjacent ones go out in the
+ * same WRITE(10).  Writers that care about losing data on unplug sync.
+ */
+
+#ifdef CONFIG_USB_STORAGE
+
+/* SCSI commands */
+#define TEST_UNIT_READY		0x00
+#define REQUEST_SENSE		0x03
+#define INQUIRY			0x12
+#define READ_CAPACITY		0x25
+#define READ_10			0x28
+#define WRITE_10		0x2a
+
+/* iobuf: cbw, csw and up to 64 bytes of reply, each on its own */
+#define US_IOBUF_CSW	RT_ALIGN(US_BULK_CB_WRAP_LEN, USB_DMA_ALIGN)
+#define US_IOBUF_DATA	(US_IOBUF_CSW + RT_ALIGN(US_BULK_CS_WRAP_LEN, \
+				USB_DMA_ALIGN))
+#define US_IOBUF_SIZE	(US_IOBUF_DATA + 64)
+
+static rt_uint32_t us_index_map;	/* device name numbers in use */
+
+rt_inline void us_put_be32(uint8_t *p, rt_uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+rt_inline rt_uint32_t us_get_be32(const uint8_t *p)
+{
+	return ((rt_uint32_t)p[0] << 24) | ((rt_uint32_t)p[1] << 16) |
+			((rt_uint32_t)p[2] << 8) | p[3];
+}
+
+/* bits for sectors off .. off + n - 1 of a line */
+rt_inline rt_uint32_t us_mask(rt_uint32_t off, rt_uint32_t n)
+{
+	return (n >= 32 ? 0xffffffff : (1u << n) - 1) << off;
+}
+
+/*-------------------------------------------------------------------------*/
+
+static void us_urb_complete(struct urb *urb)
+{
+	struct us_data *us = urb->context;
+
+	/* a failed phase takes the later ones with it */
+	if (urb->status && urb != us->csw_urb) {
+		us->aborted = 1;
+		if (urb == us->cbw_urb)
+			usb_unlink_urb(us->data_urb);
+		usb_unlink_urb(us->csw_urb);
+	}
+	if (rt_atomic_sub(&us->pending, 1) == 1)
+		rt_completion_done(&us->done);
+}
+
+static void us_fill_urb(struct us_data *us, struct urb *urb,
+		unsigned int pipe, void *buf, dma_addr_t dma, rt_uint32_t len)
+{
+	usb_fill_bulk_urb(urb, us->udev, pipe, buf, len, us_urb_complete, us);
+	urb->transfer_dma = dma;
+	urb->transfer_flags = URB_NO_TRANSFER_DMA_MAP;
+}
+
+/*
+ * Called with us->lock held, which storage_disconnect() takes on the
+ * hub thread, so a port reset is only queued for it; the urbs of the
+ * next command wait for the device to come back, see recovery.c.
+ */
+static void us_reset_recovery(struct us_data *us)
+{
+	int ret;
+
+	ret = usb_control_msg(us->udev, usb_sndctrlpipe(us->udev, 0),
+			US_BULK_RESET_REQUEST,
+			USB_REQ_TYPE_CLASS | USB_REQ_TYPE_INTERFACE, 0,
+			us->intf->cur_altsetting->desc.bInterfaceNumber,
+			RT_NULL, 0, USB_CTRL_SET_TIMEOUT);
+	/* a device that doesn't even take that gets its port reset */
+	if (ret < 0 && ret != -EPIPE) {
+		usb_queue_recovery(us->udev, 0, USB_RECOVER_RESET);
+		return;
+	}
+	usb_clear_halt(us->udev, us->recv_pipe);
+	usb_clear_halt(us->udev, us->send_pipe);
+}
+
+/* the CSW on its own, after its queued urb failed */
+static int us_read_csw(struct us_data *us)
+{
+	int i, ret, actual;
+
+	for (i = 0; i < 2; i++) {
+		ret = usb_bulk_msg(us->udev, us->recv_pipe,
+				us->iobuf + US_IOBUF_CSW, US_BULK_CS_WRAP_LEN,
+				&actual, US_TIMEOUT);
+		if (ret == -EPIPE) {
+			usb_clear_halt(us->udev, us->recv_pipe);
+			continue;
+		}
+		if (ret == 0 && actual != US_BULK_CS_WRAP_LEN)
+			ret = -EPROTO;
+		break;
+	}
+	return ret;
+}
+
+/*
+ * One command through all three phases.  @data must be dma-able at
+ * @dma.  Called with us->lock held.
+ *
+ * Return: 0, -EREMOTEIO if the device failed the command, or another
+ * negative error number if the transport did.
+ */
+static int us_transport(struct us_data *us, int lun, const uint8_t *cdb,
+		int cdb_len, void *data, dma_addr_t dma, rt_uint32_t len, int in)
+{
+	struct bulk_cb_wrap *bcb = (void *)us->iobuf;
+	struct bulk_cs_wrap *bcs = (void *)(us->iobuf + US_IOBUF_CSW);
+	unsigned int data_pipe = in ? us->recv_pipe : us->send_pipe;
+	struct urb *urbs[3];
+	int i, j, n = 0, ret = 0;
+
+	if (us->gone)
+		return -ENODEV;
+
+	bcb->Signature = cpu_to_le32(US_BULK_CB_SIGN);
+	bcb->Tag = cpu_to_le32(++us->tag);
+	bcb->DataTransferLength = cpu_to_le32(len);
+	bcb->Flags = in ? US_BULK_FLAG_IN : 0;
+	bcb->Lun = lun;
+	bcb->Length = cdb_len;
+	rt_memset(bcb->CDB, 0, sizeof(bcb->CDB));
+	rt_memcpy(bcb->CDB, cdb, cdb_len);
+
+	us_fill_urb(us, us->cbw_urb, us->send_pipe, bcb, us->iobuf_dma,
+			US_BULK_CB_WRAP_LEN);
+	urbs[n++] = us->cbw_urb;
+	if (len) {
+		us_fill_urb(us, us->data_urb, data_pipe, data, dma, len);
+		urbs[n++] = us->data_urb;
+	}
+	us_fill_urb(us, us->csw_urb, us->recv_pipe, bcs,
+			us->iobuf_dma + US_IOBUF_CSW, US_BULK_CS_WRAP_LEN);
+	urbs[n++] = us->csw_urb;
+
+	rt_completion_init(&us->done);
+	rt_atomic_store(&us->pending, n);
+	us->aborted = 0;
+	for (i = 0; i < n && !us->aborted; i++) {
+		ret = usb_submit_urb(urbs[i]);
+		if (ret)
+			break;
+	}
+	/* urbs never submitted count as given back */
+	if (i < n && rt_atomic_sub(&us->pending, n - i) == n - i)
+		rt_completion_done(&us->done);
+	if (ret) {
+		for (j = 0; j < i; j++)
+			usb_kill_urb(urbs[j]);
+		return ret;
+	}
+	/* urbs submitted after a phase before them failed; its handler
+	 * could only unlink the ones already queued then */
+	if (us->aborted)
+		for (j = 0; j < i; j++)
+			usb_unlink_urb(urbs[j]);
+
+	if (rt_completion_wait(&us->done,
+			rt_tick_from_millisecond(US_TIMEOUT)) != RT_EOK) {
+		for (j = 0; j < n; j++)
+			usb_kill_urb(urbs[j]);
+		us_reset_recovery(us);
+		return -ETIMEDOUT;
+	}
+
+	if (us->cbw_urb->status) {
+		us_reset_recovery(us);
+		return -EIO;
+	}
+	if (len && us->data_urb->status == -EPIPE)
+		usb_clear_halt(us->udev, data_pipe);
+	if (i < n || us->csw_urb->status ||
+			us->csw_urb->actual_length != US_BULK_CS_WRAP_LEN) {
+		if (i == n && us->csw_urb->status == -EPIPE)
+			usb_clear_halt(us->udev, us->recv_pipe);
+		if (us_read_csw(us)) {
+			us_reset_recovery(us);
+			return -EIO;
+		}
+	}
+
+	if (le32_to_cpu(bcs->Signature) != US_BULK_CS_SIGN ||
+			le32_to_cpu(bcs->Tag) != us->tag ||
+			bcs->Status == US_BULK_STAT_PHASE) {
+		us_reset_recovery(us);
+		return -EIO;
+	}
+	if (bcs->Status != US_BULK_STAT_OK)
+		return -EREMOTEIO;
+	if (len && us->data_urb->status && us->data_urb->status != -EPIPE)
+		return us->data_urb->status;
+	return 0;
+}
+
+/* a failed command leaves sense data that must be fetched */
+static int us_command(struct us_data *us, int lun, const uint8_t *cdb,
+		int cdb_len, void *data, dma_addr_t dma, rt_uint32_t len, int in)
+{
+	uint8_t sense[6] = { REQUEST_SENSE, 0, 0, 0, 18, 0 };
+	int ret;
+
+	ret = us_transport(us, lun, cdb, cdb_len, data, dma, len, in);
+	if (ret == -EREMOTEIO) {
+		us_transport(us, lun, sense, sizeof(sense),
+				us->iobuf + US_IOBUF_DATA,
+				us->iobuf_dma + US_IOBUF_DATA, 18, 1);
+		ret = -EIO;
+	}
+	return ret;
+}
+
+static int us_rw10(struct us_lun *l, int write, rt_uint32_t lba,
+		rt_uint32_t count, uint8_t *buf)
+{
+	uint8_t cdb[10] = { write ? WRITE_10 : READ_10 };
+
+	us_put_be32(cdb + 2, lba);
+	cdb[7] = count >> 8;
+	cdb[8] = count;
+	return us_command(l->us, l->lun, cdb, sizeof(cdb), buf,
+			l->cache_dma + (buf - l->cache),
+			count * l->sector_size, !write);
+}
+
+/*-------------------------------------------------------------------------*/
+
+/*
+ * The cache.  Everything here runs with us->lock held.
+ */
+
+rt_inline uint8_t *us_cache_buf(struct us_lun *l, int slot, rt_uint32_t off)
+{
+	return l->cache + (slot * l->line_sectors + off) * l->sector_size;
+}
+
+static void us_cache_clean(struct us_lun *l, rt_uint32_t lba,
+		rt_uint32_t count)
+{
+	rt_uint32_t line, off, n;
+
+	while (count) {
+		line = lba / l->line_sectors;
+		off = lba % l->line_sectors;
+		n = l->line_sectors - off;
+		if (n > count)
+			n = count;
+		l->lines[line % US_CACHE_LINES].dirty &= ~us_mask(off, n);
+		lba += n;
+		count -= n;
+	}
+}
+
+/* write back every dirty sector, adjacent ones in the same command */
+static int us_cache_flush(struct us_lun *l)
+{
+	rt_uint32_t run_lba = 0, run_n = 0, lba, s;
+	uint8_t *run_buf = RT_NULL, *buf;
+	struct us_cache_line *cl;
+	int i, ret;
+
+	for (i = 0; i < US_CACHE_LINES; i++) {
+		cl = &l->lines[i];
+		for (s = 0; cl->dirty && s < l->line_sectors; s++) {
+			if (!(cl->dirty & (1u << s)))
+				continue;
+			lba = cl->line * l->line_sectors + s;
+			buf = us_cache_buf(l, i, s);
+			if (run_n && lba == run_lba + run_n &&
+					buf == run_buf + run_n * l->sector_size) {
+				run_n++;
+				continue;
+			}
+			if (run_n) {
+				ret = us_rw10(l, 1, run_lba, run_n, run_buf);
+				if (ret)
+					return ret;
+				us_cache_clean(l, run_lba, run_n);
+			}
+			run_lba = lba;
+			run_buf = buf;
+			run_n = 1;
+		}
+	}
+	if (!run_n)
+		return 0;
+	ret = us_rw10(l, 1, run_lba, run_n, run_buf);
+	if (!ret)
+		us_cache_clean(l, run_lba, run_n);
+	return ret;
+}
+
+/* read disk lines first .. first + n - 1 into their slots, clean */
+static int us_cache_fill(struct us_lun *l, rt_uint32_t first, int n)
+{
+	rt_uint32_t lba = first * l->line_sectors;
+	rt_uint32_t count = n * l->line_sectors, left;
+	int slot = first % US_CACHE_LINES;
+	struct us_cache_line *cl;
+	int i, ret;
+
+	for (i = 0; i < n; i++) {
+		if (l->lines[slot + i].dirty) {
+			ret = us_cache_flush(l);
+			if (ret)
+				return ret;
+			break;
+		}
+	}
+
+	if (count > l->capacity - lba)
+		count = l->capacity - lba;
+	ret = us_rw10(l, 0, lba, count, us_cache_buf(l, slot, 0));
+
+	for (i = 0, left = count; i < n; i++) {
+		cl = &l->lines[slot + i];
+		cl->line = first + i;
+		cl->dirty = 0;
+		cl->valid = ret ? 0 : us_mask(0, left < l->line_sectors ?
+				left : l->line_sectors);
+		left -= left < l->line_sectors ? left : l->line_sectors;
+	}
+	return ret;
+}
+
+static rt_ssize_t us_cache_read(struct us_lun *l, rt_uint32_t sector,
+		uint8_t *buf, rt_uint32_t count)
+{
+	rt_uint32_t done = 0, line, last, off, n, mask;
+	rt_uint32_t disk_lines = (l->capacity + l->line_sectors - 1) /
+			l->line_sectors;
+	struct us_cache_line *cl;
+	int want, ret;
+
+	if (sector == l->next_sector)
+		l->sequential++;
+	else
+		l->sequential = 0;
+	l->next_sector = sector + count;
+
+	while (done < count) {
+		line = (sector + done) / l->line_sectors;
+		off = (sector + done) % l->line_sectors;
+		n = l->line_sectors - off;
+		if (n > count - done)
+			n = count - done;
+		mask = us_mask(off, n);
+		cl = &l->lines[line % US_CACHE_LINES];
+
+		if (!cl->valid || cl->line != line ||
+				(cl->valid & mask) != mask) {
+			/* the rest of the request, or more if sequential */
+			last = (sector + count - 1) / l->line_sectors;
+			want = last - line + 1;
+			if (l->sequential && want < US_CACHE_READAHEAD)
+				want = US_CACHE_READAHEAD;
+			if (want > US_CACHE_LINES - (int)(line % US_CACHE_LINES))
+				want = US_CACHE_LINES - line % US_CACHE_LINES;
+			if (want > (int)(disk_lines - line))
+				want = disk_lines - line;
+			ret = us_cache_fill(l, line, want);
+			if (ret)
+				return done ? (rt_ssize_t)done : ret;
+		}
+
+		rt_memcpy(buf + done * l->sector_size,
+				us_cache_buf(l, line % US_CACHE_LINES, off),
+				n * l->sector_size);
+		done += n;
+	}
+	return done;
+}
+
+static rt_ssize_t us_cache_write(struct us_lun *l, rt_uint32_t sector,
+		const uint8_t *buf, rt_uint32_t count)
+{
+	rt_uint32_t done = 0, line, off, n, mask;
+	struct us_cache_line *cl;
+	int ret;
+
+	while (done < count) {
+		line = (sector + done) / l->line_sectors;
+		off = (sector + done) % l->line_sectors;
+		n = l->line_sectors - off;
+		if (n > count - done)
+			n = count - done;
+		mask = us_mask(off, n);
+		cl = &l->lines[line % US_CACHE_LINES];
+
+		if (cl->valid && cl->line != line) {
+			if (cl->dirty) {
+				ret = us_cache_flush(l);
+				if (ret)
+					return done ? (rt_ssize_t)done : ret;
+			}
+			cl->valid = 0;
+		}
+		cl->line = line;
+
+		rt_memcpy(us_cache_buf(l, line % US_CACHE_LINES, off),
+				buf + done * l->sector_size,
+				n * l->sector_size);
+		cl->valid |= mask;
+		cl->dirty |= mask;
+		done += n;
+	}
+	return done;
+}
+
+/*-------------------------------------------------------------------------*/
+
+/*
+ * The block device of a unit: pos and size count sectors.
+ */
+
+#define dev_to_lun(d)	rt_container_of(d, struct us_lun, parent)
+
+static rt_err_t us_dev_open(rt_device_t dev, rt_uint16_t oflag)
+{
+	return dev_to_lun(dev)->us->gone ? -RT_EIO : RT_EOK;
+}
+
+static rt_err_t us_dev_sync(struct us_lun *l)
+{
+	struct us_data *us = l->us;
+	int ret;
+
+	rt_mutex_take(&us->lock, RT_WAITING_FOREVER);
+	ret = us->gone ? -ENODEV : us_cache_flush(l);
+	rt_mutex_release(&us->lock);
+	return ret ? -RT_EIO : RT_EOK;
+}
+
+static rt_err_t us_dev_close(rt_device_t dev)
+{
+	return us_dev_sync(dev_to_lun(dev));
+}
+
+static rt_ssize_t us_dev_read(rt_device_t dev, rt_off_t pos, void *buffer,
+		rt_size_t size)
+{
+	struct us_lun *l = dev_to_lun(dev);
+	rt_ssize_t ret;
+
+	if (pos < 0 || (rt_uint32_t)pos >= l->capacity)
+		return -EINVAL;
+	if (size > l->capacity - (rt_uint32_t)pos)
+		size = l->capacity - pos;
+
+	rt_mutex_take(&l->us->lock, RT_WAITING_FOREVER);
+	ret = l->us->gone ? -ENODEV : us_cache_read(l, pos, buffer, size);
+	rt_mutex_release(&l->us->lock);
+	return ret;
+}
+
+static rt_ssize_t us_dev_write(rt_device_t dev, rt_off_t pos,
+		const void *buffer, rt_size_t size)
+{
+	struct us_lun *l = dev_to_lun(dev);
+	rt_ssize_t ret;
+
+	if (pos < 0 || (rt_uint32_t)pos >= l->capacity)
+		return -EINVAL;
+	if (size > l->capacity - (rt_uint32_t)pos)
+		size = l->capacity - pos;
+
+	rt_mutex_take(&l->us->lock, RT_WAITING_FOREVER);
+	ret = l->us->gone ? -ENODEV : us_cache_write(l, pos, buffer, size);
+	rt_mutex_release(&l->us->lock);
+	return ret;
+}
+
+static rt_err_t us_dev_control(rt_device_t dev, int cmd, void *args)
+{
+	struct us_lun *l = dev_to_lun(dev);
+	struct rt_device_blk_geometry *geometry;
+
+	switch (cmd) {
+	case RT_DEVICE_CTRL_BLK_GETGEOME:
+		geometry = args;
+		if (!geometry)
+			return -RT_EINVAL;
+		geometry->sector_count = l->capacity;
+		geometry->bytes_per_sector = l->sector_size;
+		geometry->block_size = l->sector_size;
+		return RT_EOK;
+	case RT_DEVICE_CTRL_BLK_SYNC:
+		return us_dev_sync(l);
+	}
+	return -RT_ENOSYS;
+}
+
+#ifdef RT_USING_DEVICE_OPS
+static const struct rt_device_ops us_dev_ops = {
+	.open		= us_dev_open,
+	.close		= us_dev_close,
+	.read		= us_dev_read,
+	.write		= us_dev_write,
+	.control	= us_dev_control,
+};
+#endif
+
+/*-------------------------------------------------------------------------*/
+
+/* ask a unit what it is; only disks with media get a device */
+static int us_lun_probe(struct us_data *us, int lun)
+{
+	uint8_t inquiry[6] = { INQUIRY, 0, 0, 0, 36, 0 };
+	uint8_t tur[6] = { TEST_UNIT_READY };
+	uint8_t capacity[10] = { READ_CAPACITY };
+	uint8_t *reply = us->iobuf + US_IOBUF_DATA;
+	dma_addr_t reply_dma = us->iobuf_dma + US_IOBUF_DATA;
+	rt_uint32_t sector_size, last;
+	char name[RT_NAME_MAX];
+	struct us_lun *l;
+	int i, ret;
+
+	ret = us_command(us, lun, inquiry, sizeof(inquiry), reply, reply_dma,
+			36, 1);
+	if (ret)
+		return ret;
+	if ((reply[0] & 0x1f) != 0)	/* direct access block device */
+		return -ENODEV;
+
+	/* the first commands often fail with a unit attention */
+	for (i = 0; i < 3; i++) {
+		ret = us_command(us, lun, tur, sizeof(tur), RT_NULL, 0, 0, 0);
+		if (ret != -EIO)
+			break;
+		rt_thread_mdelay(100);
+	}
+	if (ret)
+		return ret;
+
+	ret = us_command(us, lun, capacity, sizeof(capacity), reply,
+			reply_dma, 8, 1);
+	if (ret)
+		return ret;
+	last = us_get_be32(reply);
+	sector_size = us_get_be32(reply + 4);
+	if (sector_size < 512 || sector_size > US_CACHE_LINE_SIZE ||
+			(sector_size & (sector_size - 1)) || last == 0xffffffff)
+		return -EINVAL;
+
+	l = rt_calloc(1, sizeof(*l));
+	if (!l)
+		return -ENOMEM;
+	l->us = us;
+	l->lun = lun;
+	l->capacity = last + 1;
+	l->sector_size = sector_size;
+	l->line_sectors = US_CACHE_LINE_SIZE / sector_size;
+	if (l->line_sectors > 32)
+		l->line_sectors = 32;
+	l->next_sector = ~0u;
+	l->cache = hcd_buffer_alloc(us->udev->bus,
+			US_CACHE_LINES * l->line_sectors * sector_size,
+			&l->cache_dma);
+	if (!l->cache) {
+		rt_free(l);
+		return -ENOMEM;
+	}
+
+	l->parent.type = RT_Device_Class_Block;
+#ifdef RT_USING_DEVICE_OPS
+	l->parent.ops = &us_dev_ops;
+#else
+	l->parent.open = us_dev_open;
+	l->parent.close = us_dev_close;
+	l->parent.read = us_dev_read;
+	l->parent.write = us_dev_write;
+	l->parent.control = us_dev_control;
+#endif
+	rt_snprintf(name, sizeof(name), "ud%d-%d", us->index, lun);
+	if (rt_device_register(&l->parent, name, RT_DEVICE_FLAG_RDWR |
+			RT_DEVICE_FLAG_REMOVABLE |
+			RT_DEVICE_FLAG_STANDALONE) != RT_EOK) {
+		hcd_buffer_free(us->udev->bus,
+				US_CACHE_LINES * l->line_sectors * sector_size,
+				l->cache, l->cache_dma);
+		rt_free(l);
+		return -EEXIST;
+	}
+	us->luns[lun] = l;
+	return 0;
+}
+
+static void us_free(struct us_data *us)
+{
+	struct us_lun *l;
+	rt_base_t level;
+	int i;
+
+	for (i = 0; i < US_MAX_LUNS; i++) {
+		l = us->luns[i];
+		if (!l)
+			continue;
+		rt_device_unregister(&l->parent);
+		hcd_buffer_free(us->udev->bus,
+				US_CACHE_LINES * l->line_sectors * l->sector_size,
+				l->cache, l->cache_dma);
+		rt_free(l);
+	}
+	if (us->iobuf)
+		hcd_buffer_free(us->udev->bus, US_IOBUF_SIZE, us->iobuf,
+				us->iobuf_dma);
+	usb_free_urb(us->cbw_urb);
+	usb_free_urb(us->data_urb);
+	usb_free_urb(us->csw_urb);
+	rt_mutex_detach(&us->lock);
+
+	if (us->index >= 0) {
+		level = rt_hw_interrupt_disable();
+		us_index_map &= ~(1u << us->index);
+		rt_hw_interrupt_enable(level);
+	}
+	rt_free(us);
+}
+
+static int storage_probe(struct usb_interface *intf,
+		const struct usb_device_id *id)
+{
+	struct usb_host_interface *alt = intf->cur_altsetting;
+	struct usb_device *udev = intf->udev;
+	struct usb_endpoint_descriptor *ep;
+	int in = 0, out = 0, i, ret;
+	struct us_data *us;
+	rt_base_t level;
+	uint8_t maxlun;
+
+	for (i = 0; i < alt->desc.bNumEndpoints; i++) {
+		ep = &alt->endpoint[i].desc;
+		if ((ep->bmAttributes & USB_EP_ATTR_TYPE_MASK) !=
+				USB_EP_ATTR_BULK)
+			continue;
+		if (ep->bEndpointAddress & USB_DIR_IN)
+			in = in ? in : ep->bEndpointAddress;
+		else
+			out = out ? out : ep->bEndpointAddress;
+	}
+	if (!in || !out)
+		return -ENODEV;
+
+	us = rt_calloc(1, sizeof(*us));
+	if (!us)
+		return -ENOMEM;
+	us->udev = udev;
+	us->intf = intf;
+	us->recv_pipe = usb_rcvbulkpipe(udev, in & 0x0f);
+	us->send_pipe = usb_sndbulkpipe(udev, out & 0x0f);
+	rt_mutex_init(&us->lock, "usbstor", RT_IPC_FLAG_PRIO);
+	rt_completion_init(&us->done);
+
+	us->index = -1;
+	level = rt_hw_interrupt_disable();
+	for (i = 0; i < 32; i++) {
+		if (!(us_index_map & (1u << i))) {
+			us_index_map |= 1u << i;
+			us->index = i;
+			break;
+		}
+	}
+	rt_hw_interrupt_enable(level);
+
+	us->cbw_urb = usb_alloc_urb(0);
+	us->data_urb = usb_alloc_urb(0);
+	us->csw_urb = usb_alloc_urb(0);
+	us->iobuf = hcd_buffer_alloc(udev->bus, US_IOBUF_SIZE,
+			&us->iobuf_dma);
+	if (us->index < 0 || !us->cbw_urb || !us->data_urb ||
+			!us->csw_urb || !us->iobuf) {
+		ret = us->index < 0 ? -EBUSY : -ENOMEM;
+		goto fail;
+	}
+
+	/* devices with a single unit may stall this */
+	ret = usb_control_msg(udev, usb_rcvctrlpipe(udev, 0),
+			US_BULK_GET_MAX_LUN,
+			USB_DIR_IN | USB_REQ_TYPE_CLASS | USB_REQ_TYPE_INTERFACE,
+			0, alt->desc.bInterfaceNumber, &maxlun, 1,
+			USB_CTRL_GET_TIMEOUT);
+	us->nluns = ret == 1 ? maxlun + 1 : 1;
+	if (us->nluns > US_MAX_LUNS)
+		us->nluns = US_MAX_LUNS;
+
+	/* units without media are skipped, but one must be there */
+	ret = -ENODEV;
+	rt_mutex_take(&us->lock, RT_WAITING_FOREVER);
+	for (i = 0; i < us->nluns; i++)
+		if (us_lun_probe(us, i) == 0)
+			ret = 0;
+	rt_mutex_release(&us->lock);
+	if (ret)
+		goto fail;
+
+	intf->driver_data = us;
+	return 0;
+
+fail:
+	us_free(us);
+	return ret;
+}
+
+static void storage_disconnect(struct usb_interface *intf)
+{
+	struct us_data *us = intf->driver_data;
+
+	/* a command in flight fails, the next one is not sent */
+	us->gone = 1;
+	usb_kill_urb(us->cbw_urb);
+	usb_kill_urb(us->data_urb);
+	usb_kill_urb(us->csw_urb);
+
+	rt_mutex_take(&us->lock, RT_WAITING_FOREVER);
+	rt_mutex_release(&us->lock);
+	us_free(us);
+}
+
+static const struct usb_device_id storage_id_table[] = {
+	{ USB_INTERFACE_INFO(USB_CLASS_MASS_STORAGE, US_SC_SCSI, US_PR_BULK) },
+	{ }
+};
+
+static struct usb_driver storage_driver = {
+	.name =		"usb-storage",
+	.probe =	storage_probe,
+	.disconnect =	storage_disconnect,
+	.id_table =	storage_id_table,
+};
+
+/**
+ * usb_storage_init - register the mass storage driver
+ *
+ * Return: 0.
+ */
+int usb_storage_init(void)
+{
+	return usb_register_driver(&storage_driver);
+}
+INIT_PREV_EXPORT(usb_storage_init);
+
+/**
+ * usb_storage_cleanup - unregister the mass storage driver
+ */
+void usb_storage_cleanup(void)
+{
+	usb_deregister(&storage_driver);
+}
+
+#endif /* CONFIG_USB_STORAGE */
@@ -0,0 +1,394 @@
+#include "hcd.h"
+#include "hub.h"
+
+/*
+ * URB instrumentation.
+ *
+ * Each cpu logs to its own ring.  A writer claims a slot with one
+ * atomic add on the ring's head and fills it in place; the record's seq
+ * is stored last, so a reader that copied a record can tell whether a
+ * writer overtook it meanwhile.  Nothing is ever locked on the submit
+ * and giveback paths.
+ *
+ * The endpoint counters are plain increments: an endpoint is given
+ * back by one hcd, which serializes its own completions.
+ */
+
+#ifdef CONFIG_USB_TRACE
+
+#ifdef RT_USING_FINSH
+#include <finsh.h>
+#endif
+#ifdef RT_USING_DFS
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define usb_trace_barrier()	__sync_synchronize()
+#else
+#define usb_trace_barrier()	rt_hw_dmb()
+#endif
+
+struct usb_trace_ring {
+	atomic_t head;			/* records ever claimed */
+	struct usb_trace_record rec[USB_TRACE_RING_SIZE];
+};
+
+static struct usb_trace_ring usb_trace_rings[USB_TRACE_CPUS];
+static struct usb_bus *usb_trace_buses[USB_TRACE_BUSES];
+static int usb_trace_enabled = 1;
+
+static void usb_trace_log(int event, struct urb *urb, rt_uint32_t time,
+		int status, rt_uint32_t length, rt_uint32_t latency)
+{
+	int cpu = usb_trace_cpu();
+	struct usb_trace_ring *ring = &usb_trace_rings[cpu];
+	struct usb_trace_record *r;
+	rt_uint32_t pos;
+
+	if (!usb_trace_enabled)
+		return;
+
+	pos = (rt_uint32_t)rt_atomic_add(&ring->head, 1);
+	r = &ring->rec[pos & (USB_TRACE_RING_SIZE - 1)];
+	r->seq = 0;
+	usb_trace_barrier();
+	r->time = time;
+	r->pipe = urb->pipe;
+	r->status = status;
+	r->length = length;
+	r->latency = latency;
+	r->urb = (rt_uint32_t)(rt_ubase_t)urb;
+	r->event = event;
+	r->cpu = cpu;
+	r->busnum = urb->dev->bus->busnum;
+	usb_trace_barrier();
+	r->seq = pos + 1;
+}
+
+void usb_trace_submit(struct urb *urb, int status)
+{
+	usb_trace_log(USB_TRACE_SUBMIT, urb, urb->submit_time, status,
+			urb->transfer_buffer_length, 0);
+}
+
+void usb_trace_giveback(struct urb *urb)
+{
+	struct usb_ep_stats *st = &urb->ep->stats;
+	rt_uint32_t now = usb_trace_clock();
+	rt_uint32_t lat = now - urb->submit_time;
+
+	if (!st->urbs || lat < st->lat_min)
+		st->lat_min = lat;
+	if (lat > st->lat_max)
+		st->lat_max = lat;
+	st->lat_sum += lat;
+	st->urbs++;
+	st->bytes += urb->actual_length;
+
+	if (usb_pipeisoc(urb->pipe))
+		st->errors += urb->error_count;
+	else if (urb->status == -EREMOTEIO || (!urb->status &&
+			urb->actual_length < urb->transfer_buffer_length))
+		st->short_xfers++;
+	else if (urb->status && urb->status != -ENOENT &&
+			urb->status != -ECONNRESET)
+		st->errors++;
+
+	usb_trace_log(USB_TRACE_GIVEBACK, urb, now, urb->status,
+			urb->actual_length, lat);
+}
+
+/**
+ * usb_trace_add_bus - make a bus visible to the usb_trace command
+ * @bus: bus whose root hub was just registered
+ *
+ * Busses past USB_TRACE_BUSES are still traced, just not listed.
+ */
+void usb_trace_add_bus(struct usb_bus *bus)
+{
+	rt_base_t level;
+	int i;
+
+	level = rt_hw_interrupt_disable();
+	for (i = 0; i < USB_TRACE_BUSES; i++) {
+		if (!usb_trace_buses[i]) {
+			usb_trace_buses[i] = bus;
+			break;
+		}
+	}
+	rt_hw_interrupt_enable(level);
+}
+
+void usb_trace_remove_bus(struct usb_bus *bus)
+{
+	rt_base_t level;
+	int i;
+
+	level = rt_hw_interrupt_disable();
+	for (i = 0; i < USB_TRACE_BUSES; i++) {
+		if (usb_trace_buses[i] == bus)
+			usb_trace_buses[i] = RT_NULL;
+	}
+	rt_hw_interrupt_enable(level);
+}
+
+/**
+ * usb_trace_get_stats - read an endpoint's counters
+ * @ep: the endpoint
+ * @stats: where to copy them
+ *
+ * A snapshot; the hcd may be updating them meanwhile.
+ */
+void usb_trace_get_stats(struct usb_host_endpoint *ep,
+		struct usb_ep_stats *stats)
+{
+	*stats = ep->stats;
+}
+
+static void usb_trace_clear_dev(struct usb_device *udev, void *arg)
+{
+	int i;
+
+	rt_memset(&udev->ep0.stats, 0, sizeof(udev->ep0.stats));
+	for (i = 1; i < 16; i++) {
+		if (udev->ep_in[i])
+			rt_memset(&udev->ep_in[i]->stats, 0,
+					sizeof(udev->ep_in[i]->stats));
+		if (udev->ep_out[i])
+			rt_memset(&udev->ep_out[i]->stats, 0,
+					sizeof(udev->ep_out[i]->stats));
+	}
+}
+
+/* the listed busses, with a reference to nothing: callers hold off
+ * usb_remove_hcd() themselves */
+static int usb_trace_get_buses(struct usb_bus **buses)
+{
+	rt_base_t level;
+	int i, n = 0;
+
+	level = rt_hw_interrupt_disable();
+	for (i = 0; i < USB_TRACE_BUSES; i++) {
+		if (usb_trace_buses[i])
+			buses[n++] = usb_trace_buses[i];
+	}
+	rt_hw_interrupt_enable(level);
+	return n;
+}
+
+/**
+ * usb_trace_clear - empty the trace rings and zero all endpoint counters
+ */
+void usb_trace_clear(void)
+{
+	struct usb_bus *buses[USB_TRACE_BUSES];
+	int i, n;
+
+	for (i = 0; i < USB_TRACE_CPUS; i++) {
+		rt_memset(usb_trace_rings[i].rec, 0,
+				sizeof(usb_trace_rings[i].rec));
+		rt_atomic_store(&usb_trace_rings[i].head, 0);
+	}
+
+	n = usb_trace_get_buses(buses);
+	for (i = 0; i < n; i++)
+		usb_hub_for_each_device(buses[i], usb_trace_clear_dev, RT_NULL);
+}
+
+/* copy the record at ring position @pos, seq 0 if it was overwritten */
+static void usb_trace_read(struct usb_trace_ring *ring, rt_uint32_t pos,
+		struct usb_trace_record *r)
+{
+	*r = ring->rec[pos & (USB_TRACE_RING_SIZE - 1)];
+	usb_trace_barrier();
+	if (r->seq != pos + 1)
+		r->seq = 0;
+}
+
+/* first position still in the ring and the position after the last */
+static void usb_trace_window(struct usb_trace_ring *ring,
+		rt_uint32_t *first, rt_uint32_t *end)
+{
+	*end = (rt_uint32_t)rt_atomic_load(&ring->head);
+	*first = *end > USB_TRACE_RING_SIZE ? *end - USB_TRACE_RING_SIZE : 0;
+}
+
+/**
+ * usb_trace_dump - export the trace rings in binary
+ * @write: called with consecutive pieces of the dump, returns the bytes
+ *	it took
+ * @ctx: passed on to @write
+ *
+ * Writes a struct usb_trace_dump_header and then every record in the
+ * rings.  Tracing goes on meanwhile; records overwritten before they
+ * were copied are written with seq 0.
+ *
+ * Return: 0, or -EIO if @write came up short.
+ */
+int usb_trace_dump(rt_size_t (*write)(void *ctx, const void *buf,
+		rt_size_t len), void *ctx)
+{
+	struct usb_trace_dump_header hdr;
+	struct usb_trace_record r;
+	rt_uint32_t first[USB_TRACE_CPUS], end[USB_TRACE_CPUS], pos;
+	int cpu;
+
+	hdr.magic = USB_TRACE_MAGIC;
+	hdr.version = USB_TRACE_VERSION;
+	hdr.record_size = sizeof(r);
+	hdr.count = 0;
+	hdr.time = usb_trace_clock();
+	for (cpu = 0; cpu < USB_TRACE_CPUS; cpu++) {
+		usb_trace_window(&usb_trace_rings[cpu], &first[cpu], &end[cpu]);
+		hdr.count += end[cpu] - first[cpu];
+	}
+	if (write(ctx, &hdr, sizeof(hdr)) != sizeof(hdr))
+		return -EIO;
+
+	for (cpu = 0; cpu < USB_TRACE_CPUS; cpu++) {
+		for (pos = first[cpu]; pos != end[cpu]; pos++) {
+			usb_trace_read(&usb_trace_rings[cpu], pos, &r);
+			if (write(ctx, &r, sizeof(r)) != sizeof(r))
+				return -EIO;
+		}
+	}
+	return 0;
+}
+
+#ifdef RT_USING_FINSH
+
+static const char * const usb_trace_types[] = {
+	"iso", "int", "ctrl", "bulk",
+};
+
+static void usb_trace_show_ep(struct usb_device *udev,
+		struct usb_host_endpoint *ep)
+{
+	struct usb_ep_stats st;
+	uint8_t addr = ep->desc.bEndpointAddress;
+
+	usb_trace_get_stats(ep, &st);
+	if (!st.urbs)
+		return;
+	rt_kprintf("%3d %3d  %02x %6u %10u %6u %6u %6u %6u/%u/%u\n",
+			udev->bus->busnum, udev->devnum, addr,
+			st.urbs, st.bytes, st.naks, st.short_xfers, st.errors,
+			st.lat_min, (rt_uint32_t)(st.lat_sum / st.urbs),
+			st.lat_max);
+}
+
+static void usb_trace_show_dev(struct usb_device *udev, void *arg)
+{
+	int i;
+
+	usb_trace_show_ep(udev, &udev->ep0);
+	for (i = 1; i < 16; i++) {
+		if (udev->ep_out[i])
+			usb_trace_show_ep(udev, udev->ep_out[i]);
+		if (udev->ep_in[i])
+			usb_trace_show_ep(udev, udev->ep_in[i]);
+	}
+}
+
+static void usb_trace_show_stats(void)
+{
+	struct usb_bus *buses[USB_TRACE_BUSES];
+	int i, n;
+
+	rt_kprintf("bus dev  ep   urbs      bytes   naks  short errors "
+			"lat min/avg/max us\n");
+	n = usb_trace_get_buses(buses);
+	for (i = 0; i < n; i++)
+		usb_hub_for_each_device(buses[i], usb_trace_show_dev, RT_NULL);
+}
+
+static void usb_trace_show_log(rt_uint32_t count)
+{
+	struct usb_trace_ring *ring;
+	struct usb_trace_record r;
+	rt_uint32_t first, end, pos;
+	int cpu;
+
+	rt_kprintf("cpu       time  event    bus dev  ep type   status"
+			"     len    lat\n");
+	for (cpu = 0; cpu < USB_TRACE_CPUS; cpu++) {
+		ring = &usb_trace_rings[cpu];
+		usb_trace_window(ring, &first, &end);
+		if (end - first > count)
+			first = end - count;
+		for (pos = first; pos != end; pos++) {
+			usb_trace_read(ring, pos, &r);
+			if (!r.seq)
+				continue;
+			rt_kprintf("%3d %10u  %-8s %3d %3d  %02x %-4s %8d %7u %6u\n",
+					r.cpu, r.time,
+					r.event == USB_TRACE_SUBMIT ?
+						"submit" : "giveback",
+					r.busnum, usb_pipedevice(r.pipe),
+					usb_pipeendpoint(r.pipe) |
+						(usb_pipein(r.pipe) ? 0x80 : 0),
+					usb_trace_types[usb_pipetype(r.pipe)],
+					r.status, r.length, r.latency);
+		}
+	}
+}
+
+#ifdef RT_USING_DFS
+static rt_size_t usb_trace_write_fd(void *ctx, const void *buf,
+		rt_size_t len)
+{
+	int ret = write((int)(rt_ubase_t)ctx, buf, len);
+
+	return ret < 0 ? 0 : (rt_size_t)ret;
+}
+
+static int usb_trace_dump_file(const char *path)
+{
+	int fd, ret;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0);
+	if (fd < 0) {
+		rt_kprintf("usb_trace: can't open %s\n", path);
+		return -EIO;
+	}
+	ret = usb_trace_dump(usb_trace_write_fd, (void *)(rt_ubase_t)fd);
+	close(fd);
+	if (ret)
+		rt_kprintf("usb_trace: writing %s failed\n", path);
+	return ret;
+}
+#endif
+
+static int usb_trace(int argc, char **argv)
+{
+	if (argc < 2 || !rt_strcmp(argv[1], "stats")) {
+		usb_trace_show_stats();
+	} else if (!rt_strcmp(argv[1], "log")) {
+		usb_trace_show_log(argc > 2 ? atoi(argv[2]) : 20);
+	} else if (!rt_strcmp(argv[1], "clear")) {
+		usb_trace_clear();
+	} else if (!rt_strcmp(argv[1], "on")) {
+		usb_trace_enabled = 1;
+	} else if (!rt_strcmp(argv[1], "off")) {
+		usb_trace_enabled = 0;
+#ifdef RT_USING_DFS
+	} else if (!rt_strcmp(argv[1], "dump") && argc > 2) {
+		return usb_trace_dump_file(argv[2]);
+#endif
+	} else {
+		rt_kprintf("usage: usb_trace [stats|log [n]|clear|on|off"
+#ifdef RT_USING_DFS
+				"|dump <file>"
+#endif
+				"]\n");
+		return -EINVAL;
+	}
+	return 0;
+}
+MSH_CMD_EXPORT(usb_trace, usb urb counters and trace);
+
+#endif /* RT_USING_FINSH */
+
+#endif /* CONFIG_USB_TRACE */
@@ -0,0 +1,683 @@
+#include "hcd.h"
+
+/**
+ * usb_init_urb - initializes a urb so that it can be used by a USB driver
+ * @urb: pointer to the urb to initialize
+ *
+ * Only for URBs that were not obtained from usb_alloc_urb(), e.g. ones
+ * embedded in a driver structure.
+ */
+void usb_init_urb(struct urb *urb)
+{
+	if (urb) {
+		rt_memset(urb, 0, sizeof(*urb));
+		rt_atomic_store(&urb->kref, 1);
+		rt_list_init(&urb->urb_list);
+		rt_list_init(&urb->anchor_list);
+	}
+}
+
+/**
+ * usb_alloc_urb - creates a new urb for a USB driver to use
+ * @iso_packets: number of iso packets for this urb
+ *
+ * Return: the new urb with a reference count of one, or %RT_NULL.
+ */
+struct urb *usb_alloc_urb(int iso_packets)
+{
+	struct urb *urb;
+
+	urb = rt_malloc(sizeof(struct urb) +
+		iso_packets * sizeof(struct usb_iso_packet_descriptor));
+	if (!urb)
+		return RT_NULL;
+	usb_init_urb(urb);
+	return urb;
+}
+
+static void usb_urb_pool_recycle(struct urb *urb);
+
+/**
+ * usb_free_urb - frees the memory used by a urb when all users of it are finished
+ * @urb: pointer to the urb to free, may be %RT_NULL
+ *
+ * Drops one reference; the memory goes away with the last one.
+ */
+void usb_free_urb(struct urb *urb)
+{
+	if (!urb)
+		return;
+	if (rt_atomic_sub(&urb->kref, 1) != 1)
+		return;
+	if (urb->transfer_flags & URB_FREE_BUFFER)
+		rt_free(urb->transfer_buffer);
+	if (urb->pool)
+		usb_urb_pool_recycle(urb);
+	else
+		rt_free(urb);
+}
+
+/**
+ * usb_get_urb - increments the reference count of the urb
+ * @urb: pointer to the urb to modify, may be %RT_NULL
+ *
+ * Return: the same @urb.
+ */
+struct urb *usb_get_urb(struct urb *urb)
+{
+	if (urb)
+		rt_atomic_add(&urb->kref, 1);
+	return urb;
+}
+
+/*
+ * Scatter-gather URBs carry their data in urb->sg instead of
+ * transfer_buffer.  Without an iommu mapping is the identity, so all
+ * that is left to do is checking the list against what the hc can take:
+ * a bounded number of entries, and unless the hc says otherwise, every
+ * segment but the last a whole number of packets so no packet has to be
+ * assembled from two segments.
+ */
+static int usb_urb_map_sg(struct usb_bus *bus, struct usb_host_endpoint *ep,
+		struct urb *urb)
+{
+	struct scatterlist *sg;
+	unsigned int maxp, total = 0;
+	int i;
+
+	if (!urb->sg || urb->num_sgs < 0 || urb->transfer_buffer)
+		return -EINVAL;
+	if (!bus->sg_tablesize || (unsigned)urb->num_sgs > bus->sg_tablesize)
+		return -EINVAL;
+	if (usb_pipeisoc(urb->pipe))
+		return -EINVAL;
+
+	maxp = ep->desc.wMaxPacketSize & 0x7ff;
+	for_each_sg(urb->sg, sg, urb->num_sgs, i) {
+		if (!bus->no_sg_constraint && maxp &&
+				i != urb->num_sgs - 1 && sg->length % maxp)
+			return -EINVAL;
+		sg->dma_address = (dma_addr_t)sg->buf;
+		total += sg->length;
+	}
+
+	if (!urb->transfer_buffer_length)
+		urb->transfer_buffer_length = total;
+	else if (urb->transfer_buffer_length > total)
+		return -EINVAL;
+	urb->num_mapped_sgs = urb->num_sgs;
+	return 0;
+}
+
+/**
+ * usb_submit_urb - issue an asynchronous transfer request for an endpoint
+ * @urb: pointer to the urb describing the request
+ *
+ * Checks the request against the endpoint it addresses and queues it on
+ * that endpoint's submission ring.  Any number of threads and interrupt
+ * handlers may submit to one endpoint at once; the ring is a lock-free
+ * multi-producer queue drained by the host controller driver alone, see
+ * struct usb_urb_ring.  Urbs from one submitter reach the controller in
+ * the order it submitted them.  Isochronous urbs are the exception: submitters to
+ * one isochronous endpoint must still be serialized by the caller.
+ *
+ * Context: any.
+ *
+ * Return: 0 on success, -ENOSPC if the endpoint's ring is full, or another
+ * negative error number.
+ */
+int usb_submit_urb(struct urb *urb)
+{
+	struct usb_device *dev;
+	struct usb_host_endpoint *ep;
+	int xfertype;
+
+	if (!urb || !urb->complete)
+		return -EINVAL;
+	if (urb->hcpriv)
+		return -EBUSY;		/* still owned by the hcd */
+
+	dev = urb->dev;
+	if (!dev || dev->state < USB_STATE_UNAUTHENTICATED)
+		return -ENODEV;
+
+	ep = usb_pipe_endpoint(dev, urb->pipe);
+	if (!ep)
+		return -ENOENT;
+
+	xfertype = usb_pipetype(urb->pipe);
+	if (xfertype != (int)usb_endpoint_pipetype(&ep->desc))
+		return -EINVAL;
+	if (xfertype == PIPE_CONTROL && !urb->setup_packet)
+		return -ENOEXEC;
+	if (xfertype == PIPE_ISOCHRONOUS) {
+		int n;
+
+		if (urb->number_of_packets <= 0)
+			return -EINVAL;
+		for (n = 0; n < urb->number_of_packets; n++) {
+			struct usb_iso_packet_descriptor *d =
+					&urb->iso_frame_desc[n];
+
+			if (d->offset + d->length > urb->transfer_buffer_length)
+				return -EMSGSIZE;
+			d->status = -EXDEV;
+			d->actual_length = 0;
+		}
+	}
+	/* an endpoint with streams only takes urbs for one of them */
+	if (ep->streams ? urb->stream_id < 1 ||
+				urb->stream_id > (unsigned int)ep->streams :
+			urb->stream_id != 0)
+		return -EINVAL;
+
+	if (urb->num_sgs) {
+		int ret = usb_urb_map_sg(dev->bus, ep, urb);
+
+		if (ret)
+			return ret;
+	}
+
+	urb->ep = ep;
+	urb->unlinked = 0;
+	urb->status = -EINPROGRESS;
+	urb->actual_length = 0;
+	urb->error_count = 0;
+
+	urb->transfer_flags &= ~URB_DIR_MASK;
+	if (xfertype == PIPE_CONTROL)
+		urb->transfer_flags |= (urb->setup_packet[0] & USB_DIR_IN) ?
+				URB_DIR_IN : URB_DIR_OUT;
+	else if (usb_pipein(urb->pipe))
+		urb->transfer_flags |= URB_DIR_IN;
+
+	return usb_hcd_submit_urb(urb);
+}
+
+/**
+ * usb_unlink_urb - abort/cancel a transfer request for an endpoint
+ * @urb: pointer to urb describing a previously submitted request
+ *
+ * Asynchronous: the completion handler runs later with -ECONNRESET.
+ *
+ * Return: -EINPROGRESS if the unlink was started, or an error number.
+ */
+int usb_unlink_urb(struct urb *urb)
+{
+	int ret;
+
+	if (!urb)
+		return -EINVAL;
+	ret = usb_hcd_unlink_urb(urb, -ECONNRESET);
+	return ret ? ret : -EINPROGRESS;
+}
+
+/*
+ * Threads in usb_kill_urb(), woken as the urb they kill is given back.
+ * The list is only touched with interrupts off.
+ */
+struct usb_kill_waiter {
+	rt_list_t		node;
+	struct urb		*urb;
+	struct rt_completion	done;
+};
+
+static rt_list_t usb_kill_waiters = RT_LIST_OBJECT_INIT(usb_kill_waiters);
+
+/* called by the hcd core once a rejected urb's use_count dropped */
+void usb_kill_urb_wakeup(struct urb *urb)
+{
+	struct usb_kill_waiter *waiter;
+	rt_base_t level;
+
+	level = rt_hw_interrupt_disable();
+	rt_list_for_each_entry(waiter, &usb_kill_waiters, node) {
+		if (waiter->urb == urb)
+			rt_completion_done(&waiter->done);
+	}
+	rt_hw_interrupt_enable(level);
+}
+
+/**
+ * usb_kill_urb - cancel a transfer request and wait for it to finish
+ * @urb: pointer to URB describing a previously submitted request
+ *
+ * Sleeps until the completion handler returned, and keeps the URB from
+ * being resubmitted meanwhile.  Must not be called from interrupt
+ * context or from the URB's own completion handler.
+ */
+void usb_kill_urb(struct urb *urb)
+{
+	struct usb_kill_waiter waiter;
+	rt_base_t level;
+
+	if (!urb || !urb->dev || !urb->ep)
+		return;
+
+	waiter.urb = urb;
+	rt_completion_init(&waiter.done);
+	level = rt_hw_interrupt_disable();
+	rt_list_insert_before(&usb_kill_waiters, &waiter.node);
+	rt_hw_interrupt_enable(level);
+
+	/* a giveback between the check and the wait leaves done set */
+	rt_atomic_add(&urb->reject, 1);
+	usb_hcd_unlink_urb(urb, -ENOENT);
+	while (rt_atomic_load(&urb->use_count))
+		rt_completion_wait(&waiter.done, RT_WAITING_FOREVER);
+	rt_atomic_sub(&urb->reject, 1);
+
+	level = rt_hw_interrupt_disable();
+	rt_list_remove(&waiter.node);
+	rt_hw_interrupt_enable(level);
+}
+
+/*-------------------------------------------------------------------------*/
+
+/*
+ * Threads waiting for an anchor or an urb pool to drain, keyed by the
+ * anchor or pool.  The giveback path wakes them whenever a wait may be
+ * over; each rechecks its own condition.  Like usb_kill_waiters, the
+ * list is only touched with interrupts off.
+ */
+struct usb_idle_waiter {
+	rt_list_t		node;
+	const void		*key;
+	struct rt_completion	done;
+};
+
+static rt_list_t usb_idle_waiters = RT_LIST_OBJECT_INIT(usb_idle_waiters);
+
+static void usb_idle_wakeup(const void *key)
+{
+	struct usb_idle_waiter *waiter;
+	rt_base_t level;
+
+	level = rt_hw_interrupt_disable();
+	rt_list_for_each_entry(waiter, &usb_idle_waiters, node) {
+		if (waiter->key == key)
+			rt_completion_done(&waiter->done);
+	}
+	rt_hw_interrupt_enable(level);
+}
+
+/*
+ * Sleep until @idle(@key) holds, for at most @ticks unless that is
+ * RT_WAITING_FOREVER.  Return: non-zero if it holds, zero on timeout.
+ */
+static int usb_idle_wait(const void *key, int (*idle)(const void *key),
+		rt_int32_t ticks)
+{
+	struct usb_idle_waiter waiter;
+	rt_tick_t start = rt_tick_get();
+	rt_tick_t elapsed;
+	rt_base_t level;
+	int ret;
+
+	waiter.key = key;
+	rt_completion_init(&waiter.done);
+	level = rt_hw_interrupt_disable();
+	rt_list_insert_before(&usb_idle_waiters, &waiter.node);
+	rt_hw_interrupt_enable(level);
+
+	/* a wakeup between the check and the wait leaves done set */
+	while (!(ret = idle(key))) {
+		if (ticks == RT_WAITING_FOREVER) {
+			rt_completion_wait(&waiter.done, RT_WAITING_FOREVER);
+			continue;
+		}
+		elapsed = rt_tick_get() - start;
+		if (elapsed >= (rt_tick_t)ticks)
+			break;
+		rt_completion_wait(&waiter.done, ticks - (rt_int32_t)elapsed);
+	}
+
+	level = rt_hw_interrupt_disable();
+	rt_list_remove(&waiter.node);
+	rt_hw_interrupt_enable(level);
+	return ret;
+}
+
+/*
+ * Anchors.  The list is only touched with interrupts off, since urbs
+ * are unanchored on giveback, which may run in the hcd's interrupt
+ * handler.
+ */
+
+/* no urb anchored and no handler of an urb just unanchored running */
+static int usb_anchor_idle(const struct usb_anchor *anchor)
+{
+	return rt_list_isempty(&anchor->urb_list) &&
+			!rt_atomic_load(&anchor->suspend_wakeups);
+}
+
+/* called by the hcd core once the handlers of @anchor's urbs returned */
+void usb_anchor_wakeup(struct usb_anchor *anchor)
+{
+	usb_idle_wakeup(anchor);
+}
+
+/**
+ * usb_anchor_urb - anchors an URB while it is processed
+ * @urb: pointer to the urb to anchor
+ * @anchor: pointer to the anchor
+ *
+ * Usually done right before usb_submit_urb().  The anchor takes a
+ * reference to @urb; if the submission fails the caller unanchors it.
+ */
+void usb_anchor_urb(struct urb *urb, struct usb_anchor *anchor)
+{
+	rt_base_t level;
+
+	usb_get_urb(urb);
+	level = rt_hw_interrupt_disable();
+	rt_list_insert_before(&anchor->urb_list, &urb->anchor_list);
+	urb->anchor = anchor;
+	rt_hw_interrupt_enable(level);
+}
+
+/**
+ * usb_unanchor_urb - unanchors an URB
+ * @urb: pointer to the urb to unanchor, may be %RT_NULL
+ *
+ * Drops the anchor's reference, which may free @urb.
+ */
+void usb_unanchor_urb(struct urb *urb)
+{
+	struct usb_anchor *anchor;
+	rt_base_t level;
+	int idle;
+
+	if (!urb)
+		return;
+
+	level = rt_hw_interrupt_disable();
+	anchor = urb->anchor;
+	if (!anchor) {
+		rt_hw_interrupt_enable(level);
+		return;
+	}
+	rt_list_remove(&urb->anchor_list);
+	urb->anchor = RT_NULL;
+	idle = usb_anchor_idle(anchor);
+	rt_hw_interrupt_enable(level);
+
+	if (idle)
+		usb_idle_wakeup(anchor);
+	usb_free_urb(urb);
+}
+
+/* the last urb of @anchor with a reference for the caller, or RT_NULL */
+static struct urb *usb_anchor_last(struct usb_anchor *anchor)
+{
+	struct urb *urb = RT_NULL;
+	rt_base_t level;
+
+	level = rt_hw_interrupt_disable();
+	if (!rt_list_isempty(&anchor->urb_list)) {
+		urb = rt_list_entry(anchor->urb_list.prev, struct urb,
+				anchor_list);
+		usb_get_urb(urb);
+	}
+	rt_hw_interrupt_enable(level);
+	return urb;
+}
+
+static int usb_anchor_idle_key(const void *key)
+{
+	return usb_anchor_idle(key);
+}
+
+/* no completion handler of @anchor's urbs running */
+static int usb_anchor_quiet(const void *key)
+{
+	const struct usb_anchor *anchor = key;
+
+	return !rt_atomic_load(&anchor->suspend_wakeups);
+}
+
+/**
+ * usb_kill_anchored_urbs - kill all URBs associated with an anchor
+ * @anchor: anchor the requests are bound to
+ *
+ * Kills the urbs newest first, so an endpoint's queue never restarts
+ * behind a killed urb, and returns once the anchor is empty and no
+ * completion handler is left running.  Urbs that were anchored but
+ * never submitted are just unanchored.  Handlers resubmitting meanwhile
+ * get -EPERM.
+ *
+ * Context: thread context, sleeps.
+ */
+void usb_kill_anchored_urbs(struct usb_anchor *anchor)
+{
+	struct urb *victim;
+
+	for (;;) {
+		while ((victim = usb_anchor_last(anchor)) != RT_NULL) {
+			usb_kill_urb(victim);
+			if (victim->anchor == anchor &&
+					!rt_atomic_load(&victim->use_count))
+				usb_unanchor_urb(victim);
+			usb_free_urb(victim);
+		}
+		if (usb_anchor_idle(anchor))
+			break;
+		/* a handler still running may anchor another urb */
+		usb_idle_wait(anchor, usb_anchor_quiet, RT_WAITING_FOREVER);
+	}
+}
+
+/**
+ * usb_unlink_anchored_urbs - asynchronously cancel transfer requests en masse
+ * @anchor: anchor the requests are bound to
+ *
+ * Unanchors every urb and calls usb_unlink_urb() on it.
+ */
+void usb_unlink_anchored_urbs(struct usb_anchor *anchor)
+{
+	struct urb *victim;
+
+	while ((victim = usb_get_from_anchor(anchor)) != RT_NULL) {
+		usb_unlink_urb(victim);
+		usb_free_urb(victim);
+	}
+}
+
+/**
+ * usb_get_from_anchor - get an anchor's oldest urb
+ * @anchor: the anchor whose urb you want
+ *
+ * Return: the urb, unanchored and with a reference for the caller, or
+ * %RT_NULL if the anchor is empty.
+ */
+struct urb *usb_get_from_anchor(struct usb_anchor *anchor)
+{
+	struct urb *urb = RT_NULL;
+	rt_base_t level;
+
+	level = rt_hw_interrupt_disable();
+	if (!rt_list_isempty(&anchor->urb_list)) {
+		urb = rt_list_first_entry(&anchor->urb_list, struct urb,
+				anchor_list);
+		usb_get_urb(urb);
+	}
+	rt_hw_interrupt_enable(level);
+
+	usb_unanchor_urb(urb);
+	return urb;
+}
+
+/**
+ * usb_scuttle_anchored_urbs - unanchor all of an anchor's urbs
+ * @anchor: the anchor whose urbs you want to unanchor
+ *
+ * For urbs that were never submitted; in-flight urbs keep running.
+ */
+void usb_scuttle_anchored_urbs(struct usb_anchor *anchor)
+{
+	struct urb *urb;
+
+	while ((urb = usb_get_from_anchor(anchor)) != RT_NULL)
+		usb_free_urb(urb);
+}
+
+/**
+ * usb_anchor_empty - is an anchor empty
+ * @anchor: the anchor you want to query
+ *
+ * Return: 1 if the anchor has no urbs associated with it.
+ */
+int usb_anchor_empty(struct usb_anchor *anchor)
+{
+	return rt_list_isempty(&anchor->urb_list);
+}
+
+/**
+ * usb_wait_anchor_empty_timeout - wait for an anchor to be unused
+ * @anchor: the anchor you want to become unused
+ * @timeout: how long you are willing to wait in milliseconds
+ *
+ * Waits until every anchored urb was given back and its completion
+ * handler returned.
+ *
+ * Return: non-zero if the anchor became unused, zero on timeout.
+ */
+int usb_wait_anchor_empty_timeout(struct usb_anchor *anchor,
+		unsigned int timeout)
+{
+	return usb_idle_wait(anchor, usb_anchor_idle_key,
+			rt_tick_from_millisecond(timeout));
+}
+
+/*-------------------------------------------------------------------------*/
+
+/**
+ * usb_urb_pool_init - pre-allocate urbs for an endpoint
+ * @pool: pool to initialize
+ * @dev: device the urbs are for
+ * @pipe: endpoint pipe the urbs are set up for
+ * @count: number of urbs
+ * @iso_packets: iso descriptors per urb, 0 for other transfer types
+ *
+ * Return: 0 on success, -EINVAL or -ENOMEM.
+ */
+int usb_urb_pool_init(struct usb_urb_pool *pool, struct usb_device *dev,
+		unsigned int pipe, int count, int iso_packets)
+{
+	char *p;
+	int i;
+
+	rt_memset(pool, 0, sizeof(*pool));
+	rt_list_init(&pool->free_list);
+	init_usb_anchor(&pool->anchor);
+	if (!dev || count < 1 || iso_packets < 0 ||
+			(iso_packets && !usb_pipeisoc(pipe)))
+		return -EINVAL;
+
+	pool->stride = RT_ALIGN(sizeof(struct urb) + iso_packets *
+			sizeof(struct usb_iso_packet_descriptor), RT_ALIGN_SIZE);
+	pool->mem = rt_malloc(pool->stride * count);
+	if (!pool->mem)
+		return -ENOMEM;
+
+	pool->dev = dev;
+	pool->pipe = pipe;
+	pool->count = count;
+	pool->iso_packets = iso_packets;
+	for (i = 0, p = pool->mem; i < count; i++, p += pool->stride)
+		rt_list_insert_before(&pool->free_list,
+				&((struct urb *)p)->urb_list);
+	rt_atomic_store(&pool->avail, count);
+	return 0;
+}
+
+/**
+ * usb_urb_pool_get - take an urb from a pool
+ * @pool: pool from usb_urb_pool_init()
+ *
+ * The urb comes initialized for the pool's device and pipe, with
+ * number_of_packets set, and anchored on the pool.  Like one from
+ * usb_alloc_urb() it carries one reference for the caller; once every
+ * reference is gone it returns to the pool.  A completion handler that
+ * resubmits it anchors it on &pool->anchor again.
+ *
+ * Return: the urb, or %RT_NULL if all of the pool's urbs are in use.
+ */
+struct urb *usb_urb_pool_get(struct usb_urb_pool *pool)
+{
+	struct urb *urb;
+	rt_base_t level;
+
+	level = rt_hw_interrupt_disable();
+	if (rt_list_isempty(&pool->free_list)) {
+		rt_hw_interrupt_enable(level);
+		return RT_NULL;
+	}
+	urb = rt_list_first_entry(&pool->free_list, struct urb, urb_list);
+	rt_list_remove(&urb->urb_list);
+	rt_atomic_sub(&pool->avail, 1);
+	rt_hw_interrupt_enable(level);
+
+	usb_init_urb(urb);
+	urb->pool = pool;
+	urb->dev = pool->dev;
+	urb->pipe = pool->pipe;
+	urb->number_of_packets = pool->iso_packets;
+	usb_anchor_urb(urb, &pool->anchor);
+	return urb;
+}
+
+/* called by usb_free_urb() for the last reference to a pool's urb */
+static void usb_urb_pool_recycle(struct urb *urb)
+{
+	struct usb_urb_pool *pool = urb->pool;
+	rt_base_t level;
+
+	level = rt_hw_interrupt_disable();
+	rt_list_insert_after(&pool->free_list, &urb->urb_list);
+	rt_atomic_add(&pool->avail, 1);
+	rt_hw_interrupt_enable(level);
+
+	if (rt_atomic_load(&pool->avail) == pool->count)
+		usb_idle_wakeup(pool);
+}
+
+/* every urb of the pool back on its free list */
+static int usb_urb_pool_idle(const void *key)
+{
+	const struct usb_urb_pool *pool = key;
+
+	return rt_atomic_load(&pool->avail) == pool->count;
+}
+
+/**
+ * usb_urb_pool_release - kill a pool's urbs and free its memory
+ * @pool: pool from usb_urb_pool_init()
+ * @timeout: milliseconds to wait for references still held elsewhere
+ *
+ * Kills whatever is in flight.  The memory is only freed when every urb
+ * came back, so a reference the caller still holds is reported rather
+ * than turned into a use after free.
+ *
+ * Context: thread context, sleeps.
+ *
+ * Return: 0 on success, -EBUSY if urbs are still referenced; the pool
+ * is left intact then and may be released again.
+ */
+int usb_urb_pool_release(struct usb_urb_pool *pool, unsigned int timeout)
+{
+	if (!pool->mem)
+		return 0;
+
+	usb_kill_anchored_urbs(&pool->anchor);
+	if (!usb_idle_wait(pool, usb_urb_pool_idle,
+			rt_tick_from_millisecond(timeout))) {
+		rt_kprintf("usb: urb pool released with %d busy urbs\n",
+				pool->count - (int)rt_atomic_load(&pool->avail));
+		return -EBUSY;
+	}
+
+	rt_free(pool->mem);
+	pool->mem = RT_NULL;
+	return 0;
+}
@@ -1 +1,402 @@
-#include "usb_host.h"
+#include "hcd.h"
+
+static rt_list_t usb_driver_list = RT_LIST_OBJECT_INIT(usb_driver_list);
+static struct rt_mutex usb_driver_lock;
+static rt_bool_t usb_driver_lock_ready;
+
+static void usb_driver_lock_take(void)
+{
+	/* first user initializes; the list is touched from thread context only */
+	rt_enter_critical();
+	if (!usb_driver_lock_ready) {
+		rt_mutex_init(&usb_driver_lock, "usbdrv", RT_IPC_FLAG_PRIO);
+		usb_driver_lock_ready = RT_TRUE;
+	}
+	rt_exit_critical();
+	rt_mutex_take(&usb_driver_lock, RT_WAITING_FOREVER);
+}
+
+/**
+ * usb_alloc_dev - usb device constructor (usbcore-internal)
+ * @parent: hub to which device is connected; null to allocate a root hub
+ * @bus: bus used to access the device
+ * @port1: one-based index of port; ignored for root hubs
+ *
+ * Return: The new device, in the ATTACHED state with only ep0 enabled,
+ * or %RT_NULL.
+ */
+struct usb_device *usb_alloc_dev(struct usb_device *parent,
+		struct usb_bus *bus, unsigned port1)
+{
+	struct usb_device *dev;
+
+	/* aligned for the endpoint state table at its head */
+	dev = rt_malloc_align(sizeof(*dev), USB_CACHE_LINE);
+	if (!dev)
+		return RT_NULL;
+	rt_memset(dev, 0, sizeof(*dev));
+
+	dev->state = USB_STATE_ATTACHED;
+	dev->bus = bus;
+	dev->parent = parent;
+	rt_list_init(&dev->children);
+	rt_list_init(&dev->sibling);
+
+	dev->ep0.desc.bLength = USB_DESC_LENGTH_ENDPOINT;
+	dev->ep0.desc.bDescriptorType = USB_DESC_TYPE_ENDPOINT;
+	rt_list_init(&dev->ep0.urb_list);
+	dev->ep0.udev = dev;
+	usb_ep0_reinit(dev);
+	/* on failure usb_control_msg() falls back to allocating */
+	usb_ctrl_init(dev);
+	usb_pm_init_dev(dev);
+	usb_recover_init(dev);
+
+	if (parent) {
+		dev->portnum = port1;
+		dev->level = parent->level + 1;
+		/* a port reset is recovered from in place, see recovery.c */
+		dev->persist_enabled = 1;
+		rt_list_insert_before(&parent->children, &dev->sibling);
+	}
+	return dev;
+}
+
+/**
+ * usb_put_dev - release a device structure
+ * @udev: device that's been disconnected, may be %RT_NULL
+ *
+ * Frees the descriptor block (parsed descriptors and strings) with the
+ * device.  The caller has already unbound its drivers and disabled its
+ * endpoints.
+ */
+void usb_put_dev(struct usb_device *udev)
+{
+	if (!udev)
+		return;
+	rt_list_remove(&udev->sibling);
+	usb_pm_release_dev(udev);
+	usb_destroy_configuration(udev);
+	usb_ctrl_release(udev);
+	rt_free_align(udev);
+}
+
+/*-------------------------------------------------------------------------*/
+
+/*
+ * Device address allocation.
+ *
+ * Addresses 1..127 are handed out round-robin from bus->devnum_next, so
+ * an address that was just freed is the last one to be reused.  Each
+ * word of the bitmap is claimed with compare-and-swap; no lock is taken
+ * and a word is scanned with one count-trailing-zeros.
+ */
+
+#if defined(__GNUC__) || defined(__clang__)
+#define devmap_ctz(x)	__builtin_ctzl(x)
+#else
+static int devmap_ctz(unsigned long x)
+{
+	int n = 0;
+
+	while (!(x & 1)) {
+		x >>= 1;
+		n++;
+	}
+	return n;
+}
+#endif
+
+/* claim the first free address in [lo, hi), or return 0 */
+static int devmap_claim(struct usb_devmap *map, int lo, int hi)
+{
+	unsigned long word, free, mask;
+	atomic_t old;
+	int w, first, last, bit;
+
+	for (w = lo / USB_DEVMAP_BITS; w * (int)USB_DEVMAP_BITS < hi; w++) {
+		first = w * USB_DEVMAP_BITS;
+		last = first + USB_DEVMAP_BITS;
+
+		mask = ~0UL;
+		if (lo > first)
+			mask &= ~0UL << (lo - first);
+		if (hi < last)
+			mask &= ~0UL >> (last - hi);
+
+		old = rt_atomic_load(&map->devicemap[w]);
+		for (;;) {
+			word = (unsigned long)old;
+			free = ~word & mask;
+			if (!free)
+				break;
+			bit = devmap_ctz(free);
+			/* on failure old is reloaded and the word rescanned */
+			if (rt_atomic_compare_exchange_strong(
+					&map->devicemap[w], &old,
+					(atomic_t)(word | (1UL << bit))))
+				return first + bit;
+		}
+	}
+	return 0;
+}
+
+/**
+ * usb_alloc_devnum - pick an address for a new device
+ * @bus: bus the device is on
+ *
+ * Context: any; lock free.
+ *
+ * Return: an address in 1..127, or -ENOSPC if all are in use.
+ */
+int usb_alloc_devnum(struct usb_bus *bus)
+{
+	int next, devnum;
+
+	next = (int)rt_atomic_load(&bus->devnum_next);
+	if (next < 1 || next > 127)
+		next = 1;
+
+	devnum = devmap_claim(&bus->devmap, next, 128);
+	if (!devnum)
+		devnum = devmap_claim(&bus->devmap, 1, next);
+	if (!devnum)
+		return -ENOSPC;
+
+	/* racing allocators may move the cursor out of order; harmless */
+	rt_atomic_store(&bus->devnum_next,
+			(atomic_t)(devnum < 127 ? devnum + 1 : 1));
+	return devnum;
+}
+
+/**
+ * usb_free_devnum - give an address back
+ * @bus: bus the device was on
+ * @devnum: address from usb_alloc_devnum(); values <= 0 are ignored
+ */
+void usb_free_devnum(struct usb_bus *bus, int devnum)
+{
+	if (devnum <= 0 || devnum > 127)
+		return;
+	rt_atomic_and(&bus->devmap.devicemap[devnum / USB_DEVMAP_BITS],
+			(atomic_t)~(1UL << (devnum % USB_DEVMAP_BITS)));
+}
+
+/*-------------------------------------------------------------------------*/
+
+/**
+ * usb_disable_endpoint - Disable an endpoint by address
+ * @dev: the device whose endpoint is being disabled
+ * @epaddr: the endpoint's address.  Endpoint number for output,
+ *	endpoint number + USB_DIR_IN for input
+ *
+ * Pending URBs are flushed and the hcd releases its endpoint state.
+ */
+void usb_disable_endpoint(struct usb_device *dev, unsigned int epaddr)
+{
+	unsigned int epnum = epaddr & USB_EPNO_MASK & USB_EP_DESC_NUM_MASK;
+	struct usb_hcd *hcd = bus_to_hcd(dev->bus);
+	struct usb_host_endpoint *ep;
+	struct usb_ep_state *st;
+
+	if (usb_pipein(epaddr)) {
+		ep = dev->ep_in[epnum];
+		if (epnum)
+			dev->ep_in[epnum] = RT_NULL;
+	} else {
+		ep = dev->ep_out[epnum];
+		if (epnum)
+			dev->ep_out[epnum] = RT_NULL;
+	}
+	if (!ep)
+		return;
+
+	st = &dev->ep_state[(usb_pipein(epaddr) ? 16 : 0) + epnum];
+	ep->enabled = 0;
+	st->flags = 0;
+	if (hcd->driver->endpoint_disable)
+		hcd->driver->endpoint_disable(hcd, ep);
+	st->hcpriv = RT_NULL;
+	ep->streams = 0;
+	ep->iso_active = 0;
+}
+
+/* a freshly enabled endpoint starts with DATA0 and not halted; the
+ * hcd's hcpriv is left alone */
+static void usb_ep_state_init(struct usb_device *dev,
+		struct usb_host_endpoint *ep, struct usb_ep_state *st)
+{
+	st->maxpacket = ep->desc.wMaxPacketSize & 0x7ff;
+	st->mult = ((ep->desc.wMaxPacketSize >> 11) & 3) + 1;
+	st->interval = usb_ep_frame_interval(dev, ep);
+	st->type = usb_endpoint_pipetype(&ep->desc);
+	st->flags = USB_EP_ENABLED;
+}
+
+static void usb_enable_endpoint(struct usb_device *dev,
+		struct usb_host_endpoint *ep)
+{
+	int epnum = ep->desc.bEndpointAddress & USB_EP_DESC_NUM_MASK;
+	int is_control = (ep->desc.bmAttributes & USB_EP_ATTR_TYPE_MASK) ==
+			USB_EP_ATTR_CONTROL;
+
+	if (is_control || (ep->desc.bEndpointAddress & USB_DIR_IN)) {
+		dev->ep_in[epnum] = ep;
+		usb_ep_state_init(dev, ep, &dev->ep_state[16 + epnum]);
+	}
+	if (is_control || !(ep->desc.bEndpointAddress & USB_DIR_IN)) {
+		dev->ep_out[epnum] = ep;
+		usb_ep_state_init(dev, ep, &dev->ep_state[epnum]);
+	}
+	ep->enabled = 1;
+}
+
+/**
+ * usb_ep0_reinit - pick up a new ep0 descriptor
+ * @udev: device whose ep0 maxpacket changed
+ *
+ * Called during enumeration once bMaxPacketSize0 is known.
+ */
+void usb_ep0_reinit(struct usb_device *udev)
+{
+	usb_enable_endpoint(udev, &udev->ep0);
+}
+
+void usb_enable_interface(struct usb_device *dev,
+		struct usb_host_interface *alt)
+{
+	int i;
+
+	for (i = 0; i < alt->desc.bNumEndpoints; ++i)
+		usb_enable_endpoint(dev, &alt->endpoint[i]);
+}
+
+void usb_disable_interface(struct usb_device *dev,
+		struct usb_host_interface *alt)
+{
+	int i;
+
+	for (i = 0; i < alt->desc.bNumEndpoints; ++i)
+		usb_disable_endpoint(dev,
+				alt->endpoint[i].desc.bEndpointAddress);
+}
+
+/*-------------------------------------------------------------------------*/
+
+static const struct usb_device_id *usb_match_id(struct usb_interface *intf,
+		const struct usb_device_id *id)
+{
+	struct usb_device *dev = interface_to_usbdev(intf);
+	struct usb_interface_descriptor *d = &intf->cur_altsetting->desc;
+
+	for (; id && id->match_flags; id++) {
+		if ((id->match_flags & USB_DEVICE_ID_MATCH_VENDOR) &&
+		    id->idVendor != dev->descriptor.idVendor)
+			continue;
+		if ((id->match_flags & USB_DEVICE_ID_MATCH_PRODUCT) &&
+		    id->idProduct != dev->descriptor.idProduct)
+			continue;
+		if ((id->match_flags & USB_DEVICE_ID_MATCH_INT_CLASS) &&
+		    id->bInterfaceClass != d->bInterfaceClass)
+			continue;
+		if ((id->match_flags & USB_DEVICE_ID_MATCH_INT_SUBCLASS) &&
+		    id->bInterfaceSubClass != d->bInterfaceSubClass)
+			continue;
+		if ((id->match_flags & USB_DEVICE_ID_MATCH_INT_PROTOCOL) &&
+		    id->bInterfaceProtocol != d->bInterfaceProtocol)
+			continue;
+		return id;
+	}
+	return RT_NULL;
+}
+
+static void usb_probe_interface(struct usb_interface *intf)
+{
+	const struct usb_device_id *id;
+	struct usb_driver *driver;
+
+	rt_list_for_each_entry(driver, &usb_driver_list, list) {
+		id = usb_match_id(intf, driver->id_table);
+		if (!id)
+			continue;
+		intf->driver = driver;
+		if (driver->probe(intf, id) == 0)
+			return;
+		intf->driver = RT_NULL;
+	}
+}
+
+/**
+ * usb_probe_interfaces - bind drivers to the active configuration
+ * @udev: a configured device
+ */
+void usb_probe_interfaces(struct usb_device *udev)
+{
+	struct usb_host_config *config = udev->actconfig;
+	int i;
+
+	if (!config)
+		return;
+
+	usb_driver_lock_take();
+	for (i = 0; i < config->desc.bNumInterfaces; i++)
+		if (config->interface[i] && !config->interface[i]->driver)
+			usb_probe_interface(config->interface[i]);
+	rt_mutex_release(&usb_driver_lock);
+}
+
+/**
+ * usb_unbind_interfaces - call disconnect for every bound interface
+ * @udev: device going away or changing configuration
+ *
+ * The driver list lock is not held: a hub's disconnect waits for its
+ * children's enumeration, which may be probing drivers under that lock.
+ * Bindings of @udev only change in the thread that owns it.
+ */
+void usb_unbind_interfaces(struct usb_device *udev)
+{
+	struct usb_host_config *config = udev->actconfig;
+	struct usb_interface *intf;
+	int i;
+
+	if (!config)
+		return;
+
+	for (i = 0; i < config->desc.bNumInterfaces; i++) {
+		intf = config->interface[i];
+		if (!intf || !intf->driver)
+			continue;
+		if (intf->driver->disconnect)
+			intf->driver->disconnect(intf);
+		intf->driver = RT_NULL;
+		intf->driver_data = RT_NULL;
+	}
+}
+
+/**
+ * usb_register_driver - register a USB interface driver
+ * @driver: the driver; probed against devices connected from now on
+ *
+ * Return: 0.
+ */
+int usb_register_driver(struct usb_driver *driver)
+{
+	usb_driver_lock_take();
+	rt_list_insert_before(&usb_driver_list, &driver->list);
+	rt_mutex_release(&usb_driver_lock);
+	return 0;
+}
+
+/**
+ * usb_deregister - unregister a USB interface driver
+ * @driver: the driver to unregister
+ *
+ * Interfaces the driver is bound to stay bound until their device goes
+ * away; callers disconnect them first.
+ */
+void usb_deregister(struct usb_driver *driver)
+{
+	usb_driver_lock_take();
+	rt_list_remove(&driver->list);
+	rt_mutex_release(&usb_driver_lock);
+}
@@ -0,0 +1,269 @@
+/*
+ * sim.c - simulated devices and bring-up for the host tests and
+ * benchmarks, see sim.h
+ */
+
+#include "sim.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+void sim_fail(const char *file, int line, const char *what)
+{
+	fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+	fflush(stdout);
+	exit(1);
+}
+
+/* the stack's threads and a controller with empty ports */
+struct usb_hcd *sim_start(void)
+{
+	struct usb_hcd *hcd;
+
+	rt_components_init();
+	hcd = dummy_hcd_create("usb0");
+	SIM_CHECK(hcd != RT_NULL);
+	return hcd;
+}
+
+rt_uint64_t sim_usecs(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (rt_uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+void sim_report(const char *name, double value, const char *unit)
+{
+	printf("%-40s %12.2f %s\n", name, value, unit);
+	fflush(stdout);
+}
+
+int sim_quick(int argc, char **argv)
+{
+	return argc > 1 && !strcmp(argv[1], "--quick");
+}
+
+/*-------------------------------------------------------------------------*/
+
+int sim_device_transfer(struct dummy_device *vdev, uint8_t epaddr,
+		void *buf, int len)
+{
+	struct sim_device *sd = rt_container_of(vdev, struct sim_device,
+			vdev);
+	uint8_t *p = buf;
+	int i, n;
+
+	if (sd->mode == SIM_SOURCE_SINK) {
+		if (epaddr & USB_DIR_IN) {
+			for (i = 0; i < len; i++)
+				p[i] = (uint8_t)(sd->in_bytes + i);
+			sd->in_bytes += len;
+		} else {
+			sd->out_bytes += len;
+		}
+		return len;
+	}
+
+	if (epaddr & USB_DIR_IN) {
+		n = (int)(sd->fifo_head - sd->fifo_tail);
+		if (!n)
+			return -EAGAIN;
+		if (n > len)
+			n = len;
+		for (i = 0; i < n; i++)
+			p[i] = sd->fifo[(sd->fifo_tail + i) % SIM_FIFO_SIZE];
+		sd->fifo_tail += n;
+		sd->in_bytes += n;
+		return n;
+	}
+	if (sd->fifo_head - sd->fifo_tail + len > SIM_FIFO_SIZE)
+		return -EAGAIN;
+	for (i = 0; i < len; i++)
+		sd->fifo[(sd->fifo_head + i) % SIM_FIFO_SIZE] = p[i];
+	sd->fifo_head += len;
+	sd->out_bytes += len;
+	return len;
+}
+
+static int sim_device_setup(struct dummy_device *vdev,
+		const struct usb_ctrlrequest *req, void *buf)
+{
+	struct sim_device *sd = rt_container_of(vdev, struct sim_device,
+			vdev);
+
+	sd->requests++;
+	if (req->bRequestType & USB_DIR_IN) {
+		rt_memset(buf, 0, req->wLength);
+		return req->wLength;
+	}
+	return 0;
+}
+
+static void sim_config_add(struct sim_device *sd, const void *desc, int len)
+{
+	uint16_t total = sd->config[2] | (sd->config[3] << 8);
+
+	SIM_CHECK(total + len <= SIM_CONFIG_SIZE);
+	rt_memcpy(&sd->config[total], desc, len);
+	total += len;
+	sd->config[2] = total & 0xff;
+	sd->config[3] = total >> 8;
+}
+
+/**
+ * sim_device_init - build a simulated device
+ * @sd: the device
+ * @speed: USB_SPEED_LOW, _FULL or _HIGH
+ * @vid: idVendor
+ * @pid: idProduct
+ * @cls: bInterfaceClass of its one interface
+ * @eps: its endpoints
+ * @neps: how many
+ *
+ * The device sources and sinks data until @sd->mode is changed; plug it
+ * in with dummy_hcd_connect(&sd->vdev).
+ */
+void sim_device_init(struct sim_device *sd, int speed, uint16_t vid,
+		uint16_t pid, uint8_t cls, const struct sim_ep *eps, int neps)
+{
+	uint8_t intf[USB_DESC_LENGTH_INTERFACE] = {
+		USB_DESC_LENGTH_INTERFACE, USB_DESC_TYPE_INTERFACE,
+		0, 0, (uint8_t)neps, cls, 0, 0, 0,
+	};
+	uint8_t ep[USB_DESC_LENGTH_ENDPOINT];
+	int i;
+
+	rt_memset(sd, 0, sizeof(*sd));
+	sd->desc.bLength = USB_DESC_LENGTH_DEVICE;
+	sd->desc.bDescriptorType = USB_DESC_TYPE_DEVICE;
+	sd->desc.bcdUSB = speed == USB_SPEED_HIGH ? 0x0200 : 0x0110;
+	sd->desc.bMaxPacketSize0 = speed == USB_SPEED_LOW ? 8 : 64;
+	sd->desc.idVendor = vid;
+	sd->desc.idProduct = pid;
+	sd->desc.bNumConfigurations = 1;
+
+	sd->config[0] = USB_DESC_LENGTH_CONFIG;
+	sd->config[1] = USB_DESC_TYPE_CONFIGURATION;
+	sd->config[2] = USB_DESC_LENGTH_CONFIG;
+	sd->config[4] = 1;		/* bNumInterfaces */
+	sd->config[5] = 1;		/* bConfigurationValue */
+	sd->config[7] = 0x80;		/* bus powered */
+	sd->config[8] = 50;		/* 100 mA */
+	sim_config_add(sd, intf, sizeof(intf));
+	for (i = 0; i < neps; i++) {
+		ep[0] = USB_DESC_LENGTH_ENDPOINT;
+		ep[1] = USB_DESC_TYPE_ENDPOINT;
+		ep[2] = eps[i].addr;
+		ep[3] = eps[i].attr;
+		ep[4] = eps[i].maxp & 0xff;
+		ep[5] = eps[i].maxp >> 8;
+		ep[6] = eps[i].interval;
+		sim_config_add(sd, ep, sizeof(ep));
+	}
+	sd->configs[0] = sd->config;
+
+	sd->ops.setup = sim_device_setup;
+	sd->ops.transfer = sim_device_transfer;
+	sd->vdev.speed = speed;
+	sd->vdev.device = &sd->desc;
+	sd->vdev.configs = sd->configs;
+	sd->vdev.ops = &sd->ops;
+	sd->fifo = malloc(SIM_FIFO_SIZE);
+	SIM_CHECK(sd->fifo != RT_NULL);
+}
+
+/* class descriptors, appended to the configuration as they come */
+void sim_device_extra(struct sim_device *sd, const void *desc, int len)
+{
+	sim_config_add(sd, desc, len);
+}
+
+void sim_device_release(struct sim_device *sd)
+{
+	free(sd->fifo);
+	sd->fifo = RT_NULL;
+}
+
+/*-------------------------------------------------------------------------*/
+
+static int sim_probe(struct usb_interface *intf,
+		const struct usb_device_id *id)
+{
+	struct sim_driver *sdrv = rt_container_of(intf->driver,
+			struct sim_driver, driver);
+	rt_base_t level;
+
+	level = rt_hw_interrupt_disable();
+	if (sdrv->nbound < SIM_MAX_BOUND)
+		sdrv->intf[sdrv->nbound++] = intf;
+	rt_hw_interrupt_enable(level);
+	rt_sem_release(&sdrv->probed);
+	return 0;
+}
+
+static void sim_disconnect(struct usb_interface *intf)
+{
+	struct sim_driver *sdrv = rt_container_of(intf->driver,
+			struct sim_driver, driver);
+	rt_base_t level;
+	int i;
+
+	level = rt_hw_interrupt_disable();
+	for (i = 0; i < sdrv->nbound; i++) {
+		if (sdrv->intf[i] == intf) {
+			sdrv->intf[i] = sdrv->intf[--sdrv->nbound];
+			break;
+		}
+	}
+	rt_hw_interrupt_enable(level);
+	rt_sem_release(&sdrv->gone);
+}
+
+void sim_driver_register(struct sim_driver *sdrv, uint16_t vid,
+		uint16_t pid)
+{
+	rt_memset(sdrv, 0, sizeof(*sdrv));
+	sdrv->id[0].match_flags = USB_DEVICE_ID_MATCH_VENDOR |
+			USB_DEVICE_ID_MATCH_PRODUCT;
+	sdrv->id[0].idVendor = vid;
+	sdrv->id[0].idProduct = pid;
+	sdrv->driver.name = "sim";
+	sdrv->driver.probe = sim_probe;
+	sdrv->driver.disconnect = sim_disconnect;
+	sdrv->driver.id_table = sdrv->id;
+	rt_sem_init(&sdrv->probed, "simprb", 0, RT_IPC_FLAG_FIFO);
+	rt_sem_init(&sdrv->gone, "simgone", 0, RT_IPC_FLAG_FIFO);
+	usb_register_driver(&sdrv->driver);
+}
+
+void sim_driver_unregister(struct sim_driver *sdrv)
+{
+	usb_deregister(&sdrv->driver);
+	rt_sem_detach(&sdrv->probed);
+	rt_sem_detach(&sdrv->gone);
+}
+
+/* the interface of the next probe, %RT_NULL after @ms */
+struct usb_interface *sim_wait_probe(struct sim_driver *sdrv, int ms)
+{
+	struct usb_interface *intf;
+	rt_base_t level;
+
+	if (rt_sem_take(&sdrv->probed, rt_tick_from_millisecond(ms)))
+		return RT_NULL;
+	level = rt_hw_interrupt_disable();
+	intf = sdrv->nbound ? sdrv->intf[sdrv->nbound - 1] : RT_NULL;
+	rt_hw_interrupt_enable(level);
+	return intf;
+}
+
+/* 0 once one bound interface was disconnected, -ETIMEDOUT after @ms */
+int sim_wait_disconnect(struct sim_driver *sdrv, int ms)
+{
+	if (rt_sem_take(&sdrv->gone, rt_tick_from_millisecond(ms)))
+		return -ETIMEDOUT;
+	return 0;
+}
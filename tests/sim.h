@@ -0,0 +1,98 @@
+#ifndef __USB_SIM_H__
+#define __USB_SIM_H__
+
+#include "hcd.h"
+#include "hub.h"
+#include "dummy_hcd.h"
+
+#include <stdio.h>
+
+/*
+ * Helpers the host tests and benchmarks share: bringing the stack up on
+ * a dummy_hcd, simulated devices built from a list of endpoints, a
+ * driver that binds to them by vendor and product id, and checks.
+ */
+
+#define SIM_CHECK(cond)							\
+	do {								\
+		if (!(cond))						\
+			sim_fail(__FILE__, __LINE__, #cond);		\
+	} while (0)
+
+void sim_fail(const char *file, int line, const char *what);
+
+struct usb_hcd *sim_start(void);
+rt_uint64_t sim_usecs(void);
+void sim_report(const char *name, double value, const char *unit);
+/* benchmarks run shorter under ctest, see bench/CMakeLists.txt */
+int sim_quick(int argc, char **argv);
+
+/*
+ * A simulated device: one configuration with one interface and up to
+ * SIM_MAX_EPS endpoints, and class descriptors after the interface.
+ * Bulk and interrupt endpoints either source and sink data or loop the
+ * OUT data back on the IN endpoints, see sim_device_transfer().
+ */
+#define SIM_MAX_EPS		8
+#define SIM_CONFIG_SIZE		256
+#define SIM_FIFO_SIZE		65536
+
+enum sim_mode {
+	SIM_SOURCE_SINK,	/* IN returns full packets, OUT is dropped */
+	SIM_LOOPBACK,		/* OUT data comes back on IN */
+};
+
+struct sim_ep {
+	uint8_t		addr;		/* bEndpointAddress */
+	uint8_t		attr;		/* bmAttributes */
+	uint16_t	maxp;		/* wMaxPacketSize */
+	uint8_t		interval;	/* bInterval */
+};
+
+struct sim_device {
+	struct dummy_device		vdev;
+	struct dummy_device_ops		ops;
+	struct usb_device_descriptor	desc;
+	uint8_t				config[SIM_CONFIG_SIZE];
+	const uint8_t			*configs[1];
+	enum sim_mode			mode;
+
+	/* loopback data, frame timer context only */
+	uint8_t				*fifo;
+	rt_size_t			fifo_head;
+	rt_size_t			fifo_tail;
+
+	rt_uint64_t			in_bytes;
+	rt_uint64_t			out_bytes;
+	rt_uint32_t			requests;	/* class/vendor setups */
+};
+
+void sim_device_init(struct sim_device *sd, int speed, uint16_t vid,
+		uint16_t pid, uint8_t cls, const struct sim_ep *eps, int neps);
+void sim_device_extra(struct sim_device *sd, const void *desc, int len);
+void sim_device_release(struct sim_device *sd);
+int sim_device_transfer(struct dummy_device *vdev, uint8_t epaddr,
+		void *buf, int len);
+
+/*
+ * A usb_driver bound by vendor and product id; remembers the interfaces
+ * it was probed with.
+ */
+#define SIM_MAX_BOUND		32
+
+struct sim_driver {
+	struct usb_driver	driver;
+	struct usb_device_id	id[2];
+	struct rt_semaphore	probed;
+	struct rt_semaphore	gone;
+	struct usb_interface	*intf[SIM_MAX_BOUND];
+	int			nbound;
+};
+
+void sim_driver_register(struct sim_driver *sdrv, uint16_t vid,
+		uint16_t pid);
+void sim_driver_unregister(struct sim_driver *sdrv);
+struct usb_interface *sim_wait_probe(struct sim_driver *sdrv, int ms);
+int sim_wait_disconnect(struct sim_driver *sdrv, int ms);
+
+#endif /* __USB_SIM_H__ */
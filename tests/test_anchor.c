@@ -0,0 +1,203 @@
+/*
+ * test_anchor.c - anchors and urb pools through hot unplug
+ *
+ * A driver keeps a bulk IN endpoint busy with the urbs of a usb_urb_pool
+ * and a bulk OUT endpoint with urbs of its own on an anchor, every
+ * completion handler resubmitting, plus a few urbs anchored and never
+ * submitted.  The device is unplugged while all of that is queued, at a
+ * different point of the stream every round.  The driver's disconnect
+ * kills its anchor and releases the pool; afterwards every submission
+ * has to have completed exactly once, the anchors have to be empty, the
+ * pool has to have every urb back and the driver's own urbs must be
+ * left with nothing but the driver's reference.
+ */
+
+#include "sim.h"
+
+#define TEST_VID	0x1d6b
+#define TEST_PID	0x010c
+#define TEST_IN_URBS	24
+#define TEST_OUT_URBS	8
+#define TEST_IDLE_URBS	2		/* anchored, never submitted */
+#define TEST_LEN	16384
+#define TEST_ROUNDS	30
+
+static const struct sim_ep test_eps[] = {
+	{ USB_DIR_IN | 1, USB_EP_ATTR_BULK, 512, 0 },
+	{ 2, USB_EP_ATTR_BULK, 512, 0 },
+};
+
+struct test_drv {
+	struct usb_driver	driver;
+	struct usb_device_id	id[2];
+	struct rt_semaphore	probed;
+	struct rt_semaphore	gone;
+
+	struct usb_urb_pool	pool;		/* bulk IN */
+	struct usb_anchor	anchor;		/* bulk OUT and the idle ones */
+	struct urb		*urbs[TEST_OUT_URBS + TEST_IDLE_URBS];
+	int			running;
+
+	atomic_t		submitted;
+	atomic_t		completed;
+	rt_uint64_t		in_bytes;	/* over all rounds */
+	int			disconnect_ok;
+};
+
+static struct test_drv test_drv;
+static uint8_t test_in_bufs[TEST_IN_URBS][TEST_LEN];
+static uint8_t test_out_bufs[TEST_OUT_URBS][TEST_LEN];
+
+static int test_submit(struct urb *urb, struct usb_anchor *anchor)
+{
+	int ret;
+
+	usb_anchor_urb(urb, anchor);
+	rt_atomic_add(&test_drv.submitted, 1);
+	ret = usb_submit_urb(urb);
+	if (ret) {
+		usb_unanchor_urb(urb);
+		rt_atomic_sub(&test_drv.submitted, 1);
+	}
+	return ret;
+}
+
+static void test_complete(struct urb *urb)
+{
+	struct usb_anchor *anchor = urb->context;
+	rt_base_t level;
+
+	rt_atomic_add(&test_drv.completed, 1);
+	if (usb_pipein(urb->pipe)) {
+		level = rt_hw_interrupt_disable();
+		test_drv.in_bytes += urb->actual_length;
+		rt_hw_interrupt_enable(level);
+	}
+	if (urb->status || !test_drv.running)
+		return;
+	test_submit(urb, anchor);
+}
+
+static int test_probe(struct usb_interface *intf,
+		const struct usb_device_id *id)
+{
+	struct usb_device *udev = intf->udev;
+	struct urb *urb;
+	int i;
+
+	SIM_CHECK(usb_urb_pool_init(&test_drv.pool, udev,
+			usb_rcvbulkpipe(udev, 1), TEST_IN_URBS, 0) == 0);
+	init_usb_anchor(&test_drv.anchor);
+	test_drv.running = 1;
+
+	/* the pool's urbs belong to the core once submitted */
+	for (i = 0; i < TEST_IN_URBS; i++) {
+		urb = usb_urb_pool_get(&test_drv.pool);
+		SIM_CHECK(urb != RT_NULL);
+		usb_fill_bulk_urb(urb, udev, urb->pipe, test_in_bufs[i],
+				TEST_LEN, test_complete, &test_drv.pool.anchor);
+		rt_atomic_add(&test_drv.submitted, 1);
+		SIM_CHECK(usb_submit_urb(urb) == 0);
+		usb_free_urb(urb);
+	}
+	SIM_CHECK(usb_urb_pool_get(&test_drv.pool) == RT_NULL);
+
+	for (i = 0; i < TEST_OUT_URBS; i++) {
+		urb = test_drv.urbs[i];
+		usb_fill_bulk_urb(urb, udev, usb_sndbulkpipe(udev, 2),
+				test_out_bufs[i], TEST_LEN, test_complete,
+				&test_drv.anchor);
+		SIM_CHECK(test_submit(urb, &test_drv.anchor) == 0);
+	}
+	for (; i < TEST_OUT_URBS + TEST_IDLE_URBS; i++)
+		usb_anchor_urb(test_drv.urbs[i], &test_drv.anchor);
+
+	rt_sem_release(&test_drv.probed);
+	return 0;
+}
+
+static void test_disconnect(struct usb_interface *intf)
+{
+	int ok;
+
+	test_drv.running = 0;
+	usb_kill_anchored_urbs(&test_drv.anchor);
+	ok = usb_wait_anchor_empty_timeout(&test_drv.anchor, 1000) &&
+			usb_anchor_empty(&test_drv.anchor);
+	ok = usb_urb_pool_release(&test_drv.pool, 1000) == 0 && ok;
+	test_drv.disconnect_ok = ok;
+	rt_sem_release(&test_drv.gone);
+}
+
+static void test_check_leaks(void)
+{
+	int i;
+
+	SIM_CHECK(test_drv.disconnect_ok);
+	SIM_CHECK(usb_anchor_empty(&test_drv.anchor));
+	SIM_CHECK(usb_anchor_empty(&test_drv.pool.anchor));
+	SIM_CHECK(rt_atomic_load(&test_drv.pool.avail) == TEST_IN_URBS);
+	SIM_CHECK(test_drv.pool.mem == RT_NULL);
+	SIM_CHECK(rt_atomic_load(&test_drv.submitted) ==
+			rt_atomic_load(&test_drv.completed));
+	for (i = 0; i < TEST_OUT_URBS + TEST_IDLE_URBS; i++) {
+		SIM_CHECK(rt_atomic_load(&test_drv.urbs[i]->kref) == 1);
+		SIM_CHECK(rt_atomic_load(&test_drv.urbs[i]->use_count) == 0);
+		SIM_CHECK(test_drv.urbs[i]->anchor == RT_NULL);
+	}
+}
+
+int main(void)
+{
+	rt_uint64_t submitted = 0;
+	struct sim_device sd;
+	struct usb_hcd *hcd;
+	int i, round;
+
+	hcd = sim_start();
+	rt_memset(&test_drv, 0, sizeof(test_drv));
+	test_drv.id[0].match_flags = USB_DEVICE_ID_MATCH_VENDOR |
+			USB_DEVICE_ID_MATCH_PRODUCT;
+	test_drv.id[0].idVendor = TEST_VID;
+	test_drv.id[0].idProduct = TEST_PID;
+	test_drv.driver.name = "anchor";
+	test_drv.driver.probe = test_probe;
+	test_drv.driver.disconnect = test_disconnect;
+	test_drv.driver.id_table = test_drv.id;
+	rt_sem_init(&test_drv.probed, "test", 0, RT_IPC_FLAG_FIFO);
+	rt_sem_init(&test_drv.gone, "test", 0, RT_IPC_FLAG_FIFO);
+	for (i = 0; i < TEST_OUT_URBS + TEST_IDLE_URBS; i++) {
+		test_drv.urbs[i] = usb_alloc_urb(0);
+		SIM_CHECK(test_drv.urbs[i] != RT_NULL);
+	}
+	usb_register_driver(&test_drv.driver);
+
+	sim_device_init(&sd, USB_SPEED_HIGH, TEST_VID, TEST_PID, 0xff,
+			test_eps, 2);
+	for (round = 0; round < TEST_ROUNDS; round++) {
+		rt_atomic_store(&test_drv.submitted, 0);
+		rt_atomic_store(&test_drv.completed, 0);
+		SIM_CHECK(dummy_hcd_connect(hcd, 1, &sd.vdev) == 0);
+		SIM_CHECK(rt_sem_take(&test_drv.probed, 2000) == RT_EOK);
+
+		/* right away, then ever further into the stream */
+		rt_thread_mdelay(round % 10);
+		dummy_hcd_disconnect(hcd, 1);
+		SIM_CHECK(rt_sem_take(&test_drv.gone, 2000) == RT_EOK);
+		test_check_leaks();
+		submitted += rt_atomic_load(&test_drv.submitted);
+	}
+	SIM_CHECK(test_drv.in_bytes > 0);
+	SIM_CHECK(test_drv.in_bytes == sd.in_bytes);
+
+	printf("%d unplugs with %d urbs queued, %llu submissions, no leaks\n",
+			TEST_ROUNDS, TEST_IN_URBS + TEST_OUT_URBS,
+			(unsigned long long)submitted);
+	usb_deregister(&test_drv.driver);
+	for (i = 0; i < TEST_OUT_URBS + TEST_IDLE_URBS; i++)
+		usb_free_urb(test_drv.urbs[i]);
+	rt_sem_detach(&test_drv.probed);
+	rt_sem_detach(&test_drv.gone);
+	sim_device_release(&sd);
+	return 0;
+}
@@ -0,0 +1,250 @@
+/*
+ * test_bandwidth.c - the periodic schedule under synthetic loads
+ *
+ * Fills the high speed schedule of a dummy_hcd with sets of made-up
+ * interrupt and isochronous endpoints, one reservation at a time, and
+ * prints where it ended up: how many of each set were placed, the load
+ * of the busiest, idlest and average slot, and how fragmented the free
+ * time is.  Along the way no slot may exceed its budget, a refused
+ * reservation must leave the table as it was, identical endpoints must
+ * spread evenly over their phases, and a failed swap must put the old
+ * endpoints back in their very slots.
+ */
+
+#include "sim.h"
+
+#define TEST_MAX_EPS	256
+
+struct test_set {
+	const char	*name;
+	int		speed;
+	uint8_t		addr;
+	uint8_t		attr;
+	uint16_t	maxp;		/* with the mult bits */
+	uint8_t		interval;
+	int		count;		/* to try; refusals end the set */
+	int		expect;		/* placed, -1 if it depends */
+};
+
+static struct usb_device test_devs[3];	/* low, full and high speed */
+static struct usb_host_endpoint test_eps[TEST_MAX_EPS];
+static struct usb_host_endpoint *test_placed[TEST_MAX_EPS];
+static int test_nplaced;
+
+static struct usb_device *test_dev(struct usb_hcd *hcd, int speed)
+{
+	struct usb_device *udev = &test_devs[speed - USB_SPEED_LOW];
+
+	udev->speed = speed;
+	udev->bus = &hcd->self;
+	udev->parent = hcd->self.root_hub;
+	return udev;
+}
+
+static void test_check_budget(struct usb_bus *bus)
+{
+	int slot;
+
+	for (slot = 0; slot < bus->bw_slots; slot++)
+		SIM_CHECK(bus->bw_load[slot] <= bus->bw_budget);
+}
+
+static int test_reserve(struct usb_hcd *hcd, struct usb_host_endpoint *ep)
+{
+	int ret;
+
+	rt_mutex_take(hcd->bandwidth_mutex, RT_WAITING_FOREVER);
+	ret = usb_bandwidth_reserve(&hcd->self, &ep, 1);
+	rt_mutex_release(hcd->bandwidth_mutex);
+	return ret;
+}
+
+static void test_report(struct usb_hcd *hcd, const char *name, int placed,
+		int tried)
+{
+	struct usb_bandwidth_stats st;
+
+	usb_bandwidth_get_stats(&hcd->self, &st);
+	printf("%-34s %3d/%-3d  load max %3d min %3d avg %3d of %d us, "
+			"fragmentation %3d.%d%%\n", name, placed, tried,
+			st.max_load, st.min_load, st.avg_load, st.budget,
+			st.fragmentation / 10, st.fragmentation % 10);
+	fflush(stdout);
+}
+
+static void test_ep_init(struct usb_hcd *hcd, struct usb_host_endpoint *ep,
+		const struct test_set *set)
+{
+	rt_memset(ep, 0, sizeof(*ep));
+	ep->udev = test_dev(hcd, set->speed);
+	ep->desc.bLength = USB_DESC_LENGTH_ENDPOINT;
+	ep->desc.bDescriptorType = USB_DESC_TYPE_ENDPOINT;
+	ep->desc.bEndpointAddress = set->addr;
+	ep->desc.bmAttributes = set->attr;
+	ep->desc.wMaxPacketSize = set->maxp;
+	ep->desc.bInterval = set->interval;
+}
+
+/* places what fits of @set; returns how many did */
+static int test_fill(struct usb_hcd *hcd, const struct test_set *set)
+{
+	static rt_uint16_t before[USB_BW_SLOTS];
+	struct usb_bus *bus = &hcd->self;
+	struct usb_host_endpoint *ep;
+	int i, placed = 0, ret;
+
+	for (i = 0; i < set->count; i++) {
+		SIM_CHECK(test_nplaced < TEST_MAX_EPS);
+		ep = &test_eps[test_nplaced];
+		test_ep_init(hcd, ep, set);
+
+		rt_memcpy(before, bus->bw_load, sizeof(before));
+		ret = test_reserve(hcd, ep);
+		if (ret) {
+			/* all or nothing */
+			SIM_CHECK(ret == -ENOSPC);
+			SIM_CHECK(!rt_memcmp(before, bus->bw_load,
+					sizeof(before)));
+			SIM_CHECK(ep->bw_period == 0);
+			break;
+		}
+		SIM_CHECK(ep->bw_period && ep->bw_phase < ep->bw_period);
+		test_check_budget(bus);
+		test_placed[test_nplaced++] = ep;
+		placed++;
+	}
+	test_report(hcd, set->name, placed, set->count);
+	return placed;
+}
+
+static void test_release_all(struct usb_hcd *hcd)
+{
+	struct usb_bus *bus = &hcd->self;
+	int slot;
+
+	rt_mutex_take(hcd->bandwidth_mutex, RT_WAITING_FOREVER);
+	usb_bandwidth_release(bus, test_placed, test_nplaced);
+	rt_mutex_release(hcd->bandwidth_mutex);
+	test_nplaced = 0;
+
+	for (slot = 0; slot < bus->bw_slots; slot++)
+		SIM_CHECK(bus->bw_load[slot] == 0);
+	SIM_CHECK(bus->bandwidth_allocated == 0);
+	SIM_CHECK(bus->bandwidth_int_reqs == 0);
+	SIM_CHECK(bus->bandwidth_isoc_reqs == 0);
+}
+
+/* identical endpoints on an empty schedule take turns over the phases */
+static void test_spread(struct usb_hcd *hcd)
+{
+	static const struct test_set hid = {
+		"HS HID 64 B / 1 ms, spread", USB_SPEED_HIGH, USB_DIR_IN | 1,
+		USB_EP_ATTR_INT, 64, 4, 36, 36,
+	};
+	int per_phase[8] = { 0 }, i, lo = 1000, hi = 0;
+
+	SIM_CHECK(test_fill(hcd, &hid) == hid.expect);
+	for (i = 0; i < test_nplaced; i++) {
+		SIM_CHECK(test_placed[i]->bw_period == 8);
+		per_phase[test_placed[i]->bw_phase]++;
+	}
+	for (i = 0; i < 8; i++) {
+		if (per_phase[i] < lo)
+			lo = per_phase[i];
+		if (per_phase[i] > hi)
+			hi = per_phase[i];
+	}
+	SIM_CHECK(hi - lo <= 1);
+	test_release_all(hcd);
+}
+
+/* several device classes sharing the bus until it is full */
+static void test_mixed(struct usb_hcd *hcd)
+{
+	static const struct test_set sets[] = {
+		{ "HS HID 64 B / 1 ms", USB_SPEED_HIGH, USB_DIR_IN | 1,
+			USB_EP_ATTR_INT, 64, 4, 24, 24 },
+		{ "FS HID 8 B / 8 ms (no TT)", USB_SPEED_FULL, USB_DIR_IN | 1,
+			USB_EP_ATTR_INT, 8, 8, 16, 16 },
+		/* without a TT model its 118 us never fit a microframe */
+		{ "LS keyboard 8 B / 8 ms (no TT)", USB_SPEED_LOW,
+			USB_DIR_IN | 1, USB_EP_ATTR_INT, 8, 10, 4, 0 },
+		{ "HS audio out 192 B / 125 us", USB_SPEED_HIGH, 2,
+			USB_EP_ATTR_ISOC, 192, 1, 4, 4 },
+		/* 66 us, one stream per microframe at most */
+		{ "HS video in 3x1024 B / 125 us", USB_SPEED_HIGH,
+			USB_DIR_IN | 3, USB_EP_ATTR_ISOC, 1024 | (2 << 11), 1,
+			4, -1 },
+		{ "HS HID 64 B / 1 ms, to the brim", USB_SPEED_HIGH,
+			USB_DIR_IN | 1, USB_EP_ATTR_INT, 64, 4, 200, -1 },
+	};
+	struct usb_bandwidth_stats st;
+	unsigned int i;
+	int placed;
+
+	for (i = 0; i < sizeof(sets) / sizeof(sets[0]); i++) {
+		placed = test_fill(hcd, &sets[i]);
+		if (sets[i].expect >= 0)
+			SIM_CHECK(placed == sets[i].expect);
+	}
+	/* filled up: the last set ended on a refusal */
+	usb_bandwidth_get_stats(&hcd->self, &st);
+	SIM_CHECK(st.int_reqs < 24 + 16 + 200);
+	SIM_CHECK(st.isoc_reqs <= 4 + 1);
+	test_release_all(hcd);
+}
+
+/* a configuration that does not fit leaves the old one where it was */
+static void test_swap(struct usb_hcd *hcd)
+{
+	static const struct test_set old = {
+		"swap: old set", USB_SPEED_HIGH, USB_DIR_IN | 1,
+		USB_EP_ATTR_INT, 64, 4, 12, 12,
+	};
+	/* one of these fills a microframe on its own */
+	static const struct test_set video = {
+		"swap: new set", USB_SPEED_HIGH, USB_DIR_IN | 3,
+		USB_EP_ATTR_ISOC, 1024 | (2 << 11), 1, 2, 2,
+	};
+	struct usb_host_endpoint *old_eps[12], *new_eps[2];
+	rt_uint16_t phases[12];
+	int i;
+
+	SIM_CHECK(test_fill(hcd, &old) == old.expect);
+	for (i = 0; i < 12; i++) {
+		old_eps[i] = test_placed[i];
+		phases[i] = old_eps[i]->bw_phase;
+	}
+	for (i = 0; i < 2; i++) {
+		new_eps[i] = &test_eps[12 + i];
+		test_ep_init(hcd, new_eps[i], &video);
+	}
+
+	SIM_CHECK(usb_hcd_check_bandwidth(old_eps[0]->udev, old_eps, 12,
+			new_eps, 2) == -ENOSPC);
+	for (i = 0; i < 12; i++) {
+		SIM_CHECK(old_eps[i]->bw_period == 8);
+		SIM_CHECK(old_eps[i]->bw_phase == phases[i]);
+	}
+	SIM_CHECK(!new_eps[0]->bw_period && !new_eps[1]->bw_period);
+
+	/* no configuration has more endpoints than that */
+	SIM_CHECK(usb_hcd_check_bandwidth(old_eps[0]->udev, old_eps,
+			USB_MAXENDPOINTS + 1, new_eps, 2) == -EINVAL);
+	SIM_CHECK(old_eps[0]->bw_phase == phases[0]);
+
+	test_check_budget(&hcd->self);
+	test_report(hcd, "swap refused, old set back", 12, 12);
+	test_release_all(hcd);
+}
+
+int main(void)
+{
+	struct usb_hcd *hcd = sim_start();
+
+	SIM_CHECK(hcd->self.bw_slots == USB_BW_FRAMES * 8);
+	test_spread(hcd);
+	test_mixed(hcd);
+	test_swap(hcd);
+	return 0;
+}
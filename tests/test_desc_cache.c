@@ -0,0 +1,134 @@
+/*
+ * test_desc_cache.c - configuration descriptors shared between devices
+ *
+ * Identical simulated devices have to end up with one cached copy of
+ * their raw configuration descriptors.  A device that looks the same
+ * from its device descriptor but whose configuration differs, in a
+ * byte or in its length, must be caught by the check read and parsed
+ * from its own descriptors, without disturbing the devices still using
+ * the old entry.  Another bcdDevice is another entry.
+ */
+
+#include "sim.h"
+
+#define TEST_VID	0x1d6b
+#define TEST_PID	0x0109
+
+static const struct sim_ep test_eps[] = {
+	{ USB_DIR_IN | 1, USB_EP_ATTR_BULK, 512, 0 },
+	{ 2, USB_EP_ATTR_BULK, 512, 0 },
+};
+
+/* wMaxPacketSize of the first endpoint, see sim_device_init() */
+#define TEST_MAXP_OFFSET	(USB_DESC_LENGTH_CONFIG + \
+				 USB_DESC_LENGTH_INTERFACE + 4)
+
+static struct sim_driver test_drv;
+
+static struct usb_device *test_plug(struct usb_hcd *hcd, int port1,
+		struct sim_device *sd)
+{
+	struct usb_interface *intf;
+
+	SIM_CHECK(dummy_hcd_connect(hcd, port1, &sd->vdev) == 0);
+	intf = sim_wait_probe(&test_drv, 2000);
+	SIM_CHECK(intf != RT_NULL);
+	return intf->udev;
+}
+
+static void test_unplug(struct usb_hcd *hcd, int port1)
+{
+	dummy_hcd_disconnect(hcd, port1);
+	SIM_CHECK(sim_wait_disconnect(&test_drv, 2000) == 0);
+}
+
+/* what was parsed, from whichever copy */
+static void test_check_parsed(struct usb_device *udev, int neps, int maxp)
+{
+	struct usb_host_interface *alt =
+			udev->actconfig->interface[0]->cur_altsetting;
+
+	SIM_CHECK(alt->desc.bNumEndpoints == neps);
+	SIM_CHECK((alt->endpoint[0].desc.wMaxPacketSize & 0x7ff) == maxp);
+}
+
+int main(void)
+{
+	struct sim_device a, b, c, d, e;
+	struct usb_device *ua, *ub, *uc, *ud, *ue;
+	struct usb_hcd *hcd;
+
+	hcd = sim_start();
+	sim_driver_register(&test_drv, TEST_VID, TEST_PID);
+	sim_device_init(&a, USB_SPEED_HIGH, TEST_VID, TEST_PID, 0xff,
+			test_eps, 2);
+	sim_device_init(&b, USB_SPEED_HIGH, TEST_VID, TEST_PID, 0xff,
+			test_eps, 2);
+
+	/* the first one fills the cache, the second one shares it */
+	ua = test_plug(hcd, 1, &a);
+	SIM_CHECK(ua->desc_cache != RT_NULL);
+	ub = test_plug(hcd, 2, &b);
+	SIM_CHECK(ub->desc_cache == ua->desc_cache);
+	SIM_CHECK(ub->rawdescriptors[0] == ua->rawdescriptors[0]);
+	test_check_parsed(ub, 2, 512);
+
+	/* same device descriptor, one byte off in the configuration */
+	sim_device_init(&c, USB_SPEED_HIGH, TEST_VID, TEST_PID, 0xff,
+			test_eps, 2);
+	c.config[TEST_MAXP_OFFSET] = 64;
+	c.config[TEST_MAXP_OFFSET + 1] = 0;
+	uc = test_plug(hcd, 3, &c);
+	SIM_CHECK(uc->desc_cache != ua->desc_cache);
+	SIM_CHECK(uc->rawdescriptors[0] != ua->rawdescriptors[0]);
+	test_check_parsed(uc, 2, 64);
+	/* the old entry lives on for the devices using it */
+	test_check_parsed(ua, 2, 512);
+	test_check_parsed(ub, 2, 512);
+	SIM_CHECK(!rt_memcmp(ua->rawdescriptors[0], a.config,
+			a.config[2] | (a.config[3] << 8)));
+
+	/* same device descriptor, a configuration of another length */
+	sim_device_init(&d, USB_SPEED_HIGH, TEST_VID, TEST_PID, 0xff,
+			test_eps, 1);
+	ud = test_plug(hcd, 4, &d);
+	SIM_CHECK(ud->desc_cache != uc->desc_cache);
+	test_check_parsed(ud, 1, 512);
+	test_check_parsed(uc, 2, 64);
+
+	/* replugged, the first model is fetched once more and cached
+	 * again, then shared by the next one like before */
+	test_unplug(hcd, 1);
+	test_unplug(hcd, 3);
+	ua = test_plug(hcd, 1, &a);
+	test_check_parsed(ua, 2, 512);
+	SIM_CHECK(ua->desc_cache != RT_NULL);
+	SIM_CHECK(ua->desc_cache != ud->desc_cache);
+	test_unplug(hcd, 2);
+	ub = test_plug(hcd, 2, &b);
+	SIM_CHECK(ub->desc_cache == ua->desc_cache);
+
+	/* another revision is another entry, and doesn't evict this one */
+	sim_device_init(&e, USB_SPEED_HIGH, TEST_VID, TEST_PID, 0xff,
+			test_eps, 1);
+	e.desc.bcdDevice = 0x0200;
+	ue = test_plug(hcd, 3, &e);
+	SIM_CHECK(ue->desc_cache != ud->desc_cache);
+	SIM_CHECK(ue->desc_cache != ua->desc_cache);
+	test_unplug(hcd, 2);
+	ub = test_plug(hcd, 2, &b);
+	SIM_CHECK(ub->desc_cache == ua->desc_cache);
+
+	printf("shared, mismatched byte and length caught, revisions apart\n");
+	test_unplug(hcd, 1);
+	test_unplug(hcd, 2);
+	test_unplug(hcd, 3);
+	test_unplug(hcd, 4);
+	sim_driver_unregister(&test_drv);
+	sim_device_release(&a);
+	sim_device_release(&b);
+	sim_device_release(&c);
+	sim_device_release(&d);
+	sim_device_release(&e);
+	return 0;
+}
@@ -0,0 +1,164 @@
+/*
+ * test_devnum.c - the device address allocator
+ *
+ * On a bus of its own, usb_alloc_devnum() has to hand out 1..127 in
+ * order, fail with -ENOSPC once they are all taken without touching the
+ * map, continue after the last address it gave out rather than reuse one
+ * that was just freed, and wrap around from 127 to 1.  Several threads
+ * allocating and freeing at once must never hold the same address.
+ */
+
+#include "sim.h"
+
+#define TEST_THREADS	4
+#define TEST_ROUNDS	20000
+
+static int test_is_set(struct usb_bus *bus, int devnum)
+{
+	return (rt_atomic_load(&bus->devmap.devicemap[devnum /
+			USB_DEVMAP_BITS]) >> (devnum % USB_DEVMAP_BITS)) & 1;
+}
+
+static void test_exhaust(struct usb_bus *bus)
+{
+	struct usb_devmap before;
+	int i;
+
+	for (i = 1; i <= 127; i++)
+		SIM_CHECK(usb_alloc_devnum(bus) == i);
+	SIM_CHECK(!test_is_set(bus, 0));
+
+	before = bus->devmap;
+	SIM_CHECK(usb_alloc_devnum(bus) == -ENOSPC);
+	SIM_CHECK(!rt_memcmp(&before, &bus->devmap, sizeof(before)));
+
+	/* the only free one is found wherever the cursor is */
+	usb_free_devnum(bus, 64);
+	SIM_CHECK(usb_alloc_devnum(bus) == 64);
+	SIM_CHECK(usb_alloc_devnum(bus) == -ENOSPC);
+
+	/* out of range is ignored */
+	usb_free_devnum(bus, 0);
+	usb_free_devnum(bus, -ENOSPC);
+	usb_free_devnum(bus, 128);
+	SIM_CHECK(!rt_memcmp(&before, &bus->devmap, sizeof(before)));
+
+	for (i = 1; i <= 127; i++)
+		usb_free_devnum(bus, i);
+	for (i = 0; i < 128; i++)
+		SIM_CHECK(!test_is_set(bus, i));
+}
+
+static void test_round_robin(struct usb_bus *bus)
+{
+	int i;
+
+	rt_atomic_store(&bus->devnum_next, 1);
+	for (i = 1; i <= 10; i++)
+		SIM_CHECK(usb_alloc_devnum(bus) == i);
+
+	/* a freed address waits until the cursor comes round again */
+	usb_free_devnum(bus, 3);
+	SIM_CHECK(usb_alloc_devnum(bus) == 11);
+	usb_free_devnum(bus, 11);
+	SIM_CHECK(usb_alloc_devnum(bus) == 12);
+
+	for (i = 1; i <= 12; i++)
+		usb_free_devnum(bus, i);
+}
+
+static void test_wraparound(struct usb_bus *bus)
+{
+	int i;
+
+	/* the cursor starts over at 1 after 127 */
+	rt_atomic_store(&bus->devnum_next, 126);
+	SIM_CHECK(usb_alloc_devnum(bus) == 126);
+	SIM_CHECK(usb_alloc_devnum(bus) == 127);
+	SIM_CHECK(usb_alloc_devnum(bus) == 1);
+	SIM_CHECK(usb_alloc_devnum(bus) == 2);
+
+	/* and skips what is in use on the way */
+	for (i = 3; i <= 125; i++)
+		SIM_CHECK(usb_alloc_devnum(bus) == i);
+	usb_free_devnum(bus, 127);
+	usb_free_devnum(bus, 5);
+	SIM_CHECK(usb_alloc_devnum(bus) == 127);
+	SIM_CHECK(usb_alloc_devnum(bus) == 5);
+	SIM_CHECK(usb_alloc_devnum(bus) == -ENOSPC);
+
+	/* an out of range cursor counts as 1 */
+	for (i = 1; i <= 127; i++)
+		usb_free_devnum(bus, i);
+	rt_atomic_store(&bus->devnum_next, 0);
+	SIM_CHECK(usb_alloc_devnum(bus) == 1);
+	rt_atomic_store(&bus->devnum_next, 200);
+	SIM_CHECK(usb_alloc_devnum(bus) == 2);
+	usb_free_devnum(bus, 1);
+	usb_free_devnum(bus, 2);
+}
+
+/*-------------------------------------------------------------------------*/
+
+static struct usb_bus test_bus;
+static atomic_t test_owner[128];
+static struct rt_semaphore test_finished;
+
+static void test_thread_entry(void *parameter)
+{
+	atomic_t me = (atomic_t)(rt_ubase_t)parameter, none;
+	int i, devnum;
+
+	for (i = 0; i < TEST_ROUNDS; i++) {
+		devnum = usb_alloc_devnum(&test_bus);
+		if (devnum == -ENOSPC)
+			continue;
+		SIM_CHECK(devnum >= 1 && devnum <= 127);
+		none = 0;
+		SIM_CHECK(rt_atomic_compare_exchange_strong(
+				&test_owner[devnum], &none, me));
+		rt_atomic_store(&test_owner[devnum], 0);
+		usb_free_devnum(&test_bus, devnum);
+	}
+	rt_sem_release(&test_finished);
+}
+
+static void test_concurrent(void)
+{
+	rt_thread_t tid;
+	int i;
+
+	/* most addresses taken, so the threads fight over a few words */
+	for (i = 1; i <= 100; i++)
+		SIM_CHECK(usb_alloc_devnum(&test_bus) == i);
+
+	rt_sem_init(&test_finished, "test", 0, RT_IPC_FLAG_FIFO);
+	for (i = 0; i < TEST_THREADS; i++) {
+		tid = rt_thread_create("devnum", test_thread_entry,
+				(void *)(rt_ubase_t)(i + 1), 4096, 10, 10);
+		SIM_CHECK(tid != RT_NULL);
+		rt_thread_startup(tid);
+	}
+	for (i = 0; i < TEST_THREADS; i++)
+		SIM_CHECK(rt_sem_take(&test_finished, 30000) == RT_EOK);
+	rt_sem_detach(&test_finished);
+
+	/* what was held before is still held, the rest is free again */
+	for (i = 1; i < 128; i++)
+		SIM_CHECK(test_is_set(&test_bus, i) == (i <= 100));
+}
+
+int main(void)
+{
+	struct usb_bus bus;
+
+	rt_components_init();
+	rt_memset(&bus, 0, sizeof(bus));
+	test_exhaust(&bus);
+	test_round_robin(&bus);
+	test_wraparound(&bus);
+	test_concurrent();
+	printf("%d threads, %d allocations each, no address held twice\n",
+			TEST_THREADS, TEST_ROUNDS);
+	return 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * test_hub.c - devices behind a tree of virtual hubs
+ *
+ * Six hubs chained five deep below the root hub's first port, with
+ * devices at several tiers and one more on the second root port.  All
+ * of them must be enumerated with the right level and route and answer
+ * at their own address, except the one behind the hub in the sixth
+ * tier, which is beyond HUB_MAX_DEPTH.  Unplugging a hub in the middle
+ * takes exactly the devices below it away, and they come back when it
+ * is plugged in again.
+ */
+
+#include "sim.h"
+
+#define TEST_VID	0x1d6b
+#define TEST_PID	0x0107
+#define TEST_DEVS	6
+#define TEST_HUBS	6
+
+static const struct sim_ep test_eps[] = {
+	{ USB_DIR_IN | 1, USB_EP_ATTR_BULK, 512, 0 },
+};
+
+/* where each device goes; the last one is too deep to be reached */
+static const char *const test_routes[TEST_DEVS] = {
+	"2", "1.2", "1.1.2", "1.1.1.1", "1.1.1.2.1.2", "1.1.1.2.1.1.1",
+};
+
+/* the route of @udev from the root hub, like "1.1.2"; its length */
+static int test_route(struct usb_device *udev, char *buf, int size)
+{
+	uint8_t ports[HUB_MAX_DEPTH + 2];
+	int n = 0, len = 0, i;
+
+	for (; udev->parent; udev = udev->parent) {
+		SIM_CHECK(n < (int)sizeof(ports));
+		ports[n++] = udev->portnum;
+	}
+	buf[0] = '\0';
+	for (i = n - 1; i >= 0; i--)
+		len += rt_snprintf(buf + len, size - len, i ? "%d." : "%d",
+				ports[i]);
+	return n;
+}
+
+/* all bound devices sit where they should and answer on their own */
+static void test_check_bound(struct sim_driver *sdrv, int expect)
+{
+	uint8_t seen[128] = { 0 }, buf[512];
+	struct usb_device *udev;
+	char route[32];
+	int i, j, n, actual;
+
+	SIM_CHECK(sdrv->nbound == expect);
+	for (i = 0; i < sdrv->nbound; i++) {
+		udev = sdrv->intf[i]->udev;
+		n = test_route(udev, route, sizeof(route));
+		for (j = 0; j < TEST_DEVS - 1; j++)
+			if (!rt_strcmp(route, test_routes[j]))
+				break;
+		SIM_CHECK(j < TEST_DEVS - 1);
+		SIM_CHECK(udev->level == n);
+		SIM_CHECK(udev->level <= HUB_MAX_DEPTH + 1);
+
+		SIM_CHECK(udev->devnum > 0 && udev->devnum < 128);
+		SIM_CHECK(!seen[udev->devnum]);
+		seen[udev->devnum] = 1;
+
+		SIM_CHECK(usb_bulk_msg(udev, usb_rcvbulkpipe(udev, 1), buf,
+				sizeof(buf), &actual, 1000) == 0);
+		SIM_CHECK(actual == (int)sizeof(buf));
+		printf("%-14s level %d, address %3d\n", route, udev->level,
+				udev->devnum);
+	}
+	fflush(stdout);
+}
+
+static void test_wait_probes(struct sim_driver *sdrv, int n)
+{
+	while (n--)
+		SIM_CHECK(sim_wait_probe(sdrv, 5000) != RT_NULL);
+}
+
+static void test_wait_gone(struct sim_driver *sdrv, int n)
+{
+	while (n--)
+		SIM_CHECK(sim_wait_disconnect(sdrv, 5000) == 0);
+	SIM_CHECK(sim_wait_disconnect(sdrv, 300) == -ETIMEDOUT);
+}
+
+int main(void)
+{
+	struct dummy_device *hubs[TEST_HUBS];
+	struct sim_device devs[TEST_DEVS];
+	struct sim_driver sdrv;
+	struct usb_hcd *hcd;
+	rt_uint64_t start;
+	int i;
+
+	hcd = sim_start();
+	sim_driver_register(&sdrv, TEST_VID, TEST_PID);
+	for (i = 0; i < TEST_DEVS; i++)
+		sim_device_init(&devs[i], USB_SPEED_HIGH, TEST_VID, TEST_PID,
+				0xff, test_eps, 1);
+	for (i = 0; i < TEST_HUBS; i++) {
+		hubs[i] = dummy_hub_create(i < 2 ? 4 : 2);
+		SIM_CHECK(hubs[i] != RT_NULL);
+	}
+	SIM_CHECK(dummy_hub_create(DUMMY_HUB_PORTS + 1) == RT_NULL);
+
+	/* the tree is built unplugged and comes along as a whole */
+	SIM_CHECK(dummy_hub_connect(hubs[0], 1, hubs[1]) == 0);
+	SIM_CHECK(dummy_hub_connect(hubs[0], 2, &devs[1].vdev) == 0);
+	SIM_CHECK(dummy_hub_connect(hubs[1], 1, hubs[2]) == 0);
+	SIM_CHECK(dummy_hub_connect(hubs[1], 2, &devs[2].vdev) == 0);
+	SIM_CHECK(dummy_hub_connect(hubs[2], 1, &devs[3].vdev) == 0);
+	SIM_CHECK(dummy_hub_connect(hubs[2], 2, hubs[3]) == 0);
+	SIM_CHECK(dummy_hub_connect(hubs[3], 1, hubs[4]) == 0);
+	SIM_CHECK(dummy_hub_connect(hubs[4], 2, &devs[4].vdev) == 0);
+	SIM_CHECK(dummy_hub_connect(hubs[4], 1, hubs[5]) == 0);
+	SIM_CHECK(dummy_hub_connect(hubs[5], 1, &devs[5].vdev) == 0);
+
+	/* no cycles, no device in two places, no port twice */
+	SIM_CHECK(dummy_hub_connect(hubs[5], 2, hubs[0]) == -ELOOP);
+	SIM_CHECK(dummy_hub_connect(hubs[0], 3, hubs[2]) == -EBUSY);
+	SIM_CHECK(dummy_hub_connect(hubs[0], 2, &devs[0].vdev) == -EBUSY);
+	SIM_CHECK(dummy_hub_connect(hubs[0], 5, &devs[0].vdev) == -EINVAL);
+	SIM_CHECK(dummy_hub_connect(&devs[0].vdev, 1, hubs[0]) == -EINVAL);
+
+	start = sim_usecs();
+	SIM_CHECK(dummy_hcd_connect(hcd, 1, hubs[0]) == 0);
+	SIM_CHECK(dummy_hcd_connect(hcd, 2, &devs[0].vdev) == 0);
+	test_wait_probes(&sdrv, TEST_DEVS - 1);
+	printf("%d devices behind %d hubs configured in %llu ms\n",
+			TEST_DEVS - 1, TEST_HUBS - 1,
+			(unsigned long long)(sim_usecs() - start) / 1000);
+	/* and no more: nothing behind the hub past the last tier */
+	SIM_CHECK(sim_wait_probe(&sdrv, 500) == RT_NULL);
+	test_check_bound(&sdrv, TEST_DEVS - 1);
+	SIM_CHECK(devs[5].vdev.address == 0);
+
+	/* the middle of the tree goes, and everything below it */
+	dummy_hub_disconnect(hubs[0], 1);
+	test_wait_gone(&sdrv, 3);
+	test_check_bound(&sdrv, 2);
+
+	SIM_CHECK(dummy_hub_connect(hubs[0], 1, hubs[1]) == 0);
+	test_wait_probes(&sdrv, 3);
+	SIM_CHECK(sim_wait_probe(&sdrv, 500) == RT_NULL);
+	test_check_bound(&sdrv, TEST_DEVS - 1);
+
+	dummy_hcd_disconnect(hcd, 1);
+	test_wait_gone(&sdrv, TEST_DEVS - 2);
+	dummy_hcd_disconnect(hcd, 2);
+	test_wait_gone(&sdrv, 1);
+	SIM_CHECK(sdrv.nbound == 0);
+
+	/* the hubs' own teardown runs after their children's drivers */
+	rt_thread_mdelay(200);
+	for (i = 0; i < TEST_HUBS; i++)
+		dummy_hub_destroy(hubs[i]);
+	sim_driver_unregister(&sdrv);
+	for (i = 0; i < TEST_DEVS; i++)
+		sim_device_release(&devs[i]);
+	return 0;
+}
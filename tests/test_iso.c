@@ -0,0 +1,170 @@
+/*
+ * test_iso.c - isochronous streams over a long run
+ *
+ * A high speed audio device with a 48 kHz, six channel, 16 bit capture
+ * and playback endpoint, 576 bytes every 1 ms frame, streamed through
+ * usb_iso_stream for several seconds, past frame number wraparound.
+ * No packet may be late, every urb has to start in the frame right
+ * after the one before it ended, and the endpoints must not count a
+ * single underrun or overrun; every captured byte has to arrive.  Then
+ * the capture side is held up for longer than it has queued: the urbs
+ * already scheduled still go out in their frames, the frames after them
+ * must be counted as underruns, and the stream has to pick up again by
+ * itself from the next free frame.
+ */
+
+#include "sim.h"
+
+#define TEST_VID	0x1d6b
+#define TEST_PID	0x010b
+#define TEST_PACKET	576		/* 48 samples * 6 channels * 2 bytes */
+#define TEST_URBS	4
+#define TEST_PACKETS	8		/* per urb, 32 ms queued in all */
+#define TEST_FRAMES	5000
+#define TEST_STALL_MS	50
+
+static const struct sim_ep test_eps[] = {
+	{ USB_DIR_IN | 1, USB_EP_ATTR_ISOC, TEST_PACKET, 4 },
+	{ 2, USB_EP_ATTR_ISOC, TEST_PACKET, 4 },
+};
+
+struct test_stats {
+	rt_uint32_t	packets;
+	rt_uint32_t	late;		/* -EXDEV, missed their frame */
+	rt_uint32_t	errors;		/* anything else */
+	rt_uint32_t	gaps;		/* urbs not right behind the last */
+	rt_uint32_t	after_gap;	/* clean urbs since the first gap */
+	rt_uint64_t	bytes;
+	int		next_frame;	/* -1 until the first urb */
+	int		stall_ms;	/* once, from the completion */
+};
+
+static struct test_stats test_in, test_out;
+
+static void test_complete(struct usb_iso_stream *stream, struct urb *urb)
+{
+	struct test_stats *ts = stream->context;
+	int i, late = 0;
+
+	ts->bytes += urb->actual_length;
+	if (urb->status)
+		return;		/* killed at the end of a run */
+
+	if (ts->next_frame >= 0 && urb->start_frame != ts->next_frame)
+		ts->gaps++;
+	ts->next_frame = (urb->start_frame + urb->number_of_packets *
+			usb_ep_frame_interval(urb->dev, stream->ep)) &
+			USB_FRAME_MASK;
+
+	for (i = 0; i < urb->number_of_packets; i++) {
+		ts->packets++;
+		if (urb->iso_frame_desc[i].status == -EXDEV)
+			late++;
+		else if (urb->iso_frame_desc[i].status)
+			ts->errors++;
+	}
+	ts->late += late;
+	if (!late && ts->gaps)
+		ts->after_gap++;
+
+	if (ts->stall_ms) {
+		rt_thread_mdelay(ts->stall_ms);
+		ts->stall_ms = 0;
+	}
+}
+
+static void test_reset(struct test_stats *ts)
+{
+	rt_memset(ts, 0, sizeof(*ts));
+	ts->next_frame = -1;
+}
+
+/* until both have seen @packets, stopped again */
+static void test_run(struct usb_iso_stream *in, struct usb_iso_stream *out,
+		rt_uint32_t packets)
+{
+	int ms;
+
+	SIM_CHECK(usb_iso_stream_start(in) == 0);
+	SIM_CHECK(usb_iso_stream_start(out) == 0);
+	for (ms = 0; test_in.packets < packets || test_out.packets < packets;
+			ms += 100) {
+		SIM_CHECK(ms < (int)packets * 4 + 5000);
+		rt_thread_mdelay(100);
+	}
+	usb_iso_stream_stop(in);
+	usb_iso_stream_stop(out);
+	SIM_CHECK(rt_atomic_load(&in->active) == 0);
+	SIM_CHECK(rt_atomic_load(&out->active) == 0);
+	SIM_CHECK(!in->error && !out->error);
+}
+
+static void test_report(const char *name, struct test_stats *ts,
+		struct usb_host_endpoint *ep)
+{
+	printf("%-9s %6u packets, %u late, %u errors, %u gaps, "
+			"%u underruns, %u overruns\n", name, ts->packets,
+			ts->late, ts->errors, ts->gaps, ep->iso_underruns,
+			ep->iso_overruns);
+	fflush(stdout);
+}
+
+int main(void)
+{
+	struct usb_iso_stream in, out;
+	struct usb_interface *intf;
+	struct usb_device *udev;
+	struct sim_driver sdrv;
+	struct sim_device sd;
+	struct usb_hcd *hcd;
+
+	hcd = sim_start();
+	sim_driver_register(&sdrv, TEST_VID, TEST_PID);
+	sim_device_init(&sd, USB_SPEED_HIGH, TEST_VID, TEST_PID, 0x01,
+			test_eps, 2);
+	SIM_CHECK(dummy_hcd_connect(hcd, 1, &sd.vdev) == 0);
+	intf = sim_wait_probe(&sdrv, 2000);
+	SIM_CHECK(intf != RT_NULL);
+	udev = intf->udev;
+
+	test_reset(&test_in);
+	test_reset(&test_out);
+	SIM_CHECK(usb_iso_stream_init(&in, udev, usb_rcvisocpipe(udev, 1),
+			TEST_URBS, TEST_PACKETS, TEST_PACKET, test_complete,
+			&test_in) == 0);
+	SIM_CHECK(usb_iso_stream_init(&out, udev, usb_sndisocpipe(udev, 2),
+			TEST_URBS, TEST_PACKETS, TEST_PACKET, test_complete,
+			&test_out) == 0);
+
+	/* steady state: not one frame late, not one byte lost */
+	test_run(&in, &out, TEST_FRAMES);
+	test_report("capture", &test_in, in.ep);
+	test_report("playback", &test_out, out.ep);
+	SIM_CHECK(test_in.late == 0 && test_out.late == 0);
+	SIM_CHECK(test_in.errors == 0 && test_out.errors == 0);
+	SIM_CHECK(test_in.gaps == 0 && test_out.gaps == 0);
+	SIM_CHECK(in.ep->iso_underruns == 0 && out.ep->iso_underruns == 0);
+	SIM_CHECK(in.ep->iso_overruns == 0 && out.ep->iso_overruns == 0);
+	SIM_CHECK(test_in.bytes == sd.in_bytes);
+	SIM_CHECK(test_out.bytes == sd.out_bytes);
+
+	/* a completion that sleeps through more than what is queued */
+	in.ep->iso_underruns = 0;
+	test_reset(&test_in);
+	test_reset(&test_out);
+	test_in.stall_ms = TEST_STALL_MS;
+	test_run(&in, &out, TEST_FRAMES / 5);
+	test_report("stalled", &test_in, in.ep);
+	SIM_CHECK(test_in.gaps == 1);
+	SIM_CHECK(in.ep->iso_underruns > 0);
+	SIM_CHECK(test_in.after_gap > 0);
+	SIM_CHECK(test_in.late == 0 && test_in.errors == 0);
+
+	usb_iso_stream_release(&in);
+	usb_iso_stream_release(&out);
+	dummy_hcd_disconnect(hcd, 1);
+	SIM_CHECK(sim_wait_disconnect(&sdrv, 2000) == 0);
+	sim_driver_unregister(&sdrv);
+	sim_device_release(&sd);
+	return 0;
+}
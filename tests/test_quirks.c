@@ -0,0 +1,203 @@
+/*
+ * test_quirks.c - quirk table lookups and quirky devices
+ *
+ * The lookup finds built-in and application entries by id and
+ * bcdDevice range, and refuses an unsorted table.  Then simulated
+ * revisions of one product, each listed with one quirk, are plugged in
+ * next to a revision without any: one whose strings are not read, one
+ * that stalls SET_INTERFACE, one that needs longer after SET_ADDRESS
+ * and one whose ep0 takes only 8 byte packets.
+ */
+
+#include "sim.h"
+
+#define TEST_VID	0x1d6b
+#define TEST_PID	0x0114
+
+static const struct sim_ep test_eps[] = {
+	{ USB_DIR_IN | 1, USB_EP_ATTR_BULK, 512, 0 },
+};
+
+/* alternate setting 1 of interface 0, without endpoints */
+static const uint8_t test_alt1[] = {
+	USB_DESC_LENGTH_INTERFACE, USB_DESC_TYPE_INTERFACE,
+	0, 1, 0, 0xff, 0, 0, 0,
+};
+
+static const char * const test_strings[] = {
+	"Quirky", "Test Vendor", "0001",
+};
+
+static const struct usb_quirk_entry test_table[] = {
+	USB_QUIRK_DEVICE(0x0001, 0x0001, USB_QUIRK_NO_STRINGS),
+	USB_QUIRK_DEVICE_VER(TEST_VID, TEST_PID, 0x0100, 0x0100,
+			USB_QUIRK_NO_STRINGS),
+	USB_QUIRK_DEVICE_VER(TEST_VID, TEST_PID, 0x0200, 0x0200,
+			USB_QUIRK_NO_SET_INTF),
+	USB_QUIRK_DEVICE_VER(TEST_VID, TEST_PID, 0x0300, 0x0300,
+			USB_QUIRK_DELAY_SET_ADDRESS),
+	USB_QUIRK_DEVICE_VER(TEST_VID, TEST_PID, 0x0400, 0x04ff,
+			USB_QUIRK_EP0_MAXP_8),
+	USB_QUIRK_DEVICE(0xfffe, 0x0001, USB_QUIRK_NO_SET_INTF),
+};
+
+static const struct usb_quirk_entry test_unsorted[] = {
+	USB_QUIRK_DEVICE(0xfffe, 0x0001, USB_QUIRK_NO_SET_INTF),
+	USB_QUIRK_DEVICE(0x0001, 0x0001, USB_QUIRK_NO_STRINGS),
+};
+
+static struct sim_driver test_drv;
+static rt_uint32_t test_set_intf;
+
+/* counts SET_INTERFACE, and stalls it like the device it stands for */
+static int test_setup(struct dummy_device *vdev,
+		const struct usb_ctrlrequest *req, void *buf)
+{
+	if (req->bRequest == USB_REQ_SET_INTERFACE &&
+			(req->bRequestType & USB_REQ_TYPE_RECIPIENT_MASK) ==
+			USB_REQ_TYPE_INTERFACE) {
+		test_set_intf++;
+		return -EPIPE;
+	}
+	if (req->bRequestType & USB_DIR_IN) {
+		rt_memset(buf, 0, req->wLength);
+		return req->wLength;
+	}
+	return 0;
+}
+
+static void test_init(struct sim_device *sd, uint16_t bcd)
+{
+	sim_device_init(sd, USB_SPEED_HIGH, TEST_VID, TEST_PID, 0xff,
+			test_eps, 1);
+	sim_device_extra(sd, test_alt1, sizeof(test_alt1));
+	sd->desc.bcdDevice = bcd;
+	sd->desc.iProduct = 1;
+	sd->desc.iManufacturer = 2;
+	sd->desc.iSerialNumber = 3;
+	sd->vdev.strings = test_strings;
+	sd->vdev.nstrings = 3;
+	sd->ops.setup = test_setup;
+}
+
+/* plugs @sd in, returns its device and how long it took to probe */
+static struct usb_device *test_plug(struct usb_hcd *hcd,
+		struct sim_device *sd, rt_uint64_t *usecs)
+{
+	struct usb_interface *intf;
+	rt_uint64_t start;
+
+	start = sim_usecs();
+	SIM_CHECK(dummy_hcd_connect(hcd, 1, &sd->vdev) == 0);
+	intf = sim_wait_probe(&test_drv, 2000);
+	SIM_CHECK(intf != RT_NULL);
+	if (usecs)
+		*usecs = sim_usecs() - start;
+	return intf->udev;
+}
+
+static void test_unplug(struct usb_hcd *hcd)
+{
+	dummy_hcd_disconnect(hcd, 1);
+	SIM_CHECK(sim_wait_disconnect(&test_drv, 2000) == 0);
+}
+
+static void test_lookup(void)
+{
+	/* built in */
+	SIM_CHECK(usb_quirks_lookup(0x046d, 0x0990, 0x0005) ==
+			USB_QUIRK_RESET_RESUME);
+	SIM_CHECK(usb_quirks_lookup(0x046d, 0x0991, 0x0005) == 0);
+
+	SIM_CHECK(usb_quirks_set_table(test_unsorted, 2) == -EINVAL);
+	SIM_CHECK(usb_quirks_lookup(0xfffe, 0x0001, 0) == 0);
+
+	SIM_CHECK(usb_quirks_set_table(test_table, sizeof(test_table) /
+			sizeof(test_table[0])) == 0);
+	SIM_CHECK(usb_quirks_lookup(0x0001, 0x0001, 0) ==
+			USB_QUIRK_NO_STRINGS);
+	SIM_CHECK(usb_quirks_lookup(0xfffe, 0x0001, 0xffff) ==
+			USB_QUIRK_NO_SET_INTF);
+	SIM_CHECK(usb_quirks_lookup(TEST_VID, TEST_PID, 0x0200) ==
+			USB_QUIRK_NO_SET_INTF);
+	SIM_CHECK(usb_quirks_lookup(TEST_VID, TEST_PID, 0x0480) ==
+			USB_QUIRK_EP0_MAXP_8);
+	/* between the ranges, and next to the id */
+	SIM_CHECK(usb_quirks_lookup(TEST_VID, TEST_PID, 0x0201) == 0);
+	SIM_CHECK(usb_quirks_lookup(TEST_VID, TEST_PID, 0x0500) == 0);
+	SIM_CHECK(usb_quirks_lookup(TEST_VID, TEST_PID - 1, 0x0100) == 0);
+	SIM_CHECK(usb_quirks_lookup(TEST_VID, TEST_PID + 1, 0x0100) == 0);
+	/* the built-in table still counts */
+	SIM_CHECK(usb_quirks_lookup(0x046d, 0x0990, 0) ==
+			USB_QUIRK_RESET_RESUME);
+}
+
+int main(void)
+{
+	struct sim_device plain, strings, set_intf, address, maxp8;
+	struct usb_device_descriptor desc;
+	struct usb_device *udev;
+	struct usb_hcd *hcd;
+	rt_uint64_t usecs;
+
+	hcd = sim_start();
+	test_lookup();
+	sim_driver_register(&test_drv, TEST_VID, TEST_PID);
+
+	/* no quirks: strings read, SET_INTERFACE sent and stalled */
+	test_init(&plain, 0x0500);
+	udev = test_plug(hcd, &plain, RT_NULL);
+	SIM_CHECK(udev->quirks == 0);
+	SIM_CHECK(udev->product && !rt_strcmp(udev->product, "Quirky"));
+	SIM_CHECK(udev->serial && !rt_strcmp(udev->serial, "0001"));
+	SIM_CHECK(udev->ep0.desc.wMaxPacketSize == 64);
+	test_set_intf = 0;
+	SIM_CHECK(usb_set_interface(udev, 0, 1) == -EPIPE);
+	SIM_CHECK(test_set_intf == 1);
+	test_unplug(hcd);
+
+	test_init(&strings, 0x0100);
+	udev = test_plug(hcd, &strings, RT_NULL);
+	SIM_CHECK(udev->quirks == USB_QUIRK_NO_STRINGS);
+	SIM_CHECK(!udev->product && !udev->manufacturer && !udev->serial);
+	test_unplug(hcd);
+
+	/* the switch is made without asking the device */
+	test_init(&set_intf, 0x0200);
+	udev = test_plug(hcd, &set_intf, RT_NULL);
+	SIM_CHECK(udev->quirks == USB_QUIRK_NO_SET_INTF);
+	test_set_intf = 0;
+	SIM_CHECK(usb_set_interface(udev, 0, 1) == 0);
+	SIM_CHECK(test_set_intf == 0);
+	SIM_CHECK(udev->actconfig->interface[0]->cur_altsetting->
+			desc.bAlternateSetting == 1);
+	test_unplug(hcd);
+
+	test_init(&address, 0x0300);
+	udev = test_plug(hcd, &address, &usecs);
+	SIM_CHECK(udev->quirks == USB_QUIRK_DELAY_SET_ADDRESS);
+	SIM_CHECK(usecs >= USB_QUIRK_ADDRESS_DELAY * 1000);
+	test_unplug(hcd);
+
+	/* 8 byte packets although the descriptor says 64 */
+	test_init(&maxp8, 0x0420);
+	udev = test_plug(hcd, &maxp8, RT_NULL);
+	SIM_CHECK(udev->quirks == USB_QUIRK_EP0_MAXP_8);
+	SIM_CHECK(udev->ep0.desc.wMaxPacketSize == 8);
+	SIM_CHECK(usb_get_descriptor(udev, USB_DESC_TYPE_DEVICE, 0,
+			&desc, sizeof(desc)) == USB_DESC_LENGTH_DEVICE);
+	SIM_CHECK(desc.bMaxPacketSize0 == 64);
+	test_unplug(hcd);
+
+	printf("lookups, no strings, no SET_INTERFACE, SET_ADDRESS delay, "
+			"8 byte ep0\n");
+	SIM_CHECK(usb_quirks_set_table(RT_NULL, 0) == 0);
+	SIM_CHECK(usb_quirks_lookup(TEST_VID, TEST_PID, 0x0100) == 0);
+	sim_driver_unregister(&test_drv);
+	sim_device_release(&plain);
+	sim_device_release(&strings);
+	sim_device_release(&set_intf);
+	sim_device_release(&address);
+	sim_device_release(&maxp8);
+	return 0;
+}
@@ -0,0 +1,212 @@
+/*
+ * test_recovery.c - error recovery, one level at a time
+ *
+ * A driver streams from a bulk IN endpoint through a bulk fifo with
+ * several urbs in flight while faults are injected into the simulated
+ * device, each after the last recovery's window has passed, so that
+ * each starts at the bottom:
+ *
+ *  - a stall, which clearing the halt cures;
+ *  - a hang that a port reset cures, after clearing the halt failed;
+ *  - a hang that outlasts that reset too, so that only enumerating the
+ *    port again brings the device back.
+ *
+ * The reader sees the first failed urb of each fault and nothing else:
+ * through the first two the stream goes on where it stopped, without a
+ * byte lost or repeated, as the urbs that failed or were submitted
+ * meanwhile were held back and queued again in order.
+ * The time each level took is reported from the recovery counters.
+ */
+
+#include "sim.h"
+
+#define TEST_VID	0x1d6b
+#define TEST_PID	0x0115
+#define TEST_URBS	4
+#define TEST_CHUNK	512
+
+static const struct sim_ep test_eps[] = {
+	{ USB_DIR_IN | 1, USB_EP_ATTR_BULK, TEST_CHUNK, 0 },
+	{ 2, USB_EP_ATTR_BULK, TEST_CHUNK, 0 },
+};
+
+struct test_drv {
+	struct usb_driver	driver;
+	struct usb_device_id	id[2];
+	struct rt_semaphore	probed;
+	struct rt_semaphore	gone;
+	struct usb_device	*udev;
+	struct usb_bulk_fifo	fifo;		/* bulk IN */
+};
+
+static struct test_drv test_drv;
+static struct sim_device test_dev;
+static rt_uint64_t test_next;		/* offset of the next byte due */
+
+static int test_probe(struct usb_interface *intf,
+		const struct usb_device_id *id)
+{
+	struct usb_device *udev = intf->udev;
+
+	SIM_CHECK(usb_bulk_fifo_init(&test_drv.fifo, udev,
+			usb_rcvbulkpipe(udev, 1), TEST_URBS, TEST_CHUNK,
+			0) == 0);
+	SIM_CHECK(usb_bulk_fifo_start(&test_drv.fifo) == 0);
+	test_drv.udev = udev;
+	rt_sem_release(&test_drv.probed);
+	return 0;
+}
+
+static void test_disconnect(struct usb_interface *intf)
+{
+	usb_bulk_fifo_disconnect(&test_drv.fifo);
+	usb_bulk_fifo_release(&test_drv.fifo);
+	test_drv.udev = RT_NULL;
+	rt_sem_release(&test_drv.gone);
+}
+
+static void test_drv_register(void)
+{
+	test_drv.id[0].match_flags = USB_DEVICE_ID_MATCH_VENDOR |
+			USB_DEVICE_ID_MATCH_PRODUCT;
+	test_drv.id[0].idVendor = TEST_VID;
+	test_drv.id[0].idProduct = TEST_PID;
+	test_drv.driver.name = "test_recovery";
+	test_drv.driver.probe = test_probe;
+	test_drv.driver.disconnect = test_disconnect;
+	test_drv.driver.id_table = test_drv.id;
+	rt_sem_init(&test_drv.probed, "tprobed", 0, RT_IPC_FLAG_FIFO);
+	rt_sem_init(&test_drv.gone, "tgone", 0, RT_IPC_FLAG_FIFO);
+	SIM_CHECK(usb_register_driver(&test_drv.driver) == 0);
+}
+
+/*
+ * Reads @len bytes of the device's counting pattern, or until the
+ * first error with @until_error.  Return: the errors seen.
+ */
+static int test_read(rt_size_t len, int until_error)
+{
+	static uint8_t buf[TEST_CHUNK];
+	rt_size_t done = 0;
+	rt_ssize_t ret, i;
+	int errors = 0;
+
+	while (done < len) {
+		ret = usb_bulk_fifo_read(&test_drv.fifo, buf, sizeof(buf),
+				2000);
+		if (ret < 0) {
+			SIM_CHECK(ret == -EPIPE || ret == -EPROTO);
+			errors++;
+			if (until_error)
+				break;
+			continue;
+		}
+		SIM_CHECK(ret > 0);
+		for (i = 0; i < ret; i++)
+			SIM_CHECK(buf[i] == (uint8_t)(test_next + i));
+		test_next += ret;
+		done += ret;
+	}
+	return errors;
+}
+
+/* the first byte after a re-enumeration is where the stream resumes */
+static void test_resync(void)
+{
+	uint8_t b;
+
+	SIM_CHECK(usb_bulk_fifo_read(&test_drv.fifo, &b, 1, 2000) == 1);
+	test_next = b + 1;
+}
+
+static void test_report(int level)
+{
+	static const char * const names[USB_RECOVER_LEVELS] = {
+		"clear halt", "port reset", "re-enumeration",
+	};
+	struct usb_recover_stats st;
+	char name[64];
+
+	usb_recover_get_stats(&st);
+	rt_snprintf(name, sizeof(name), "recovery by %s", names[level - 1]);
+	sim_report(name, st.time_last[level - 1] / 1000.0, "ms");
+}
+
+/* lets the window of the last recovery pass */
+static void test_settle(void)
+{
+	rt_thread_mdelay(USB_RECOVER_WINDOW + 100);
+}
+
+int main(void)
+{
+	struct usb_recover_stats st;
+	struct dummy_faults *f = &test_dev.vdev.faults;
+	struct usb_device *udev;
+	struct usb_hcd *hcd;
+	int i;
+
+	hcd = sim_start();
+	test_drv_register();
+	sim_device_init(&test_dev, USB_SPEED_HIGH, TEST_VID, TEST_PID, 0xff,
+			test_eps, 2);
+	SIM_CHECK(dummy_hcd_connect(hcd, 1, &test_dev.vdev) == 0);
+	SIM_CHECK(rt_sem_take(&test_drv.probed,
+			rt_tick_from_millisecond(2000)) == RT_EOK);
+	udev = test_drv.udev;
+	SIM_CHECK(udev->persist_enabled);
+	SIM_CHECK(test_read(64 * TEST_CHUNK, 0) == 0);
+
+	/* level 1: the stall is cleared */
+	f->stall_ep = USB_DIR_IN | 1;
+	f->stall_after = test_dev.vdev.packets + 16;
+	SIM_CHECK(test_read(64 * TEST_CHUNK, 0) == 1);
+	usb_recover_get_stats(&st);
+	SIM_CHECK(st.count[0] == 1 && st.failed[0] == 0);
+	test_report(USB_RECOVER_ENDPOINT);
+	test_settle();
+
+	/* level 2: the hung device can't clear a halt, a reset cures it */
+	f->hang_resets = 0;
+	f->hang_after = test_dev.vdev.packets + 16;
+	SIM_CHECK(test_read(64 * TEST_CHUNK, 0) == 1);
+	usb_recover_get_stats(&st);
+	SIM_CHECK(st.failed[0] == 1);
+	SIM_CHECK(st.count[1] == 1 && st.failed[1] == 0);
+	SIM_CHECK(test_drv.udev == udev);
+	SIM_CHECK(rt_sem_trytake(&test_drv.gone) != RT_EOK);
+	test_report(USB_RECOVER_RESET);
+	test_settle();
+
+	/* level 3: hung through one reset, only a new device will do */
+	f->hang_resets = 1;
+	f->hang_after = test_dev.vdev.packets + 16;
+	SIM_CHECK(test_read(64 * TEST_CHUNK, 1) == 1);
+	SIM_CHECK(rt_sem_take(&test_drv.gone,
+			rt_tick_from_millisecond(5000)) == RT_EOK);
+	SIM_CHECK(rt_sem_take(&test_drv.probed,
+			rt_tick_from_millisecond(5000)) == RT_EOK);
+	test_resync();
+	SIM_CHECK(test_read(64 * TEST_CHUNK, 0) == 0);
+	/* accounted once the enumeration is over */
+	for (i = 0; ; i++) {
+		usb_recover_get_stats(&st);
+		if (st.count[2])
+			break;
+		SIM_CHECK(i < 1000);
+		rt_thread_mdelay(1);
+	}
+	SIM_CHECK(st.failed[0] == 2 && st.failed[1] == 1);
+	SIM_CHECK(st.count[2] == 1 && st.failed[2] == 0);
+	test_report(USB_RECOVER_REENUMERATE);
+
+	printf("halt cleared, reset in place, re-enumerated\n");
+	dummy_hcd_disconnect(hcd, 1);
+	SIM_CHECK(rt_sem_take(&test_drv.gone,
+			rt_tick_from_millisecond(2000)) == RT_EOK);
+	usb_deregister(&test_drv.driver);
+	rt_sem_detach(&test_drv.probed);
+	rt_sem_detach(&test_drv.gone);
+	sim_device_release(&test_dev);
+	return 0;
+}
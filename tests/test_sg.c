@@ -0,0 +1,205 @@
+/*
+ * test_sg.c - scatter-gather bulk transfers
+ *
+ * 64 KiB go out to a loopback device from one set of scattered segments
+ * and come back into another, cut up differently, so that packets
+ * straddle segment boundaries both ways.  The data has to arrive byte
+ * for byte, and it has to be the callers' segments the controller
+ * moved it through: the stack maps them as they are, with no bounce
+ * buffer in between.  A bounce would need memory, so every heap
+ * allocation and every transfer buffer slab block taken while an urb is
+ * in flight counts as a copy, and there must be none.
+ *
+ * A controller that does want whole packets per segment gets the same
+ * lists checked up front: a short segment in the middle is refused.
+ */
+
+#include "sim.h"
+
+#include <stdlib.h>
+
+#define TEST_VID	0x1d6b
+#define TEST_PID	0x0106
+#define TEST_LEN	65536
+#define TEST_MAX_SEGS	256
+
+static const struct sim_ep test_eps[] = {
+	{ USB_DIR_IN | 1, USB_EP_ATTR_BULK, 512, 0 },
+	{ 2, USB_EP_ATTR_BULK, 512, 0 },
+};
+
+static atomic_t test_copies;
+
+static void test_malloc_hook(void *ptr, rt_size_t size)
+{
+	rt_atomic_add(&test_copies, 1);
+}
+
+/* transfer buffer slab blocks in use on @bus */
+static rt_size_t test_slab_in_use(struct usb_bus *bus)
+{
+	struct hcd_buffer_stats stats[HCD_BUFFER_POOLS];
+	rt_size_t in_use = 0;
+	int i, n;
+
+	n = hcd_buffer_get_stats(bus, stats, HCD_BUFFER_POOLS);
+	for (i = 0; i < n; i++)
+		in_use += stats[i].in_use;
+	return in_use;
+}
+
+static rt_size_t test_slab_base;
+
+static void test_complete(struct urb *urb)
+{
+	/* a bounce buffer would still be held here */
+	if (test_slab_in_use(urb->dev->bus) != test_slab_base)
+		rt_atomic_add(&test_copies, 1);
+	rt_completion_done(urb->context);
+}
+
+/* cut TEST_LEN into separately allocated segments of @sizes, repeated */
+static int test_sg_alloc(struct scatterlist *sg, const unsigned int *sizes,
+		int nsizes)
+{
+	unsigned int left = TEST_LEN, len;
+	int n = 0;
+
+	sg_init_table(sg, TEST_MAX_SEGS);
+	while (left) {
+		SIM_CHECK(n < TEST_MAX_SEGS);
+		len = sizes[n % nsizes];
+		if (len > left)
+			len = left;
+		sg_set_buf(&sg[n], malloc(len), len);
+		SIM_CHECK(sg[n].buf != RT_NULL);
+		left -= len;
+		n++;
+	}
+	return n;
+}
+
+static void test_sg_free(struct scatterlist *sg, int n)
+{
+	while (n--)
+		free(sg[n].buf);
+}
+
+static int test_sg_xfer(struct usb_device *udev, unsigned int pipe,
+		struct scatterlist *sg, int n)
+{
+	struct rt_completion done;
+	struct urb *urb;
+	int ret, i;
+
+	urb = usb_alloc_urb(0);
+	SIM_CHECK(urb != RT_NULL);
+	rt_completion_init(&done);
+	usb_fill_bulk_urb(urb, udev, pipe, RT_NULL, 0, test_complete, &done);
+	urb->sg = sg;
+	urb->num_sgs = n;
+
+	test_slab_base = test_slab_in_use(udev->bus);
+	rt_malloc_sethook(test_malloc_hook);
+	ret = usb_submit_urb(urb);
+	if (ret) {
+		rt_malloc_sethook(RT_NULL);
+		usb_free_urb(urb);
+		return ret;
+	}
+	SIM_CHECK(rt_completion_wait(&done,
+			rt_tick_from_millisecond(5000)) == RT_EOK);
+	rt_malloc_sethook(RT_NULL);
+
+	/* mapped in place: each segment is its own bus address */
+	SIM_CHECK(urb->transfer_buffer == RT_NULL);
+	SIM_CHECK(urb->num_mapped_sgs == n);
+	for (i = 0; i < n; i++)
+		SIM_CHECK(sg[i].dma_address == (dma_addr_t)sg[i].buf);
+
+	ret = urb->status;
+	if (!ret && urb->actual_length != TEST_LEN)
+		ret = -EREMOTEIO;
+	usb_free_urb(urb);
+	return ret;
+}
+
+static uint8_t test_byte(unsigned int i)
+{
+	return (uint8_t)(i * 7 + (i >> 8) + 3);
+}
+
+int main(void)
+{
+	/* whole packets out, odd sizes back, so both sides straddle */
+	static const unsigned int out_sizes[] = { 4096, 512, 1024, 8192 };
+	static const unsigned int in_sizes[] = { 1, 511, 4096, 700, 3000,
+			123 };
+	struct scatterlist out[TEST_MAX_SEGS], in[TEST_MAX_SEGS];
+	struct sim_driver sdrv;
+	struct sim_device sd;
+	struct usb_interface *intf;
+	struct usb_device *udev;
+	struct usb_hcd *hcd;
+	unsigned int pos, k;
+	int nout, nin, i;
+
+	hcd = sim_start();
+	sim_driver_register(&sdrv, TEST_VID, TEST_PID);
+	sim_device_init(&sd, USB_SPEED_HIGH, TEST_VID, TEST_PID, 0xff,
+			test_eps, 2);
+	sd.mode = SIM_LOOPBACK;
+	SIM_CHECK(dummy_hcd_connect(hcd, 1, &sd.vdev) == 0);
+	intf = sim_wait_probe(&sdrv, 2000);
+	SIM_CHECK(intf != RT_NULL);
+	udev = intf->udev;
+
+	nout = test_sg_alloc(out, out_sizes, 4);
+	nin = test_sg_alloc(in, in_sizes, 6);
+	for (i = 0, pos = 0; i < nout; pos += out[i++].length)
+		for (k = 0; k < out[i].length; k++)
+			((uint8_t *)out[i].buf)[k] = test_byte(pos + k);
+	for (i = 0; i < nin; i++)
+		rt_memset(in[i].buf, 0, in[i].length);
+
+	SIM_CHECK(test_sg_xfer(udev, usb_sndbulkpipe(udev, 2), out,
+			nout) == 0);
+	SIM_CHECK(sd.out_bytes == TEST_LEN);
+	SIM_CHECK(test_sg_xfer(udev, usb_rcvbulkpipe(udev, 1), in,
+			nin) == 0);
+	SIM_CHECK(sd.in_bytes == TEST_LEN);
+
+	/* byte-exact, in the segments the caller handed in */
+	for (i = 0, pos = 0; i < nin; pos += in[i++].length)
+		for (k = 0; k < in[i].length; k++)
+			SIM_CHECK(((uint8_t *)in[i].buf)[k] ==
+					test_byte(pos + k));
+
+	/* more segments than the controller takes */
+	SIM_CHECK(udev->bus->sg_tablesize < TEST_MAX_SEGS);
+	SIM_CHECK(test_sg_xfer(udev, usb_sndbulkpipe(udev, 2), out,
+			udev->bus->sg_tablesize + 1) == -EINVAL);
+	SIM_CHECK(rt_atomic_load(&test_copies) == 0);
+
+	/* whole packets per segment: the odd IN cut is refused, the OUT
+	 * one still goes */
+	udev->bus->no_sg_constraint = 0;
+	SIM_CHECK(test_sg_xfer(udev, usb_rcvbulkpipe(udev, 1), in,
+			nin) == -EINVAL);
+	SIM_CHECK(test_sg_xfer(udev, usb_sndbulkpipe(udev, 2), out,
+			nout) == 0);
+	SIM_CHECK(sd.out_bytes == 2 * TEST_LEN);
+	udev->bus->no_sg_constraint = 1;
+
+	printf("%d segments out, %d back, %d bytes, %d copies by the stack\n",
+			nout, nin, TEST_LEN, (int)rt_atomic_load(&test_copies));
+	SIM_CHECK(rt_atomic_load(&test_copies) == 0);
+	test_sg_free(out, nout);
+	test_sg_free(in, nin);
+
+	dummy_hcd_disconnect(hcd, 1);
+	SIM_CHECK(sim_wait_disconnect(&sdrv, 2000) == 0);
+	sim_driver_unregister(&sdrv);
+	sim_device_release(&sd);
+	return 0;
+}
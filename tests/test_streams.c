@@ -0,0 +1,214 @@
+/*
+ * test_streams.c - bulk streams completed out of order
+ *
+ * A simulated device with streams on its bulk IN endpoint answers the
+ * commands queued on them in an order of its own choosing, the way a
+ * UAS device does, through dummy_hcd's next_stream callback.  The urbs
+ * have to complete in that order, each with its own stream's data.  An
+ * urb unlinked while its stream waits comes back at once, urbs on
+ * streams outside the allocation are refused, and freeing the streams
+ * gives back whatever is still queued on them.
+ */
+
+#include "sim.h"
+
+#define TEST_VID	0x1d6b
+#define TEST_PID	0x010a
+#define TEST_STREAMS	16
+#define TEST_URBS	8
+#define TEST_LEN	1024
+
+static const struct sim_ep test_eps[] = {
+	{ USB_DIR_IN | 1, USB_EP_ATTR_BULK, 512, 0 },
+};
+
+/* the device's side: which stream it serves next, and for how long */
+struct test_dev {
+	struct sim_device	sd;
+	int			ready;
+	const int		*order;
+	int			norder;
+	int			pos;
+	int			sent;		/* of order[pos] */
+};
+
+static struct test_dev test_dev;
+
+static int test_next_stream(struct dummy_device *vdev, uint8_t epaddr)
+{
+	struct test_dev *td = rt_container_of(vdev, struct test_dev, sd.vdev);
+
+	if (!td->ready || td->pos >= td->norder)
+		return 0;
+	return td->order[td->pos];
+}
+
+/* every byte is the stream's number */
+static int test_transfer(struct dummy_device *vdev, uint8_t epaddr,
+		void *buf, int len)
+{
+	struct test_dev *td = rt_container_of(vdev, struct test_dev, sd.vdev);
+
+	if (td->pos >= td->norder)
+		return -EAGAIN;
+	rt_memset(buf, td->order[td->pos], len);
+	td->sent += len;
+	if (td->sent == TEST_LEN) {
+		td->sent = 0;
+		td->pos++;
+	}
+	return len;
+}
+
+static void test_serve(const int *order, int n)
+{
+	rt_enter_critical();
+	test_dev.order = order;
+	test_dev.norder = n;
+	test_dev.pos = 0;
+	test_dev.sent = 0;
+	test_dev.ready = 1;
+	rt_exit_critical();
+}
+
+/*-------------------------------------------------------------------------*/
+
+static struct rt_semaphore test_done;
+static int test_completed[TEST_URBS];
+static int test_ncompleted;
+
+static void test_complete(struct urb *urb)
+{
+	rt_base_t level;
+
+	level = rt_hw_interrupt_disable();
+	test_completed[test_ncompleted++] = urb->stream_id;
+	rt_hw_interrupt_enable(level);
+	rt_sem_release(&test_done);
+}
+
+static void test_submit(struct urb **urbs, int n)
+{
+	int i;
+
+	test_ncompleted = 0;
+	for (i = 0; i < n; i++) {
+		rt_memset(urbs[i]->transfer_buffer, 0, TEST_LEN);
+		SIM_CHECK(usb_submit_urb(urbs[i]) == 0);
+	}
+}
+
+static void test_wait(int n)
+{
+	while (n--)
+		SIM_CHECK(rt_sem_take(&test_done, 2000) == RT_EOK);
+}
+
+static void test_check_data(struct urb *urb)
+{
+	uint8_t *p = urb->transfer_buffer;
+	int i;
+
+	SIM_CHECK(urb->status == 0);
+	SIM_CHECK(urb->actual_length == TEST_LEN);
+	for (i = 0; i < TEST_LEN; i++)
+		SIM_CHECK(p[i] == urb->stream_id);
+}
+
+int main(void)
+{
+	/* the device's order, nothing like the order of submission */
+	static const int reverse[] = { 8, 7, 6, 5, 4, 3, 2, 1 };
+	static const int shuffled[] = { 3, 1, 4, 6, 8, 7, 5 };
+	static uint8_t bufs[TEST_URBS][TEST_LEN];
+	struct usb_host_endpoint *ep;
+	struct urb *urbs[TEST_URBS];
+	struct usb_interface *intf;
+	struct usb_device *udev;
+	struct sim_driver sdrv;
+	struct usb_hcd *hcd;
+	int i;
+
+	hcd = sim_start();
+	SIM_CHECK(hcd->can_do_streams);
+	sim_driver_register(&sdrv, TEST_VID, TEST_PID);
+	sim_device_init(&test_dev.sd, USB_SPEED_HIGH, TEST_VID, TEST_PID,
+			0x08, test_eps, 1);
+	test_dev.sd.ops.transfer = test_transfer;
+	test_dev.sd.ops.next_stream = test_next_stream;
+	SIM_CHECK(dummy_hcd_connect(hcd, 1, &test_dev.sd.vdev) == 0);
+	intf = sim_wait_probe(&sdrv, 2000);
+	SIM_CHECK(intf != RT_NULL);
+	udev = intf->udev;
+	ep = udev->ep_in[1];
+	SIM_CHECK(ep != RT_NULL);
+	rt_sem_init(&test_done, "test", 0, RT_IPC_FLAG_FIFO);
+
+	/* asking for more than the controller has gets what it has */
+	SIM_CHECK(usb_alloc_streams(intf, &ep, 1, 1000) < 1000);
+	SIM_CHECK(usb_alloc_streams(intf, &ep, 1, 2) == -EINVAL);
+	SIM_CHECK(usb_free_streams(intf, &ep, 1) == 0);
+	SIM_CHECK(usb_alloc_streams(intf, &ep, 1, 0) == -EINVAL);
+	SIM_CHECK(usb_alloc_streams(intf, &ep, 1, TEST_STREAMS) ==
+			TEST_STREAMS);
+	SIM_CHECK(ep->streams == TEST_STREAMS);
+
+	for (i = 0; i < TEST_URBS; i++) {
+		urbs[i] = usb_alloc_urb(0);
+		SIM_CHECK(urbs[i] != RT_NULL);
+		usb_fill_bulk_urb(urbs[i], udev, usb_rcvbulkpipe(udev, 1),
+				bufs[i], TEST_LEN, test_complete, RT_NULL);
+	}
+
+	/* only streams 1..TEST_STREAMS */
+	urbs[0]->stream_id = 0;
+	SIM_CHECK(usb_submit_urb(urbs[0]) == -EINVAL);
+	urbs[0]->stream_id = TEST_STREAMS + 1;
+	SIM_CHECK(usb_submit_urb(urbs[0]) == -EINVAL);
+
+	/* submitted 1..8, answered 8..1 */
+	for (i = 0; i < TEST_URBS; i++)
+		urbs[i]->stream_id = i + 1;
+	test_submit(urbs, TEST_URBS);
+	test_serve(reverse, TEST_URBS);
+	test_wait(TEST_URBS);
+	for (i = 0; i < TEST_URBS; i++) {
+		SIM_CHECK(test_completed[i] == reverse[i]);
+		test_check_data(urbs[i]);
+	}
+
+	/* one is unlinked while the device isn't looking at its stream */
+	test_dev.ready = 0;
+	test_submit(urbs, TEST_URBS);
+	SIM_CHECK(usb_unlink_urb(urbs[1]) == -EINPROGRESS);
+	test_wait(1);
+	SIM_CHECK(test_completed[0] == 2);
+	SIM_CHECK(urbs[1]->status == -ECONNRESET);
+	test_serve(shuffled, TEST_URBS - 1);
+	test_wait(TEST_URBS - 1);
+	for (i = 0; i < TEST_URBS - 1; i++) {
+		SIM_CHECK(test_completed[i + 1] == shuffled[i]);
+		test_check_data(urbs[shuffled[i] - 1]);
+	}
+
+	/* freed with urbs still waiting */
+	test_dev.ready = 0;
+	test_submit(urbs, 4);
+	rt_thread_mdelay(5);
+	SIM_CHECK(usb_free_streams(intf, &ep, 1) == 0);
+	test_wait(4);
+	for (i = 0; i < 4; i++)
+		SIM_CHECK(urbs[i]->status == -ESHUTDOWN);
+	SIM_CHECK(ep->streams == 0);
+	SIM_CHECK(usb_submit_urb(urbs[0]) == -EINVAL);
+
+	printf("%d streams, completed in the device's order\n", TEST_STREAMS);
+	for (i = 0; i < TEST_URBS; i++)
+		usb_free_urb(urbs[i]);
+	rt_sem_detach(&test_done);
+	dummy_hcd_disconnect(hcd, 1);
+	SIM_CHECK(sim_wait_disconnect(&sdrv, 2000) == 0);
+	sim_driver_unregister(&sdrv);
+	sim_device_release(&test_dev.sd);
+	return 0;
+}